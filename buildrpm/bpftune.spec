@@ -56,6 +56,7 @@ rm -Rf %{buildroot}
 %files
 %defattr(-,root,root)
 %{_sbindir}/bpftune
+%{_sbindir}/bpftunectl
 %{_unitdir}/bpftune.service
 %{_libdir}/libbpftune.so.%{version}.%{rel}
 %{_libdir}/bpftune/*
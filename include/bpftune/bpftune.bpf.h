@@ -161,20 +161,43 @@ static __always_inline typeof(name(0)) ____##name(struct pt_regs *ctx, ##args)
 		bpf_map_delete_elem(&save_map, &current);		\
 	} while (0)
 
-/* must be specified prior to including bpftune.h */
+/* must be specified prior to including bpftune.h; this is the tuner's
+ * learning rate, which may differ from the global rate.
+ */
 unsigned short bpftune_learning_rate;
 
 #include <bpftune/bpftune.h>
 #include <bpftune/corr.h>
 
+/* per-tunable learning rates, indexed by tunable id; set by userspace */
+unsigned short bpftune_tunable_rates[BPFTUNE_MAX_TUNABLES];
+
 BPF_RINGBUF(ring_buffer_map, 128 * 1024);
 
 BPF_MAP_DEF(netns_map, BPF_MAP_TYPE_HASH, __u64, __u64, 65536);
 
+BPF_MAP_DEF(netns_profile_map, BPF_MAP_TYPE_HASH, __u64,
+	    struct bpftune_netns_profile, 65536);
+
 unsigned int tuner_id;
 unsigned int bpftune_pid;
+/* set by the overhead governor when this tuner is over its CPU budget */
+unsigned int bpftune_sample_shift;
 /* init_net value used for older kernels since __ksym does not work */
 unsigned long bpftune_init_net;
+/* events not sent because the ring buffer was full */
+__u64 bpftune_ringbuf_drops;
+/* record tunable changes in shadow_map rather than making them */
+bool bpftune_dry_run;
+
+static __always_inline long bpftune_ringbuf_output(void *data, __u64 size)
+{
+	long ret = bpf_ringbuf_output(&ring_buffer_map, data, size, 0);
+
+	if (ret)
+		__sync_fetch_and_add(&bpftune_ringbuf_drops, 1);
+	return ret;
+}
 
 /* TCP buffer tuning */
 #ifndef SO_SNDBUF
@@ -268,8 +291,118 @@ static __always_inline long get_netns_cookie(struct net *net)
 	return -1;
 }
  
-#define last_event_key(nscookie, tuner, event)	\
-	((__u64)nscookie | ((__u64)event << 32) |((__u64)tuner <<48))
+/* Hot-path programs whose work can be sampled without losing correctness
+ * (for example checks that buffers are nearly full) should return early
+ * if this is true; the overhead governor raises bpftune_sample_shift when
+ * the tuner exceeds its CPU budget.
+ */
+static __always_inline bool bpftune_sample_skip(void)
+{
+	__u32 shift = bpftune_sample_shift;
+
+	if (!shift)
+		return false;
+	return (bpf_get_prandom_u32() & ((1U << shift) - 1)) != 0;
+}
+
+/* key for per-tunable state for tunable in netns; net is NULL for tunables
+ * that are not namespaced.
+ */
+static __always_inline int bpftune_tunable_key_init(struct bpftune_tunable_key *key,
+						    struct net *net, __u32 tunable)
+{
+	long cookie;
+
+	key->tunable = tunable;
+	if (net) {
+		cookie = get_netns_cookie(net);
+		if (cookie < 0)
+			return cookie;
+		key->netns_cookie = cookie;
+	}
+	return 0;
+}
+
+/* In dry-run mode, changes bpftune would have made to tunables are kept in
+ * shadow_map; read tunable values via bpftune_shadow_value() so decisions
+ * are based on those values rather than the unchanged kernel ones.  net
+ * should be NULL for tunables that are not namespaced.
+ */
+BPF_MAP_DEF(shadow_map, BPF_MAP_TYPE_HASH, struct bpftune_tunable_key,
+	    struct bpftune_shadow, 4096);
+
+static __always_inline long bpftune_shadow_value(struct net *net,
+						 __u32 tunable, int index,
+						 long value)
+{
+	struct bpftune_tunable_key key = {};
+	struct bpftune_shadow *shadow;
+
+	if (!bpftune_dry_run || index < 0 || index >= BPFTUNE_MAX_VALUES)
+		return value;
+	if (bpftune_tunable_key_init(&key, net, tunable))
+		return value;
+	shadow = bpf_map_lookup_elem(&shadow_map, &key);
+	return shadow ? shadow->values[index] : value;
+}
+
+/* adaptive step state is maintained by userspace as changes are made
+ * (see bpftuner_tunable_step_update()).
+ */
+BPF_MAP_DEF(step_map, BPF_MAP_TYPE_HASH, struct bpftune_tunable_key,
+	    struct bpftune_step, 4096);
+
+/* step adjustment for tunable in netns; see BPFTUNE_STEP_WINDOW */
+static __always_inline int bpftune_tunable_step(struct net *net, __u32 tunable)
+{
+	struct bpftune_tunable_key key = {};
+	struct bpftune_step *step;
+
+	if (bpftune_tunable_key_init(&key, net, tunable))
+		return 0;
+	step = bpf_map_lookup_elem(&step_map, &key);
+	return step ? bpftune_step_get(step, bpf_ktime_get_ns()) : 0;
+}
+
+/* learning rate for netns from its profile if one is set, otherwise rate */
+static __always_inline unsigned short __bpftune_netns_learning_rate(struct net *net,
+								    unsigned short rate)
+{
+	struct bpftune_netns_profile *profile;
+	__u64 key;
+	long cookie;
+
+	if (!net)
+		return rate;
+	cookie = get_netns_cookie(net);
+	if (cookie < 0)
+		return rate;
+	key = cookie;
+	profile = bpf_map_lookup_elem(&netns_profile_map, &key);
+	return profile ? profile->learning_rate : rate;
+}
+
+/* learning rate for netns; from its profile if one is set, otherwise the
+ * tuner learning rate.
+ */
+static __always_inline unsigned short bpftune_netns_learning_rate(struct net *net)
+{
+	return __bpftune_netns_learning_rate(net, bpftune_learning_rate);
+}
+
+/* learning rate for tunable in netns; from the netns profile if one is set,
+ * otherwise the rate for the tunable.  net is NULL for tunables that are
+ * not namespaced.
+ */
+static __always_inline unsigned short bpftune_tunable_learning_rate(struct net *net,
+								    __u32 tunable)
+{
+	unsigned short rate = bpftune_learning_rate;
+
+	if (tunable < BPFTUNE_MAX_TUNABLES)
+		rate = bpftune_tunable_rates[tunable];
+	return __bpftune_netns_learning_rate(net, rate);
+}
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -278,6 +411,49 @@ struct {
 	__type(value, __u64);
 } last_event_map SEC(".maps");
 
+/* limits are maintained by userspace from the config file and profiles
+ * (see bpftuner_limits_update()); netns-specific limits are keyed by
+ * netns cookie, limits for all namespaces by cookie 0.
+ */
+BPF_MAP_DEF(limit_map, BPF_MAP_TYPE_HASH, struct bpftune_tunable_key,
+	    struct bpftune_limit, 4096);
+
+/* clamp changed values in new to limits for tunable in netns; returns
+ * false if the tunable may not be changed or clamped values are the same
+ * as old, so no event need be sent.
+ */
+static __always_inline bool bpftune_tunable_limit(long nscookie, __u32 tunable,
+						  long *old, long *new)
+{
+	struct bpftune_tunable_key key = { .tunable = tunable };
+	struct bpftune_limit *limit;
+	bool changed = false;
+	int i;
+
+	key.netns_cookie = nscookie;
+	limit = bpf_map_lookup_elem(&limit_map, &key);
+	if (!limit && nscookie) {
+		key.netns_cookie = 0;
+		limit = bpf_map_lookup_elem(&limit_map, &key);
+	}
+	if (!limit)
+		return true;
+	if (limit->deny)
+		return false;
+	/* only clamp changed values; unused values are 0 in old and new */
+	for (i = 0; i < BPFTUNE_MAX_VALUES; i++) {
+		if (new[i] == old[i])
+			continue;
+		if (new[i] < limit->min)
+			new[i] = limit->min;
+		else if (new[i] > limit->max)
+			new[i] = limit->max;
+		if (new[i] != old[i])
+			changed = true;
+	}
+	return changed;
+}
+
 static __always_inline long send_net_sysctl_event(struct net *net,
 						  int scenario_id, int event_id,
 						  long *old, long *new,
@@ -293,6 +469,9 @@ static __always_inline long send_net_sysctl_event(struct net *net,
 	if (nscookie < 0)
 		return nscookie;
 
+	if (!bpftune_tunable_limit(nscookie, event_id, old, new))
+		return 0;
+
 	event_key = last_event_key(nscookie, tuner_id, event_id);
 	/* avoid sending same event for same tuner+netns in < 25msec */
 	last_timep = bpf_map_lookup_elem(&last_event_map, &event_key);
@@ -314,7 +493,7 @@ static __always_inline long send_net_sysctl_event(struct net *net,
 	event->update[0].new[0] = new[0];
 	event->update[0].new[1] = new[1];
 	event->update[0].new[2] = new[2];
-	ret = bpf_ringbuf_output(&ring_buffer_map, event, sizeof(*event), 0);
+	ret = bpftune_ringbuf_output(event, sizeof(*event));
 	bpftune_debug("tuner [%d] scenario [%d]: event send: %d ",
 		    tuner_id, scenario_id, ret);
 	bpftune_debug("\told '%ld %ld %ld'\n", old[0], old[1], old[2]);
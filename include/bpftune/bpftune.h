@@ -22,6 +22,9 @@
 
 
 #define BPFTUNE_MAX_TUNERS		64
+#define BPFTUNE_SAMPLE_SHIFT_MAX	6
+#define BPFTUNE_GOVERNOR_MAX_DETACH	8
+#define BPFTUNE_GOVERNOR_MAX_PROGS	16
 
 /* max # of tunables per tuner */
 #define BPFTUNE_MAX_TUNABLES		16
@@ -36,6 +39,9 @@ extern unsigned short bpftune_learning_rate;
 #ifndef min
 #define min(a, b)       ((a) < (b) ? (a) : (b))
 #endif
+#ifndef max
+#define max(a, b)       ((a) > (b) ? (a) : (b))
+#endif
 
 /*
  * convert learning rate to bitshift value
@@ -46,8 +52,39 @@ extern unsigned short bpftune_learning_rate;
  * 1 -> bitshift of 5 (3.125%)
  * 0 -> bitshift of 6 (1.0625%)
  */
-#define BPFTUNE_BITSHIFT	\
-	((BPFTUNE_DELTA_MAX + 2) - min(bpftune_learning_rate, BPFTUNE_DELTA_MAX))
+#define BPFTUNE_BITSHIFT_RATE(rate)	\
+	((BPFTUNE_DELTA_MAX + 2) - min((rate), BPFTUNE_DELTA_MAX))
+
+#define BPFTUNE_BITSHIFT	BPFTUNE_BITSHIFT_RATE(bpftune_learning_rate)
+
+/* grow/shrink by delta for a specific learning rate, e.g. the rate from
+ * a per-netns profile.
+ */
+#define BPFTUNE_GROW_BY_RATE(val, rate)	\
+	((val) + ((val) >> BPFTUNE_BITSHIFT_RATE(rate)))
+#define BPFTUNE_SHRINK_BY_RATE(val, rate)	\
+	((val) - ((val) >> BPFTUNE_BITSHIFT_RATE(rate)))
+
+/* Adaptive step sizing.  Repeated changes to a tunable in the same
+ * direction within BPFTUNE_STEP_WINDOW of each other suggest it is some way
+ * from where it needs to be, so each one increments the step adjustment,
+ * doubling the step size, up to BPFTUNE_STEP_ACCEL_MAX times.  A reversal
+ * in direction suggests oscillation, so decrements it, halving the step
+ * size, down to -BPFTUNE_STEP_DAMP_MAX.  Later changes in the same
+ * direction undo damping; acceleration lapses after BPFTUNE_STEP_WINDOW.
+ */
+#define BPFTUNE_STEP_WINDOW		(5 * SECOND)
+#define BPFTUNE_STEP_ACCEL_MAX		2
+#define BPFTUNE_STEP_DAMP_MAX		3
+#define BPFTUNE_STEP_SHIFT_MIN		1	/* 50% */
+
+#define BPFTUNE_BITSHIFT_STEP(rate, step)	\
+	max(BPFTUNE_STEP_SHIFT_MIN, BPFTUNE_BITSHIFT_RATE(rate) - (step))
+
+#define BPFTUNE_GROW_BY_STEP(val, rate, step)	\
+	((val) + ((val) >> BPFTUNE_BITSHIFT_STEP(rate, step)))
+#define BPFTUNE_SHRINK_BY_STEP(val, rate, step)	\
+	((val) - ((val) >> BPFTUNE_BITSHIFT_STEP(rate, step)))
 
 #define BPFTUNE_GROW_BY_DELTA(val)    ((val) + ((val) >> BPFTUNE_BITSHIFT))
 
@@ -62,6 +99,16 @@ extern unsigned short bpftune_learning_rate;
 #define NEARLY_FULL(val, limit) \
 	((val) >= (limit) || (val) + ((limit) >> BPFTUNE_BITSHIFT) >= (limit))
 
+#define NEARLY_FULL_RATE(val, limit, rate) \
+	((val) >= (limit) ||	\
+	 (val) + ((limit) >> BPFTUNE_BITSHIFT_RATE(rate)) >= (limit))
+
+/* key for per-tuner last event time map; also used by userspace to clean
+ * up state when a netns goes away.
+ */
+#define last_event_key(nscookie, tuner, event)	\
+	((__u64)nscookie | ((__u64)event << 32) |((__u64)tuner <<48))
+
 enum bpftunable_type {
 	BPFTUNABLE_SYSCTL,
 	BPFTUNABLE_OTHER,
@@ -104,6 +151,14 @@ struct bpftunable {
 	long initial_values[BPFTUNE_MAX_VALUES];
 	long current_values[BPFTUNE_MAX_VALUES];
 	struct bpftunable_stats stats;
+	/* sysctl writes made by tuner and their cumulative latency */
+	unsigned long writes;
+	unsigned long write_errors;
+	__u64 write_time_ns;
+	/* changes recorded instead of made in dry-run mode */
+	unsigned long dry_run_writes;
+	/* changes rolled back as they made health metrics worse */
+	unsigned long rollbacks;
 };
 
 struct bpftunable_update {
@@ -129,10 +184,96 @@ struct bpftune_event {
 	};
 };
 
+/* per-netns profile, stored in netns_profile_map keyed by netns cookie;
+ * used by BPF programs to pick the learning rate for the namespace.
+ */
+struct bpftune_netns_profile {
+	unsigned short learning_rate;
+};
+
+/* key for per-tunable, per-netns state in shadow_map and step_map;
+ * netns_cookie is 0 for tunables that are not namespaced.
+ */
+struct bpftune_tunable_key {
+	__u64 netns_cookie;
+	__u32 tunable;
+	__u32 pad;
+};
+
+/* dry-run tunable values, stored in shadow_map */
+struct bpftune_shadow {
+	long values[BPFTUNE_MAX_VALUES];
+};
+
+/* adaptive step state, stored in step_map; see BPFTUNE_STEP_WINDOW */
+struct bpftune_step {
+	__u64 time;			/* time of last change (nsecs) */
+	long values[BPFTUNE_MAX_VALUES];/* values set by last change */
+	int dir;			/* 1 if last change grew tunable */
+	int step;			/* step adjustment */
+};
+
+/* step adjustment in effect at time now (nsecs) */
+static inline int bpftune_step_get(struct bpftune_step *step, __u64 now)
+{
+	if (step->step > 0 && now - step->time > BPFTUNE_STEP_WINDOW)
+		return 0;
+	return step->step;
+}
+
+/* record a change at time now (nsecs) which grew (dir 1) or shrank (dir -1)
+ * a tunable; see BPFTUNE_STEP_WINDOW.
+ */
+static inline void bpftune_step_change(struct bpftune_step *step, int dir,
+				       __u64 now)
+{
+	if (step->dir == dir) {
+		if (now - step->time <= BPFTUNE_STEP_WINDOW)
+			step->step = min(step->step + 1, BPFTUNE_STEP_ACCEL_MAX);
+		else
+			step->step = min(step->step + 1, 0);
+	} else if (step->dir == -dir) {
+		step->step = max(min(step->step, 0) - 1, -BPFTUNE_STEP_DAMP_MAX);
+	}
+	step->dir = dir;
+	step->time = now;
+}
+
+/* safety limits and policy for tunable from config file and profiles,
+ * stored in limit_map; see bpftuner_limits_update().
+ */
+struct bpftune_limit {
+	long min;
+	long max;
+	__u32 deny;			/* tunable may not be changed */
+	__u32 pad;
+};
+
 struct bpftuner_netns {
 	struct bpftuner_netns *next;	
 	unsigned long netns_cookie;
 	enum bpftune_state state;
+	/* per-tunable manual override state, and time (in seconds) of
+	 * last manual change.
+	 */
+	enum bpftune_state tunable_state[BPFTUNE_MAX_TUNABLES];
+	unsigned long tunable_manual_time[BPFTUNE_MAX_TUNABLES];
+};
+
+/* cumulative BPF program run-time stats, and change over last interval */
+struct bpftune_run_stats {
+	__u64 run_time_ns;
+	__u64 run_cnt;
+	__u64 interval_run_time_ns;
+	__u64 interval_run_cnt;
+};
+
+/* run time of a BPF_TCP_HOOK() program; the kernel charges tail-called
+ * programs' time to the dispatcher, so hook programs time themselves.
+ */
+struct bpftune_tcp_hook_time {
+	__u64 run_time_ns;
+	__u64 run_cnt;
 };
 
 struct bpftuner {
@@ -154,12 +295,63 @@ struct bpftuner {
 	int corr_map_fd;
 	void *netns_map;
 	int netns_map_fd;
+	void *netns_profile_map;
+	int netns_profile_map_fd;
 	void (*event_handler)(struct bpftuner *tuner,
 			      struct bpftune_event *event, void *ctx);
 	unsigned int num_tunables;
 	struct bpftunable *tunables;
 	unsigned int num_scenarios;
 	struct bpftunable_scenario *scenarios;
+	/* NULL-terminated list of maps whose state is saved/restored */
+	const char **persistent_maps;
+	/* maps were adopted from BPFTUNE_PIN */
+	bool pinned;
+	/* BPF skeleton was loaded; shared map fds are closed when the last
+	 * loaded tuner goes away.
+	 */
+	bool loaded;
+	/* BPF load or attach failed in init(); the skeleton has been
+	 * torn down, so init() can be retried in legacy mode.
+	 */
+	bool bpf_failed;
+	/* NULL-terminated list of programs not attached at startup */
+	const char **lazy_progs;
+	/* NULL-terminated list of programs the overhead governor may detach
+	 * when the tuner is over budget; programs that keep state accurate
+	 * (netns cleanup, socket counts, sysctl override detection) must
+	 * not be listed.
+	 */
+	const char **governed_progs;
+	/* optional callback run every periodic_interval seconds */
+	void (*periodic)(struct bpftuner *tuner);
+	unsigned int periodic_interval;
+	unsigned long periodic_last;
+	struct bpftune_run_stats run_stats;
+	/* run time of BPF_TCP_HOOK() programs since unregistered */
+	struct bpftune_tcp_hook_time tcp_hook_time;
+	/* events received, by scenario */
+	unsigned long events[BPFTUNE_MAX_SCENARIOS];
+	/* bpftune_ringbuf_drops in BPF .bss */
+	__u64 *bpf_ringbuf_drops;
+	/* time spent in event_handler() and periodic() */
+	__u64 handler_time_ns;
+	/* overhead governor state; BPF programs calling bpftune_sample_skip()
+	 * run for 1 in 2^sample_shift calls.
+	 */
+	unsigned int sample_shift;
+	unsigned int *bpf_sample_shift;
+	/* bpftune_learning_rate in BPF .bss; may be changed at runtime */
+	unsigned short *bpf_learning_rate;
+	/* bpftune_tunable_rates[] in BPF .bss */
+	unsigned short *bpf_tunable_rates;
+	unsigned int governor_calm;
+	unsigned int governor_num_detached;
+	int governor_detached[BPFTUNE_GOVERNOR_MAX_DETACH];
+	struct bpftune_run_stats governor_stats;
+	__u64 governor_handler_ns;
+	/* run time of governed_progs at the last governor interval */
+	__u64 governor_prog_ns[BPFTUNE_GOVERNOR_MAX_PROGS];
 };
 
 /* from include/linux/log2.h */
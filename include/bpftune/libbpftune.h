@@ -44,6 +44,13 @@
 
 #define BPFTUNE_RUN_DIR			"/var/run/bpftune"
 #define BPFTUNER_CGROUP_DIR		BPFTUNE_RUN_DIR "/cgroupv2"
+#define BPFTUNE_STATE_FILE		BPFTUNE_RUN_DIR "/state"
+#define BPFTUNE_SUPPORT_CACHE		BPFTUNE_RUN_DIR "/support"
+#define BPFTUNE_STATS_FILE		BPFTUNE_RUN_DIR "/stats"
+#define BPFTUNE_CONTROL_SOCKET		BPFTUNE_RUN_DIR "/control"
+#define BPFTUNE_METRICS_FILE		BPFTUNE_RUN_DIR "/bpftune.prom"
+#define BPFTUNE_CONFIG_FILE		"/etc/bpftune.conf"
+#define BPFTUNE_STATS_INTERVAL		30	/* seconds */
 #define BPFTUNER_LIB_DIR		"/usr/lib64/bpftune/"
 #define BPFTUNER_LOCAL_LIB_DIR		"/usr/local/lib64/bpftune/"
 #define BPFTUNER_LIB_SUFFIX		"_tuner.so"
@@ -52,6 +59,9 @@
 
 #define BPFTUNE_PIN			"/sys/fs/bpf/bpftune"
 
+/* maximum number of threads used to initialize tuners */
+#define BPFTUNE_INIT_THREADS		8
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(arr)			(sizeof(arr) / sizeof((arr)[0])) 
 #endif
@@ -79,6 +89,13 @@ void bpftune_cap_drop(void);
 extern unsigned short bpftune_learning_rate;
 
 void bpftune_set_learning_rate(unsigned short rate);
+int bpftune_set_named_learning_rate(const char *name, unsigned short rate);
+unsigned short bpftuner_learning_rate(struct bpftuner *tuner);
+void bpftuner_learning_rates_update(struct bpftuner *tuner);
+void bpftune_set_manual_resume(unsigned long secs);
+void bpftune_set_rollback(unsigned long secs);
+int bpftune_set_dry_run(const char *tuner_name);
+bool bpftuner_dry_run(struct bpftuner *tuner);
 
 int bpftune_cgroup_init(const char *cgroup_path);
 const char *bpftune_cgroup_name(void);
@@ -91,6 +108,7 @@ void bpftuner_cgroup_detach(struct bpftuner *tuner, const char *prog_name,
 
 
 struct bpftuner *bpftuner_init(const char *path);
+int bpftune_tuners_init(const char **paths, unsigned int num_paths);
 int __bpftuner_bpf_load(struct bpftuner *tuner, const char **optionals);
 int __bpftuner_bpf_attach(struct bpftuner *tuner);
 
@@ -111,6 +129,9 @@ static inline const char *bpftuner_tunable_name(struct bpftuner *tuner,
 #define bpftuner_for_each_tunable(tuner, tunable)			     \
 	for (unsigned int __itun = 0; (tunable = bpftuner_tunable(tuner, __itun)); __itun++)
 
+void bpftuner_tunable_netns_manual(struct bpftuner *tuner, unsigned int tunable,
+				   unsigned long cookie);
+
 int bpftuner_tunable_sysctl_write(struct bpftuner *tuner,
 				  unsigned int tunable,
 				  unsigned int scenario,
@@ -124,10 +145,29 @@ int bpftuner_tunable_update(struct bpftuner *tuner,
 			    int netns_fd,
 			    const char *fmt, ...);
 
+int bpftuner_tunable_shadow(struct bpftuner *tuner,
+			    unsigned int tunable,
+			    unsigned long netns_cookie,
+			    __u8 num_values, long *values);
+
+void bpftuner_tunable_step_update(struct bpftuner *tuner,
+				  unsigned int tunable,
+				  unsigned long netns_cookie,
+				  __u8 num_values, long *values);
+
+int bpftuner_tunable_limit(struct bpftuner *tuner,
+			   unsigned int tunable,
+			   unsigned long netns_cookie,
+			   __u8 num_values, long *old_values,
+			   long *values);
+void bpftuner_limits_update(struct bpftuner *tuner);
+
 struct bpftuner *bpftune_tuner(unsigned int index);
 unsigned int bpftune_tuner_num(void);
+/* ids of tuners that failed to initialize are skipped */
 #define bpftune_for_each_tuner(tuner)					     \
-	for (unsigned int __it = 0; (tuner = bpftune_tuner(__it)) != NULL; __it++)
+	for (unsigned int __it = 0; __it < bpftune_tuner_num(); __it++)	     \
+		if ((tuner = bpftune_tuner(__it)) == NULL) {} else
 
 void bpftuner_fini(struct bpftuner *tuner, enum bpftune_state state);
 void bpftuner_bpf_fini(struct bpftuner *tuner);
@@ -143,25 +183,28 @@ void bpftuner_tunables_fini(struct bpftuner *tuner);
                                                                              \
 		if (__err) return __err;				     \
                 tuner->name = #tuner_name;                                   \
-		tuner->bpf_legacy = bpftuner_bpf_legacy();		     \
+		/* may already be set if falling back to legacy */	     \
+		tuner->bpf_legacy = tuner->bpf_legacy || bpftuner_bpf_legacy();\
                 if (!tuner->bpf_legacy) {				     \
 			tuner->skel = __skel = tuner_name##_tuner_bpf__open();\
 			tuner->skeleton = __skel->skeleton;		     \
 			__skel->bss->debug = bpftune_log_level() >= LOG_DEBUG;\
 			__skel->bss->bpftune_pid = getpid();		     \
-			__skel->bss->bpftune_learning_rate = bpftune_learning_rate;\
+			__skel->bss->bpftune_learning_rate = bpftuner_learning_rate(tuner);\
 			tuner->obj = __skel->obj;			     \
 			tuner->ring_buffer_map = __skel->maps.ring_buffer_map;\
 			tuner->netns_map = __skel->maps.netns_map;	     \
+			tuner->netns_profile_map = __skel->maps.netns_profile_map;\
 		} else {						     \
 			tuner->skel = __lskel = tuner_name##_tuner_bpf_legacy__open();\
 			tuner->skeleton = __lskel->skeleton;		     \
 			__lskel->bss->debug = bpftune_log_level() >= LOG_DEBUG;\
-			__lskel->bss->bpftune_learning_rate = bpftune_learning_rate;\
+			__lskel->bss->bpftune_learning_rate = bpftuner_learning_rate(tuner);\
 			__lskel->bss->bpftune_pid = getpid();		     \
 			tuner->obj = __lskel->obj;			     \
 			tuner->ring_buffer_map = __lskel->maps.ring_buffer_map;\
 			tuner->netns_map = __lskel->maps.netns_map;	     \
+			tuner->netns_profile_map = __lskel->maps.netns_profile_map;\
 		}							     \
 		bpftune_cap_drop();					     \
                 __err = libbpf_get_error(tuner->skel);                       \
@@ -188,13 +231,32 @@ void bpftuner_tunables_fini(struct bpftuner *tuner);
 									     \
 		__err = __bpftuner_bpf_load(tuner, optionals);		     \
 		if (__err) {						     \
-			bpftuner_bpf_destroy(tuner_name, tuner);	     \
+			bpftuner_bpf_fini(tuner);			     \
 			return __err;					     \
 		}							     \
-		if (!tuner->bpf_legacy)					     \
-			__skel->bss->tuner_id = bpftune_tuner_num();	     \
-		else							     \
-			__lskel->bss->tuner_id = bpftune_tuner_num();	     \
+		/* .bss may be an adopted pinned map, so (re)set variables */\
+		if (!tuner->bpf_legacy) {				     \
+			__skel->bss->tuner_id = tuner->id;			     \
+			__skel->bss->debug = bpftune_log_level() >= LOG_DEBUG;\
+			__skel->bss->bpftune_pid = getpid();		     \
+			__skel->bss->bpftune_sample_shift = tuner->sample_shift;\
+			tuner->bpf_sample_shift = &__skel->bss->bpftune_sample_shift;\
+			tuner->bpf_learning_rate = &__skel->bss->bpftune_learning_rate;\
+			tuner->bpf_tunable_rates = __skel->bss->bpftune_tunable_rates;\
+			tuner->bpf_ringbuf_drops = &__skel->bss->bpftune_ringbuf_drops;\
+			__skel->bss->bpftune_dry_run = bpftuner_dry_run(tuner);\
+		} else {						     \
+			__lskel->bss->tuner_id = tuner->id;		     \
+			__lskel->bss->debug = bpftune_log_level() >= LOG_DEBUG;\
+			__lskel->bss->bpftune_pid = getpid();		     \
+			__lskel->bss->bpftune_sample_shift = tuner->sample_shift;\
+			tuner->bpf_sample_shift = &__lskel->bss->bpftune_sample_shift;\
+			tuner->bpf_learning_rate = &__lskel->bss->bpftune_learning_rate;\
+			tuner->bpf_tunable_rates = __lskel->bss->bpftune_tunable_rates;\
+			tuner->bpf_ringbuf_drops = &__lskel->bss->bpftune_ringbuf_drops;\
+			__lskel->bss->bpftune_dry_run = bpftuner_dry_run(tuner);\
+		}							     \
+		bpftuner_learning_rates_update(tuner);			     \
 	} while (0)
 
 #define bpftuner_bpf_load(tuner_name, tuner)				     \
@@ -212,7 +274,7 @@ void bpftuner_tunables_fini(struct bpftuner *tuner);
 			__err = __bpftuner_bpf_attach(tuner);		     \
 		}							     \
                 if (__err) {                                                 \
-			bpftuner_bpf_destroy(tuner_name, tuner);	     \
+			bpftuner_bpf_fini(tuner);			     \
                         return __err;                                        \
 		}							     \
 	} while (0)
@@ -249,6 +311,17 @@ enum bpftune_support_level {
 };
 
 enum bpftune_support_level bpftune_bpf_support(void);
+
+/* BPF program attach types, probed individually */
+enum bpftune_attach_type {
+	BPFTUNE_ATTACH_FENTRY	= 0x1,
+	BPFTUNE_ATTACH_TP_BTF	= 0x2,
+	BPFTUNE_ATTACH_RAW_TP	= 0x4,
+	BPFTUNE_ATTACH_KPROBE	= 0x8,
+	BPFTUNE_ATTACH_ITER	= 0x10,
+};
+
+bool bpftune_attach_supported(unsigned int types);
 void bpftuner_force_bpf_legacy(void);
 bool bpftuner_bpf_legacy(void);
 int bpftuner_ring_buffer_map_fd(struct bpftuner *tuner);
@@ -260,7 +333,54 @@ void bpftune_sysctl_name_to_path(const char *name, char *path, size_t path_sz);
 int bpftune_sysctl_read(int netns_fd, const char *name, long *values);
 int bpftune_sysctl_write(int netns_fd, const char *name, __u8 num_values, long *values);
 
+struct bpftune_sysctl_match {
+	struct bpftuner *tuner;
+	struct bpftunable *tunable;
+};
+
+/* find tunables for sysctl "path" (either "dir/name" or "name"); returns
+ * number of matches stored in "matches".
+ */
+int bpftune_sysctl_tunables_find(const char *path,
+				 struct bpftune_sysctl_match *matches,
+				 unsigned int max_matches);
+
 bool bpftune_netns_cookie_supported(void);
+
+int bpftune_pin_init(bool pin);
+
+unsigned long bpftune_now_secs(void);
+
+bool bpftuner_prog_attached(struct bpftuner *tuner, const char *name);
+int bpftuner_prog_attach(struct bpftuner *tuner, const char *name);
+void bpftuner_prog_detach(struct bpftuner *tuner, const char *name);
+
+int bpftune_state_init(const char *file);
+int bpftune_state_save(void);
+
+int bpftune_stats_init(void);
+void bpftune_stats_update(void);
+void bpftune_stats_summary(void);
+void bpftune_stats_fini(void);
+void bpftune_set_cpu_budget(double pct);
+
+int bpftune_control_init(const char *path);
+void bpftune_control_fini(void);
+
+int bpftune_metrics_init(const char *file);
+void bpftune_metrics_fini(void);
+
+int bpftune_record_init(const char *file);
+void bpftune_record_fini(void);
+
+int bpftune_profiles_load(const char *file);
+void bpftune_profiles_update(void);
+int bpftune_config_load(const char *file);
+void bpftune_config_reload_request(void);
+unsigned short bpftune_netns_learning_rate_get(unsigned long cookie);
+unsigned short bpftuner_tunable_learning_rate(struct bpftuner *tuner,
+					      unsigned int index,
+					      unsigned long netns_cookie);
 int bpftune_netns_set(int fd, int *orig_fd);
 int bpftune_netns_info(int pid, int *fd, unsigned long *cookie);
 int bpftune_netns_init_all(void);
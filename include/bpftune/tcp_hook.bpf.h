@@ -0,0 +1,178 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Copyright (c) 2023, Oracle and/or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+/* Shared TCP hooks.  Rather than each tuner attaching its own fentry
+ * program to hot TCP functions, libbpftune attaches a single dispatcher
+ * program (see tcp_hook.bpf.c) per function.  It reads commonly-used
+ * socket fields once into a per-cpu struct bpftune_tcp_hook_ctx, then
+ * tail-calls the BPF_TCP_HOOK() programs tuners registered for that
+ * function in turn; each of those tail-calls the next when done.
+ *
+ * In legacy mode BPF_TCP_HOOK() programs are simply attached as kprobes.
+ *
+ * All hooked functions must take the socket as their first argument.
+ */
+#ifndef __BPFTUNE_TCP_HOOK_BPF_H
+#define __BPFTUNE_TCP_HOOK_BPF_H
+
+enum bpftune_tcp_hook_id {
+	bpftune_tcp_hook__tcp_set_state,
+	bpftune_tcp_hook__tcp_init_sock,
+	bpftune_tcp_hook__tcp_release_cb,
+	bpftune_tcp_hook__tcp_sndbuf_expand,
+	bpftune_tcp_hook__tcp_rcv_space_adjust,
+	BPFTUNE_TCP_HOOK_MAX
+};
+
+/* must not exceed the tail call limit (33) */
+#define BPFTUNE_TCP_HOOK_SLOTS		16
+
+struct bpftune_tcp_hook_ctx {
+	struct sock *sk;
+	struct net *net;
+	int state;
+	int sndbuf;
+	int rcvbuf;
+	__u32 nr;		/* number of prog array slots in use */
+	__u32 next;		/* next prog array slot to tail-call */
+	__u32 timed;		/* hook programs record run time */
+};
+
+static __always_inline void bpftune_tcp_hook_ctx_fill(struct bpftune_tcp_hook_ctx *hook,
+						      struct sock *sk)
+{
+	hook->sk = sk;
+	hook->net = BPF_CORE_READ(sk, sk_net.net);
+	hook->state = BPF_CORE_READ(sk, sk_state);
+	hook->sndbuf = BPF_CORE_READ(sk, sk_sndbuf);
+	hook->rcvbuf = BPF_CORE_READ(sk, sk_rcvbuf);
+}
+
+#ifdef BPFTUNE_LEGACY
+#define BPF_TCP_HOOK(func, args...)					\
+static __always_inline int ____bpftune_hook_##func(void *ctx, ##args,	\
+				struct bpftune_tcp_hook_ctx *hook);	\
+SEC("kprobe/" #func)							\
+int hook__##func(struct pt_regs *ctx)					\
+{									\
+	struct bpftune_tcp_hook_ctx hook = {};				\
+									\
+	bpftune_tcp_hook_ctx_fill(&hook,				\
+				  (struct sock *)PT_REGS_PARM1_CORE(ctx));\
+	_Pragma("GCC diagnostic push")					\
+	_Pragma("GCC diagnostic ignored \"-Wint-conversion\"")		\
+	return ____bpftune_hook_##func(___bpf_kprobe_args(args), &hook);\
+	_Pragma("GCC diagnostic pop")					\
+}									\
+static __always_inline int ____bpftune_hook_##func(void *ctx, ##args,	\
+				struct bpftune_tcp_hook_ctx *hook)
+
+#else
+
+/* per-cpu context for each hook; indexed by enum bpftune_tcp_hook_id.
+ * Per-hook rather than single context since a hook may fire in softirq
+ * context while another is running on the same CPU.
+ */
+BPF_MAP_DEF(tcp_hook_ctx_map, BPF_MAP_TYPE_PERCPU_ARRAY, __u32,
+	    struct bpftune_tcp_hook_ctx, BPFTUNE_TCP_HOOK_MAX);
+
+#define BPF_TCP_HOOK_MAP(func)						\
+	struct {							\
+		__uint(type, BPF_MAP_TYPE_PROG_ARRAY);			\
+		__uint(key_size, sizeof(__u32));			\
+		__uint(value_size, sizeof(__u32));			\
+		__uint(max_entries, BPFTUNE_TCP_HOOK_SLOTS);		\
+	} tcp_hook_##func SEC(".maps")
+
+/* per-cpu run time of each hook program, indexed by
+ * hook id * BPFTUNE_TCP_HOOK_SLOTS + prog array slot; read by userspace to
+ * charge hook program run time to the tuner that registered it.
+ */
+BPF_MAP_DEF(tcp_hook_time_map, BPF_MAP_TYPE_PERCPU_ARRAY, __u32,
+	    struct bpftune_tcp_hook_time,
+	    BPFTUNE_TCP_HOOK_MAX * BPFTUNE_TCP_HOOK_SLOTS);
+
+BPF_TCP_HOOK_MAP(tcp_set_state);
+BPF_TCP_HOOK_MAP(tcp_init_sock);
+BPF_TCP_HOOK_MAP(tcp_release_cb);
+BPF_TCP_HOOK_MAP(tcp_sndbuf_expand);
+BPF_TCP_HOOK_MAP(tcp_rcv_space_adjust);
+
+static __always_inline struct bpftune_tcp_hook_ctx *bpftune_tcp_hook_ctx(__u32 id)
+{
+	return bpf_map_lookup_elem(&tcp_hook_ctx_map, &id);
+}
+
+/* charge run time since start to the hook program in the current slot */
+static __always_inline void bpftune_tcp_hook_time(__u32 id,
+						  struct bpftune_tcp_hook_ctx *hook,
+						  __u64 start)
+{
+	struct bpftune_tcp_hook_time *t;
+	__u32 key;
+
+	if (!hook->timed || !hook->next || hook->next > BPFTUNE_TCP_HOOK_SLOTS)
+		return;
+	key = id * BPFTUNE_TCP_HOOK_SLOTS + hook->next - 1;
+	t = bpf_map_lookup_elem(&tcp_hook_time_map, &key);
+	if (!t)
+		return;
+	t->run_time_ns += bpf_ktime_get_ns() - start;
+	t->run_cnt++;
+}
+
+/* tail-call the next registered program; only returns if there are none */
+static __always_inline void bpftune_tcp_hook_next(void *ctx, void *prog_array,
+						  struct bpftune_tcp_hook_ctx *hook)
+{
+	__u32 i;
+
+	for (i = hook->next; i < hook->nr && i < BPFTUNE_TCP_HOOK_SLOTS; i++) {
+		hook->next = i + 1;
+		bpf_tail_call(ctx, prog_array, i);
+	}
+}
+
+/* The body has the dispatcher's context available as "hook". */
+#define BPF_TCP_HOOK(func, args...)					\
+static __always_inline int ____bpftune_hook_##func(void *ctx, ##args,	\
+				struct bpftune_tcp_hook_ctx *hook);	\
+SEC("fentry/" #func)							\
+int hook__##func(unsigned long long *ctx)				\
+{									\
+	struct bpftune_tcp_hook_ctx *hook;				\
+	__u64 start;							\
+									\
+	hook = bpftune_tcp_hook_ctx(bpftune_tcp_hook__##func);		\
+	if (!hook)							\
+		return 0;						\
+	start = hook->timed ? bpf_ktime_get_ns() : 0;			\
+	_Pragma("GCC diagnostic push")					\
+	_Pragma("GCC diagnostic ignored \"-Wint-conversion\"")		\
+	____bpftune_hook_##func(___bpf_ctx_cast(args), hook);		\
+	_Pragma("GCC diagnostic pop")					\
+	bpftune_tcp_hook_time(bpftune_tcp_hook__##func, hook, start);	\
+	bpftune_tcp_hook_next(ctx, &tcp_hook_##func, hook);		\
+	return 0;							\
+}									\
+static __always_inline int ____bpftune_hook_##func(void *ctx, ##args,	\
+				struct bpftune_tcp_hook_ctx *hook)
+#endif /* BPFTUNE_LEGACY */
+
+#endif /* __BPFTUNE_TCP_HOOK_BPF_H */
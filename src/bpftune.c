@@ -29,6 +29,7 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <math.h>
 #include <signal.h>
 #include <string.h>
 #include <syslog.h>
@@ -79,13 +80,26 @@ static void cleanup(int sig)
 		fflush(stderr);
 }
 
+/* re-read config file from the poll loop */
+static void reload(__attribute__((unused)) int sig)
+{
+	bpftune_config_reload_request();
+}
+
 void fini(void)
 {
 	struct bpftuner *tuner;
 
+	bpftune_control_fini();
+	/* save learned state prior to tuners going away */
+	bpftune_state_save();
+	bpftune_stats_summary();
 	bpftune_for_each_tuner(tuner)
 		bpftuner_fini(tuner, BPFTUNE_INACTIVE);
 	bpftune_cgroup_fini();
+	bpftune_stats_fini();
+	bpftune_metrics_fini();
+	bpftune_record_fini();
 }
 
 #define MAX_INOTIFY_EVENTS	32
@@ -151,57 +165,66 @@ void *inotify_thread(void *arg)
 	return NULL;
 }
 
+static int tuner_filter(const struct dirent *dirent)
+{
+	int i;
+
+	if (strstr(dirent->d_name, BPFTUNER_LIB_SUFFIX) == NULL)
+		return 0;
+	/* check if tuner is on optional allowlist */
+	if (!nr_allowlist)
+		return 1;
+	for (i = 0; i < nr_allowlist; i++) {
+		if (strcmp(dirent->d_name, allowlist[i]) == 0)
+			return 1;
+	}
+	bpftune_log(LOG_DEBUG, "skipping %s as not on allowlist\n",
+		    dirent->d_name);
+	return 0;
+}
+
 int init(const char *library_dir)
 {
+	char *library_paths[BPFTUNE_MAX_TUNERS];
 	pthread_attr_t attr = {};
-	char library_path[512];
-	struct dirent *dirent;
+	struct dirent **dirents;
+	struct bpftuner *tuner;
 	pthread_t inotify_tid;
-	DIR *dir;
-	int err;
+	int err, i, num, nr_paths = 0;
 
-	dir = opendir(library_dir);
-	if (!dir) {
+	bpftune_log(LOG_DEBUG, "searching %s for plugins...\n", library_dir);
+	/* sort tuners by name so tuner ids are the same from run to run */
+	num = scandir(library_dir, &dirents, tuner_filter, alphasort);
+	if (num < 0) {
 		err = -errno;
 		bpftune_log(LOG_DEBUG, "could not open dir '%s': %s\n",
 			    library_dir, strerror(-err));
 		return err;
 	}
-
-	bpftune_log(LOG_DEBUG, "searching %s for plugins...\n", library_dir);
-	while ((dirent = readdir(dir)) != NULL) {
-		struct bpftuner *tuner;
-		bool allowed = true;
-
-		/* check if tuner is on optional allowlist */
-		if (nr_allowlist) {
-			int i;
-
-			allowed = false;
-			for (i = 0; i < nr_allowlist; i++) {
-				if (strcmp(dirent->d_name, allowlist[i]) == 0) {
-					allowed = true;
-					break;
-				}
+	for (i = 0; i < num; i++) {
+		if (nr_paths < BPFTUNE_MAX_TUNERS) {
+			library_paths[nr_paths] = malloc(PATH_MAX);
+			if (library_paths[nr_paths]) {
+				snprintf(library_paths[nr_paths], PATH_MAX,
+					 "%s/%s", library_dir,
+					 dirents[i]->d_name);
+				bpftune_log(LOG_DEBUG, "found lib %s\n",
+					    library_paths[nr_paths]);
+				nr_paths++;
 			}
 		}
-		if (!allowed) {
-			bpftune_log(LOG_DEBUG, "skipping %s as not on allowlist\n",
-				    dirent->d_name);
-			continue;
-		}
-					
-		if (strstr(dirent->d_name, BPFTUNER_LIB_SUFFIX) == NULL)
-			continue;
-		snprintf(library_path, sizeof(library_path), "%s/%s",
-			 library_dir, dirent->d_name);
-		bpftune_log(LOG_DEBUG, "found lib %s, init\n", library_path);
-		tuner = bpftuner_init(library_path);
-		/* individual tuner failure shouldn't prevent progress */
-		if (!tuner)
-			continue;
-		if (ringbuf_map_fd == 0)
-			ringbuf_map_fd = bpftuner_ring_buffer_map_fd(tuner);
+		free(dirents[i]);
+	}
+	free(dirents);
+	/* individual tuner failure shouldn't prevent progress */
+	bpftune_tuners_init((const char **)library_paths, nr_paths);
+	for (i = 0; i < nr_paths; i++)
+		free(library_paths[i]);
+
+	bpftune_for_each_tuner(tuner) {
+		if (ringbuf_map_fd > 0)
+			break;
+		ringbuf_map_fd = bpftuner_ring_buffer_map_fd(tuner);
 	}
 
 	if (pthread_attr_init(&attr) ||
@@ -227,14 +250,26 @@ void do_help(void)
 	fprintf(stderr,
 		"Usage: %s [OPTIONS]\n"
 		"	OPTIONS := { { -a|--allow tuner}\n"
+		"		     { -b|--rollback seconds}\n"
+		"		     { -B|--budget cpu_percent}\n"
+		"		     { -C|--config config_file}\n"
 		"		     { -d|--debug} {-D|--daemon}\n"
+		"		     { -e|--record events_file}\n"
 		"		     { -c|--cgroup_path cgroup_path}\n"
 		"		     { -L|--legacy}\n"
 		"		     { -h|--help}}\n"
 		"		     { -l|--library_path library_path}\n"
-		"		     { -r|--learning_rate learning_rate}\n"
+		"		     { -m|--metrics metrics_file}\n"
+		"		     { -n|--dry_run}\n"
+		"		     { -N|--dry_run_tuner tuner}\n"
+		"		     { -p|--profiles profiles_file}\n"
+		"		     { -P|--pin}\n"
+		"		     { -r|--learning_rate [tuner|tunable=]learning_rate}\n"
+		"		     { -R|--resume seconds}\n"
 		"		     { -s|--stderr}\n"
 		"		     { -S|--suppport}\n"
+		"		     { -t|--stats}\n"
+		"		     { -T|--run_stats}\n"
 		"		     { -V|--version}}\n",
 		bin_name);
 }
@@ -244,6 +279,37 @@ static void do_version(void)
 	printf("%s v%s\n", bin_name, BPFTUNE_VERSION);
 }
 
+/* parse a (non-negative) number of seconds */
+static int parse_secs(const char *arg, unsigned long *secs)
+{
+	char *end;
+
+	errno = 0;
+	*secs = strtoul(arg, &end, 10);
+	if (errno || end == arg || *end != '\0' || strchr(arg, '-'))
+		return -EINVAL;
+	return 0;
+}
+
+/* show BPF program run-time stats of running bpftune */
+static int do_stats(void)
+{
+	char buf[512];
+	size_t len;
+	FILE *fp;
+
+	fp = fopen(BPFTUNE_STATS_FILE, "r");
+	if (!fp) {
+		fprintf(stderr, "no stats in '%s' (is bpftune running with -T?): %s\n",
+			BPFTUNE_STATS_FILE, strerror(errno));
+		return 1;
+	}
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		fwrite(buf, 1, len, stdout);
+	fclose(fp);
+	return 0;
+}
+
 static void do_usage(void)
 {
 	do_help();
@@ -267,6 +333,12 @@ void print_support_level(enum bpftune_support_level support_level)
 		bpftune_log(BPFTUNE_LOG_LEVEL, "bpftune %s per-netns policy (via netns cookie)\n",
 			    bpftune_netns_cookie_supported() ?
 			    "supports" : "does not support");
+		bpftune_log(BPFTUNE_LOG_LEVEL, "bpftune supports attach types:%s%s%s%s%s\n",
+			    bpftune_attach_supported(BPFTUNE_ATTACH_FENTRY) ? " fentry" : "",
+			    bpftune_attach_supported(BPFTUNE_ATTACH_TP_BTF) ? " tp_btf" : "",
+			    bpftune_attach_supported(BPFTUNE_ATTACH_RAW_TP) ? " raw_tp" : "",
+			    bpftune_attach_supported(BPFTUNE_ATTACH_KPROBE) ? " kprobe" : "",
+			    bpftune_attach_supported(BPFTUNE_ATTACH_ITER) ? " iter" : "");
 	}
 }
 
@@ -274,40 +346,82 @@ int main(int argc, char *argv[])
 {
 	static const struct option options[] = {
 		{ "allow",	required_argument,	NULL,	'a' },
+		{ "rollback",	required_argument,	NULL,	'b' },
+		{ "budget",	required_argument,	NULL,	'B' },
 		{ "cgroup",	required_argument,	NULL,	'c' },
+		{ "config",	required_argument,	NULL,	'C' },
 		{ "daemon", 	no_argument,		NULL,	'D' },
 		{ "debug",	no_argument,		NULL,	'd' },
+		{ "record",	required_argument,	NULL,	'e' },
 		{ "legacy",	no_argument,		NULL,	'L' },
 		{ "help",	no_argument,		NULL,	'h' },
 		{ "libdir",	required_argument,	NULL,	'l' },
+		{ "metrics",	required_argument,	NULL,	'm' },
+		{ "dry_run",	no_argument,		NULL,	'n' },
+		{ "dry_run_tuner", required_argument,	NULL,	'N' },
+		{ "profiles",	required_argument,	NULL,	'p' },
+		{ "pin",	no_argument,		NULL,	'P' },
 		{ "learning_rate", required_argument,	NULL,	'r' },
+		{ "resume",	required_argument,	NULL,	'R' },
 		{ "stderr", 	no_argument,		NULL,	's' },
 		{ "support",	no_argument,		NULL,	'S' },
+		{ "stats",	no_argument,		NULL,	't' },
+		{ "run_stats",	no_argument,		NULL,	'T' },
 		{ "version",	no_argument,		NULL,	'V' },
 		{ 0 }
 	};
 	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
 	char *cgroup_dir = BPFTUNER_CGROUP_DIR;
 	char *library_dir = BPFTUNER_LOCAL_LIB_DIR;
+	char *metrics = BPFTUNE_METRICS_FILE;
 	enum bpftune_support_level support_level;
 	unsigned short rate = BPFTUNE_DELTA_MAX;
+	char *rate_name, *rate_str, *end;
+	long named_rate;
+	double budget = 0;
+	unsigned long resume = 0, rollback;
+	char *profiles = NULL;
+	char *config = NULL;
+	char *record = NULL;
 	int log_level = BPFTUNE_LOG_LEVEL;
-	struct sigaction sa = {}, oldsa = {};
+	struct sigaction sa = {}, oldsa = {}, oldhupsa = {};
 	bool support_only = false;
+	bool run_stats = false;
+	bool pin = false;
 	int interval = 100;
 	int err, opt;
 
 	bin_name = argv[0];
 
-	while ((opt = getopt_long(argc, argv, "a:c:dDhl:Lr:sSV", options, NULL))
+	while ((opt = getopt_long(argc, argv, "a:b:B:c:C:dDe:hl:Lm:nN:p:Pr:R:sStTV", options, NULL))
 		>= 0) {
 		switch (opt) {
 		case 'a':
 			allowlist[nr_allowlist++] = optarg;
 			break;
+		case 'b':
+			if (parse_secs(optarg, &rollback)) {
+				fprintf(stderr, "rollback window must be a number of seconds\n");
+				return 1;
+			}
+			bpftune_set_rollback(rollback);
+			break;
+		case 'B':
+			errno = 0;
+			budget = strtod(optarg, &end);
+			if (errno || end == optarg || *end != '\0' ||
+			    !(budget > 0) || isinf(budget)) {
+				fprintf(stderr, "budget must be a positive percentage of a CPU\n");
+				return 1;
+			}
+			bpftune_set_cpu_budget(budget);
+			break;
 		case 'c':
 			cgroup_dir = optarg;
 			break;
+		case 'C':
+			config = optarg;
+			break;
 		case 'd':
 			log_level = LOG_DEBUG;
 			break;
@@ -318,6 +432,9 @@ int main(int argc, char *argv[])
 				return 1;
 			}
 			break;
+		case 'e':
+			record = optarg;
+			break;
 		case 'h':
 			do_help();
 			return 0;
@@ -327,13 +444,54 @@ int main(int argc, char *argv[])
 		case 'L':
 			bpftuner_force_bpf_legacy();
 			break;
+		case 'm':
+			metrics = optarg;
+			break;
+		case 'n':
+			bpftune_set_dry_run(NULL);
+			break;
+		case 'N':
+			if (bpftune_set_dry_run(optarg)) {
+				fprintf(stderr, "could not set dry run for '%s'\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			profiles = optarg;
+			break;
+		case 'P':
+			pin = true;
+			break;
 		case 'r':
-			rate = atoi(optarg);
-			if (rate > BPFTUNE_DELTA_MAX) {
+			/* either a global rate or tuner|tunable=rate */
+			rate_name = strchr(optarg, '=');
+			rate_str = rate_name ? rate_name + 1 : optarg;
+			errno = 0;
+			named_rate = strtol(rate_str, &end, 10);
+			if (errno || end == rate_str || *end != '\0' ||
+			    named_rate < BPFTUNE_DELTA_MIN ||
+			    named_rate > BPFTUNE_DELTA_MAX) {
 				fprintf(stderr, "values %d-%d are supported\n",
 					BPFTUNE_DELTA_MIN, BPFTUNE_DELTA_MAX);
 				return 1;
 			}
+			if (!rate_name) {
+				rate = named_rate;
+				break;
+			}
+			*rate_name = '\0';
+			if (bpftune_set_named_learning_rate(optarg, named_rate)) {
+				fprintf(stderr, "could not set learning rate for '%s'\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'R':
+			if (parse_secs(optarg, &resume)) {
+				fprintf(stderr, "resume period must be a number of seconds\n");
+				return 1;
+			}
 			break;
 		case 's':
 			use_stderr = true;
@@ -342,6 +500,11 @@ int main(int argc, char *argv[])
 			use_stderr = true;
 			support_only = true;
 			break;
+		case 't':
+			return do_stats();
+		case 'T':
+			run_stats = true;
+			break;
 		case 'V':
 			do_version();
 			return 0;
@@ -355,6 +518,14 @@ int main(int argc, char *argv[])
 	bpftune_set_log(log_level, use_stderr ? bpftune_log_stderr : bpftune_log_syslog);
 
 	bpftune_set_learning_rate(rate);
+	bpftune_set_manual_resume(resume);
+	/* default config file is optional */
+	if (!config && access(BPFTUNE_CONFIG_FILE, F_OK) == 0)
+		config = BPFTUNE_CONFIG_FILE;
+	if (config && bpftune_config_load(config))
+		return 1;
+	if (profiles && bpftune_profiles_load(profiles))
+		return 1;
 
 	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
 		err = -errno;
@@ -388,6 +559,25 @@ int main(int argc, char *argv[])
 
 	bpftune_cap_drop();
 
+	/* adopt (or clean up) BPF objects pinned by a previous bpftune */
+	if (bpftune_pin_init(pin))
+		exit(EXIT_FAILURE);
+
+	/* account BPF program run time from the start; this turns on
+	 * run-time accounting for all BPF programs on the system, so is
+	 * only done on request, or if the governor needs it.
+	 */
+	if (run_stats || budget > 0)
+		bpftune_stats_init();
+
+	/* restore learned state from last run (if any) as tuners load */
+	bpftune_state_init(BPFTUNE_STATE_FILE);
+
+	bpftune_metrics_init(metrics);
+
+	if (record && bpftune_record_init(record))
+		exit(EXIT_FAILURE);
+
 	if (init(BPFTUNER_LIB_DIR)) {
 		bpftune_log(LOG_ERR, "could not initialize tuners in '%s'\n",
 			    BPFTUNER_LIB_DIR);
@@ -397,6 +587,9 @@ int main(int argc, char *argv[])
 	if (library_dir)
 		init(library_dir);
 
+	/* failure to create the control socket is not fatal */
+	bpftune_control_init(BPFTUNE_CONTROL_SOCKET);
+
 	sa.sa_handler = cleanup;
 	sigemptyset(&sa.sa_mask);
 	if (sigaction(SIGINT, &sa, &oldsa) == -1 ||
@@ -404,10 +597,17 @@ int main(int argc, char *argv[])
 		err = -errno;
 		bpftune_log(LOG_ERR, "signal handling failure: %s\n",
 			    strerror(-err));
+		goto out;
+	}
+	sa.sa_handler = reload;
+	if (sigaction(SIGHUP, &sa, &oldhupsa) == -1) {
+		err = -errno;
+		bpftune_log(LOG_ERR, "signal handling failure: %s\n",
+			    strerror(-err));
 	} else {
 		err = bpftune_ring_buffer_poll(ring_buffer, interval);
 	}
-
+out:
 	fini();
 
 	if (use_stderr)
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Copyright (c) 2023, Oracle and/or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+/* bpftunectl: send a request to a running bpftune via its control socket
+ * and display the response.
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <bpftune/libbpftune.h>
+
+static void usage(const char *bin_name)
+{
+	fprintf(stderr,
+		"Usage: %s [-s control_socket] command\n"
+		"	where command is one of\n"
+		"	list\n"
+		"	stats\n"
+		"	enable tuner [global|netns_cookie|netns_path]\n"
+		"	disable tuner [global|netns_cookie|netns_path]\n"
+		"	rate [tuner|tunable] learning_rate\n",
+		bin_name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char *path = BPFTUNE_CONTROL_SOCKET;
+	char req[BPFTUNE_MAX_NAME * 4] = {};
+	char buf[BPFTUNE_MAX_NAME];
+	bool ok = false, first = true;
+	size_t len = 0;
+	FILE *fp;
+	int i, fd;
+
+	if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+		path = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2 || strcmp(argv[1], "-h") == 0)
+		usage(argv[0]);
+	for (i = 1; i < argc; i++) {
+		len += snprintf(req + len, sizeof(req) - len, "%s%s",
+				argv[i], i == argc - 1 ? "\n" : " ");
+		if (len >= sizeof(req)) {
+			fprintf(stderr, "request too long\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path '%s' too long\n", path);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "could not connect to '%s': %s; is bpftune running?\n",
+			path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (send(fd, req, len, 0) != (ssize_t)len) {
+		fprintf(stderr, "could not send request: %s\n", strerror(errno));
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	fp = fdopen(fd, "r");
+	if (!fp) {
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (first) {
+			first = false;
+			ok = strcmp(buf, "ok\n") == 0;
+			if (ok)
+				continue;
+			fprintf(stderr, "%s", buf);
+			continue;
+		}
+		fputs(buf, stdout);
+	}
+	fclose(fp);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,984 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Copyright (c) 2023, Oracle and/or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+/* bpftunesim: offline simulator for tuners.  A tuner shared object is
+ * loaded against the mock libbpftune functions defined here, which take
+ * precedence over those in libbpftune.so since bpftunesim exports them
+ * (it is linked with -rdynamic).  Events from scenario files, either
+ * written by hand or recorded by bpftune --record, are fed to the tuner's
+ * event_handler() in order of simulated time, and the resulting tunable
+ * changes are reported.  BPF programs are never loaded; the tuner's BPF
+ * skeleton is only opened (in legacy mode) for its global variables.
+ * Simulated time is the only clock tuners see, so runs are deterministic.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include <bpftune/libbpftune.h>
+
+/* per-netns tunable values; netns cookie 0 is the global namespace, and
+ * is used for tunables that are not namespaced.
+ */
+struct sim_value {
+	unsigned int tunable;
+	unsigned long netns_cookie;
+	long values[BPFTUNE_MAX_VALUES];
+	struct bpftune_step step;
+	unsigned long changes;
+	__u64 last_change;		/* msecs */
+};
+
+/* initial sysctl values, from "sysctl" lines */
+struct sim_sysctl {
+	char name[BPFTUNE_MAX_NAME];
+	int num_values;
+	long values[BPFTUNE_MAX_VALUES];
+};
+
+/* learning rates for tuners/tunables, from "rate" lines and -r */
+struct sim_rate {
+	char name[BPFTUNE_MAX_NAME];
+	unsigned short rate;
+};
+
+enum sim_source_type {
+	SIM_EVENT,			/* event with new tunable values */
+	SIM_RECORD,			/* event recorded by bpftune */
+	SIM_GROW,			/* grow tunable value to target */
+	SIM_SHRINK,			/* shrink tunable value to target */
+};
+
+/* a source of one or more events; events are delivered in order of
+ * time, and in order of scenario file lines for events at the same time.
+ */
+struct sim_source {
+	enum sim_source_type type;
+	int line;
+	__u64 time;			/* time of next event, msecs */
+	__u64 interval;			/* msecs between events */
+	unsigned long count;		/* events remaining */
+	unsigned int scenario;
+	unsigned long netns_cookie;
+	char tunable_name[BPFTUNE_MAX_NAME];
+	unsigned int tunable;
+	unsigned int index;		/* value to grow/shrink */
+	long target;
+	__u64 reached;			/* time target was reached, msecs */
+	bool done;
+	int num_values;
+	long values[BPFTUNE_MAX_VALUES];
+	__u8 payload[sizeof(struct bpftune_event) -
+		     offsetof(struct bpftune_event, update)];
+};
+
+#define SIM_MAX_VALUES		256
+#define SIM_MAX_SYSCTLS		64
+#define SIM_MAX_RATES		64
+
+static struct sim_value sim_values[SIM_MAX_VALUES];
+static unsigned int sim_num_values;
+static struct sim_sysctl sim_sysctls[SIM_MAX_SYSCTLS];
+static unsigned int sim_num_sysctls;
+static struct sim_rate sim_rates[SIM_MAX_RATES];
+static unsigned int sim_num_rates;
+static struct sim_source *sim_sources;
+static unsigned int sim_num_sources;
+
+static struct bpftuner sim_tuner;
+static char sim_tuner_path[PATH_MAX];
+static __u64 sim_now;			/* msecs */
+static int sim_log_level = LOG_WARNING;
+
+unsigned short bpftune_learning_rate = BPFTUNE_DELTA_MAX;
+
+/* mock libbpftune */
+
+int bpftune_log_level(void)
+{
+	return sim_log_level;
+}
+
+void bpftune_log(int level, const char *fmt, ...)
+{
+	va_list args;
+
+	if (level > sim_log_level)
+		return;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void bpftune_log_bpf_err(int err, const char *fmt)
+{
+	bpftune_log(LOG_ERR, fmt, strerror(-err));
+}
+
+int bpftune_cap_add(void)
+{
+	return 0;
+}
+
+void bpftune_cap_drop(void)
+{
+}
+
+/* legacy mode needs the fewest BPF features at init time, and tuners do
+ * not rely on BPF iterators to act on events in legacy mode.
+ */
+bool bpftuner_bpf_legacy(void)
+{
+	return true;
+}
+
+/* tuners making changes by means other than sysctls record them with
+ * bpftuner_tunable_shadow() in dry-run mode, so nothing is changed.
+ */
+bool bpftuner_dry_run(__attribute__((unused)) struct bpftuner *tuner)
+{
+	return true;
+}
+
+static int sim_named_rate(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; name && i < sim_num_rates; i++) {
+		if (strcmp(sim_rates[i].name, name) == 0)
+			return sim_rates[i].rate;
+	}
+	return -1;
+}
+
+static int sim_set_rate(const char *name, int rate)
+{
+	unsigned int i;
+
+	if (rate < BPFTUNE_DELTA_MIN || rate > BPFTUNE_DELTA_MAX)
+		return -EINVAL;
+	if (!name) {
+		bpftune_learning_rate = rate;
+		return 0;
+	}
+	for (i = 0; i < sim_num_rates; i++) {
+		if (strcmp(sim_rates[i].name, name) == 0)
+			break;
+	}
+	if (i == SIM_MAX_RATES)
+		return -E2BIG;
+	if (i == sim_num_rates)
+		sim_num_rates++;
+	strncpy(sim_rates[i].name, name, sizeof(sim_rates[i].name) - 1);
+	sim_rates[i].rate = rate;
+	return 0;
+}
+
+unsigned short bpftuner_learning_rate(struct bpftuner *tuner)
+{
+	int rate = sim_named_rate(tuner->name);
+
+	return rate >= 0 ? rate : bpftune_learning_rate;
+}
+
+void bpftuner_learning_rates_update(struct bpftuner *tuner)
+{
+	unsigned short rate = bpftuner_learning_rate(tuner);
+	unsigned int i;
+
+	if (tuner->bpf_learning_rate)
+		*tuner->bpf_learning_rate = rate;
+	if (!tuner->bpf_tunable_rates)
+		return;
+	for (i = 0; i < BPFTUNE_MAX_TUNABLES; i++)
+		tuner->bpf_tunable_rates[i] = rate;
+	for (i = 0; i < tuner->num_tunables; i++) {
+		struct bpftunable_desc *desc = &tuner->tunables[i].desc;
+		int tunable_rate = sim_named_rate(desc->name);
+
+		if (tunable_rate < 0 || desc->id >= BPFTUNE_MAX_TUNABLES)
+			continue;
+		tuner->bpf_tunable_rates[desc->id] = tunable_rate;
+	}
+}
+
+unsigned short bpftuner_tunable_learning_rate(struct bpftuner *tuner,
+					      unsigned int index,
+					      __attribute__((unused))
+					      unsigned long netns_cookie)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, index);
+	int rate = t ? sim_named_rate(t->desc.name) : -1;
+
+	return rate >= 0 ? rate : bpftuner_learning_rate(tuner);
+}
+
+int __bpftuner_bpf_load(struct bpftuner *tuner,
+			__attribute__((unused)) const char **optionals)
+{
+	tuner->ring_buffer_map_fd = -1;
+	tuner->corr_map_fd = -1;
+	tuner->netns_map_fd = -1;
+	tuner->netns_profile_map_fd = -1;
+	return 0;
+}
+
+int __bpftuner_bpf_attach(__attribute__((unused)) struct bpftuner *tuner)
+{
+	return 0;
+}
+
+void bpftuner_bpf_fini(struct bpftuner *tuner)
+{
+	tuner->bpf_sample_shift = NULL;
+	tuner->bpf_learning_rate = NULL;
+	tuner->bpf_tunable_rates = NULL;
+	tuner->bpf_ringbuf_drops = NULL;
+	bpf_object__destroy_skeleton(tuner->skeleton);
+	free(tuner->skel);
+	tuner->skeleton = NULL;
+	tuner->skel = NULL;
+	tuner->obj = NULL;
+}
+
+int bpftuner_cgroup_attach(__attribute__((unused)) struct bpftuner *tuner,
+			   __attribute__((unused)) const char *prog_name,
+			   __attribute__((unused)) enum bpf_attach_type attach_type)
+{
+	return 0;
+}
+
+void bpftuner_cgroup_detach(__attribute__((unused)) struct bpftuner *tuner,
+			    __attribute__((unused)) const char *prog_name,
+			    __attribute__((unused)) enum bpf_attach_type attach_type)
+{
+}
+
+bool bpftuner_prog_attached(__attribute__((unused)) struct bpftuner *tuner,
+			    __attribute__((unused)) const char *prog_name)
+{
+	return true;
+}
+
+int bpftuner_prog_attach(__attribute__((unused)) struct bpftuner *tuner,
+			 __attribute__((unused)) const char *prog_name)
+{
+	return 0;
+}
+
+void bpftuner_prog_detach(__attribute__((unused)) struct bpftuner *tuner,
+			  __attribute__((unused)) const char *prog_name)
+{
+}
+
+int bpftune_module_load(__attribute__((unused)) const char *name)
+{
+	return -EEXIST;
+}
+
+static struct sim_sysctl *sim_sysctl(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sim_num_sysctls; i++) {
+		if (strcmp(sim_sysctls[i].name, name) == 0)
+			return &sim_sysctls[i];
+	}
+	return NULL;
+}
+
+/* sysctls have the values given in the scenario */
+int bpftune_sysctl_read(__attribute__((unused)) int netns_fd,
+			const char *name, long *values)
+{
+	struct sim_sysctl *s = sim_sysctl(name);
+
+	if (!s)
+		return -ENOENT;
+	memcpy(values, s->values, s->num_values * sizeof(*values));
+	return s->num_values;
+}
+
+int bpftune_sysctl_tunables_find(__attribute__((unused)) const char *path,
+				 __attribute__((unused))
+				 struct bpftune_sysctl_match *matches,
+				 __attribute__((unused))
+				 unsigned int max_matches)
+{
+	return 0;
+}
+
+int bpftuner_tunables_init(struct bpftuner *tuner, unsigned int num_descs,
+			   struct bpftunable_desc *descs,
+			   unsigned int num_scenarios,
+			   struct bpftunable_scenario *scenarios)
+{
+	unsigned int i;
+
+	tuner->scenarios = scenarios;
+	tuner->num_scenarios = num_scenarios;
+	tuner->tunables = calloc(num_descs, sizeof(struct bpftunable));
+	if (!tuner->tunables)
+		return -ENOMEM;
+	tuner->num_tunables = num_descs;
+	for (i = 0; i < num_descs; i++) {
+		struct bpftunable *t = &tuner->tunables[i];
+
+		memcpy(&t->desc, &descs[i], sizeof(*descs));
+		if (descs[i].type == BPFTUNABLE_SYSCTL &&
+		    bpftune_sysctl_read(0, descs[i].name,
+					t->current_values) < 0)
+			bpftune_log(LOG_WARNING, "no value for '%s' in scenario; using 0\n",
+				    descs[i].name);
+		memcpy(t->initial_values, t->current_values,
+		       sizeof(t->initial_values));
+	}
+	bpftuner_learning_rates_update(tuner);
+	return 0;
+}
+
+struct bpftunable *bpftuner_tunable(struct bpftuner *tuner, unsigned int index)
+{
+	if (index < tuner->num_tunables)
+		return &tuner->tunables[index];
+	return NULL;
+}
+
+unsigned int bpftuner_num_tunables(struct bpftuner *tuner)
+{
+	return tuner->num_tunables;
+}
+
+struct bpftuner *bpftune_tuner(unsigned int index)
+{
+	return index == 0 && sim_tuner.handle ? &sim_tuner : NULL;
+}
+
+unsigned int bpftune_tuner_num(void)
+{
+	return 1;
+}
+
+bool bpftune_netns_cookie_supported(void)
+{
+	return true;
+}
+
+int bpftune_netns_info(__attribute__((unused)) int pid,
+		       __attribute__((unused)) int *fd,
+		       __attribute__((unused)) unsigned long *cookie)
+{
+	return -ENOENT;
+}
+
+int bpftune_netns_set(__attribute__((unused)) int fd,
+		      __attribute__((unused)) int *orig_fd)
+{
+	return -ENOENT;
+}
+
+int bpftuner_netns_fd_from_cookie(__attribute__((unused)) struct bpftuner *tuner,
+				  __attribute__((unused)) unsigned long cookie)
+{
+	return -ENOENT;
+}
+
+void bpftuner_netns_init(__attribute__((unused)) struct bpftuner *tuner,
+			 __attribute__((unused)) unsigned long cookie)
+{
+}
+
+void bpftuner_netns_fini(__attribute__((unused)) struct bpftuner *tuner,
+			 __attribute__((unused)) unsigned long cookie,
+			 __attribute__((unused)) enum bpftune_state state)
+{
+}
+
+void bpftune_profiles_update(void)
+{
+}
+
+void bpftuner_tunable_netns_manual(struct bpftuner *tuner, unsigned int tunable,
+				   unsigned long cookie)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+
+	if (t)
+		printf("%llu %s %lu manual\n", sim_now, t->desc.name, cookie);
+}
+
+int bpftuner_tunable_limit(__attribute__((unused)) struct bpftuner *tuner,
+			   __attribute__((unused)) unsigned int tunable,
+			   __attribute__((unused)) unsigned long netns_cookie,
+			   __attribute__((unused)) __u8 num_values,
+			   __attribute__((unused)) long *old_values,
+			   __attribute__((unused)) long *values)
+{
+	return 0;
+}
+
+unsigned long bpftune_now_secs(void)
+{
+	return sim_now / 1000;
+}
+
+static struct sim_value *sim_value(struct bpftuner *tuner, unsigned int tunable,
+				   unsigned long netns_cookie)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	struct sim_value *v;
+	unsigned int i;
+
+	if (!t)
+		return NULL;
+	if (!t->desc.namespaced)
+		netns_cookie = 0;
+	for (i = 0; i < sim_num_values; i++) {
+		v = &sim_values[i];
+		if (v->tunable == tunable && v->netns_cookie == netns_cookie)
+			return v;
+	}
+	if (sim_num_values == SIM_MAX_VALUES)
+		return NULL;
+	v = &sim_values[sim_num_values++];
+	v->tunable = tunable;
+	v->netns_cookie = netns_cookie;
+	memcpy(v->values, t->initial_values, sizeof(v->values));
+	return v;
+}
+
+/* apply and report a change to tunable values, updating adaptive step
+ * state as bpftuner_tunable_step_update() does; returns 1 if values
+ * changed.
+ */
+static int sim_change(struct bpftuner *tuner, unsigned int tunable,
+		      unsigned long netns_cookie, __u8 num_values,
+		      long *values)
+{
+	struct sim_value *v = sim_value(tuner, tunable, netns_cookie);
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	int dir = 0;
+	__u8 i;
+
+	if (!v)
+		return -EINVAL;
+	if (num_values > BPFTUNE_MAX_VALUES)
+		num_values = BPFTUNE_MAX_VALUES;
+	for (i = 0; i < num_values; i++) {
+		if (values[i] != v->values[i]) {
+			dir = values[i] > v->values[i] ? 1 : -1;
+			break;
+		}
+	}
+	if (!dir)
+		return 0;
+	bpftune_step_change(&v->step, dir, sim_now * MSEC);
+	memcpy(v->values, values, num_values * sizeof(*values));
+	v->changes++;
+	v->last_change = sim_now;
+	if (!v->netns_cookie)
+		memcpy(t->current_values, values, num_values * sizeof(*values));
+	t->writes++;
+
+	printf("%llu %s %lu", sim_now, t->desc.name, v->netns_cookie);
+	for (i = 0; i < t->desc.num_values; i++)
+		printf(" %ld", v->values[i]);
+	printf(" rate %d step %d\n",
+	       bpftuner_tunable_learning_rate(tuner, tunable, netns_cookie),
+	       v->step.step);
+	return 1;
+}
+
+int bpftuner_tunable_sysctl_write(struct bpftuner *tuner, unsigned int tunable,
+				  __attribute__((unused)) unsigned int scenario,
+				  unsigned long netns_cookie,
+				  __u8 num_values, long *values,
+				  const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	ret = sim_change(tuner, tunable, netns_cookie, num_values, values);
+	if (ret > 0 && BPFTUNE_LOG_LEVEL <= sim_log_level) {
+		va_start(args, fmt);
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+	}
+	return ret < 0 ? ret : 0;
+}
+
+int bpftuner_tunable_shadow(struct bpftuner *tuner, unsigned int tunable,
+			    unsigned long netns_cookie, __u8 num_values,
+			    long *values)
+{
+	int ret = sim_change(tuner, tunable, netns_cookie, num_values, values);
+
+	return ret < 0 ? ret : 0;
+}
+
+/* changes without values, e.g. congestion control algorithm */
+int bpftuner_tunable_update(struct bpftuner *tuner, unsigned int tunable,
+			    __attribute__((unused)) unsigned int scenario,
+			    __attribute__((unused)) int netns_fd,
+			    const char *fmt, ...)
+{
+	struct sim_value *v = sim_value(tuner, tunable, 0);
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	va_list args;
+
+	if (!v)
+		return -EINVAL;
+	v->changes++;
+	v->last_change = sim_now;
+	printf("%llu %s 0 update\n", sim_now, t->desc.name);
+	if (BPFTUNE_LOG_LEVEL <= sim_log_level) {
+		va_start(args, fmt);
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+	}
+	return 0;
+}
+
+/* simulator */
+
+static int sim_hex_decode(const char *hex, __u8 *buf, size_t len)
+{
+	unsigned int byte;
+	size_t i;
+
+	if (strlen(hex) != len * 2)
+		return -EINVAL;
+	for (i = 0; i < len; i++) {
+		if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+			return -EINVAL;
+		buf[i] = byte;
+	}
+	return 0;
+}
+
+static struct sim_source *sim_source_add(int line)
+{
+	struct sim_source *sources;
+
+	sources = realloc(sim_sources,
+			  (sim_num_sources + 1) * sizeof(*sim_sources));
+	if (!sources)
+		return NULL;
+	sim_sources = sources;
+	memset(&sim_sources[sim_num_sources], 0, sizeof(*sim_sources));
+	sim_sources[sim_num_sources].line = line;
+	sim_sources[sim_num_sources].count = 1;
+	return &sim_sources[sim_num_sources++];
+}
+
+/* scenario format is one item per line:
+ *
+ * tuner <tuner_so_path>
+ * sysctl <name> <value> [<value> <value>]
+ * rate [<tuner|tunable>] <learning_rate>
+ * event <msecs> <scenario> <netns_cookie> <tunable> <value> [<value> <value>]
+ * grow <msecs> <interval> <count> <scenario> <netns_cookie> <tunable> <index> <target>
+ * shrink <msecs> <interval> <count> <scenario> <netns_cookie> <tunable> <index> <target>
+ * record <msecs> <tuner> <scenario> <netns_cookie> <payload>
+ *
+ * "record" lines are written by bpftune --record; those for other tuners
+ * are skipped.
+ */
+static int sim_scenario_load(const char *file, int *lineno)
+{
+	char line[1024], type[16], name[BPFTUNE_MAX_NAME], hex[512];
+	struct sim_source *src;
+	unsigned long long time, interval;
+	int ret = 0, n;
+	FILE *fp;
+
+	fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (!fp) {
+		ret = -errno;
+		fprintf(stderr, "could not open '%s': %s\n", file,
+			strerror(-ret));
+		return ret;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		long v[BPFTUNE_MAX_VALUES] = {};
+		char *rest;
+
+		(*lineno)++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%15s", type) != 1)
+			continue;
+		rest = strstr(line, type) + strlen(type);
+		if (!strcmp(type, "tuner")) {
+			if (sscanf(rest, "%4095s", sim_tuner_path) == 1)
+				continue;
+		} else if (!strcmp(type, "sysctl")) {
+			struct sim_sysctl *s;
+
+			n = sscanf(rest, "%127s %ld %ld %ld", name, &v[0],
+				   &v[1], &v[2]);
+			s = sim_sysctl(name);
+			if (!s && sim_num_sysctls < SIM_MAX_SYSCTLS)
+				s = &sim_sysctls[sim_num_sysctls++];
+			if (n >= 2 && s) {
+				strcpy(s->name, name);
+				s->num_values = n - 1;
+				memcpy(s->values, v, sizeof(v));
+				continue;
+			}
+		} else if (!strcmp(type, "rate")) {
+			n = sscanf(rest, "%127s %ld", name, &v[0]);
+			if (n == 1 && !sim_set_rate(NULL, atoi(name)))
+				continue;
+			if (n == 2 && !sim_set_rate(name, v[0]))
+				continue;
+		} else if (!strcmp(type, "event")) {
+			src = sim_source_add(*lineno);
+			if (!src) {
+				ret = -ENOMEM;
+				break;
+			}
+			src->type = SIM_EVENT;
+			n = sscanf(rest, "%llu %u %lu %127s %ld %ld %ld", &time,
+				   &src->scenario, &src->netns_cookie,
+				   src->tunable_name, &src->values[0],
+				   &src->values[1], &src->values[2]);
+			src->time = time;
+			src->num_values = n - 4;
+			if (n >= 5)
+				continue;
+		} else if (!strcmp(type, "grow") || !strcmp(type, "shrink")) {
+			src = sim_source_add(*lineno);
+			if (!src) {
+				ret = -ENOMEM;
+				break;
+			}
+			src->type = !strcmp(type, "grow") ? SIM_GROW : SIM_SHRINK;
+			n = sscanf(rest, "%llu %llu %lu %u %lu %127s %u %ld",
+				   &time, &interval, &src->count,
+				   &src->scenario, &src->netns_cookie,
+				   src->tunable_name, &src->index,
+				   &src->target);
+			src->time = time;
+			src->interval = interval;
+			if (n == 8 && src->index < BPFTUNE_MAX_VALUES)
+				continue;
+		} else if (!strcmp(type, "record")) {
+			n = sscanf(rest, "%llu %127s", &time, name);
+			/* recorded events for other tuners */
+			if (n == 2 && sim_tuner.name &&
+			    strcmp(name, sim_tuner.name) != 0)
+				continue;
+			src = sim_source_add(*lineno);
+			if (!src) {
+				ret = -ENOMEM;
+				break;
+			}
+			src->type = SIM_RECORD;
+			n = sscanf(rest, "%llu %127s %u %lu %511s", &time, name,
+				   &src->scenario, &src->netns_cookie, hex);
+			src->time = time;
+			if (n == 5 && !sim_hex_decode(hex, src->payload,
+						      sizeof(src->payload)))
+				continue;
+		}
+		fprintf(stderr, "invalid scenario line at %s:%d\n", file,
+			*lineno);
+		ret = -EINVAL;
+		break;
+	}
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
+static int sim_tunable_find(const char *name)
+{
+	unsigned int i;
+	char *end;
+	long id;
+
+	for (i = 0; i < sim_tuner.num_tunables; i++) {
+		if (strcmp(sim_tuner.tunables[i].desc.name, name) == 0)
+			return i;
+	}
+	id = strtol(name, &end, 10);
+	if (*end == '\0' && id >= 0 && id < (long)sim_tuner.num_tunables)
+		return id;
+	return -ENOENT;
+}
+
+static int sim_tuner_init(const char *path)
+{
+	int err;
+
+	sim_tuner.handle = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+	if (!sim_tuner.handle) {
+		fprintf(stderr, "could not dlopen '%s': %s\n", path,
+			dlerror());
+		return -ENOENT;
+	}
+	sim_tuner.path = path;
+	sim_tuner.init = dlsym(sim_tuner.handle, "init");
+	sim_tuner.fini = dlsym(sim_tuner.handle, "fini");
+	sim_tuner.event_handler = dlsym(sim_tuner.handle, "event_handler");
+	if (!sim_tuner.init || !sim_tuner.fini || !sim_tuner.event_handler) {
+		fprintf(stderr, "missing definitions in '%s': need 'init', 'fini' and 'event_handler'\n",
+			path);
+		return -ENOENT;
+	}
+	sim_tuner.bpf_legacy = true;
+	err = sim_tuner.init(&sim_tuner);
+	if (err) {
+		fprintf(stderr, "could not initialize '%s': %d\n", path, err);
+		return err < 0 ? err : -EINVAL;
+	}
+	sim_tuner.state = BPFTUNE_ACTIVE;
+	return 0;
+}
+
+/* fill in event for the next event from src; returns false if the source
+ * has no event this time, as when a grow/shrink target has been reached.
+ */
+static bool sim_source_event(struct sim_source *src,
+			     struct bpftune_event *event)
+{
+	struct bpftunable_update *update = &event->update[0];
+	struct sim_value *v = NULL;
+	unsigned short rate;
+	long cur;
+	int step;
+
+	event->tuner_id = sim_tuner.id;
+	event->scenario_id = src->scenario;
+	event->netns_cookie = src->netns_cookie;
+	if (src->type == SIM_RECORD) {
+		memcpy(event->update, src->payload, sizeof(src->payload));
+		return true;
+	}
+	v = sim_value(&sim_tuner, src->tunable, src->netns_cookie);
+	if (!v)
+		return false;
+	update->id = src->tunable;
+	memcpy(update->old, v->values, sizeof(update->old));
+	memcpy(update->new, v->values, sizeof(update->new));
+	if (src->type == SIM_EVENT) {
+		memcpy(update->new, src->values,
+		       src->num_values * sizeof(*src->values));
+		return true;
+	}
+	/* grow/shrink as BPF programs do, using the learning rate and
+	 * adaptive step for the tunable.
+	 */
+	cur = v->values[src->index];
+	if ((src->type == SIM_GROW && cur >= src->target) ||
+	    (src->type == SIM_SHRINK && cur <= src->target))
+		return false;
+	rate = bpftuner_tunable_learning_rate(&sim_tuner, src->tunable,
+					      src->netns_cookie);
+	step = bpftune_step_get(&v->step, sim_now * MSEC);
+	if (src->type == SIM_GROW)
+		update->new[src->index] = BPFTUNE_GROW_BY_STEP(cur, rate, step);
+	else
+		update->new[src->index] = BPFTUNE_SHRINK_BY_STEP(cur, rate, step);
+	return true;
+}
+
+static void sim_source_reached(struct sim_source *src)
+{
+	struct sim_value *v;
+	long cur;
+
+	if ((src->type != SIM_GROW && src->type != SIM_SHRINK) || src->reached)
+		return;
+	v = sim_value(&sim_tuner, src->tunable, src->netns_cookie);
+	if (!v)
+		return;
+	cur = v->values[src->index];
+	if ((src->type == SIM_GROW && cur >= src->target) ||
+	    (src->type == SIM_SHRINK && cur <= src->target))
+		src->reached = sim_now;
+}
+
+static void sim_run(void)
+{
+	unsigned long events = 0;
+
+	for (;;) {
+		struct bpftune_event event = {};
+		struct sim_source *src = NULL;
+		unsigned int i;
+
+		/* earliest pending event; ties go to the earlier line */
+		for (i = 0; i < sim_num_sources; i++) {
+			if (sim_sources[i].done)
+				continue;
+			if (!src || sim_sources[i].time < src->time)
+				src = &sim_sources[i];
+		}
+		if (!src)
+			break;
+		sim_now = src->time;
+		if (sim_source_event(src, &event)) {
+			sim_tuner.event_handler(&sim_tuner, &event, NULL);
+			events++;
+		}
+		sim_source_reached(src);
+		if (--src->count == 0)
+			src->done = true;
+		src->time += src->interval;
+	}
+	printf("# %lu events in %llu msecs\n", events, sim_now);
+}
+
+static void sim_report(void)
+{
+	unsigned int i;
+	int j;
+
+	printf("# tunable netns changes last_change values\n");
+	for (i = 0; i < sim_num_values; i++) {
+		struct sim_value *v = &sim_values[i];
+		struct bpftunable *t = bpftuner_tunable(&sim_tuner, v->tunable);
+
+		printf("summary %s %lu %lu %llu", t->desc.name,
+		       v->netns_cookie, v->changes, v->last_change);
+		for (j = 0; j < t->desc.num_values; j++)
+			printf(" %ld", v->values[j]);
+		printf("\n");
+	}
+	for (i = 0; i < sim_num_sources; i++) {
+		struct sim_source *src = &sim_sources[i];
+		struct bpftunable *t = bpftuner_tunable(&sim_tuner, src->tunable);
+
+		if (src->type != SIM_GROW && src->type != SIM_SHRINK)
+			continue;
+		if (src->reached)
+			printf("converged %s %lu %ld %llu\n", t->desc.name,
+			       src->netns_cookie, src->target, src->reached);
+		else
+			printf("converged %s %lu %ld never\n", t->desc.name,
+			       src->netns_cookie, src->target);
+	}
+}
+
+static void usage(const char *bin_name)
+{
+	fprintf(stderr,
+		"Usage: %s [-d] [-v] [-r [tuner|tunable=]learning_rate] [-t tuner_so] scenario_file ...\n",
+		bin_name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *tuner_path = NULL;
+	int i, opt, err, lineno = 0;
+	char *rate_name;
+
+	while ((opt = getopt(argc, argv, "dhr:t:v")) >= 0) {
+		switch (opt) {
+		case 'd':
+			sim_log_level = LOG_DEBUG;
+			break;
+		case 'r':
+			/* either a global rate or tuner|tunable=rate */
+			rate_name = strchr(optarg, '=');
+			if (rate_name)
+				*rate_name++ = '\0';
+			if (sim_set_rate(rate_name ? optarg : NULL,
+					 atoi(rate_name ? rate_name : optarg))) {
+				fprintf(stderr, "values %d-%d are supported\n",
+					BPFTUNE_DELTA_MIN, BPFTUNE_DELTA_MAX);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			tuner_path = optarg;
+			break;
+		case 'v':
+			if (sim_log_level < BPFTUNE_LOG_LEVEL)
+				sim_log_level = BPFTUNE_LOG_LEVEL;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc)
+		usage(argv[0]);
+	if (sim_log_level < LOG_DEBUG)
+		libbpf_set_print(NULL);
+
+	/* tuner and sysctl values are needed to initialize the tuner */
+	for (i = optind; i < argc; i++) {
+		err = sim_scenario_load(argv[i], &lineno);
+		if (err)
+			return EXIT_FAILURE;
+	}
+	if (tuner_path)
+		strncpy(sim_tuner_path, tuner_path, sizeof(sim_tuner_path) - 1);
+	if (!sim_tuner_path[0]) {
+		fprintf(stderr, "no tuner specified\n");
+		usage(argv[0]);
+	}
+	if (sim_tuner_init(sim_tuner_path))
+		return EXIT_FAILURE;
+
+	/* now we know the tuner name, skip recorded events for others */
+	free(sim_sources);
+	sim_sources = NULL;
+	sim_num_sources = 0;
+	lineno = 0;
+	for (i = optind; i < argc; i++) {
+		err = sim_scenario_load(argv[i], &lineno);
+		if (err)
+			return EXIT_FAILURE;
+	}
+	for (i = 0; i < (int)sim_num_sources; i++) {
+		struct sim_source *src = &sim_sources[i];
+
+		if (src->type == SIM_RECORD)
+			continue;
+		err = sim_tunable_find(src->tunable_name);
+		if (err < 0) {
+			fprintf(stderr, "unknown tunable '%s' for tuner '%s'\n",
+				src->tunable_name, sim_tuner.name);
+			return EXIT_FAILURE;
+		}
+		src->tunable = err;
+	}
+
+	printf("# tuner %s\n", sim_tuner.name);
+	printf("# msecs tunable netns values\n");
+	sim_run();
+	sim_report();
+
+	sim_tuner.fini(&sim_tuner);
+	return EXIT_SUCCESS;
+}
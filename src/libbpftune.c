@@ -20,8 +20,10 @@
 #define _GNU_SOURCE  
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -29,6 +31,7 @@
 #include <syslog.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
@@ -39,15 +42,25 @@
 #include <linux/types.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/utsname.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
 #include <sched.h>
 #include <mntent.h>
 #include <sys/capability.h>
 #include <pthread.h>
+#include <signal.h>
+#include <ftw.h>
 
 unsigned short bpftune_learning_rate;
 
 #include <bpftune/libbpftune.h>
+#include <bpftune/corr.h>
 
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
@@ -55,6 +68,7 @@ unsigned short bpftune_learning_rate;
 
 #include "probe.skel.h"
 #include "probe.skel.legacy.h"
+#include "tcp_hook.skel.h"
 
 #ifndef SO_NETNS_COOKIE
 #define SO_NETNS_COOKIE 71
@@ -67,6 +81,7 @@ int bpftune_loglevel = BPFTUNE_LOG_LEVEL;
 struct ring_buffer *ring_buffer;
 int ring_buffer_map_fd;
 int netns_map_fd;
+int netns_profile_map_fd;
 
 int bpftune_log_level(void)
 {
@@ -383,6 +398,8 @@ void bpftuner_cgroup_detach(struct bpftuner *tuner, const char *prog_name,
 
 static bool force_bpf_legacy;
 static bool netns_cookie_supported;
+/* netns cookie support from support cache; -1 if unknown */
+static int netns_cookie_cached = -1;
 
 void bpftuner_force_bpf_legacy(void)
 {
@@ -391,10 +408,12 @@ void bpftuner_force_bpf_legacy(void)
 
 bool bpftune_netns_cookie_supported(void)
 {
-	int s = socket(AF_INET, SOCK_STREAM, 0);
 	unsigned long netns_cookie;
-	int ret = 0;
+	int s, ret = 0;
 
+	if (netns_cookie_cached >= 0)
+		return netns_cookie_cached;
+	s = socket(AF_INET, SOCK_STREAM, 0);
 	if (s < 0) {
 		bpftune_log(LOG_ERR, "could not open socket: %s\n",
 			   strerror(errno));
@@ -414,50 +433,179 @@ bool bpftune_netns_cookie_supported(void)
 }
 
 enum bpftune_support_level support_level = BPFTUNE_NONE;
+static bool support_level_probed;
+/* BPFTUNE_ATTACH_* types that work; a tuner uses its normal skeleton only
+ * if the attach types its programs need are all available, and falls back
+ * to its legacy skeleton otherwise (see bpftuner_attach_types_prepare()).
+ */
+static unsigned int attach_types;
+
+bool bpftune_attach_supported(unsigned int types)
+{
+	return (attach_types & types) == types;
+}
+
+/* Probing support level means loading and attaching probe programs, so
+ * results are cached in BPFTUNE_SUPPORT_CACHE.  The cache is keyed by
+ * kernel release/build and vmlinux BTF, so we probe again if the kernel
+ * changes.  called with caps set.
+ */
+static void bpftune_support_key(char *key, size_t key_sz)
+{
+	struct utsname utsname = {};
+	__u32 id = 0, btf_id = 0;
+	struct stat st = {};
+
+	uname(&utsname);
+	stat("/sys/kernel/btf/vmlinux", &st);
+	while (!bpf_btf_get_next_id(id, &id)) {
+		struct bpf_btf_info info = {};
+		__u32 len = sizeof(info);
+		char name[64] = {};
+		int fd;
+
+		fd = bpf_btf_get_fd_by_id(id);
+		if (fd < 0)
+			continue;
+		info.name = (__u64)(unsigned long)name;
+		info.name_len = sizeof(name);
+		if (!bpf_obj_get_info_by_fd(fd, &info, &len) &&
+		    strcmp(name, "vmlinux") == 0)
+			btf_id = id;
+		close(fd);
+		if (btf_id)
+			break;
+	}
+	snprintf(key, key_sz, "%s %s btf %u %ld",
+		 utsname.release, utsname.version, btf_id, (long)st.st_size);
+}
+
+static int bpftune_support_cache_read(const char *key)
+{
+	int level = BPFTUNE_NONE, cookie = -1, attach = -1;
+	char line[512], cached_key[512] = {};
+	FILE *fp;
+
+	fp = fopen(BPFTUNE_SUPPORT_CACHE, "r");
+	if (!fp)
+		return -errno;
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (strncmp(line, "key ", 4) == 0)
+			snprintf(cached_key, sizeof(cached_key), "%s", line + 4);
+		else if (sscanf(line, "support_level %d", &level) != 1 &&
+			 sscanf(line, "netns_cookie %d", &cookie) != 1)
+			sscanf(line, "attach_types %d", &attach);
+	}
+	fclose(fp);
+	if (strcmp(key, cached_key) != 0 || level <= BPFTUNE_NONE ||
+	    level > BPFTUNE_NORMAL || cookie < 0 || attach < 0 ||
+	    (level == BPFTUNE_NORMAL && !(attach & BPFTUNE_ATTACH_FENTRY))) {
+		bpftune_log(LOG_DEBUG, "cached support level does not match kernel, probing\n");
+		return -ENOENT;
+	}
+	support_level = level;
+	netns_cookie_cached = cookie;
+	attach_types = attach;
+	bpftune_log(LOG_DEBUG, "using cached support level %d, netns cookie support %d, attach types 0x%x\n",
+		    level, cookie, attach);
+	return 0;
+}
+
+static void bpftune_support_cache_write(const char *key)
+{
+	FILE *fp;
+
+	fp = fopen(BPFTUNE_SUPPORT_CACHE, "w");
+	if (!fp) {
+		bpftune_log(LOG_DEBUG, "could not write '%s': %s\n",
+			    BPFTUNE_SUPPORT_CACHE, strerror(errno));
+		return;
+	}
+	fprintf(fp, "key %s\nsupport_level %d\nnetns_cookie %d\nattach_types %d\n",
+		key, support_level, netns_cookie_cached, attach_types);
+	fclose(fp);
+}
+
+/* called with caps set */
+static bool bpftune_probe_attach(struct bpf_program *prog)
+{
+	struct bpf_link *link = bpf_program__attach(prog);
+
+	if (!link || libbpf_get_error(link))
+		return false;
+	bpf_link__destroy(link);
+	return true;
+}
 
 enum bpftune_support_level bpftune_bpf_support(void)
 {
+	struct probe_bpf_legacy *probe_bpf_legacy;
+	struct probe_bpf *probe_bpf;
+	char key[512];
 	bool ret;
 	int err;
-	struct probe_bpf *probe_bpf;
-	struct probe_bpf_legacy *probe_bpf_legacy;
 
 	err = bpftune_cap_add();
 	if (err)
 		return BPFTUNE_NONE;
+	support_level_probed = true;
+	bpftune_support_key(key, sizeof(key));
+	if (!bpftune_support_cache_read(key)) {
+		bpftune_cap_drop();
+		return support_level;
+	}
 	/* disable bpf logging to avoid spurious errors */
 	bpftune_set_bpf_log(false);
 
+	/* probe each attach type separately, so that only tuners whose
+	 * programs need a missing attach type fall back to legacy mode.
+	 * fentry is required for the normal skeletons; kprobe and raw_tp
+	 * are probed via the legacy skeleton, which tuners fall back to.
+	 */
+	support_level = BPFTUNE_NONE;
+	attach_types = 0;
 	probe_bpf = probe_bpf__open_and_load();
-	support_level = BPFTUNE_LEGACY;
 	err = libbpf_get_error(probe_bpf);
 	if (!err) {
-		if (!probe_bpf__attach(probe_bpf))
-			support_level = BPFTUNE_NORMAL;
+		if (bpftune_probe_attach(probe_bpf->progs.entry__setup_net))
+			attach_types |= BPFTUNE_ATTACH_FENTRY;
+		if (bpftune_probe_attach(probe_bpf->progs.bpftune_neigh_create))
+			attach_types |= BPFTUNE_ATTACH_TP_BTF;
+		if (bpftune_probe_attach(probe_bpf->progs.bpftune_probe_iter))
+			attach_types |= BPFTUNE_ATTACH_ITER;
 		probe_bpf__destroy(probe_bpf);
+		if (attach_types & BPFTUNE_ATTACH_FENTRY)
+			support_level = BPFTUNE_NORMAL;
 	}
-
-	if (support_level == BPFTUNE_LEGACY) {
+	if (support_level < BPFTUNE_NORMAL)
 		bpftune_log(LOG_DEBUG, "full bpftune support not available: %s\n",
-			    strerror(err));
-		probe_bpf_legacy = probe_bpf_legacy__open_and_load();		
-		err = libbpf_get_error(probe_bpf_legacy);
-		if (err) {
-			support_level = BPFTUNE_NONE;
-			bpftune_log(LOG_DEBUG, "legacy bpftune support not available (load): %s\n",
-				    strerror(err));
-		} else {
-			if (probe_bpf_legacy__attach(probe_bpf_legacy)) {
-				support_level = BPFTUNE_NONE;
-				bpftune_log(LOG_DEBUG, "legacy bpftune support not available (attach): %s\n",
-					    strerror(errno));
-			}
-			probe_bpf_legacy__destroy(probe_bpf_legacy);
-		}
+			    strerror(-err));
+
+	probe_bpf_legacy = probe_bpf_legacy__open_and_load();
+	err = libbpf_get_error(probe_bpf_legacy);
+	if (err) {
+		bpftune_log(LOG_DEBUG, "legacy bpftune support not available (load): %s\n",
+			    strerror(-err));
+	} else {
+		if (bpftune_probe_attach(probe_bpf_legacy->progs.entry__setup_net))
+			attach_types |= BPFTUNE_ATTACH_KPROBE;
+		if (bpftune_probe_attach(probe_bpf_legacy->progs.bpftune_neigh_create))
+			attach_types |= BPFTUNE_ATTACH_RAW_TP;
+		probe_bpf_legacy__destroy(probe_bpf_legacy);
 	}
+	if (support_level < BPFTUNE_NORMAL &&
+	    (attach_types & BPFTUNE_ATTACH_KPROBE))
+		support_level = BPFTUNE_LEGACY;
+	bpftune_log(LOG_DEBUG, "supported attach types: 0x%x\n", attach_types);
 	ret = bpftune_netns_cookie_supported();
 	if (!ret)
 		bpftune_log(LOG_DEBUG, "netns cookie not supported\n");
+	/* do not cache failure, as it may be due to missing privileges */
+	if (support_level > BPFTUNE_NONE) {
+		netns_cookie_cached = ret;
+		bpftune_support_cache_write(key);
+	}
 
 	bpftune_set_bpf_log(true);
 	bpftune_cap_drop();
@@ -469,7 +617,7 @@ bool bpftuner_bpf_legacy(void)
 	if (force_bpf_legacy)
 		return true;
 
-	if (support_level == BPFTUNE_NONE)
+	if (!support_level_probed)
 		support_level = bpftune_bpf_support();
 	return support_level < BPFTUNE_NORMAL;
 }
@@ -520,920 +668,5216 @@ static void bpftuner_map_init(struct bpftuner *tuner, const char *name,
 	}
 }
 
-int __bpftuner_bpf_load(struct bpftuner *tuner, const char **optionals)
+/* Learned state (contents of tuners' persistent maps, such as
+ * correlations, and tunable state) is saved to BPFTUNE_STATE_FILE
+ * periodically and on exit, and restored on startup so that tuning
+ * resumes where it left off.  Map contents include netns cookies and
+ * boot-relative timestamps, so state is only restored for the same boot.
+ */
+#define BPFTUNE_STATE_MAGIC		"BPFTUNE"
+#define BPFTUNE_STATE_VERSION		1
+#define BPFTUNE_STATE_INTERVAL		300	/* seconds */
+#define BPFTUNE_BOOT_ID			"/proc/sys/kernel/random/boot_id"
+
+struct bpftune_state_hdr {
+	char magic[8];
+	__u32 version;
+	__u32 pad;
+	char boot_id[40];
+};
+
+enum bpftune_state_type {
+	BPFTUNE_STATE_MAP,
+	BPFTUNE_STATE_TUNABLE,
+};
+
+/* each record is followed by len bytes of data; map records contain
+ * key/value pairs, tunable records a struct bpftune_state_tunable.
+ */
+struct bpftune_state_rec {
+	__u32 type;
+	__u32 len;
+	char tuner[32];
+	char name[BPFTUNE_MAX_NAME];
+	__u32 key_size;
+	__u32 value_size;
+};
+
+struct bpftune_state_tunable {
+	long initial_values[BPFTUNE_MAX_VALUES];
+	long current_values[BPFTUNE_MAX_VALUES];
+	struct bpftunable_stats stats;
+};
+
+static char bpftune_state_file[PATH_MAX];
+static char *bpftune_state;
+static size_t bpftune_state_len;
+static unsigned long bpftune_state_last_save;
+
+static void bpftune_boot_id(char *boot_id, size_t sz)
 {
-	int err = 0;
+	FILE *fp = fopen(BPFTUNE_BOOT_ID, "r");
 
-	err = bpftune_cap_add();
+	memset(boot_id, 0, sz);
+	if (!fp)
+		return;
+	if (!fgets(boot_id, sz, fp))
+		boot_id[0] = '\0';
+	fclose(fp);
+}
 
-	if (err)
-		return err;
+int bpftune_state_init(const char *file)
+{
+	struct bpftune_state_hdr *hdr;
+	char boot_id[40];
+	struct stat st;
+	FILE *fp;
+	int ret = 0;
 
-	if (bpftuner_map_reuse("ring_buffer", tuner->ring_buffer_map,
-			       ring_buffer_map_fd, &tuner->ring_buffer_map_fd) ||
-	    bpftuner_map_reuse("netns_map", tuner->netns_map,
-			       netns_map_fd, &tuner->netns_map_fd)) {
-		err = -1;
+	if (strlen(file) >= sizeof(bpftune_state_file))
+		return -ENAMETOOLONG;
+	strncpy(bpftune_state_file, file, sizeof(bpftune_state_file) - 1);
+	bpftune_state_last_save = bpftune_now_secs();
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return errno == ENOENT ? 0 : -errno;
+	if (fstat(fileno(fp), &st) || st.st_size < (off_t)sizeof(*hdr)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	bpftune_state = malloc(st.st_size);
+	if (!bpftune_state) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (fread(bpftune_state, 1, st.st_size, fp) != (size_t)st.st_size) {
+		ret = -EIO;
+		goto out;
+	}
+	bpftune_state_len = st.st_size;
+	hdr = (struct bpftune_state_hdr *)bpftune_state;
+	bpftune_boot_id(boot_id, sizeof(boot_id));
+	if (strncmp(hdr->magic, BPFTUNE_STATE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != BPFTUNE_STATE_VERSION ||
+	    strncmp(hdr->boot_id, boot_id, sizeof(boot_id))) {
+		bpftune_log(LOG_DEBUG, "ignoring saved state in '%s'; different version or boot\n",
+			    file);
+		ret = -EINVAL;
 		goto out;
 	}
+	bpftune_log(LOG_DEBUG, "loaded saved state from '%s'\n", file);
+out:
+	fclose(fp);
+	if (ret) {
+		free(bpftune_state);
+		bpftune_state = NULL;
+		bpftune_state_len = 0;
+	}
+	return ret;
+}
 
-	if (optionals) {
-		int i;
+/* records are not necessarily aligned, so copy record header to rec */
+static void *bpftune_state_find(enum bpftune_state_type type,
+				const char *tuner, const char *name,
+				struct bpftune_state_rec *rec)
+{
+	size_t off = sizeof(struct bpftune_state_hdr);
 
-		for (i = 0; optionals[i] != NULL; i++) {
-			struct bpf_program *prog;
+	while (bpftune_state &&
+	       off + sizeof(*rec) <= bpftune_state_len) {
+		memcpy(rec, bpftune_state + off, sizeof(*rec));
+		off += sizeof(*rec);
+		if (rec->len > bpftune_state_len - off)
+			break;
+		if (rec->type == type &&
+		    !strncmp(rec->tuner, tuner, sizeof(rec->tuner)) &&
+		    !strncmp(rec->name, name, sizeof(rec->name)))
+			return bpftune_state + off;
+		off += rec->len;
+	}
+	return NULL;
+}
 
-			prog = bpf_object__find_program_by_name(tuner->obj,
-								optionals[i]);
-			if (prog) {
-				bpftune_log(LOG_DEBUG, "marking '%s' as optional\n",
-					    optionals[i]);
-				bpf_program__set_autoload(prog, false);
+/* called with caps set, after maps are created but prior to attach. */
+static void bpftuner_state_restore_maps(struct bpftuner *tuner)
+{
+	unsigned int i;
+
+	for (i = 0; tuner->persistent_maps && tuner->persistent_maps[i]; i++) {
+		const char *name = tuner->persistent_maps[i];
+		struct bpftune_state_rec rec;
+		unsigned int entries = 0;
+		struct bpf_map *map;
+		__u32 off, entry_sz;
+		char *data;
+		int fd;
+
+		map = bpf_object__find_map_by_name(tuner->obj, name);
+		data = bpftune_state_find(BPFTUNE_STATE_MAP, tuner->name, name,
+					  &rec);
+		if (!map || !data)
+			continue;
+		if (rec.key_size != bpf_map__key_size(map) ||
+		    rec.value_size != bpf_map__value_size(map)) {
+			bpftune_log(LOG_DEBUG, "saved state for map '%s' does not match; ignoring\n",
+				    name);
+			continue;
+		}
+		fd = bpf_map__fd(map);
+		entry_sz = rec.key_size + rec.value_size;
+		for (off = 0; fd >= 0 && off + entry_sz <= rec.len;
+		     off += entry_sz) {
+			if (!bpf_map_update_elem(fd, data + off,
+						 data + off + rec.key_size,
+						 BPF_ANY))
+				entries++;
+		}
+		bpftune_log(LOG_DEBUG, "restored %d entries for '%s' map '%s'\n",
+			    entries, tuner->name, name);
+	}
+}
+
+/* restore initial values and stats for tunables; only if tunable values
+ * have not changed since state was saved.
+ */
+static void bpftuner_state_restore_tunables(struct bpftuner *tuner)
+{
+	unsigned int i;
+
+	for (i = 0; i < tuner->num_tunables; i++) {
+		struct bpftunable *t = &tuner->tunables[i];
+		struct bpftune_state_tunable ts;
+		struct bpftune_state_rec rec;
+		void *data;
+
+		if (t->desc.type != BPFTUNABLE_SYSCTL)
+			continue;
+		data = bpftune_state_find(BPFTUNE_STATE_TUNABLE, tuner->name,
+					  t->desc.name, &rec);
+		if (!data || rec.len != sizeof(ts))
+			continue;
+		memcpy(&ts, data, sizeof(ts));
+		if (memcmp(ts.current_values, t->current_values,
+			   t->desc.num_values * sizeof(long)))
+			continue;
+		memcpy(t->initial_values, ts.initial_values,
+		       sizeof(t->initial_values));
+		memcpy(&t->stats, &ts.stats, sizeof(t->stats));
+		bpftune_log(LOG_DEBUG, "restored state for '%s'\n",
+			    t->desc.name);
+	}
+}
+
+static int bpftune_state_write_rec(FILE *fp, enum bpftune_state_type type,
+				   struct bpftuner *tuner, const char *name,
+				   __u32 key_size, __u32 value_size,
+				   const void *data, __u32 len)
+{
+	struct bpftune_state_rec rec = {};
+
+	rec.type = type;
+	rec.len = len;
+	strncpy(rec.tuner, tuner->name, sizeof(rec.tuner) - 1);
+	strncpy(rec.name, name, sizeof(rec.name) - 1);
+	rec.key_size = key_size;
+	rec.value_size = value_size;
+	if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+	    (len && fwrite(data, len, 1, fp) != 1))
+		return -EIO;
+	return 0;
+}
+
+/* called with caps set */
+static int bpftuner_state_save_map(FILE *fp, struct bpftuner *tuner,
+				   const char *name)
+{
+	__u32 key_size, value_size, entry_sz, len = 0, max_len = 0;
+	char *data = NULL, *key, *prev_key, *prev = NULL;
+	struct bpf_map *map;
+	int fd, ret;
+
+	map = bpf_object__find_map_by_name(tuner->obj, name);
+	if (!map)
+		return 0;
+	fd = bpf_map__fd(map);
+	if (fd < 0)
+		return 0;
+	key_size = bpf_map__key_size(map);
+	value_size = bpf_map__value_size(map);
+	entry_sz = key_size + value_size;
+
+	/* previous key is kept separately since data may move on realloc */
+	prev_key = malloc(key_size);
+	if (!prev_key)
+		return -ENOMEM;
+	for (;;) {
+		if (len + entry_sz > max_len) {
+			char *newdata;
+
+			max_len = max_len ? max_len * 2 : entry_sz * 64;
+			newdata = realloc(data, max_len);
+			if (!newdata) {
+				free(data);
+				free(prev_key);
+				return -ENOMEM;
 			}
+			data = newdata;
 		}
+		key = data + len;
+		if (bpf_map_get_next_key(fd, prev, key))
+			break;
+		memcpy(prev_key, key, key_size);
+		prev = prev_key;
+		if (bpf_map_lookup_elem(fd, key, key + key_size))
+			continue;
+		len += entry_sz;
 	}
-	err = bpf_object__load_skeleton(tuner->skeleton);
-	if (err) {
-		bpftune_log_bpf_err(err, "could not load skeleton: %s\n");
+	ret = bpftune_state_write_rec(fp, BPFTUNE_STATE_MAP, tuner, name,
+				      key_size, value_size, data, len);
+	free(prev_key);
+	free(data);
+	return ret;
+}
+
+int bpftune_state_save(void)
+{
+	struct bpftune_state_hdr hdr = {};
+	char tmpfile[PATH_MAX];
+	struct bpftuner *tuner;
+	int ret = 0;
+	FILE *fp;
+
+	if (!bpftune_state_file[0])
+		return 0;
+	ret = bpftune_cap_add();
+	if (ret)
+		return ret;
+	bpftune_state_last_save = bpftune_now_secs();
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", bpftune_state_file);
+	fp = fopen(tmpfile, "w");
+	if (!fp) {
+		ret = -errno;
+		bpftune_log(LOG_ERR, "could not save state to '%s': %s\n",
+			    tmpfile, strerror(-ret));
 		goto out;
 	}
+	memcpy(hdr.magic, BPFTUNE_STATE_MAGIC, sizeof(BPFTUNE_STATE_MAGIC));
+	hdr.version = BPFTUNE_STATE_VERSION;
+	bpftune_boot_id(hdr.boot_id, sizeof(hdr.boot_id));
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		ret = -EIO;
 
-	bpftuner_map_init(tuner, "ring_buffer_map", &tuner->ring_buffer_map,
-			  &ring_buffer_map_fd, &tuner->ring_buffer_map_fd);
-	bpftuner_map_init(tuner, "netns_map", &tuner->netns_map,
-			  &netns_map_fd, &tuner->netns_map_fd);
+	bpftune_for_each_tuner(tuner) {
+		unsigned int i;
+
+		if (ret)
+			break;
+		if (tuner->state != BPFTUNE_ACTIVE || !tuner->obj)
+			continue;
+		for (i = 0; !ret && tuner->persistent_maps &&
+			    tuner->persistent_maps[i]; i++)
+			ret = bpftuner_state_save_map(fp, tuner,
+						      tuner->persistent_maps[i]);
+		for (i = 0; !ret && i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+			struct bpftune_state_tunable ts = {};
+
+			if (t->desc.type != BPFTUNABLE_SYSCTL)
+				continue;
+			memcpy(ts.initial_values, t->initial_values,
+			       sizeof(ts.initial_values));
+			memcpy(ts.current_values, t->current_values,
+			       sizeof(ts.current_values));
+			memcpy(&ts.stats, &t->stats, sizeof(ts.stats));
+			ret = bpftune_state_write_rec(fp, BPFTUNE_STATE_TUNABLE,
+						      tuner, t->desc.name,
+						      0, 0, &ts, sizeof(ts));
+		}
+	}
+	if (fclose(fp) && !ret)
+		ret = -errno;
+	if (!ret && rename(tmpfile, bpftune_state_file))
+		ret = -errno;
+	if (ret) {
+		bpftune_log(LOG_ERR, "could not save state to '%s': %s\n",
+			    bpftune_state_file, strerror(-ret));
+		unlink(tmpfile);
+	} else {
+		bpftune_log(LOG_DEBUG, "saved state to '%s'\n",
+			    bpftune_state_file);
+	}
 out:
 	bpftune_cap_drop();
-	return err;
+	return ret;
 }
 
-int __bpftuner_bpf_attach(struct bpftuner *tuner)
+/* When pinning is enabled, tuner maps and links are pinned under
+ * BPFTUNE_PIN/<tuner>/ (shared maps directly under BPFTUNE_PIN) and are
+ * left in place on exit.  A subsequent bpftune adopts the pinned maps
+ * (including the ring buffer, so events that arrive while no bpftune is
+ * running are not lost), keeps links for programs that have not changed
+ * and replaces links for those that have.  The TCP hook dispatcher's
+ * maps and links are pinned under BPFTUNE_PIN/tcp_hook/.  Without
+ * pinning, any pinned objects left behind by a previous bpftune are
+ * removed.
+ */
+static bool bpftune_pin_enabled;
+
+static int bpftune_unpin_entry(const char *path,
+			       __attribute__((unused))const struct stat *st,
+			       int type,
+			       __attribute__((unused))struct FTW *ftw)
+{
+	if (type == FTW_DP)
+		return rmdir(path);
+	return unlink(path);
+}
+
+static void bpftune_unpin_path(const char *path)
+{
+	if (access(path, F_OK))
+		return;
+	if (nftw(path, bpftune_unpin_entry, 16, FTW_DEPTH | FTW_PHYS))
+		bpftune_log(LOG_ERR, "could not remove pinned objects in '%s': %s\n",
+			    path, strerror(errno));
+}
+
+int bpftune_pin_init(bool pin)
 {
 	int err;
 
 	err = bpftune_cap_add();
 	if (err)
 		return err;
-	err = bpf_object__attach_skeleton(tuner->skeleton);
-	if (err) {
-		bpftune_log_bpf_err(err, "could not attach skeleton: %s\n");
-	} else {
-		tuner->ring_buffer_map_fd = bpf_map__fd(tuner->ring_buffer_map);
+	if (!pin) {
+		if (!access(BPFTUNE_PIN, F_OK))
+			bpftune_log(LOG_DEBUG, "removing pinned objects in '%s'\n",
+				    BPFTUNE_PIN);
+		bpftune_unpin_path(BPFTUNE_PIN);
+		goto out;
+	}
+	if (mkdir(BPFTUNE_PIN, 0700) && errno != EEXIST) {
+		err = -errno;
+		bpftune_log(LOG_ERR, "could not create '%s': %s\n",
+			    BPFTUNE_PIN, strerror(-err));
+		goto out;
 	}
+	bpftune_pin_enabled = true;
+out:
 	bpftune_cap_drop();
 	return err;
 }
 
-static unsigned int bpftune_num_tuners;
-
-void bpftuner_bpf_fini(struct bpftuner *tuner)
+/* bpffs does not allow '.' in names, so internal maps such as
+ * "tcp_buff.bss" are pinned as "tcp_buff_bss".
+ */
+static void bpftuner_pin_path(struct bpftuner *tuner, const char *prefix,
+			      const char *name, char *path, size_t path_sz)
 {
-	if (bpftune_cap_add())
+	char *c;
+	int len;
+
+	if (tuner)
+		len = snprintf(path, path_sz, "%s/%s/%s", BPFTUNE_PIN,
+			       tuner->name, prefix);
+	else
+		len = snprintf(path, path_sz, "%s/%s", BPFTUNE_PIN, prefix);
+	if (len < 0 || (size_t)len >= path_sz)
 		return;
-	bpf_object__destroy_skeleton(tuner->skeleton);
-	free(tuner->skel);
-	if (bpftune_num_tuners == 0) {
-		if (ring_buffer_map_fd > 0)
-			close(ring_buffer_map_fd);
-		if (netns_map_fd > 0)
-			close(netns_map_fd);
-		ring_buffer_map_fd = netns_map_fd = 0;
+	snprintf(path + len, path_sz - len, "%s", name);
+	for (c = path + len; *c != '\0'; c++) {
+		if (*c == '.')
+			*c = '_';
 	}
-	bpftune_cap_drop();
 }
 
-static struct bpftuner *bpftune_tuners[BPFTUNE_MAX_TUNERS];
+/* called with caps set; returns true if existing pinned map at path
+ * can be reused for map.  Incompatible pinned maps (from a tuner whose
+ * map definitions changed) are removed.
+ */
+static bool bpftune_pinned_map_compat(struct bpf_map *map, const char *path)
+{
+	struct bpf_map_info info = {};
+	__u32 len = sizeof(info);
+	bool compat = false;
+	int fd;
 
-/* add a tuner to the list of tuners, or replace existing inactive tuner.
- * If successful, call init().
+	fd = bpf_obj_get(path);
+	if (fd < 0)
+		return false;
+	if (!bpf_obj_get_info_by_fd(fd, &info, &len))
+		compat = info.type == bpf_map__type(map) &&
+			 info.key_size == bpf_map__key_size(map) &&
+			 info.value_size == bpf_map__value_size(map) &&
+			 info.max_entries == bpf_map__max_entries(map) &&
+			 info.map_flags == bpf_map__map_flags(map);
+	close(fd);
+	if (!compat) {
+		bpftune_log(LOG_DEBUG, "pinned map '%s' is incompatible; replacing\n",
+			    path);
+		unlink(path);
+	}
+	return compat;
+}
+
+/* maps shared via the TCP hook dispatcher; see bpftune_tcp_hooks[] */
+#define BPFTUNE_TCP_HOOK_MAP_PREFIX	"tcp_hook_"
+
+/* called with caps set, prior to load.  libbpf reuses maps already
+ * pinned at the pin path, and pins newly-created maps there.  Shared
+ * maps are only pinned by the tuner that creates them; read-only
+ * internal maps (.rodata, .kconfig) are not pinned.
  */
-struct bpftuner *bpftuner_init(const char *path)
+static void bpftuner_pin_maps_prepare(struct bpftuner *tuner)
 {
-	struct bpftuner *tuner = NULL;
-	int err, retries;
+	static const char *shared_maps[] = {
+		"ring_buffer_map", "netns_map", "netns_profile_map", NULL
+	};
+	const int *shared_fds[] = {
+		&ring_buffer_map_fd, &netns_map_fd, &netns_profile_map_fd
+	};
+	char path[PATH_MAX];
+	struct bpf_map *map;
 
-	tuner = calloc(1, sizeof(*tuner));
-	if (!tuner) {
-		bpftune_log(LOG_ERR, "could not allocate tuner\n");
-		return NULL;
+	tuner->pinned = false;
+	if (!bpftune_pin_enabled)
+		return;
+	bpftuner_pin_path(tuner, "", "", path, sizeof(path));
+	if (mkdir(path, 0700) && errno != EEXIST) {
+		bpftune_log(LOG_ERR, "could not create '%s': %s\n",
+			    path, strerror(errno));
+		return;
 	}
+	bpf_object__for_each_map(map, tuner->obj) {
+		const char *name = bpf_map__name(map);
+		bool shared = false;
+		int i;
 
-	bpftune_cap_add();
-	/* if file appears via inotify we may get "file too short" errors;
-	 * retry a few times to avoid this.
-	 */
-	for (retries = 0; retries < 5; retries++) {
-		tuner->handle = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
-		if (tuner->handle)
-			break;
-		usleep(1000);
+		if (bpf_map__is_internal(map) && !strstr(name, ".bss") &&
+		    !strstr(name, ".data"))
+			continue;
+		for (i = 0; shared_maps[i] != NULL; i++) {
+			if (strcmp(name, shared_maps[i]) == 0) {
+				shared = true;
+				break;
+			}
+		}
+		if (shared && *shared_fds[i] > 0)
+			continue;
+		/* shared TCP hook maps belong to the dispatcher */
+		if (strncmp(name, BPFTUNE_TCP_HOOK_MAP_PREFIX,
+			    strlen(BPFTUNE_TCP_HOOK_MAP_PREFIX)) == 0)
+			continue;
+		bpftuner_pin_path(shared ? NULL : tuner, "", name, path,
+				  sizeof(path));
+		if (bpftune_pinned_map_compat(map, path) && !shared)
+			tuner->pinned = true;
+		if (bpf_map__set_pin_path(map, path))
+			bpftune_log(LOG_DEBUG, "could not set pin path '%s'\n",
+				    path);
 	}
-	bpftune_cap_drop();
-	if (!tuner->handle) {
-		bpftune_log(LOG_ERR,
-			    "could not dlopen '%s' after %d retries: %s\n",
-			    path, retries, dlerror());
-		free(tuner);
-		return NULL;
-	}
-	/* If we have a ringbuf fd from any tuner, use its fd to be re-used
- 	 * for other ringbuf maps (so we can use the same ring buffer for all
- 	 * BPF events.
- 	 */
-	tuner->ring_buffer_map_fd = ring_buffer_map_fd;
-	tuner->init = dlsym(tuner->handle, "init");
-	tuner->fini = dlsym(tuner->handle, "fini");
-	tuner->event_handler = dlsym(tuner->handle, "event_handler");
-	if (!tuner->init || !tuner->fini || !tuner->event_handler) {	
-		bpftune_log(LOG_ERR, "missing definitions in '%s': need 'init', 'fini' and 'event_handler'\n",
-			    path);
-		dlclose(tuner->handle);
-		free(tuner);
-		return NULL;
-	}
-	bpftune_log(LOG_DEBUG, "calling init for '%s\n", path);
-	err = tuner->init(tuner);
-	if (err) {
-		dlclose(tuner->handle);
-		bpftune_log(LOG_ERR, "error initializing '%s: %s\n",
-			    path, strerror(-err));
-		free(tuner);
-		return NULL;
+}
+
+/* called with caps set; is program "prog_id" (attached by a previous
+ * bpftune) the same as the one we have just loaded?  Program tags are a
+ * hash of program instructions, so match if the program is unchanged.
+ */
+static bool bpftune_prog_unchanged(__u32 prog_id, struct bpf_program *prog)
+{
+	struct bpf_prog_info oinfo = {}, ninfo = {};
+	bool unchanged = false;
+	__u32 len;
+	int fd;
+
+	fd = bpf_prog_get_fd_by_id(prog_id);
+	if (fd < 0)
+		return false;
+	len = sizeof(oinfo);
+	if (!bpf_obj_get_info_by_fd(fd, &oinfo, &len)) {
+		len = sizeof(ninfo);
+		if (!bpf_obj_get_info_by_fd(bpf_program__fd(prog), &ninfo,
+					    &len))
+			unchanged = oinfo.type == ninfo.type &&
+				    memcmp(oinfo.tag, ninfo.tag,
+					   sizeof(oinfo.tag)) == 0;
 	}
-	tuner->id = bpftune_num_tuners;
-	tuner->state = BPFTUNE_ACTIVE;
-	bpftune_tuners[bpftune_num_tuners++] = tuner;
-	bpftune_log(LOG_DEBUG, "sucessfully initialized tuner %s[%d]\n",
-		    tuner->name, tuner->id);
-	return tuner;
+	close(fd);
+	return unchanged;
 }
 
-static void bpftuner_scenario_log(struct bpftuner *tuner, unsigned int tunable,
-				  unsigned int scenario, int netns_fd,
-				  bool summary,
-				  const char *fmt, va_list args);
+/* called with caps set; has a previously-pinned link got the same program
+ * as the one we have just loaded?
+ */
+static bool bpftune_link_prog_unchanged(struct bpf_link *link,
+					struct bpf_program *prog)
+{
+	struct bpf_link_info linfo = {};
+	__u32 len = sizeof(linfo);
 
-static unsigned long global_netns_cookie;
+	if (bpf_obj_get_info_by_fd(bpf_link__fd(link), &linfo, &len))
+		return false;
+	return bpftune_prog_unchanged(linfo.prog_id, prog);
+}
 
-void bpftuner_fini(struct bpftuner *tuner, enum bpftune_state state)
+struct bpftuner_pinned_link {
+	struct bpf_link *link;
+	bool adopted;
+};
+
+/* called with caps set, prior to attach.  Links for unchanged programs
+ * are adopted into the skeleton so libbpf does not attach them again;
+ * links for changed programs are kept attached until their replacement
+ * is attached.
+ */
+static void bpftuner_pin_links_adopt(struct bpftuner *tuner,
+				     struct bpftuner_pinned_link *pinned)
 {
-	unsigned int i, j;
+	struct bpf_object_skeleton *s = tuner->skeleton;
+	char path[PATH_MAX];
+	int i;
 
-	if (!tuner || tuner->state != BPFTUNE_ACTIVE)
-		return;
+	for (i = 0; i < s->prog_cnt; i++) {
+		struct bpf_program *prog = *s->progs[i].prog;
+		struct bpf_link *link;
 
-	bpftune_log(LOG_DEBUG, "cleaning up tuner %s with %d tunables, %d scenarios\n",
-		    tuner->name, tuner->num_tunables, tuner->num_scenarios);
-	/* report summary of events for tuner */
-	for (i = 0; i < tuner->num_tunables; i++) {
-		for (j = 0; j < tuner->num_scenarios; j++) {
-			va_list args;
-			bpftune_log(LOG_DEBUG, "checking scenarios for tuner %d, scenario %d\n",
-				    i, j);
-			bpftuner_scenario_log(tuner, i, j, 0, true, NULL, args);
-			bpftuner_scenario_log(tuner, i, j, 1, true, NULL, args);
+		bpftuner_pin_path(tuner, "link_", s->progs[i].name, path,
+				  sizeof(path));
+		if (access(path, F_OK))
+			continue;
+		if (!bpf_program__autoload(prog)) {
+			unlink(path);
+			continue;
 		}
+		link = bpf_link__open(path);
+		if (!link || libbpf_get_error(link))
+			continue;
+		if (bpftune_link_prog_unchanged(link, prog)) {
+			bpftune_log(LOG_DEBUG, "%s: adopting pinned link for unchanged program '%s'\n",
+				    tuner->name, s->progs[i].name);
+			*s->progs[i].link = link;
+			pinned[i].adopted = true;
+		} else {
+			bpftune_log(LOG_DEBUG, "%s: program '%s' changed, replacing pinned link\n",
+				    tuner->name, s->progs[i].name);
+		}
+		pinned[i].link = link;
 	}
-	if (tuner->fini)
-		tuner->fini(tuner);
-
-	tuner->state = state;
 }
 
-struct bpftuner *bpftune_tuner(unsigned int index)
+/* called with caps set, after attach; replace links for changed programs
+ * and pin new links.  On attach failure, previously-pinned links are left
+ * in place.
+ */
+static void bpftuner_pin_links(struct bpftuner *tuner,
+			       struct bpftuner_pinned_link *pinned,
+			       bool attached)
 {
-	if (index < bpftune_num_tuners)
-		return bpftune_tuners[index];
-	return NULL;
+	struct bpf_object_skeleton *s = tuner->skeleton;
+	char path[PATH_MAX];
+	int i, err;
+
+	for (i = 0; i < s->prog_cnt; i++) {
+		struct bpf_link *link = *s->progs[i].link;
+
+		if (pinned[i].adopted)
+			continue;
+		if (pinned[i].link) {
+			if (attached)
+				bpf_link__unpin(pinned[i].link);
+			bpf_link__destroy(pinned[i].link);
+		}
+		if (!attached || !link)
+			continue;
+		bpftuner_pin_path(tuner, "link_", s->progs[i].name, path,
+				  sizeof(path));
+		/* not all links can be pinned; for example kprobe links in
+		 * legacy mode are not.
+		 */
+		err = bpf_link__pin(link, path);
+		if (err)
+			bpftune_log(LOG_DEBUG, "%s: could not pin link for '%s': %s\n",
+				    tuner->name, s->progs[i].name, strerror(-err));
+	}
 }
 
-unsigned int bpftune_tuner_num(void)
+static void bpftuner_unpin(struct bpftuner *tuner)
 {
-	return bpftune_num_tuners;
+	char path[PATH_MAX];
+
+	if (!bpftune_pin_enabled || bpftune_cap_add())
+		return;
+	bpftuner_pin_path(tuner, "", "", path, sizeof(path));
+	bpftune_unpin_path(path);
+	bpftune_cap_drop();
 }
 
-void bpftune_set_learning_rate(unsigned short rate)
+/* Shared TCP hooks (see include/bpftune/tcp_hook.bpf.h).  A dispatcher
+ * program per hooked function is attached while any tuner has a
+ * BPF_TCP_HOOK() program registered in the prog array for that function.
+ * Order must match enum bpftune_tcp_hook_id.
+ */
+static const char *bpftune_tcp_hooks[] = {
+	"tcp_set_state",
+	"tcp_init_sock",
+	"tcp_release_cb",
+	"tcp_sndbuf_expand",
+	"tcp_rcv_space_adjust",
+};
+
+/* Slots hold the tuner whose program is registered there.  With pinning,
+ * prog arrays and dispatcher links are adopted from a previous bpftune;
+ * slots it registered are "stale" until a tuner with the same program
+ * takes them over, or are cleared once all tuners are initialized (see
+ * bpftune_tcp_hooks_purge()).
+ */
+static struct bpftune_tcp_hook {
+	struct bpf_link *link;
+	struct bpftuner *slots[BPFTUNE_MAX_TUNERS];
+	bool stale[BPFTUNE_MAX_TUNERS];
+	unsigned int nr;
+} bpftune_tcp_hook[ARRAY_SIZE(bpftune_tcp_hooks)];
+
+static struct tcp_hook_bpf *tcp_hook_bpf;
+static pthread_mutex_t tcp_hook_lock = PTHREAD_MUTEX_INITIALIZER;
+/* hook programs time themselves if BPF run-time stats are enabled */
+static bool bpftune_tcp_hook_timed;
+/* run time of hook programs since unregistered, for all tuners */
+static struct bpftune_tcp_hook_time bpftune_tcp_hook_time_gone;
+
+#define BPFTUNE_TCP_HOOK_PIN		"tcp_hook/"
+
+static struct bpf_map *bpftune_tcp_hook_map(int id)
 {
-	bpftune_learning_rate = rate;
+	char name[BPFTUNE_MAX_NAME];
+
+	snprintf(name, sizeof(name), BPFTUNE_TCP_HOOK_MAP_PREFIX "%s",
+		 bpftune_tcp_hooks[id]);
+	return bpf_object__find_map_by_name(tcp_hook_bpf->obj, name);
 }
 
-static int bpftune_ringbuf_event_read(void *ctx, void *data, size_t size)
+static unsigned int bpftune_tcp_hook_max(int id)
 {
-	struct bpftune_event *event = data;
-	struct bpftuner *tuner;
+	struct bpf_map *map = bpftune_tcp_hook_map(id);
+	unsigned int max = map ? bpf_map__max_entries(map) : 0;
 
-	if (size < sizeof(*event)) {
-		bpftune_log(LOG_ERR, "unexpected size event %d\n", size);
-		return 0;
+	return max > BPFTUNE_MAX_TUNERS ? BPFTUNE_MAX_TUNERS : max;
+}
+
+/* called with caps set and tcp_hook_lock held; add run time of the program
+ * in slot (summed across CPUs) to "time" if set, and reset it.
+ */
+static void bpftune_tcp_hook_slot_time(int id, unsigned int slot,
+				       struct bpftune_tcp_hook_time *time,
+				       bool reset)
+{
+	struct bpf_map *map, *pmap = bpftune_tcp_hook_map(id);
+	struct bpftune_tcp_hook_time *t;
+	int i, ncpus;
+	__u32 key;
+
+	map = bpf_object__find_map_by_name(tcp_hook_bpf->obj,
+					   "tcp_hook_time_map");
+	ncpus = libbpf_num_possible_cpus();
+	if (!map || !pmap || ncpus <= 0)
+		return;
+	key = id * bpf_map__max_entries(pmap) + slot;
+	t = calloc(ncpus, sizeof(*t));
+	if (!t)
+		return;
+	if (time && !bpf_map_lookup_elem(bpf_map__fd(map), &key, t)) {
+		for (i = 0; i < ncpus; i++) {
+			time->run_time_ns += t[i].run_time_ns;
+			time->run_cnt += t[i].run_cnt;
+		}
 	}
-	if (event->tuner_id > BPFTUNE_MAX_TUNERS) {
-		bpftune_log(LOG_ERR, "invalid tuner id %d\n", event->tuner_id);
-		return 0;
+	if (reset) {
+		memset(t, 0, ncpus * sizeof(*t));
+		bpf_map_update_elem(bpf_map__fd(map), &key, t, BPF_ANY);
 	}
-	tuner = bpftune_tuner(event->tuner_id);
-	if (!tuner) {
-		bpftune_log(LOG_ERR, "no tuner for id %d\n", event->tuner_id);
-		return 0;
+	free(t);
+}
+
+/* called with caps set and tcp_hook_lock held; slot no longer holds
+ * tuner's program, so keep its run time in the tuner's (and the global)
+ * total of unregistered hook run time.
+ */
+static void bpftune_tcp_hook_slot_retire(int id, unsigned int slot,
+					 struct bpftuner *tuner)
+{
+	struct bpftune_tcp_hook_time time = {};
+
+	bpftune_tcp_hook_slot_time(id, slot, &time, true);
+	if (tuner) {
+		tuner->tcp_hook_time.run_time_ns += time.run_time_ns;
+		tuner->tcp_hook_time.run_cnt += time.run_cnt;
 	}
-	bpftune_log(LOG_DEBUG,
-		    "event scenario [%d] for tuner %s[%d] netns %ld (%s)\n",
-		    event->scenario_id, tuner->name, tuner->id,
-		    event->netns_cookie,
-		    event->netns_cookie && event->netns_cookie != global_netns_cookie ?
-		    "non-global netns" : "global netns");
-	tuner->event_handler(tuner, event, ctx);
+	bpftune_tcp_hook_time_gone.run_time_ns += time.run_time_ns;
+	bpftune_tcp_hook_time_gone.run_cnt += time.run_cnt;
+}
 
-	return 0;
+/* Run time of hook programs: those registered by tuner (all tuners if
+ * NULL) for hook id (all hooks if < 0), including programs since
+ * unregistered when id < 0.  The dispatcher is charged by the kernel for
+ * the programs it tail-calls, so this is used to attribute run time to
+ * the tuners that registered them.
+ */
+static void bpftune_tcp_hooks_run_time(struct bpftuner *tuner, int hook_id,
+				       __u64 *run_time_ns, __u64 *run_cnt)
+{
+	struct bpftune_tcp_hook_time time = {};
+	unsigned int id, slot;
+
+	if (hook_id < 0)
+		time = tuner ? tuner->tcp_hook_time : bpftune_tcp_hook_time_gone;
+	pthread_mutex_lock(&tcp_hook_lock);
+	for (id = 0; tcp_hook_bpf && id < ARRAY_SIZE(bpftune_tcp_hooks); id++) {
+		struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+
+		if (hook_id >= 0 && id != (unsigned int)hook_id)
+			continue;
+		for (slot = 0; slot < hook->nr; slot++) {
+			if ((tuner && hook->slots[slot] != tuner) ||
+			    (!tuner && !hook->slots[slot] && !hook->stale[slot]))
+				continue;
+			bpftune_tcp_hook_slot_time(id, slot, &time, false);
+		}
+	}
+	pthread_mutex_unlock(&tcp_hook_lock);
+	*run_time_ns += time.run_time_ns;
+	*run_cnt += time.run_cnt;
 }
 
-int bpftuner_ring_buffer_map_fd(struct bpftuner *tuner)
+/* called with tcp_hook_lock held; number of slots the dispatcher visits */
+static void bpftune_tcp_hook_nr_update(int id)
 {
-	return tuner->ring_buffer_map_fd;
+	struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+
+	while (hook->nr > 0 && !hook->slots[hook->nr - 1] &&
+	       !hook->stale[hook->nr - 1])
+		hook->nr--;
+	tcp_hook_bpf->bss->tcp_hook_nr[id] = hook->nr;
 }
 
-void *bpftune_ring_buffer_init(int ring_buffer_map_fd, void *ctx)
+/* called with caps set and tcp_hook_lock held; detach the dispatcher
+ * for the hook, removing its pinned link.
+ */
+static void bpftune_tcp_hook_link_destroy(int id)
 {
-	struct ring_buffer *rb;
+	struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+
+	if (!hook->link)
+		return;
+	if (bpftune_pin_enabled)
+		bpf_link__unpin(hook->link);
+	bpf_link__destroy(hook->link);
+	hook->link = NULL;
+}
+
+/* called with caps set and tcp_hook_lock held; attach the dispatcher for
+ * the hook, replacing "old" (a pinned link for a changed dispatcher) if
+ * set, and pin it.
+ */
+static int bpftune_tcp_hook_link_attach(int id, struct bpf_link *old)
+{
+	struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+	char name[BPFTUNE_MAX_NAME], path[PATH_MAX];
+	struct bpf_program *dprog;
+	struct bpf_link *link;
 	int err;
 
-	bpftune_log(LOG_DEBUG, "calling ring_buffer__new, ringbuf_map_fd %d\n",
-		    ring_buffer_map_fd);
-	err = bpftune_cap_add();
-	if (err)
-		return NULL;
-	rb = ring_buffer__new(ring_buffer_map_fd, bpftune_ringbuf_event_read, ctx, NULL);
-	err = libbpf_get_error(rb);
+	snprintf(name, sizeof(name), "entry__%s", bpftune_tcp_hooks[id]);
+	dprog = bpf_object__find_program_by_name(tcp_hook_bpf->obj, name);
+	link = dprog ? bpf_program__attach(dprog) : NULL;
+	err = link ? libbpf_get_error(link) : -ENOENT;
 	if (err) {
-		bpftune_log_bpf_err(err, "couldnt create ring buffer: %s\n");
-		rb = NULL;
+		bpftune_log(LOG_ERR, "could not attach tcp hook dispatcher '%s': %s\n",
+			    name, strerror(-err));
+		return err;
 	}
-	bpftune_cap_drop();
-	return rb;
+	if (old) {
+		bpf_link__unpin(old);
+		bpf_link__destroy(old);
+	}
+	hook->link = link;
+	if (!bpftune_pin_enabled)
+		return 0;
+	bpftuner_pin_path(NULL, BPFTUNE_TCP_HOOK_PIN "link_", name, path,
+			  sizeof(path));
+	err = bpf_link__pin(link, path);
+	if (err)
+		bpftune_log(LOG_DEBUG, "could not pin tcp hook dispatcher '%s': %s\n",
+			    name, strerror(-err));
+	return 0;
 }
 
-static int ring_buffer_done;
+/* called with caps set and tcp_hook_lock held, after dispatcher load
+ * with pinning; pick up slots and dispatcher links registered by a
+ * previous bpftune, so hooks keep running until tuners take over.
+ */
+static void bpftune_tcp_hooks_adopt(void)
+{
+	char name[BPFTUNE_MAX_NAME], path[PATH_MAX];
+	unsigned int id, slot;
+
+	for (id = 0; id < ARRAY_SIZE(bpftune_tcp_hooks); id++) {
+		struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+		struct bpf_map *map = bpftune_tcp_hook_map(id);
+		struct bpf_program *dprog;
+		struct bpf_link *link;
+		__u32 prog_id;
+
+		for (slot = 0; map && slot < bpftune_tcp_hook_max(id); slot++) {
+			if (bpf_map_lookup_elem(bpf_map__fd(map), &slot,
+						&prog_id))
+				continue;
+			hook->stale[slot] = true;
+			hook->nr = slot + 1;
+		}
+		/* run time is counted afresh, as for the dispatcher */
+		for (slot = 0; map && slot < bpf_map__max_entries(map); slot++)
+			bpftune_tcp_hook_slot_time(id, slot, NULL, true);
+		bpftune_tcp_hook_nr_update(id);
+
+		snprintf(name, sizeof(name), "entry__%s", bpftune_tcp_hooks[id]);
+		bpftuner_pin_path(NULL, BPFTUNE_TCP_HOOK_PIN "link_", name,
+				  path, sizeof(path));
+		if (access(path, F_OK))
+			continue;
+		link = bpf_link__open(path);
+		if (!link || libbpf_get_error(link))
+			continue;
+		dprog = bpf_object__find_program_by_name(tcp_hook_bpf->obj,
+							 name);
+		if (hook->nr && dprog && bpftune_link_prog_unchanged(link, dprog)) {
+			bpftune_log(LOG_DEBUG, "adopting pinned tcp hook dispatcher '%s' (%u slots)\n",
+				    name, hook->nr);
+			hook->link = link;
+		} else if (!hook->nr ||
+			   bpftune_tcp_hook_link_attach(id, link)) {
+			bpf_link__unpin(link);
+			bpf_link__destroy(link);
+		}
+	}
+}
 
-int bpftune_ring_buffer_poll(void *ring_buffer, int interval)
+/* called with caps set and tcp_hook_lock held; load the dispatcher.
+ * Nothing is attached until a tuner registers a hook program, unless
+ * dispatcher state is adopted from BPFTUNE_PIN.
+ */
+static int bpftune_tcp_hook_dispatcher_load(void)
 {
-	struct ring_buffer *rb = ring_buffer;
+	char path[PATH_MAX];
+	struct bpf_map *map;
 	int err;
 
-	while (!ring_buffer_done) {
-		err = ring_buffer__poll(rb, interval);
-		if (err < 0) {
-			bpftune_log_bpf_err(err, "ring_buffer__poll: %s\n");
-			break;
+	if (tcp_hook_bpf)
+		return 0;
+	tcp_hook_bpf = tcp_hook_bpf__open();
+	err = libbpf_get_error(tcp_hook_bpf);
+	if (err) {
+		tcp_hook_bpf = NULL;
+		bpftune_log_bpf_err(err, "could not open tcp hook dispatcher: %s\n");
+		return err;
+	}
+	if (bpftune_pin_enabled) {
+		bpftuner_pin_path(NULL, BPFTUNE_TCP_HOOK_PIN, "", path,
+				  sizeof(path));
+		if (mkdir(path, 0700) && errno != EEXIST)
+			bpftune_log(LOG_ERR, "could not create '%s': %s\n",
+				    path, strerror(errno));
+	}
+	bpf_object__for_each_map(map, tcp_hook_bpf->obj) {
+		const char *name = bpf_map__name(map);
+		bool internal = bpf_map__is_internal(map);
+
+		/* the dispatcher only needs the hook maps */
+		if (!internal &&
+		    strncmp(name, BPFTUNE_TCP_HOOK_MAP_PREFIX,
+			    strlen(BPFTUNE_TCP_HOOK_MAP_PREFIX)) != 0) {
+			bpf_map__set_autocreate(map, false);
+			continue;
 		}
+		/* hook maps and slot counts outlive bpftune with pinning */
+		if (!bpftune_pin_enabled ||
+		    (internal && !strstr(name, ".bss")))
+			continue;
+		bpftuner_pin_path(NULL, BPFTUNE_TCP_HOOK_PIN, name, path,
+				  sizeof(path));
+		bpftune_pinned_map_compat(map, path);
+		if (bpf_map__set_pin_path(map, path))
+			bpftune_log(LOG_DEBUG, "could not set pin path '%s'\n",
+				    path);
 	}
-	ring_buffer__free(rb);
+	err = tcp_hook_bpf__load(tcp_hook_bpf);
+	if (err) {
+		bpftune_log_bpf_err(err, "could not load tcp hook dispatcher: %s\n");
+		tcp_hook_bpf__destroy(tcp_hook_bpf);
+		tcp_hook_bpf = NULL;
+		return err;
+	}
+	bpftune_log(LOG_DEBUG, "loaded tcp hook dispatcher\n");
+	/* .bss may be an adopted pinned map, so (re)set variables */
+	tcp_hook_bpf->bss->tcp_hook_timed = bpftune_tcp_hook_timed;
+	if (bpftune_pin_enabled)
+		bpftune_tcp_hooks_adopt();
 	return 0;
 }
 
-void bpftune_ring_buffer_fini(__attribute__((unused)) void *ring_buffer)
-{
-	ring_buffer_done = true;
-}
-
-
-#define BPFTUNE_PROC_SYS	"/proc/sys/"
-void bpftune_sysctl_name_to_path(const char *name, char *path, size_t path_sz)
+/* return hook id for a BPF_TCP_HOOK() program, or -1 if it is not one. */
+static int bpftuner_tcp_hook_id(struct bpftuner *tuner,
+				struct bpf_program *prog)
 {
-	size_t i;
+	const char *name = bpf_program__name(prog);
+	unsigned int i;
 
-	snprintf(path, path_sz, BPFTUNE_PROC_SYS "%s", name);
-	for (i = 0; i < path_sz && path[i] != 0; i++)
-		if (path[i] == '.')
-			path[i] = '/';
+	if (tuner->bpf_legacy || strncmp(name, "hook__", 6) != 0)
+		return -1;
+	name += 6;
+	for (i = 0; i < ARRAY_SIZE(bpftune_tcp_hooks); i++) {
+		if (strcmp(name, bpftune_tcp_hooks[i]) == 0)
+			return i;
+	}
+	return -1;
 }
 
-int bpftune_sysctl_read(int netns_fd, const char *name, long *values)
+/* called with caps set, prior to load.  Use the dispatcher's hook maps,
+ * and do not attach hook programs; they are registered after load.
+ */
+static int bpftuner_tcp_hooks_prepare(struct bpftuner *tuner)
 {
-	int i, orig_netns_fd = 0, num_values = 0;
-	char path[PATH_MAX];
-	int err = 0;	
-	FILE *fp;
+	struct bpf_program *prog;
+	struct bpf_map *map;
+	int err;
 
-	err = bpftune_cap_add();
+	if (!bpf_object__find_map_by_name(tuner->obj, "tcp_hook_ctx_map"))
+		return 0;
+	pthread_mutex_lock(&tcp_hook_lock);
+	err = bpftune_tcp_hook_dispatcher_load();
+	pthread_mutex_unlock(&tcp_hook_lock);
 	if (err)
 		return err;
+	bpf_object__for_each_map(map, tuner->obj) {
+		const char *name = bpf_map__name(map);
+		struct bpf_map *dmap;
 
-	bpftune_sysctl_name_to_path(name, path, sizeof(path));
+		if (strncmp(name, BPFTUNE_TCP_HOOK_MAP_PREFIX,
+			    strlen(BPFTUNE_TCP_HOOK_MAP_PREFIX)) != 0)
+			continue;
+		dmap = bpf_object__find_map_by_name(tcp_hook_bpf->obj, name);
+		err = dmap ? bpf_map__reuse_fd(map, bpf_map__fd(dmap)) : -ENOENT;
+		if (err) {
+			bpftune_log(LOG_ERR, "%s: could not reuse tcp hook map '%s': %s\n",
+				    tuner->name, name, strerror(-err));
+			return err;
+		}
+	}
+	bpf_object__for_each_program(prog, tuner->obj) {
+		if (bpftuner_tcp_hook_id(tuner, prog) >= 0)
+			bpf_program__set_autoattach(prog, false);
+	}
+	return 0;
+}
 
-	err = bpftune_netns_set(netns_fd, &orig_netns_fd);
-	if (err < 0)
-		goto out_unset;
+/* called with tcp_hook_lock held; choose a slot for prog.  A stale slot
+ * holding the same program (registered by this tuner in a previous
+ * bpftune) is taken over, otherwise the first free slot is used.
+ */
+static int bpftune_tcp_hook_slot(int id, struct bpf_map *map,
+				 struct bpf_program *prog)
+{
+	struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+	unsigned int slot, max = bpftune_tcp_hook_max(id);
+	__u32 prog_id;
+
+	for (slot = 0; slot < hook->nr; slot++) {
+		if (hook->stale[slot] &&
+		    !bpf_map_lookup_elem(bpf_map__fd(map), &slot, &prog_id) &&
+		    bpftune_prog_unchanged(prog_id, prog))
+			return slot;
+	}
+	for (slot = 0; slot < max; slot++) {
+		if (!hook->slots[slot] && !hook->stale[slot])
+			return slot;
+	}
+	return -ENOSPC;
+}
 
-	fp = fopen(path, "r");
-	if (!fp) {
+/* called with caps set; add program to the hook's prog array, attaching
+ * the dispatcher if this is the first program registered for it.
+ */
+static int bpftuner_tcp_hook_add(struct bpftuner *tuner,
+				 struct bpf_program *prog)
+{
+	int id = bpftuner_tcp_hook_id(tuner, prog);
+	int fd = bpf_program__fd(prog);
+	struct bpftune_tcp_hook *hook;
+	struct bpf_map *map;
+	unsigned int slot;
+	int err = 0;
+
+	if (id < 0 || !tcp_hook_bpf)
+		return -EINVAL;
+	pthread_mutex_lock(&tcp_hook_lock);
+	hook = &bpftune_tcp_hook[id];
+	map = bpftune_tcp_hook_map(id);
+	for (slot = 0; slot < hook->nr; slot++) {
+		if (hook->slots[slot] == tuner)
+			goto out;
+	}
+	err = map ? bpftune_tcp_hook_slot(id, map, prog) : -ENOENT;
+	if (err < 0) {
+		bpftune_log(LOG_ERR, "%s: no free tcp hook slots for '%s'\n",
+			    tuner->name, bpftune_tcp_hooks[id]);
+		goto out;
+	}
+	slot = err;
+	err = 0;
+	if (bpf_map_update_elem(bpf_map__fd(map), &slot, &fd, BPF_ANY)) {
 		err = -errno;
-		bpftune_log(LOG_ERR, "could not open %s (netns fd %d) for reading: %s\n",
-			    path, netns_fd, strerror(-err));
+		bpftune_log(LOG_ERR, "%s: could not register tcp hook '%s': %s\n",
+			    tuner->name, bpftune_tcp_hooks[id], strerror(-err));
 		goto out;
 	}
-	num_values = fscanf(fp, "%ld %ld %ld",
-			    &values[0], &values[1], &values[2]);
-	if (num_values == 0)
-		err = -ENOENT;
-	else if (num_values < 0)
-		err = -errno;
-	fclose(fp);
+	if (!hook->link) {
+		err = bpftune_tcp_hook_link_attach(id, NULL);
+		if (err) {
+			if (!hook->stale[slot])
+				bpf_map_delete_elem(bpf_map__fd(map), &slot);
+			goto out;
+		}
+	}
+	bpftune_log(LOG_DEBUG, "%s: %s tcp hook '%s' in slot %u\n",
+		    tuner->name, hook->stale[slot] ? "took over" : "registered",
+		    bpftune_tcp_hooks[id], slot);
+	if (hook->stale[slot])
+		bpftune_tcp_hook_slot_retire(id, slot, NULL);
+	hook->slots[slot] = tuner;
+	hook->stale[slot] = false;
+	if (slot >= hook->nr)
+		hook->nr = slot + 1;
+	bpftune_tcp_hook_nr_update(id);
+out:
+	pthread_mutex_unlock(&tcp_hook_lock);
+	return err;
+}
 
-	if (err) {
-		bpftune_log(LOG_ERR, "could not read from %s: %s\n", path,
-			    strerror(-err));
-		goto out;
+/* called with caps set; remove tuner's program for the hook, detaching
+ * the dispatcher if no programs remain.
+ */
+static void bpftuner_tcp_hook_del(struct bpftuner *tuner, int id)
+{
+	struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+	struct bpf_map *map;
+	unsigned int slot;
+
+	pthread_mutex_lock(&tcp_hook_lock);
+	for (slot = 0; slot < hook->nr; slot++) {
+		if (hook->slots[slot] == tuner)
+			break;
 	}
+	if (slot == hook->nr || !tcp_hook_bpf)
+		goto out;
+	map = bpftune_tcp_hook_map(id);
+	if (map)
+		bpf_map_delete_elem(bpf_map__fd(map), &slot);
+	bpftune_tcp_hook_slot_retire(id, slot, tuner);
+	hook->slots[slot] = NULL;
+	bpftune_tcp_hook_nr_update(id);
+	if (hook->nr == 0)
+		bpftune_tcp_hook_link_destroy(id);
+	bpftune_log(LOG_DEBUG, "%s: unregistered tcp hook '%s'\n",
+		    tuner->name, bpftune_tcp_hooks[id]);
+out:
+	pthread_mutex_unlock(&tcp_hook_lock);
+}
 
-	for (i = 0; i < num_values; i++) {
-		bpftune_log(LOG_DEBUG, "Read %s[%d] = %ld\n",
-			    name, i, values[i]);
+static bool bpftuner_tcp_hook_registered(struct bpftuner *tuner, int id)
+{
+	struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+	bool registered = false;
+	unsigned int slot;
+
+	pthread_mutex_lock(&tcp_hook_lock);
+	for (slot = 0; slot < hook->nr && !registered; slot++)
+		registered = hook->slots[slot] == tuner;
+	pthread_mutex_unlock(&tcp_hook_lock);
+	return registered;
+}
+
+static void bpftuner_tcp_hooks_unregister(struct bpftuner *tuner)
+{
+	unsigned int id;
+
+	for (id = 0; id < ARRAY_SIZE(bpftune_tcp_hooks); id++)
+		bpftuner_tcp_hook_del(tuner, id);
+}
+
+/* on exit with pinning, leave the tuner's programs in the (pinned) prog
+ * arrays so they keep running until the next bpftune takes them over.
+ */
+static void bpftuner_tcp_hooks_keep(struct bpftuner *tuner)
+{
+	unsigned int id, slot;
+
+	pthread_mutex_lock(&tcp_hook_lock);
+	for (id = 0; id < ARRAY_SIZE(bpftune_tcp_hooks); id++) {
+		struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+
+		for (slot = 0; slot < hook->nr; slot++) {
+			if (hook->slots[slot] != tuner)
+				continue;
+			hook->slots[slot] = NULL;
+			hook->stale[slot] = true;
+		}
 	}
+	pthread_mutex_unlock(&tcp_hook_lock);
+}
 
-out:
-	bpftune_netns_set(orig_netns_fd, NULL);
-out_unset:
+/* called once tuners are initialized; remove programs registered by a
+ * previous bpftune that no tuner has taken over (tuners that are now
+ * disabled, legacy or changed), detaching dispatchers left with nothing
+ * to run.
+ */
+static void bpftune_tcp_hooks_purge(void)
+{
+	unsigned int id, slot;
+
+	if (bpftune_cap_add())
+		return;
+	pthread_mutex_lock(&tcp_hook_lock);
+	for (id = 0; tcp_hook_bpf && id < ARRAY_SIZE(bpftune_tcp_hooks); id++) {
+		struct bpftune_tcp_hook *hook = &bpftune_tcp_hook[id];
+		struct bpf_map *map = bpftune_tcp_hook_map(id);
+
+		for (slot = 0; slot < hook->nr; slot++) {
+			if (!hook->stale[slot])
+				continue;
+			bpftune_log(LOG_DEBUG, "removing stale tcp hook '%s' slot %u\n",
+				    bpftune_tcp_hooks[id], slot);
+			if (map)
+				bpf_map_delete_elem(bpf_map__fd(map), &slot);
+			bpftune_tcp_hook_slot_retire(id, slot, NULL);
+			hook->stale[slot] = false;
+		}
+		bpftune_tcp_hook_nr_update(id);
+		if (hook->nr == 0)
+			bpftune_tcp_hook_link_destroy(id);
+	}
+	pthread_mutex_unlock(&tcp_hook_lock);
 	bpftune_cap_drop();
-	return err ? err : num_values;
 }
 
-int bpftune_sysctl_write(int netns_fd, const char *name, __u8 num_values, long *values)
+/* Iterators are not loaded if unsupported; tuners must cope with their
+ * absence.  Other program types have no fallback within the skeleton; if
+ * a program needs an attach type that is not available (tp_btf say), the
+ * normal skeleton is not loaded, and the tuner is retried using its legacy
+ * skeleton (see __bpftuner_init()).  Other tuners are unaffected.
+ */
+static int bpftuner_attach_types_prepare(struct bpftuner *tuner)
 {
-	long old_values[BPFTUNE_MAX_VALUES] = {};
-	int i, err = 0, orig_netns_fd = 0;
-	int old_num_values;
-	char path[PATH_MAX];
-	FILE *fp;
+	static const struct {
+		const char *prefix;
+		unsigned int type;
+	} sec_types[] = {
+		{ "fentry/",	BPFTUNE_ATTACH_FENTRY },
+		{ "fexit/",	BPFTUNE_ATTACH_FENTRY },
+		{ "tp_btf/",	BPFTUNE_ATTACH_TP_BTF },
+		{ "raw_tp/",	BPFTUNE_ATTACH_RAW_TP },
+		{ "raw_tracepoint/", BPFTUNE_ATTACH_RAW_TP },
+		{ "kprobe/",	BPFTUNE_ATTACH_KPROBE },
+		{ "kretprobe/",	BPFTUNE_ATTACH_KPROBE },
+	};
+	bool iter = bpftune_attach_supported(BPFTUNE_ATTACH_ITER);
+	struct bpf_program *prog;
+	unsigned int i;
 
-	bpftune_sysctl_name_to_path(name, path, sizeof(path));
+	bpf_object__for_each_program(prog, tuner->obj) {
+		const char *sec = bpf_program__section_name(prog);
 
-	bpftune_log(LOG_DEBUG, "writing sysctl '%s' for netns_fd %d\n",
-		    path, netns_fd);
+		if (!bpf_program__autoload(prog))
+			continue;
+		if (strncmp(sec, "iter/", 5) == 0 && !iter) {
+			bpftune_log(LOG_DEBUG, "%s: iterators not supported, not loading '%s'\n",
+				    tuner->name, bpf_program__name(prog));
+			bpf_program__set_autoload(prog, false);
+			continue;
+		}
+		for (i = 0; i < ARRAY_SIZE(sec_types); i++) {
+			if (strncmp(sec, sec_types[i].prefix,
+				    strlen(sec_types[i].prefix)) != 0)
+				continue;
+			if (bpftune_attach_supported(sec_types[i].type))
+				break;
+			bpftune_log(LOG_DEBUG, "%s: attach type for '%s' (%s) not supported\n",
+				    tuner->name, bpf_program__name(prog), sec);
+			return -EOPNOTSUPP;
+		}
+	}
+	return 0;
+}
+
+/* number of tuners with loaded BPF skeletons sharing ring buffer/netns
+ * map fds; tuner ids are reserved up front for parallel init, so the
+ * number of tuners says nothing about how many are still live.
+ */
+static unsigned int bpftune_live_tuners;
+static pthread_mutex_t bpftune_live_tuners_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int __bpftuner_bpf_load(struct bpftuner *tuner, const char **optionals)
+{
+	int err = 0;
 
 	err = bpftune_cap_add();
+
 	if (err)
 		return err;
-	err = bpftune_netns_set(netns_fd, &orig_netns_fd);
-	if (err < 0)
-		goto out_unset;
 
-	/* If value is already set to val, do nothing. */
-	old_num_values = bpftune_sysctl_read(0, name, old_values);
-	if (old_num_values < 0) {
-		err = old_num_values;
+	if (bpftuner_map_reuse("ring_buffer", tuner->ring_buffer_map,
+			       ring_buffer_map_fd, &tuner->ring_buffer_map_fd) ||
+	    bpftuner_map_reuse("netns_map", tuner->netns_map,
+			       netns_map_fd, &tuner->netns_map_fd) ||
+	    bpftuner_map_reuse("netns_profile_map", tuner->netns_profile_map,
+			       netns_profile_map_fd,
+			       &tuner->netns_profile_map_fd)) {
+		err = -1;
 		goto out;
 	}
-	if (num_values == old_num_values) {
-		for (i = 0; i < num_values; i++) {
-			if (old_values[i] != values[i])
-				break;
+
+	if (optionals) {
+		int i;
+
+		for (i = 0; optionals[i] != NULL; i++) {
+			struct bpf_program *prog;
+
+			prog = bpf_object__find_program_by_name(tuner->obj,
+								optionals[i]);
+			if (prog) {
+				bpftune_log(LOG_DEBUG, "marking '%s' as optional\n",
+					    optionals[i]);
+				bpf_program__set_autoload(prog, false);
+			}
 		}
-		if (i == num_values)
+	}
+	if (!tuner->bpf_legacy) {
+		err = bpftuner_attach_types_prepare(tuner);
+		if (!err)
+			err = bpftuner_tcp_hooks_prepare(tuner);
+		if (err)
 			goto out;
 	}
-        fp = fopen(path, "w");
-        if (!fp) {
-                err = -errno;
-                bpftune_log(LOG_DEBUG, "could not open %s for writing: %s\n",
-			    path, strerror(-err));
+	bpftuner_pin_maps_prepare(tuner);
+	err = bpf_object__load_skeleton(tuner->skeleton);
+	if (err) {
+		bpftune_log_bpf_err(err, "could not load skeleton: %s\n");
 		goto out;
-        }
-
-	for (i = 0; i < num_values; i++)
-		fprintf(fp, "%ld ", values[i]);
-        fclose(fp);
-
-	for (i = 0; i < num_values; i++) {
-		bpftune_log(LOG_DEBUG, "Wrote %s[%d] = %ld\n",
-			    name, i, values[i]);
 	}
+
+	bpftuner_map_init(tuner, "ring_buffer_map", &tuner->ring_buffer_map,
+			  &ring_buffer_map_fd, &tuner->ring_buffer_map_fd);
+	bpftuner_map_init(tuner, "netns_map", &tuner->netns_map,
+			  &netns_map_fd, &tuner->netns_map_fd);
+	bpftuner_map_init(tuner, "netns_profile_map", &tuner->netns_profile_map,
+			  &netns_profile_map_fd, &tuner->netns_profile_map_fd);
+	pthread_mutex_lock(&bpftune_live_tuners_lock);
+	bpftune_live_tuners++;
+	tuner->loaded = true;
+	pthread_mutex_unlock(&bpftune_live_tuners_lock);
+	/* adopted pinned maps are more current than saved state */
+	if (!tuner->pinned)
+		bpftuner_state_restore_maps(tuner);
 out:
-	bpftune_netns_set(orig_netns_fd, NULL);
-out_unset:
+	tuner->bpf_failed = err != 0;
 	bpftune_cap_drop();
-        return err;
+	return err;
 }
 
-int bpftuner_tunables_init(struct bpftuner *tuner, unsigned int num_descs,
-			   struct bpftunable_desc *descs,
-			   unsigned int num_scenarios,
-			   struct bpftunable_scenario *scenarios)
+/* Programs listed in tuner->lazy_progs are not attached along with the
+ * rest of the skeleton; the tuner attaches and detaches them via
+ * bpftuner_prog_attach()/bpftuner_prog_detach() as needed.
+ */
+static void bpftuner_lazy_progs_prepare(struct bpftuner *tuner)
 {
 	unsigned int i;
 
-	tuner->scenarios = scenarios;
-	tuner->num_scenarios = num_scenarios;
-	tuner->tunables = calloc(num_descs, sizeof(struct bpftunable));
-	if (!tuner->tunables) {
-		bpftune_log(LOG_DEBUG, "no memory to alloc tunables for %s\n",
-			    tuner->name);
-		return -ENOMEM;
+	for (i = 0; tuner->lazy_progs && tuner->lazy_progs[i]; i++) {
+		struct bpf_program *prog;
+
+		prog = bpf_object__find_program_by_name(tuner->obj,
+							tuner->lazy_progs[i]);
+		if (prog)
+			bpf_program__set_autoattach(prog, false);
 	}
-	tuner->num_tunables = num_descs;
-	for (i = 0; i < num_descs; i++) {
-		int num_values;
+}
 
-		bpftune_log(LOG_DEBUG, "handling desc %ld/%ld\n", i, num_descs);
-		memcpy(&tuner->tunables[i].desc, &descs[i], sizeof(*descs));
+static bool bpftuner_prog_lazy(struct bpftuner *tuner, struct bpf_program *prog)
+{
+	unsigned int i;
 
-		if (descs[i].type != BPFTUNABLE_SYSCTL)
+	for (i = 0; tuner->lazy_progs && tuner->lazy_progs[i]; i++) {
+		if (prog == bpf_object__find_program_by_name(tuner->obj,
+							     tuner->lazy_progs[i]))
+			return true;
+	}
+	return false;
+}
+
+/* called with caps set; register non-lazy BPF_TCP_HOOK() programs. */
+static int bpftuner_tcp_hooks_register(struct bpftuner *tuner)
+{
+	struct bpf_program *prog;
+	int err;
+
+	bpf_object__for_each_program(prog, tuner->obj) {
+		if (bpftuner_tcp_hook_id(tuner, prog) < 0 ||
+		    !bpf_program__autoload(prog) ||
+		    bpftuner_prog_lazy(tuner, prog))
 			continue;
-		num_values = bpftune_sysctl_read(0, descs[i].name,
-				tuner->tunables[i].current_values);
-		if (num_values < 0) {
-			bpftune_log(LOG_ERR, "error reading tunable '%s': %s\n",
-				    descs[i].name, strerror(-num_values));
-			return num_values;
-		}
-		if (num_values != descs[i].num_values) {
-			bpftune_log(LOG_ERR, "error reading tunable '%s'; expected %d values, got %d\n",
-				    descs[i].num_values, num_values);
-			return -EINVAL;
+		err = bpftuner_tcp_hook_add(tuner, prog);
+		if (err) {
+			bpftuner_tcp_hooks_unregister(tuner);
+			return err;
 		}
-		memcpy(tuner->tunables[i].initial_values,
-		       tuner->tunables[i].current_values,
-		       sizeof(tuner->tunables[i].initial_values));
 	}
-
 	return 0;
 }
 
-struct bpftunable *bpftuner_tunable(struct bpftuner *tuner, unsigned int index)
+static struct bpf_prog_skeleton *bpftuner_prog_skel(struct bpftuner *tuner,
+						     const char *name)
 {
-	if (index < tuner->num_tunables)
-		return &tuner->tunables[index];
+	struct bpf_object_skeleton *s = tuner->skeleton;
+	int i;
+
+	for (i = 0; s && i < s->prog_cnt; i++) {
+		if (strcmp(s->progs[i].name, name) == 0)
+			return &s->progs[i];
+	}
 	return NULL;
 }
 
-static void bpftuner_tunable_stats_update(struct bpftunable *tunable,
-					  unsigned int scenario, bool global_ns)
+bool bpftuner_prog_attached(struct bpftuner *tuner, const char *name)
 {
-	if (global_ns)
-		(tunable->stats.global_ns[scenario])++;
-	else
-		(tunable->stats.nonglobal_ns[scenario])++;
-	bpftune_log(LOG_DEBUG," updated stat for tunable %s, scenario %d: %lu\n",
-		    tunable->desc.name, scenario,
-		    global_ns ? tunable->stats.global_ns[scenario] :
-				tunable->stats.nonglobal_ns[scenario]);
+	struct bpf_prog_skeleton *ps = bpftuner_prog_skel(tuner, name);
+	int id;
 
+	if (!ps)
+		return false;
+	id = bpftuner_tcp_hook_id(tuner, *ps->prog);
+	if (id >= 0)
+		return bpftuner_tcp_hook_registered(tuner, id);
+	return *ps->link != NULL;
 }
 
-static void bpftuner_scenario_log(struct bpftuner *tuner, unsigned int tunable,
-				  unsigned int scenario, int netns_fd,
-				  bool summary,
-				  const char *fmt, va_list args)
-{
-	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
-	bool global_ns = netns_fd == 0;
-
-	if (summary) {
-		unsigned long count;
+static bool bpftuner_governor_detached(struct bpftuner *tuner, int idx);
+static void bpftuner_governor_forget(struct bpftuner *tuner, int idx);
 
-		count = global_ns ? t->stats.global_ns[scenario] :
-				    t->stats.nonglobal_ns[scenario];
-		if (!count)
-			return;
-		bpftune_log(BPFTUNE_LOG_LEVEL, "Summary: scenario '%s' occurred %ld times for tunable '%s' in %sglobal ns. %s\n",
-			    tuner->scenarios[scenario].name, count,
-			    t->desc.name,
-			    global_ns ? "" : "non-",
-			    tuner->scenarios[scenario].description);
-		if (t->desc.type == BPFTUNABLE_SYSCTL) {
-			char oldvals[PATH_MAX] = { };
-			char newvals[PATH_MAX] = { };
-			char s[PATH_MAX];
-			__u8 i;
+static int __bpftuner_prog_attach(struct bpftuner *tuner, const char *name)
+{
+	struct bpf_prog_skeleton *ps = bpftuner_prog_skel(tuner, name);
+	char path[PATH_MAX];
+	struct bpf_link *link;
+	int err;
 
-			for (i = 0; i < t->desc.num_values; i++) {
-				snprintf(s, sizeof(s), "%ld ",
-					 t->initial_values[i]);
-				strcat(oldvals, s);
-				snprintf(s, sizeof(s), "%ld ",
-					 t->current_values[i]);
-				strcat(newvals, s);
-			}
-			bpftune_log(BPFTUNE_LOG_LEVEL, "sysctl '%s' changed from (%s) -> (%s)\n",
-				    t->desc.name, oldvals, newvals);
-		}
-	} else {
-		bpftune_log(BPFTUNE_LOG_LEVEL, "Scenario '%s' occurred for tunable '%s' in %sglobal ns. %s\n",
-			    tuner->scenarios[scenario].name,
-			    t->desc.name,
-			    global_ns ? "" : "non-",
-			    tuner->scenarios[scenario].description);
-		__bpftune_log(BPFTUNE_LOG_LEVEL, fmt, args);
-		bpftuner_tunable_stats_update(t, scenario, global_ns);
+	if (!ps || !bpf_program__autoload(*ps->prog))
+		return -ENOENT;
+	if (*ps->link)
+		return 0;
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+	if (bpftuner_tcp_hook_id(tuner, *ps->prog) >= 0) {
+		err = bpftuner_tcp_hook_add(tuner, *ps->prog);
+		goto out;
+	}
+	link = bpf_program__attach(*ps->prog);
+	err = libbpf_get_error(link);
+	if (err) {
+		bpftune_log(LOG_ERR, "%s: could not attach '%s': %s\n",
+			    tuner->name, name, strerror(-err));
+		goto out;
 	}
+	*ps->link = link;
+	if (bpftune_pin_enabled) {
+		bpftuner_pin_path(tuner, "link_", name, path, sizeof(path));
+		if (bpf_link__pin(link, path))
+			bpftune_log(LOG_DEBUG, "%s: could not pin link for '%s'\n",
+				    tuner->name, name);
+	}
+	bpftune_log(LOG_DEBUG, "%s: attached '%s'\n", tuner->name, name);
+out:
+	bpftune_cap_drop();
+	return err;
 }
 
-int bpftuner_tunable_sysctl_write(struct bpftuner *tuner, unsigned int tunable,
-				  unsigned int scenario, unsigned long netns_cookie,
-				  __u8 num_values, long *values,
-				  const char *fmt, ...)
+/* attach a program, unless the overhead governor has detached it. */
+int bpftuner_prog_attach(struct bpftuner *tuner, const char *name)
+{
+	struct bpf_prog_skeleton *ps = bpftuner_prog_skel(tuner, name);
+
+	if (ps && bpftuner_governor_detached(tuner, ps - tuner->skeleton->progs))
+		return -EBUSY;
+	return __bpftuner_prog_attach(tuner, name);
+}
+
+void bpftuner_prog_detach(struct bpftuner *tuner, const char *name)
+{
+	struct bpf_prog_skeleton *ps = bpftuner_prog_skel(tuner, name);
+	int id;
+
+	if (!ps)
+		return;
+	/* the tuner no longer wants it, so the governor should not reattach */
+	bpftuner_governor_forget(tuner, ps - tuner->skeleton->progs);
+	id = bpftuner_tcp_hook_id(tuner, *ps->prog);
+	if (id >= 0) {
+		if (!bpftune_cap_add()) {
+			bpftuner_tcp_hook_del(tuner, id);
+			bpftune_cap_drop();
+		}
+		return;
+	}
+	if (!*ps->link || bpftune_cap_add())
+		return;
+	if (bpftune_pin_enabled)
+		bpf_link__unpin(*ps->link);
+	bpf_link__destroy(*ps->link);
+	*ps->link = NULL;
+	bpftune_log(LOG_DEBUG, "%s: detached '%s'\n", tuner->name, name);
+	bpftune_cap_drop();
+}
+
+int __bpftuner_bpf_attach(struct bpftuner *tuner)
+{
+	struct bpftuner_pinned_link *pinned = NULL;
+	int err;
+
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+	bpftuner_lazy_progs_prepare(tuner);
+	if (bpftune_pin_enabled) {
+		pinned = calloc(tuner->skeleton->prog_cnt, sizeof(*pinned));
+		if (pinned)
+			bpftuner_pin_links_adopt(tuner, pinned);
+	}
+	err = bpf_object__attach_skeleton(tuner->skeleton);
+	if (!err)
+		err = bpftuner_tcp_hooks_register(tuner);
+	if (err) {
+		bpftune_log_bpf_err(err, "could not attach skeleton: %s\n");
+	} else {
+		tuner->ring_buffer_map_fd = bpf_map__fd(tuner->ring_buffer_map);
+	}
+	if (pinned) {
+		bpftuner_pin_links(tuner, pinned, err == 0);
+		free(pinned);
+	}
+	tuner->bpf_failed = err != 0;
+	bpftune_cap_drop();
+	return err;
+}
+
+void bpftuner_bpf_fini(struct bpftuner *tuner)
+{
+	bool last = false;
+
+	if (bpftune_cap_add())
+		return;
+	bpftuner_tcp_hooks_unregister(tuner);
+	tuner->bpf_sample_shift = NULL;
+	tuner->bpf_learning_rate = NULL;
+	tuner->bpf_tunable_rates = NULL;
+	tuner->bpf_ringbuf_drops = NULL;
+	bpf_object__destroy_skeleton(tuner->skeleton);
+	free(tuner->skel);
+	tuner->skeleton = NULL;
+	tuner->skel = NULL;
+	tuner->obj = NULL;
+	if (tuner->loaded) {
+		pthread_mutex_lock(&bpftune_live_tuners_lock);
+		tuner->loaded = false;
+		last = --bpftune_live_tuners == 0;
+		pthread_mutex_unlock(&bpftune_live_tuners_lock);
+	}
+	if (last) {
+		if (ring_buffer_map_fd > 0)
+			close(ring_buffer_map_fd);
+		if (netns_map_fd > 0)
+			close(netns_map_fd);
+		if (netns_profile_map_fd > 0)
+			close(netns_profile_map_fd);
+		ring_buffer_map_fd = netns_map_fd = netns_profile_map_fd = 0;
+	}
+	bpftune_cap_drop();
+}
+
+static struct bpftuner *bpftune_tuners[BPFTUNE_MAX_TUNERS];
+static unsigned int bpftune_num_tuners;
+static pthread_mutex_t bpftune_tuners_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void bpftune_sysctl_index_add(struct bpftuner *tuner);
+static void bpftune_sysctl_index_del(struct bpftuner *tuner);
+static void bpftuner_rollback_fini(struct bpftuner *tuner);
+
+/* a tuner with a sysctl_watch_map (the sysctl tuner) only sends events
+ * for sysctls named in that map; populate it with the sysctl tunables
+ * of all tuners.  Called each time a tuner is added, since tuners can
+ * be loaded before or after the watching tuner.
+ */
+static void bpftune_sysctl_watch_update(void)
+{
+	struct bpftuner *w, *t;
+	char key[BPFTUNE_MAX_NAME];
+	__u8 val = 1;
+
+	bpftune_for_each_tuner(w) {
+		struct bpf_map *map;
+		int map_fd;
+
+		if (w->state != BPFTUNE_ACTIVE || !w->obj)
+			continue;
+		map = bpf_object__find_map_by_name(w->obj, "sysctl_watch_map");
+		if (!map || bpf_map__key_size(map) != sizeof(key))
+			continue;
+		map_fd = bpf_map__fd(map);
+		if (map_fd < 0)
+			continue;
+		bpftune_for_each_tuner(t) {
+			struct bpftunable *tunable;
+
+			bpftuner_for_each_tunable(t, tunable) {
+				const char *name;
+
+				if (tunable->desc.type != BPFTUNABLE_SYSCTL)
+					continue;
+				name = strrchr(tunable->desc.name, '.');
+				name = name ? name + 1 : tunable->desc.name;
+				memset(key, 0, sizeof(key));
+				strncpy(key, name, sizeof(key) - 1);
+				if (bpf_map_update_elem(map_fd, key, &val,
+							BPF_ANY))
+					bpftune_log(LOG_ERR, "could not watch sysctl '%s': %s\n",
+						    tunable->desc.name,
+						    strerror(errno));
+			}
+		}
+	}
+}
+
+static unsigned long bpftune_now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static __u64 bpftune_now_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* BPF load/attach failed in init(), and the skeleton was torn down
+ * (see bpftuner_bpf_fini()); clear anything else init() set up, ready to
+ * retry in legacy mode.
+ */
+static void bpftuner_legacy_reset(struct bpftuner *tuner)
+{
+	struct bpftuner saved = *tuner;
+
+	memset(tuner, 0, sizeof(*tuner));
+	tuner->id = saved.id;
+	tuner->handle = saved.handle;
+	tuner->init = saved.init;
+	tuner->fini = saved.fini;
+	tuner->event_handler = saved.event_handler;
+	tuner->ring_buffer_map_fd = ring_buffer_map_fd;
+	tuner->bpf_legacy = true;
+}
+
+/* initialize tuner in "path" with reserved tuner id "id"; may be called
+ * from multiple threads in parallel.
+ */
+static struct bpftuner *__bpftuner_init(const char *path, unsigned int id)
+{
+	unsigned long start = bpftune_now_usecs(), elapsed;
+	struct bpftuner *tuner = NULL;
+	int err, retries;
+
+	tuner = calloc(1, sizeof(*tuner));
+	if (!tuner) {
+		bpftune_log(LOG_ERR, "could not allocate tuner\n");
+		return NULL;
+	}
+
+	bpftune_cap_add();
+	/* if file appears via inotify we may get "file too short" errors;
+	 * retry a few times to avoid this.
+	 */
+	for (retries = 0; retries < 5; retries++) {
+		tuner->handle = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+		if (tuner->handle)
+			break;
+		usleep(1000);
+	}
+	bpftune_cap_drop();
+	if (!tuner->handle) {
+		bpftune_log(LOG_ERR,
+			    "could not dlopen '%s' after %d retries: %s\n",
+			    path, retries, dlerror());
+		free(tuner);
+		return NULL;
+	}
+	/* If we have a ringbuf fd from any tuner, use its fd to be re-used
+ 	 * for other ringbuf maps (so we can use the same ring buffer for all
+ 	 * BPF events.
+ 	 */
+	tuner->ring_buffer_map_fd = ring_buffer_map_fd;
+	/* id is needed at BPF load time to tag events */
+	tuner->id = id;
+	tuner->init = dlsym(tuner->handle, "init");
+	tuner->fini = dlsym(tuner->handle, "fini");
+	tuner->event_handler = dlsym(tuner->handle, "event_handler");
+	if (!tuner->init || !tuner->fini || !tuner->event_handler) {	
+		bpftune_log(LOG_ERR, "missing definitions in '%s': need 'init', 'fini' and 'event_handler'\n",
+			    path);
+		dlclose(tuner->handle);
+		free(tuner);
+		return NULL;
+	}
+	bpftune_log(LOG_DEBUG, "calling init for '%s\n", path);
+	err = tuner->init(tuner);
+	/* some programs may need attach types that are missing, or may not
+	 * load or attach; fall back to legacy mode for this tuner only.
+	 * Other failures would recur in legacy mode, so are not retried.
+	 */
+	if (err && tuner->bpf_failed && !tuner->bpf_legacy &&
+	    bpftune_attach_supported(BPFTUNE_ATTACH_KPROBE)) {
+		bpftune_log(LOG_INFO, "could not load '%s', retrying in legacy mode\n",
+			    path);
+		bpftuner_legacy_reset(tuner);
+		err = tuner->init(tuner);
+	}
+	if (err) {
+		dlclose(tuner->handle);
+		bpftune_log(LOG_ERR, "error initializing '%s: %s\n",
+			    path, strerror(-err));
+		free(tuner);
+		return NULL;
+	}
+	bpftuner_state_restore_tunables(tuner);
+	bpftune_sysctl_index_add(tuner);
+	pthread_mutex_lock(&bpftune_tuners_lock);
+	tuner->state = BPFTUNE_ACTIVE;
+	bpftune_tuners[id] = tuner;
+	bpftune_sysctl_watch_update();
+	pthread_mutex_unlock(&bpftune_tuners_lock);
+	elapsed = bpftune_now_usecs() - start;
+	bpftune_log(LOG_INFO, "initialized tuner %s[%d] in %lu.%03lums\n",
+		    tuner->name, tuner->id, elapsed / 1000, elapsed % 1000);
+	return tuner;
+}
+
+/* reserve "num" consecutive tuner ids; returns first id or -ENOSPC */
+static int bpftune_tuner_ids_reserve(unsigned int num)
+{
+	int id = -ENOSPC;
+
+	pthread_mutex_lock(&bpftune_tuners_lock);
+	if (bpftune_num_tuners + num <= BPFTUNE_MAX_TUNERS) {
+		id = bpftune_num_tuners;
+		bpftune_num_tuners += num;
+	}
+	pthread_mutex_unlock(&bpftune_tuners_lock);
+	if (id < 0)
+		bpftune_log(LOG_ERR, "cannot add %d tuners; limit of %d reached\n",
+			    num, BPFTUNE_MAX_TUNERS);
+	return id;
+}
+
+/* add a tuner to the list of tuners, or replace existing inactive tuner.
+ * If successful, call init().
+ */
+struct bpftuner *bpftuner_init(const char *path)
+{
+	struct bpftuner *tuner;
+	int id;
+
+	id = bpftune_tuner_ids_reserve(1);
+	if (id < 0)
+		return NULL;
+	tuner = __bpftuner_init(path, id);
+	if (!tuner) {
+		/* give back id if nothing has been added since */
+		pthread_mutex_lock(&bpftune_tuners_lock);
+		if ((unsigned int)id == bpftune_num_tuners - 1)
+			bpftune_num_tuners--;
+		pthread_mutex_unlock(&bpftune_tuners_lock);
+	}
+	return tuner;
+}
+
+struct bpftune_init_work {
+	const char **paths;
+	unsigned int num_paths;
+	unsigned int next;
+	unsigned int base_id;
+	unsigned int num_init;
+	pthread_mutex_t lock;
+};
+
+static void *bpftune_init_worker(void *arg)
+{
+	struct bpftune_init_work *work = arg;
+
+	for (;;) {
+		unsigned int i;
+
+		pthread_mutex_lock(&work->lock);
+		i = work->next++;
+		pthread_mutex_unlock(&work->lock);
+		if (i >= work->num_paths)
+			break;
+		if (__bpftuner_init(work->paths[i], work->base_id + i)) {
+			pthread_mutex_lock(&work->lock);
+			work->num_init++;
+			pthread_mutex_unlock(&work->lock);
+		}
+	}
+	return NULL;
+}
+
+/* Initialize tuners in "paths" in parallel, where the bulk of the time
+ * goes in BPF verification.  Tuner ids follow the order of "paths" so
+ * they are the same from run to run, irrespective of which tuner finishes
+ * first; ids of tuners that fail to initialize are left unused.  Tuners
+ * are initialized one at a time until the shared ring buffer and netns
+ * maps have been created, so that all other tuners load and attach their
+ * programs using the same maps.  Returns number of tuners initialized.
+ */
+int bpftune_tuners_init(const char **paths, unsigned int num_paths)
+{
+	struct bpftune_init_work work = {
+		.paths = paths,
+		.num_paths = num_paths,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t tids[BPFTUNE_INIT_THREADS];
+	unsigned long start = bpftune_now_usecs(), elapsed;
+	unsigned int i, num_threads = 0;
+	long cpus;
+	int id;
+
+	if (num_paths == 0)
+		return 0;
+	id = bpftune_tuner_ids_reserve(num_paths);
+	if (id < 0)
+		return id;
+	work.base_id = id;
+
+	while (work.next < num_paths && ring_buffer_map_fd <= 0) {
+		if (__bpftuner_init(paths[work.next], work.base_id + work.next))
+			work.num_init++;
+		work.next++;
+	}
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	while (num_threads < BPFTUNE_INIT_THREADS &&
+	       num_threads < (unsigned int)cpus &&
+	       num_threads < num_paths - work.next) {
+		if (pthread_create(&tids[num_threads], NULL,
+				   bpftune_init_worker, &work)) {
+			bpftune_log(LOG_DEBUG, "could not create init thread: %s\n",
+				    strerror(errno));
+			break;
+		}
+		num_threads++;
+	}
+	/* no threads available; initialize tuners here. */
+	if (num_threads == 0)
+		bpftune_init_worker(&work);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(tids[i], NULL);
+	bpftune_tcp_hooks_purge();
+
+	elapsed = bpftune_now_usecs() - start;
+	bpftune_log(BPFTUNE_LOG_LEVEL, "initialized %d of %d tuners in %lu.%03lums (%d threads)\n",
+		    work.num_init, num_paths, elapsed / 1000, elapsed % 1000,
+		    num_threads ? num_threads : 1);
+	return work.num_init;
+}
+
+static void bpftuner_scenario_log(struct bpftuner *tuner, unsigned int tunable,
+				  unsigned int scenario, int netns_fd,
+				  bool summary,
+				  const char *fmt, va_list args);
+
+static unsigned long global_netns_cookie;
+
+void bpftuner_fini(struct bpftuner *tuner, enum bpftune_state state)
+{
+	unsigned int i, j;
+
+	if (!tuner || tuner->state != BPFTUNE_ACTIVE)
+		return;
+
+	bpftune_log(LOG_DEBUG, "cleaning up tuner %s with %d tunables, %d scenarios\n",
+		    tuner->name, tuner->num_tunables, tuner->num_scenarios);
+	/* report summary of events for tuner */
+	for (i = 0; i < tuner->num_tunables; i++) {
+		for (j = 0; j < tuner->num_scenarios; j++) {
+			va_list args;
+			bpftune_log(LOG_DEBUG, "checking scenarios for tuner %d, scenario %d\n",
+				    i, j);
+			bpftuner_scenario_log(tuner, i, j, 0, true, NULL, args);
+			bpftuner_scenario_log(tuner, i, j, 1, true, NULL, args);
+		}
+	}
+	if (state == BPFTUNE_INACTIVE && bpftune_pin_enabled)
+		bpftuner_tcp_hooks_keep(tuner);
+	if (tuner->fini)
+		tuner->fini(tuner);
+	bpftune_sysctl_index_del(tuner);
+	bpftuner_rollback_fini(tuner);
+	/* pinned objects are kept for the next bpftune on exit only; a
+	 * tuner that is removed or disabled must not stay attached.
+	 */
+	if (state != BPFTUNE_INACTIVE)
+		bpftuner_unpin(tuner);
+
+	tuner->state = state;
+}
+
+struct bpftuner *bpftune_tuner(unsigned int index)
+{
+	if (index < bpftune_num_tuners)
+		return bpftune_tuners[index];
+	return NULL;
+}
+
+unsigned int bpftune_tuner_num(void)
+{
+	return bpftune_num_tuners;
+}
+
+void bpftune_set_learning_rate(unsigned short rate)
+{
+	bpftune_learning_rate = rate;
+}
+
+/* Learning rates for named tuners or tunables, overriding the global
+ * rate; a tunable's rate takes precedence over its tuner's rate.
+ * Tuner rates are set in bpftune_learning_rate in the tuner's BPF .bss,
+ * tunable rates in bpftune_tunable_rates[] (see
+ * bpftuner_learning_rates_update()).  Rates from the config file are kept
+ * separately so they can be dropped on reload; they override rates set
+ * otherwise until a rate is set again via -r or the control socket.
+ */
+#define BPFTUNE_MAX_NAMED_RATES		128
+
+struct bpftune_named_rate {
+	char name[BPFTUNE_MAX_NAME];
+	int rate;			/* -1 if not set */
+	int config_rate;		/* -1 if not set by config file */
+};
+
+static struct bpftune_named_rate bpftune_named_rates[BPFTUNE_MAX_NAMED_RATES];
+static unsigned int bpftune_num_named_rates;
+
+static int __bpftune_set_named_learning_rate(const char *name,
+					     unsigned short rate, bool config)
+{
+	unsigned int i;
+
+	if (rate > BPFTUNE_DELTA_MAX)
+		return -ERANGE;
+	if (strlen(name) >= BPFTUNE_MAX_NAME)
+		return -ENAMETOOLONG;
+	for (i = 0; i < bpftune_num_named_rates; i++) {
+		if (strcmp(bpftune_named_rates[i].name, name) == 0)
+			break;
+	}
+	if (i == BPFTUNE_MAX_NAMED_RATES)
+		return -ENOSPC;
+	if (i == bpftune_num_named_rates) {
+		strcpy(bpftune_named_rates[i].name, name);
+		bpftune_named_rates[i].rate = -1;
+		bpftune_num_named_rates++;
+	}
+	if (config) {
+		bpftune_named_rates[i].config_rate = rate;
+	} else {
+		bpftune_named_rates[i].rate = rate;
+		bpftune_named_rates[i].config_rate = -1;
+	}
+	bpftune_log(LOG_DEBUG, "learning rate for '%s' set to %d\n",
+		    name, rate);
+	return 0;
+}
+
+int bpftune_set_named_learning_rate(const char *name, unsigned short rate)
+{
+	return __bpftune_set_named_learning_rate(name, rate, false);
+}
+
+/* drop rates set by the config file, prior to reloading it */
+static void bpftune_named_learning_rates_reset(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < bpftune_num_named_rates; i++)
+		bpftune_named_rates[i].config_rate = -1;
+}
+
+/* returns -1 if no rate is set for name */
+static int bpftune_named_learning_rate(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < bpftune_num_named_rates; i++) {
+		struct bpftune_named_rate *r = &bpftune_named_rates[i];
+
+		if (strcmp(r->name, name) == 0)
+			return r->config_rate >= 0 ? r->config_rate : r->rate;
+	}
+	return -1;
+}
+
+unsigned short bpftuner_learning_rate(struct bpftuner *tuner)
+{
+	int rate = bpftune_named_learning_rate(tuner->name);
+
+	return rate >= 0 ? rate : bpftune_learning_rate;
+}
+
+/* sync tuner and tunable learning rates to BPF .bss; called on load, once
+ * tunables are known and when rates change.
+ */
+void bpftuner_learning_rates_update(struct bpftuner *tuner)
+{
+	unsigned short rate = bpftuner_learning_rate(tuner);
+	unsigned int i;
+
+	if (tuner->bpf_learning_rate)
+		*tuner->bpf_learning_rate = rate;
+	if (!tuner->bpf_tunable_rates)
+		return;
+	for (i = 0; i < BPFTUNE_MAX_TUNABLES; i++)
+		tuner->bpf_tunable_rates[i] = rate;
+	for (i = 0; i < tuner->num_tunables; i++) {
+		struct bpftunable_desc *desc = &tuner->tunables[i].desc;
+		int tunable_rate = bpftune_named_learning_rate(desc->name);
+
+		if (tunable_rate < 0 || desc->id >= BPFTUNE_MAX_TUNABLES)
+			continue;
+		tuner->bpf_tunable_rates[desc->id] = tunable_rate;
+	}
+}
+
+/* seconds without manual changes after which auto-tuning of a manually
+ * overridden tunable resumes; 0 means never.
+ */
+static unsigned long bpftune_manual_resume;
+
+void bpftune_set_manual_resume(unsigned long secs)
+{
+	bpftune_manual_resume = secs;
+}
+
+/* Dry-run mode, for all tuners or those named.  Tunable changes are
+ * recorded (see bpftuner_tunable_shadow()) rather than made.
+ */
+static bool bpftune_dry_run_all;
+static char bpftune_dry_run_tuners[BPFTUNE_MAX_TUNERS][BPFTUNE_MAX_NAME];
+static unsigned int bpftune_num_dry_run_tuners;
+
+/* NULL tuner_name enables dry-run mode for all tuners */
+int bpftune_set_dry_run(const char *tuner_name)
+{
+	if (!tuner_name) {
+		bpftune_dry_run_all = true;
+		return 0;
+	}
+	if (bpftune_num_dry_run_tuners >= BPFTUNE_MAX_TUNERS)
+		return -ENOSPC;
+	if (strlen(tuner_name) >= BPFTUNE_MAX_NAME)
+		return -ENAMETOOLONG;
+	strncpy(bpftune_dry_run_tuners[bpftune_num_dry_run_tuners++],
+		tuner_name, BPFTUNE_MAX_NAME - 1);
+	return 0;
+}
+
+bool bpftuner_dry_run(struct bpftuner *tuner)
+{
+	unsigned int i;
+
+	if (bpftune_dry_run_all)
+		return true;
+	for (i = 0; tuner->name && i < bpftune_num_dry_run_tuners; i++) {
+		if (strcmp(tuner->name, bpftune_dry_run_tuners[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+/* events are recorded one per line as
+ *
+ * record <msecs> <tuner> <scenario> <netns_cookie> <payload>
+ *
+ * where msecs is time since recording started and payload is the event's
+ * update/raw data union in hex, so that bpftunesim can replay them.
+ */
+static FILE *bpftune_record_fp;
+static __u64 bpftune_record_start;
+
+int bpftune_record_init(const char *file)
+{
+	int ret;
+
+	bpftune_record_fini();
+	bpftune_record_fp = fopen(file, "w");
+	if (!bpftune_record_fp) {
+		ret = -errno;
+		bpftune_log(LOG_ERR, "could not open '%s' to record events: %s\n",
+			    file, strerror(-ret));
+		return ret;
+	}
+	setvbuf(bpftune_record_fp, NULL, _IOLBF, 0);
+	fprintf(bpftune_record_fp, "# bpftune %s events; replay with bpftunesim\n",
+		BPFTUNE_VERSION);
+	bpftune_record_start = bpftune_now_nsecs();
+	return 0;
+}
+
+void bpftune_record_fini(void)
+{
+	if (bpftune_record_fp)
+		fclose(bpftune_record_fp);
+	bpftune_record_fp = NULL;
+}
+
+static void bpftune_record_event(struct bpftuner *tuner,
+				 struct bpftune_event *event)
+{
+	size_t i, len = sizeof(*event) - offsetof(struct bpftune_event, update);
+	__u8 *payload = (__u8 *)event->update;
+
+	if (!bpftune_record_fp)
+		return;
+	fprintf(bpftune_record_fp, "record %llu %s %u %lu ",
+		(bpftune_now_nsecs() - bpftune_record_start) / MSEC,
+		tuner->name, event->scenario_id, event->netns_cookie);
+	for (i = 0; i < len; i++)
+		fprintf(bpftune_record_fp, "%02x", payload[i]);
+	fputc('\n', bpftune_record_fp);
+}
+
+static int bpftune_ringbuf_event_read(void *ctx, void *data, size_t size)
+{
+	struct bpftune_event *event = data;
+	struct bpftuner *tuner;
+	__u64 start;
+
+	if (size < sizeof(*event)) {
+		bpftune_log(LOG_ERR, "unexpected size event %d\n", size);
+		return 0;
+	}
+	if (event->tuner_id > BPFTUNE_MAX_TUNERS) {
+		bpftune_log(LOG_ERR, "invalid tuner id %d\n", event->tuner_id);
+		return 0;
+	}
+	tuner = bpftune_tuner(event->tuner_id);
+	if (!tuner) {
+		bpftune_log(LOG_ERR, "no tuner for id %d\n", event->tuner_id);
+		return 0;
+	}
+	bpftune_log(LOG_DEBUG,
+		    "event scenario [%d] for tuner %s[%d] netns %ld (%s)\n",
+		    event->scenario_id, tuner->name, tuner->id,
+		    event->netns_cookie,
+		    event->netns_cookie && event->netns_cookie != global_netns_cookie ?
+		    "non-global netns" : "global netns");
+	if (event->scenario_id < BPFTUNE_MAX_SCENARIOS)
+		tuner->events[event->scenario_id]++;
+	bpftune_record_event(tuner, event);
+	start = bpftune_now_nsecs();
+	tuner->event_handler(tuner, event, ctx);
+	tuner->handler_time_ns += bpftune_now_nsecs() - start;
+
+	return 0;
+}
+
+int bpftuner_ring_buffer_map_fd(struct bpftuner *tuner)
+{
+	return tuner->ring_buffer_map_fd;
+}
+
+void *bpftune_ring_buffer_init(int ring_buffer_map_fd, void *ctx)
+{
+	struct ring_buffer *rb;
+	int err;
+
+	bpftune_log(LOG_DEBUG, "calling ring_buffer__new, ringbuf_map_fd %d\n",
+		    ring_buffer_map_fd);
+	err = bpftune_cap_add();
+	if (err)
+		return NULL;
+	rb = ring_buffer__new(ring_buffer_map_fd, bpftune_ringbuf_event_read, ctx, NULL);
+	err = libbpf_get_error(rb);
+	if (err) {
+		bpftune_log_bpf_err(err, "couldnt create ring buffer: %s\n");
+		rb = NULL;
+	}
+	bpftune_cap_drop();
+	return rb;
+}
+
+static int ring_buffer_done;
+
+/* call periodic() for tuners that have one every periodic_interval
+ * seconds; called from the ring buffer poll loop, so it is serialized
+ * with event handling.
+ */
+static void bpftune_tuners_periodic(void)
+{
+	unsigned long now = bpftune_now_secs();
+	struct bpftuner *tuner;
+	__u64 start;
+
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state != BPFTUNE_ACTIVE || !tuner->periodic ||
+		    now - tuner->periodic_last < tuner->periodic_interval)
+			continue;
+		tuner->periodic_last = now;
+		start = bpftune_now_nsecs();
+		tuner->periodic(tuner);
+		tuner->handler_time_ns += bpftune_now_nsecs() - start;
+	}
+}
+
+/* BPF program run-time stats.  While the fd returned by bpf_enable_stats()
+ * is held open, the kernel accumulates run_time_ns and run_cnt for each BPF
+ * program; these are summed per tuner to report bpftune's overhead as
+ * nanoseconds per invocation and share of total CPU time.
+ */
+static int bpftune_stats_fd = -1;
+static unsigned long bpftune_stats_start, bpftune_stats_last;
+static unsigned long bpftune_stats_elapsed;
+static long bpftune_stats_cpus = 1;
+static unsigned long bpftune_governor_last;
+/* programs shared between tuners (tcp hook dispatcher) */
+static struct bpftune_run_stats bpftune_shared_run_stats;
+
+int bpftune_stats_init(void)
+{
+	int err;
+
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+	bpftune_stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+	if (bpftune_stats_fd < 0) {
+		err = bpftune_stats_fd;
+		bpftune_log(LOG_INFO, "could not enable BPF run-time stats: %s\n",
+			    strerror(-err));
+	}
+	bpftune_tcp_hook_timed = bpftune_stats_fd >= 0;
+	bpftune_cap_drop();
+	bpftune_stats_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (bpftune_stats_cpus < 1)
+		bpftune_stats_cpus = 1;
+	bpftune_stats_start = bpftune_stats_last = bpftune_now_usecs();
+	bpftune_governor_last = bpftune_stats_start;
+	return err;
+}
+
+void bpftune_stats_fini(void)
+{
+	if (bpftune_stats_fd >= 0)
+		close(bpftune_stats_fd);
+	bpftune_stats_fd = -1;
+}
+
+static void bpftune_obj_run_time(struct bpf_object *obj, __u64 *run_time_ns,
+				 __u64 *run_cnt)
+{
+	struct bpf_program *prog;
+
+	bpf_object__for_each_program(prog, obj) {
+		struct bpf_prog_info info = {};
+		__u32 len = sizeof(info);
+		int fd = bpf_program__fd(prog);
+
+		if (fd < 0 || bpf_obj_get_info_by_fd(fd, &info, &len))
+			continue;
+		*run_time_ns += info.run_time_ns;
+		*run_cnt += info.run_cnt;
+	}
+}
+
+static void bpftune_run_stats_set(struct bpftune_run_stats *stats,
+				  __u64 run_time_ns, __u64 run_cnt)
+{
+	/* counts start from zero again if the tuner has been reloaded */
+	if (run_time_ns < stats->run_time_ns || run_cnt < stats->run_cnt) {
+		stats->interval_run_time_ns = run_time_ns;
+		stats->interval_run_cnt = run_cnt;
+	} else {
+		stats->interval_run_time_ns = run_time_ns - stats->run_time_ns;
+		stats->interval_run_cnt = run_cnt - stats->run_cnt;
+	}
+	stats->run_time_ns = run_time_ns;
+	stats->run_cnt = run_cnt;
+}
+
+/* run time of tuner's programs, including BPF_TCP_HOOK() programs run via
+ * the dispatcher.
+ */
+static void bpftuner_run_stats(struct bpftuner *tuner,
+			       struct bpftune_run_stats *stats)
+{
+	__u64 run_time_ns = 0, run_cnt = 0;
+
+	bpftune_obj_run_time(tuner->obj, &run_time_ns, &run_cnt);
+	bpftune_tcp_hooks_run_time(tuner, -1, &run_time_ns, &run_cnt);
+	bpftune_run_stats_set(stats, run_time_ns, run_cnt);
+}
+
+/* run time of the dispatcher itself, less the hook programs it ran */
+static void bpftune_tcp_hook_run_stats(struct bpftune_run_stats *stats)
+{
+	__u64 run_time_ns = 0, run_cnt = 0, hook_time_ns = 0, hook_cnt = 0;
+
+	bpftune_obj_run_time(tcp_hook_bpf->obj, &run_time_ns, &run_cnt);
+	bpftune_tcp_hooks_run_time(NULL, -1, &hook_time_ns, &hook_cnt);
+	bpftune_run_stats_set(stats, run_time_ns > hook_time_ns ?
+				     run_time_ns - hook_time_ns : 0, run_cnt);
+}
+
+/* percentage of CPU time available across all CPUs */
+static double bpftune_cpu_pct(__u64 run_time_ns, unsigned long usecs)
+{
+	if (!usecs)
+		return 0;
+	return (100.0 * run_time_ns) /
+	       ((double)usecs * 1000 * bpftune_stats_cpus);
+}
+
+static void bpftune_run_stats_write(FILE *fp, const char *name,
+				    struct bpftune_run_stats *stats)
+{
+	fprintf(fp, "%-24s %12llu %16llu %10llu %10.6f %12llu %10llu %10.6f\n",
+		name, stats->run_cnt, stats->run_time_ns,
+		stats->run_cnt ? stats->run_time_ns / stats->run_cnt : 0,
+		bpftune_cpu_pct(stats->run_time_ns,
+				bpftune_stats_last - bpftune_stats_start),
+		stats->interval_run_cnt,
+		stats->interval_run_cnt ?
+		stats->interval_run_time_ns / stats->interval_run_cnt : 0,
+		bpftune_cpu_pct(stats->interval_run_time_ns,
+				bpftune_stats_elapsed));
+}
+
+static void bpftune_stats_write(void)
+{
+	char tmpfile[PATH_MAX];
+	struct bpftuner *tuner;
+	FILE *fp;
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", BPFTUNE_STATS_FILE);
+	fp = fopen(tmpfile, "w");
+	if (!fp) {
+		bpftune_log(LOG_DEBUG, "could not write stats to '%s': %s\n",
+			    tmpfile, strerror(errno));
+		return;
+	}
+	fprintf(fp, "# BPF program run-time stats over %lus (%lus interval), %ld CPUs\n",
+		(bpftune_stats_last - bpftune_stats_start) / 1000000,
+		bpftune_stats_elapsed / 1000000, bpftune_stats_cpus);
+	fprintf(fp, "%-24s %12s %16s %10s %10s %12s %10s %10s\n",
+		"# name", "runs", "run_time_ns", "ns/run", "cpu%",
+		"int_runs", "int_ns/run", "int_cpu%");
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state != BPFTUNE_ACTIVE || !tuner->obj)
+			continue;
+		bpftune_run_stats_write(fp, tuner->name, &tuner->run_stats);
+	}
+	if (tcp_hook_bpf)
+		bpftune_run_stats_write(fp, "tcp_hook",
+					&bpftune_shared_run_stats);
+	if (fclose(fp) || rename(tmpfile, BPFTUNE_STATS_FILE)) {
+		bpftune_log(LOG_DEBUG, "could not write stats to '%s': %s\n",
+			    BPFTUNE_STATS_FILE, strerror(errno));
+		unlink(tmpfile);
+	}
+}
+
+/* sample run-time stats for all tuners and update BPFTUNE_STATS_FILE. */
+void bpftune_stats_update(void)
+{
+	unsigned long now = bpftune_now_usecs();
+	struct bpftuner *tuner;
+
+	if (bpftune_stats_fd < 0 || bpftune_cap_add())
+		return;
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state != BPFTUNE_ACTIVE || !tuner->obj)
+			continue;
+		bpftuner_run_stats(tuner, &tuner->run_stats);
+	}
+	if (tcp_hook_bpf)
+		bpftune_tcp_hook_run_stats(&bpftune_shared_run_stats);
+	bpftune_stats_elapsed = now - bpftune_stats_last;
+	bpftune_stats_last = now;
+	bpftune_stats_write();
+	bpftune_cap_drop();
+}
+
+static void bpftune_run_stats_log(const char *name,
+				  struct bpftune_run_stats *stats)
+{
+	bpftune_log(BPFTUNE_LOG_LEVEL,
+		    "%s: %llu BPF program runs, %llu ns/run, %.6f%% of CPU time\n",
+		    name, stats->run_cnt,
+		    stats->run_cnt ? stats->run_time_ns / stats->run_cnt : 0,
+		    bpftune_cpu_pct(stats->run_time_ns,
+				    bpftune_stats_last - bpftune_stats_start));
+}
+
+/* report overhead of tuners since startup; called on exit. */
+void bpftune_stats_summary(void)
+{
+	struct bpftune_run_stats total = {};
+	struct bpftuner *tuner;
+
+	if (bpftune_stats_fd < 0)
+		return;
+	bpftune_stats_update();
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state != BPFTUNE_ACTIVE || !tuner->obj)
+			continue;
+		bpftune_run_stats_log(tuner->name, &tuner->run_stats);
+		total.run_cnt += tuner->run_stats.run_cnt;
+		total.run_time_ns += tuner->run_stats.run_time_ns;
+	}
+	if (tcp_hook_bpf) {
+		bpftune_run_stats_log("tcp_hook", &bpftune_shared_run_stats);
+		total.run_cnt += bpftune_shared_run_stats.run_cnt;
+		total.run_time_ns += bpftune_shared_run_stats.run_time_ns;
+	}
+	bpftune_run_stats_log("bpftune", &total);
+}
+
+/* Metrics in Prometheus text exposition format, written to a file every
+ * BPFTUNE_STATS_INTERVAL seconds; pointing this at a node-exporter
+ * textfile collector directory makes them available for scraping.
+ */
+static char bpftune_metrics_file[PATH_MAX];
+static unsigned long bpftune_metrics_last;
+
+int bpftune_metrics_init(const char *file)
+{
+	if (strlen(file) >= sizeof(bpftune_metrics_file))
+		return -ENAMETOOLONG;
+	strncpy(bpftune_metrics_file, file, sizeof(bpftune_metrics_file) - 1);
+	/* first write happens once tuners are running */
+	bpftune_metrics_last = 0;
+	return 0;
+}
+
+void bpftune_metrics_fini(void)
+{
+	/* stale metrics would suggest bpftune is still running */
+	if (bpftune_metrics_file[0])
+		unlink(bpftune_metrics_file);
+	bpftune_metrics_file[0] = '\0';
+}
+
+/* label values must have backslash, double-quote and newline escaped */
+static void bpftune_metrics_label(FILE *fp, const char *label,
+				  const char *value)
+{
+	fprintf(fp, "%s=\"", label);
+	for (; value && *value; value++) {
+		switch (*value) {
+		case '\\':
+		case '"':
+			fprintf(fp, "\\%c", *value);
+			break;
+		case '\n':
+			fprintf(fp, "\\n");
+			break;
+		default:
+			fputc(*value, fp);
+			break;
+		}
+	}
+	fputc('"', fp);
+}
+
+static void bpftune_metrics_header(FILE *fp, const char *name,
+				   const char *type, const char *help)
+{
+	fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void bpftune_metrics_netns(FILE *fp, struct bpftuner *tuner,
+				  struct bpftuner_netns *netns)
+{
+	char cookie[32];
+
+	if (netns == &tuner->netns)
+		snprintf(cookie, sizeof(cookie), "global");
+	else
+		snprintf(cookie, sizeof(cookie), "%lu", netns->netns_cookie);
+	fputc(',', fp);
+	bpftune_metrics_label(fp, "netns", cookie);
+}
+
+static void bpftune_metrics_run_stats(FILE *fp, const char *metric,
+				      const char *name,
+				      struct bpftune_run_stats *stats,
+				      bool run_time)
+{
+	fprintf(fp, "%s{", metric);
+	bpftune_metrics_label(fp, "tuner", name);
+	if (run_time)
+		fprintf(fp, "} %.9f\n", stats->run_time_ns / 1e9);
+	else
+		fprintf(fp, "} %llu\n", stats->run_cnt);
+}
+
+#define bpftune_metrics_for_each_tuner(tuner)			\
+	bpftune_for_each_tuner(tuner)				\
+		if (tuner->state == BPFTUNE_ACTIVE && tuner->name)
+
+static void bpftune_metrics_write(void)
+{
+	const char *run_metrics[] = { "bpftune_bpf_runs_total",
+				      "bpftune_bpf_run_seconds_total" };
+	struct bpftuner_netns *netns;
+	char tmpfile[PATH_MAX];
+	struct bpftuner *tuner;
+	unsigned int i, j;
+	FILE *fp;
+
+	bpftune_metrics_last = bpftune_now_secs();
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", bpftune_metrics_file);
+	fp = fopen(tmpfile, "w");
+	if (!fp) {
+		bpftune_log(LOG_DEBUG, "could not write metrics to '%s': %s\n",
+			    tmpfile, strerror(errno));
+		return;
+	}
+
+	bpftune_metrics_header(fp, "bpftune_events_total", "counter",
+			       "Events received from BPF programs.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		for (i = 0; i < tuner->num_scenarios &&
+			    i < BPFTUNE_MAX_SCENARIOS; i++) {
+			fprintf(fp, "bpftune_events_total{");
+			bpftune_metrics_label(fp, "tuner", tuner->name);
+			fputc(',', fp);
+			bpftune_metrics_label(fp, "scenario",
+					      tuner->scenarios[i].name);
+			fprintf(fp, "} %lu\n", tuner->events[i]);
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_ringbuf_drops_total", "counter",
+			       "Events dropped as the ring buffer was full.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		if (!tuner->bpf_ringbuf_drops)
+			continue;
+		fprintf(fp, "bpftune_ringbuf_drops_total{");
+		bpftune_metrics_label(fp, "tuner", tuner->name);
+		fprintf(fp, "} %llu\n", *tuner->bpf_ringbuf_drops);
+	}
+
+	bpftune_metrics_header(fp, "bpftune_sysctl_write_seconds", "summary",
+			       "Latency of sysctl writes.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			if (t->desc.type != BPFTUNABLE_SYSCTL)
+				continue;
+			fprintf(fp, "bpftune_sysctl_write_seconds_sum{");
+			bpftune_metrics_label(fp, "tuner", tuner->name);
+			fputc(',', fp);
+			bpftune_metrics_label(fp, "tunable", t->desc.name);
+			fprintf(fp, "} %.9f\n", t->write_time_ns / 1e9);
+			fprintf(fp, "bpftune_sysctl_write_seconds_count{");
+			bpftune_metrics_label(fp, "tuner", tuner->name);
+			fputc(',', fp);
+			bpftune_metrics_label(fp, "tunable", t->desc.name);
+			fprintf(fp, "} %lu\n", t->writes);
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_sysctl_write_errors_total",
+			       "counter", "Failed sysctl writes.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			if (t->desc.type != BPFTUNABLE_SYSCTL)
+				continue;
+			fprintf(fp, "bpftune_sysctl_write_errors_total{");
+			bpftune_metrics_label(fp, "tuner", tuner->name);
+			fputc(',', fp);
+			bpftune_metrics_label(fp, "tunable", t->desc.name);
+			fprintf(fp, "} %lu\n", t->write_errors);
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_dry_run_writes_total", "counter",
+			       "Tunable changes recorded but not made in dry-run mode.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		if (!bpftuner_dry_run(tuner))
+			continue;
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			fprintf(fp, "bpftune_dry_run_writes_total{");
+			bpftune_metrics_label(fp, "tuner", tuner->name);
+			fputc(',', fp);
+			bpftune_metrics_label(fp, "tunable", t->desc.name);
+			fprintf(fp, "} %lu\n", t->dry_run_writes);
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_rollbacks_total", "counter",
+			       "Tunable changes rolled back as health metrics got worse.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			fprintf(fp, "bpftune_rollbacks_total{");
+			bpftune_metrics_label(fp, "tuner", tuner->name);
+			fputc(',', fp);
+			bpftune_metrics_label(fp, "tunable", t->desc.name);
+			fprintf(fp, "} %lu\n", t->rollbacks);
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_tunable_value", "gauge",
+			       "Current tunable value (dry-run value in dry-run mode).");
+	bpftune_metrics_for_each_tuner(tuner) {
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			for (j = 0; j < t->desc.num_values &&
+				    j < BPFTUNE_MAX_VALUES; j++) {
+				fprintf(fp, "bpftune_tunable_value{");
+				bpftune_metrics_label(fp, "tuner", tuner->name);
+				fputc(',', fp);
+				bpftune_metrics_label(fp, "tunable",
+						      t->desc.name);
+				fprintf(fp, ",index=\"%u\"} %ld\n", j,
+					t->current_values[j]);
+			}
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_tunable_initial_value", "gauge",
+			       "Tunable value before tuning.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			for (j = 0; j < t->desc.num_values &&
+				    j < BPFTUNE_MAX_VALUES; j++) {
+				fprintf(fp, "bpftune_tunable_initial_value{");
+				bpftune_metrics_label(fp, "tuner", tuner->name);
+				fputc(',', fp);
+				bpftune_metrics_label(fp, "tunable",
+						      t->desc.name);
+				fprintf(fp, ",index=\"%u\"} %ld\n", j,
+					t->initial_values[j]);
+			}
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_tuner_disabled", "gauge",
+			       "Tuner disabled in network namespace.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		bpftuner_for_each_netns(tuner, netns) {
+			if (netns->state < BPFTUNE_MANUAL)
+				continue;
+			fprintf(fp, "bpftune_tuner_disabled{");
+			bpftune_metrics_label(fp, "tuner", tuner->name);
+			bpftune_metrics_netns(fp, tuner, netns);
+			fprintf(fp, "} 1\n");
+		}
+	}
+
+	bpftune_metrics_header(fp, "bpftune_tunable_manual", "gauge",
+			       "Tunable manually overridden in network namespace.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		bpftuner_for_each_netns(tuner, netns) {
+			for (i = 0; i < tuner->num_tunables &&
+				    i < BPFTUNE_MAX_TUNABLES; i++) {
+				if (netns->tunable_state[i] != BPFTUNE_MANUAL)
+					continue;
+				fprintf(fp, "bpftune_tunable_manual{");
+				bpftune_metrics_label(fp, "tuner", tuner->name);
+				fputc(',', fp);
+				bpftune_metrics_label(fp, "tunable",
+						      tuner->tunables[i].desc.name);
+				bpftune_metrics_netns(fp, tuner, netns);
+				fprintf(fp, "} 1\n");
+			}
+		}
+	}
+
+	/* BPF run-time stats are only available if stats are enabled */
+	for (i = 0; bpftune_stats_fd >= 0 && i < ARRAY_SIZE(run_metrics); i++) {
+		bpftune_metrics_header(fp, run_metrics[i], "counter",
+				       i ? "BPF program run time." :
+					   "BPF program runs.");
+		bpftune_metrics_for_each_tuner(tuner) {
+			if (!tuner->obj)
+				continue;
+			bpftune_metrics_run_stats(fp, run_metrics[i],
+						  tuner->name,
+						  &tuner->run_stats, i);
+		}
+		if (tcp_hook_bpf)
+			bpftune_metrics_run_stats(fp, run_metrics[i],
+						  "tcp_hook",
+						  &bpftune_shared_run_stats, i);
+	}
+
+	bpftune_metrics_header(fp, "bpftune_handler_seconds_total", "counter",
+			       "Time spent handling events in bpftune.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		fprintf(fp, "bpftune_handler_seconds_total{");
+		bpftune_metrics_label(fp, "tuner", tuner->name);
+		fprintf(fp, "} %.9f\n", tuner->handler_time_ns / 1e9);
+	}
+
+	bpftune_metrics_header(fp, "bpftune_sample_shift", "gauge",
+			       "BPF programs run for 1 in 2^sample_shift calls.");
+	bpftune_metrics_for_each_tuner(tuner) {
+		fprintf(fp, "bpftune_sample_shift{");
+		bpftune_metrics_label(fp, "tuner", tuner->name);
+		fprintf(fp, "} %u\n", tuner->sample_shift);
+	}
+
+	if (fclose(fp) || rename(tmpfile, bpftune_metrics_file)) {
+		bpftune_log(LOG_DEBUG, "could not write metrics to '%s': %s\n",
+			    bpftune_metrics_file, strerror(errno));
+		unlink(tmpfile);
+	}
+}
+
+/* Overhead governor.  Every BPFTUNE_GOVERNOR_INTERVAL seconds, compare each
+ * tuner's CPU use (BPF program run time plus event handler time) against
+ * the per-tuner budget.  A tuner over budget first has BPF-side sampling
+ * raised one step (programs using bpftune_sample_skip() then only run for
+ * 1 in 2^sample_shift calls); once at BPFTUNE_SAMPLE_SHIFT_MAX, the
+ * attached program in tuner->governed_progs with the most run time over
+ * the last interval is detached.  After BPFTUNE_GOVERNOR_RECOVER intervals
+ * under half the budget, one step is undone, most recent first.
+ */
+#define BPFTUNE_GOVERNOR_INTERVAL	5	/* seconds */
+#define BPFTUNE_GOVERNOR_RECOVER	3	/* intervals */
+
+/* per-tuner budget in percent of one CPU; 0 (the default) disables the
+ * governor.
+ */
+static double bpftune_cpu_budget;
+
+void bpftune_set_cpu_budget(double pct)
+{
+	bpftune_cpu_budget = pct;
+}
+
+static void bpftuner_sample_shift_set(struct bpftuner *tuner,
+				      unsigned int shift)
+{
+	tuner->sample_shift = shift;
+	if (tuner->bpf_sample_shift)
+		*tuner->bpf_sample_shift = shift;
+}
+
+static bool bpftuner_governor_detached(struct bpftuner *tuner, int idx)
+{
+	unsigned int i;
+
+	for (i = 0; i < tuner->governor_num_detached; i++) {
+		if (tuner->governor_detached[i] == idx)
+			return true;
+	}
+	return false;
+}
+
+static void bpftuner_governor_forget(struct bpftuner *tuner, int idx)
+{
+	unsigned int i, j;
+
+	for (i = 0, j = 0; i < tuner->governor_num_detached; i++) {
+		if (tuner->governor_detached[i] != idx)
+			tuner->governor_detached[j++] = tuner->governor_detached[i];
+	}
+	tuner->governor_num_detached = j;
+}
+
+/* called with caps set; run time of attached program "name", including time
+ * recorded by hook programs run via the dispatcher.  Returns -1 if it is
+ * not attached.
+ */
+static int bpftuner_governed_prog_time(struct bpftuner *tuner,
+				       const char *name, __u64 *run_time_ns)
+{
+	struct bpf_prog_skeleton *ps = bpftuner_prog_skel(tuner, name);
+	struct bpf_prog_info info = {};
+	__u32 len = sizeof(info);
+	int id;
+
+	if (!ps || bpf_program__fd(*ps->prog) < 0 ||
+	    !bpftuner_prog_attached(tuner, name) ||
+	    bpf_obj_get_info_by_fd(bpf_program__fd(*ps->prog), &info, &len))
+		return -1;
+	/* hook programs are tail-called, so time themselves */
+	id = bpftuner_tcp_hook_id(tuner, *ps->prog);
+	if (id >= 0)
+		bpftune_tcp_hooks_run_time(tuner, id, &info.run_time_ns,
+					   &info.run_cnt);
+	*run_time_ns = info.run_time_ns;
+	return 0;
+}
+
+/* called with caps set every governor interval; run time of each of
+ * tuner->governed_progs over the interval, 0 if not attached.
+ */
+static void bpftuner_governed_progs_sample(struct bpftuner *tuner,
+					   __u64 *interval_ns)
+{
+	unsigned int i;
+
+	for (i = 0; tuner->governed_progs && tuner->governed_progs[i] &&
+		    i < BPFTUNE_GOVERNOR_MAX_PROGS; i++) {
+		__u64 run_time_ns = 0, last = tuner->governor_prog_ns[i];
+
+		interval_ns[i] = 0;
+		if (bpftuner_governed_prog_time(tuner, tuner->governed_progs[i],
+						&run_time_ns))
+			continue;
+		/* hook program time restarts when re-registered */
+		interval_ns[i] = run_time_ns >= last ? run_time_ns - last :
+						       run_time_ns;
+		tuner->governor_prog_ns[i] = run_time_ns;
+	}
+}
+
+/* called with caps set; detach the governed program with the most run time
+ * over the last interval.
+ */
+static bool bpftuner_governor_detach(struct bpftuner *tuner,
+				     __u64 *interval_ns)
+{
+	struct bpf_prog_skeleton *ps = NULL;
+	__u64 max_run_time_ns = 0;
+	unsigned int i;
+
+	if (tuner->governor_num_detached >= BPFTUNE_GOVERNOR_MAX_DETACH)
+		return false;
+	for (i = 0; tuner->governed_progs && tuner->governed_progs[i] &&
+		    i < BPFTUNE_GOVERNOR_MAX_PROGS; i++) {
+		if (interval_ns[i] <= max_run_time_ns ||
+		    !bpftuner_prog_attached(tuner, tuner->governed_progs[i]))
+			continue;
+		ps = bpftuner_prog_skel(tuner, tuner->governed_progs[i]);
+		max_run_time_ns = interval_ns[i];
+	}
+	if (!ps)
+		return false;
+	bpftuner_prog_detach(tuner, ps->name);
+	tuner->governor_detached[tuner->governor_num_detached++] =
+		ps - tuner->skeleton->progs;
+	bpftune_log(BPFTUNE_LOG_LEVEL, "%s: over CPU budget; detached '%s'\n",
+		    tuner->name, ps->name);
+	return true;
+}
+
+static void bpftuner_governor(struct bpftuner *tuner, unsigned long elapsed)
+{
+	struct bpf_object_skeleton *s = tuner->skeleton;
+	__u64 handler_ns = tuner->handler_time_ns - tuner->governor_handler_ns;
+	__u64 interval_ns[BPFTUNE_GOVERNOR_MAX_PROGS] = {};
+	double pct;
+
+	bpftuner_run_stats(tuner, &tuner->governor_stats);
+	bpftuner_governed_progs_sample(tuner, interval_ns);
+	tuner->governor_handler_ns = tuner->handler_time_ns;
+	/* percent of one CPU */
+	pct = (100.0 * (tuner->governor_stats.interval_run_time_ns +
+			handler_ns)) / ((double)elapsed * 1000);
+
+	if (pct > bpftune_cpu_budget) {
+		tuner->governor_calm = 0;
+		if (tuner->sample_shift < BPFTUNE_SAMPLE_SHIFT_MAX) {
+			bpftuner_sample_shift_set(tuner, tuner->sample_shift + 1);
+			bpftune_log(BPFTUNE_LOG_LEVEL,
+				    "%s: using %.2f%% of a CPU (budget %.2f%%); sampling 1 in %u events\n",
+				    tuner->name, pct, bpftune_cpu_budget,
+				    1U << tuner->sample_shift);
+		} else if (!bpftuner_governor_detach(tuner, interval_ns)) {
+			bpftune_log(LOG_DEBUG, "%s: using %.2f%% of a CPU, nothing left to detach\n",
+				    tuner->name, pct);
+		}
+		return;
+	}
+	if (pct >= bpftune_cpu_budget / 2 ||
+	    (!tuner->sample_shift && !tuner->governor_num_detached) ||
+	    ++tuner->governor_calm < BPFTUNE_GOVERNOR_RECOVER)
+		return;
+	tuner->governor_calm = 0;
+	if (tuner->governor_num_detached) {
+		int idx = tuner->governor_detached[--tuner->governor_num_detached];
+
+		if (__bpftuner_prog_attach(tuner, s->progs[idx].name) == 0)
+			bpftune_log(BPFTUNE_LOG_LEVEL, "%s: reattached '%s'\n",
+				    tuner->name, s->progs[idx].name);
+	} else {
+		bpftuner_sample_shift_set(tuner, tuner->sample_shift - 1);
+		bpftune_log(BPFTUNE_LOG_LEVEL, "%s: sampling 1 in %u events\n",
+			    tuner->name, 1U << tuner->sample_shift);
+	}
+}
+
+static void bpftune_governor(void)
+{
+	unsigned long now = bpftune_now_usecs();
+	unsigned long elapsed = now - bpftune_governor_last;
+	struct bpftuner *tuner;
+
+	if (bpftune_cpu_budget <= 0 || bpftune_stats_fd < 0 ||
+	    elapsed < BPFTUNE_GOVERNOR_INTERVAL * 1000000UL)
+		return;
+	bpftune_governor_last = now;
+	if (bpftune_cap_add())
+		return;
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state != BPFTUNE_ACTIVE || !tuner->obj)
+			continue;
+		bpftuner_governor(tuner, elapsed);
+	}
+	bpftune_cap_drop();
+}
+
+static void bpftune_control_poll(void);
+static void bpftune_rollback_check(void);
+static void bpftune_config_reload(void);
+
+int bpftune_ring_buffer_poll(void *ring_buffer, int interval)
+{
+	struct ring_buffer *rb = ring_buffer;
+	int err;
+
+	while (!ring_buffer_done) {
+		err = ring_buffer__poll(rb, interval);
+		/* interrupted by signal, e.g. SIGHUP for config reload */
+		if (err < 0 && err != -EINTR) {
+			bpftune_log_bpf_err(err, "ring_buffer__poll: %s\n");
+			break;
+		}
+		bpftune_config_reload();
+		if (bpftune_state_file[0] &&
+		    bpftune_now_secs() - bpftune_state_last_save >=
+		    BPFTUNE_STATE_INTERVAL)
+			bpftune_state_save();
+		bpftune_tuners_periodic();
+		if (bpftune_now_usecs() - bpftune_stats_last >=
+		    BPFTUNE_STATS_INTERVAL * 1000000UL)
+			bpftune_stats_update();
+		bpftune_governor();
+		bpftune_rollback_check();
+		if (bpftune_metrics_file[0] &&
+		    bpftune_now_secs() - bpftune_metrics_last >=
+		    BPFTUNE_STATS_INTERVAL)
+			bpftune_metrics_write();
+		bpftune_control_poll();
+	}
+	ring_buffer__free(rb);
+	return 0;
+}
+
+void bpftune_ring_buffer_fini(__attribute__((unused)) void *ring_buffer)
+{
+	ring_buffer_done = true;
+}
+
+
+#define BPFTUNE_PROC_SYS	"/proc/sys/"
+void bpftune_sysctl_name_to_path(const char *name, char *path, size_t path_sz)
+{
+	size_t i;
+
+	snprintf(path, path_sz, BPFTUNE_PROC_SYS "%s", name);
+	for (i = 0; i < path_sz && path[i] != 0; i++)
+		if (path[i] == '.')
+			path[i] = '/';
+}
+
+/* index of sysctl tunables keyed by the final component of their path;
+ * entries hold the last two path components ("ipv4/tcp_rmem") since that
+ * is what the sysctl tuner sees on sysctl write.  Built as tuners are
+ * added, so override detection is a single hash lookup and exact compare
+ * rather than a scan of all tunables.
+ */
+#define BPFTUNE_SYSCTL_INDEX_SIZE	256
+
+struct bpftune_sysctl_index_entry {
+	struct bpftune_sysctl_index_entry *next;
+	char path[BPFTUNE_MAX_NAME];	/* "dir/name" */
+	const char *name;		/* "name" within path */
+	unsigned int tuner_id;
+	unsigned int tunable_id;
+};
+
+static struct bpftune_sysctl_index_entry *
+bpftune_sysctl_index[BPFTUNE_SYSCTL_INDEX_SIZE];
+static pthread_mutex_t bpftune_sysctl_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int bpftune_sysctl_index_hash(const char *name)
+{
+	unsigned int hash = 5381;
+
+	for (; *name; name++)
+		hash = ((hash << 5) + hash) + (unsigned char)*name;
+	return hash % BPFTUNE_SYSCTL_INDEX_SIZE;
+}
+
+static void bpftune_sysctl_index_add(struct bpftuner *tuner)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&bpftune_sysctl_index_lock);
+	for (i = 0; i < tuner->num_tunables; i++) {
+		struct bpftunable *tunable = &tuner->tunables[i];
+		struct bpftune_sysctl_index_entry *e;
+		char path[PATH_MAX];
+		char *name, *dir;
+		unsigned int h;
+
+		if (tunable->desc.type != BPFTUNABLE_SYSCTL)
+			continue;
+		bpftune_sysctl_name_to_path(tunable->desc.name, path,
+					    sizeof(path));
+		name = strrchr(path, '/');
+		if (!name)
+			continue;
+		*name = '\0';
+		dir = strrchr(path, '/');
+		*name = '/';
+		dir = dir ? dir + 1 : path;
+		e = calloc(1, sizeof(*e));
+		if (!e) {
+			bpftune_log(LOG_ERR, "no memory to index '%s'\n",
+				    tunable->desc.name);
+			break;
+		}
+		strncpy(e->path, dir, sizeof(e->path) - 1);
+		e->name = strrchr(e->path, '/') + 1;
+		e->tuner_id = tuner->id;
+		e->tunable_id = i;
+		h = bpftune_sysctl_index_hash(e->name);
+		e->next = bpftune_sysctl_index[h];
+		bpftune_sysctl_index[h] = e;
+	}
+	pthread_mutex_unlock(&bpftune_sysctl_index_lock);
+}
+
+/* remove index entries for tuner when it is finalized, since its tunables
+ * are freed and its id may be reused.
+ */
+static void bpftune_sysctl_index_del(struct bpftuner *tuner)
+{
+	struct bpftune_sysctl_index_entry **ep, *e;
+	unsigned int h;
+
+	pthread_mutex_lock(&bpftune_sysctl_index_lock);
+	for (h = 0; h < BPFTUNE_SYSCTL_INDEX_SIZE; h++) {
+		ep = &bpftune_sysctl_index[h];
+		while ((e = *ep) != NULL) {
+			if (e->tuner_id == tuner->id) {
+				*ep = e->next;
+				free(e);
+			} else {
+				ep = &e->next;
+			}
+		}
+	}
+	pthread_mutex_unlock(&bpftune_sysctl_index_lock);
+}
+
+int bpftune_sysctl_tunables_find(const char *path,
+				 struct bpftune_sysctl_match *matches,
+				 unsigned int max_matches)
+{
+	struct bpftune_sysctl_index_entry *e;
+	unsigned int num = 0;
+	const char *name;
+	bool full_path;
+
+	name = strrchr(path, '/');
+	full_path = name != NULL;
+	name = full_path ? name + 1 : path;
+
+	pthread_mutex_lock(&bpftune_sysctl_index_lock);
+	for (e = bpftune_sysctl_index[bpftune_sysctl_index_hash(name)];
+	     e != NULL && num < max_matches; e = e->next) {
+		struct bpftuner *tuner;
+
+		/* if we only have the final component of the path, match
+		 * on that alone.
+		 */
+		if (strcmp(full_path ? e->path : e->name, path) != 0)
+			continue;
+		tuner = bpftune_tuner(e->tuner_id);
+		if (!tuner || tuner->state != BPFTUNE_ACTIVE)
+			continue;
+		matches[num].tuner = tuner;
+		matches[num].tunable = bpftuner_tunable(tuner, e->tunable_id);
+		num++;
+	}
+	pthread_mutex_unlock(&bpftune_sysctl_index_lock);
+
+	return num;
+}
+
+int bpftune_sysctl_read(int netns_fd, const char *name, long *values)
+{
+	int i, orig_netns_fd = 0, num_values = 0;
+	char path[PATH_MAX];
+	int err = 0;	
+	FILE *fp;
+
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+
+	bpftune_sysctl_name_to_path(name, path, sizeof(path));
+
+	err = bpftune_netns_set(netns_fd, &orig_netns_fd);
+	if (err < 0)
+		goto out_unset;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		err = -errno;
+		bpftune_log(LOG_ERR, "could not open %s (netns fd %d) for reading: %s\n",
+			    path, netns_fd, strerror(-err));
+		goto out;
+	}
+	num_values = fscanf(fp, "%ld %ld %ld",
+			    &values[0], &values[1], &values[2]);
+	if (num_values == 0)
+		err = -ENOENT;
+	else if (num_values < 0)
+		err = -errno;
+	fclose(fp);
+
+	if (err) {
+		bpftune_log(LOG_ERR, "could not read from %s: %s\n", path,
+			    strerror(-err));
+		goto out;
+	}
+
+	for (i = 0; i < num_values; i++) {
+		bpftune_log(LOG_DEBUG, "Read %s[%d] = %ld\n",
+			    name, i, values[i]);
+	}
+
+out:
+	bpftune_netns_set(orig_netns_fd, NULL);
+out_unset:
+	bpftune_cap_drop();
+	return err ? err : num_values;
+}
+
+int bpftune_sysctl_write(int netns_fd, const char *name, __u8 num_values, long *values)
+{
+	long old_values[BPFTUNE_MAX_VALUES] = {};
+	int i, err = 0, orig_netns_fd = 0;
+	int old_num_values;
+	char path[PATH_MAX];
+	FILE *fp;
+
+	bpftune_sysctl_name_to_path(name, path, sizeof(path));
+
+	bpftune_log(LOG_DEBUG, "writing sysctl '%s' for netns_fd %d\n",
+		    path, netns_fd);
+
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+	err = bpftune_netns_set(netns_fd, &orig_netns_fd);
+	if (err < 0)
+		goto out_unset;
+
+	/* If value is already set to val, do nothing. */
+	old_num_values = bpftune_sysctl_read(0, name, old_values);
+	if (old_num_values < 0) {
+		err = old_num_values;
+		goto out;
+	}
+	if (num_values == old_num_values) {
+		for (i = 0; i < num_values; i++) {
+			if (old_values[i] != values[i])
+				break;
+		}
+		if (i == num_values)
+			goto out;
+	}
+        fp = fopen(path, "w");
+        if (!fp) {
+                err = -errno;
+                bpftune_log(LOG_DEBUG, "could not open %s for writing: %s\n",
+			    path, strerror(-err));
+		goto out;
+        }
+
+	for (i = 0; i < num_values; i++)
+		fprintf(fp, "%ld ", values[i]);
+        fclose(fp);
+
+	for (i = 0; i < num_values; i++) {
+		bpftune_log(LOG_DEBUG, "Wrote %s[%d] = %ld\n",
+			    name, i, values[i]);
+	}
+out:
+	bpftune_netns_set(orig_netns_fd, NULL);
+out_unset:
+	bpftune_cap_drop();
+        return err;
+}
+
+int bpftuner_tunables_init(struct bpftuner *tuner, unsigned int num_descs,
+			   struct bpftunable_desc *descs,
+			   unsigned int num_scenarios,
+			   struct bpftunable_scenario *scenarios)
+{
+	unsigned int i;
+
+	tuner->scenarios = scenarios;
+	tuner->num_scenarios = num_scenarios;
+	tuner->tunables = calloc(num_descs, sizeof(struct bpftunable));
+	if (!tuner->tunables) {
+		bpftune_log(LOG_DEBUG, "no memory to alloc tunables for %s\n",
+			    tuner->name);
+		return -ENOMEM;
+	}
+	tuner->num_tunables = num_descs;
+	for (i = 0; i < num_descs; i++) {
+		int num_values;
+
+		bpftune_log(LOG_DEBUG, "handling desc %ld/%ld\n", i, num_descs);
+		memcpy(&tuner->tunables[i].desc, &descs[i], sizeof(*descs));
+
+		if (descs[i].type != BPFTUNABLE_SYSCTL)
+			continue;
+		num_values = bpftune_sysctl_read(0, descs[i].name,
+				tuner->tunables[i].current_values);
+		if (num_values < 0) {
+			bpftune_log(LOG_ERR, "error reading tunable '%s': %s\n",
+				    descs[i].name, strerror(-num_values));
+			return num_values;
+		}
+		if (num_values != descs[i].num_values) {
+			bpftune_log(LOG_ERR, "error reading tunable '%s'; expected %d values, got %d\n",
+				    descs[i].num_values, num_values);
+			return -EINVAL;
+		}
+		memcpy(tuner->tunables[i].initial_values,
+		       tuner->tunables[i].current_values,
+		       sizeof(tuner->tunables[i].initial_values));
+	}
+	bpftuner_learning_rates_update(tuner);
+	bpftuner_limits_update(tuner);
+
+	return 0;
+}
+
+struct bpftunable *bpftuner_tunable(struct bpftuner *tuner, unsigned int index)
+{
+	if (index < tuner->num_tunables)
+		return &tuner->tunables[index];
+	return NULL;
+}
+
+static void bpftuner_tunable_stats_update(struct bpftunable *tunable,
+					  unsigned int scenario, bool global_ns)
+{
+	if (global_ns)
+		(tunable->stats.global_ns[scenario])++;
+	else
+		(tunable->stats.nonglobal_ns[scenario])++;
+	bpftune_log(LOG_DEBUG," updated stat for tunable %s, scenario %d: %lu\n",
+		    tunable->desc.name, scenario,
+		    global_ns ? tunable->stats.global_ns[scenario] :
+				tunable->stats.nonglobal_ns[scenario]);
+
+}
+
+static void bpftuner_scenario_log(struct bpftuner *tuner, unsigned int tunable,
+				  unsigned int scenario, int netns_fd,
+				  bool summary,
+				  const char *fmt, va_list args)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	bool global_ns = netns_fd == 0;
+
+	if (summary) {
+		unsigned long count;
+
+		count = global_ns ? t->stats.global_ns[scenario] :
+				    t->stats.nonglobal_ns[scenario];
+		if (!count)
+			return;
+		bpftune_log(BPFTUNE_LOG_LEVEL, "Summary: scenario '%s' occurred %ld times for tunable '%s' in %sglobal ns. %s\n",
+			    tuner->scenarios[scenario].name, count,
+			    t->desc.name,
+			    global_ns ? "" : "non-",
+			    tuner->scenarios[scenario].description);
+		if (t->desc.type == BPFTUNABLE_SYSCTL) {
+			char oldvals[PATH_MAX] = { };
+			char newvals[PATH_MAX] = { };
+			char s[PATH_MAX];
+			__u8 i;
+
+			for (i = 0; i < t->desc.num_values; i++) {
+				snprintf(s, sizeof(s), "%ld ",
+					 t->initial_values[i]);
+				strcat(oldvals, s);
+				snprintf(s, sizeof(s), "%ld ",
+					 t->current_values[i]);
+				strcat(newvals, s);
+			}
+			bpftune_log(BPFTUNE_LOG_LEVEL, "sysctl '%s' %s from (%s) -> (%s)\n",
+				    t->desc.name,
+				    bpftuner_dry_run(tuner) ?
+				    "would have changed" : "changed",
+				    oldvals, newvals);
+		}
+	} else {
+		bpftune_log(BPFTUNE_LOG_LEVEL, "Scenario '%s' occurred for tunable '%s' in %sglobal ns. %s\n",
+			    tuner->scenarios[scenario].name,
+			    t->desc.name,
+			    global_ns ? "" : "non-",
+			    tuner->scenarios[scenario].description);
+		__bpftune_log(BPFTUNE_LOG_LEVEL, fmt, args);
+		bpftuner_tunable_stats_update(t, scenario, global_ns);
+	}
+}
+
+/* monotonic time in seconds */
+unsigned long bpftune_now_secs(void)
+{
+	struct timespec ts = {};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* global netns tunable state is stored in tuner->netns */
+static struct bpftuner_netns *bpftuner_tunable_netns(struct bpftuner *tuner,
+						     unsigned long cookie)
+{
+	if (!netns_cookie_supported || cookie == 0 ||
+	    cookie == global_netns_cookie)
+		return &tuner->netns;
+	return bpftuner_netns_from_cookie(tuner->id, cookie);
+}
+
+void bpftuner_tunable_netns_manual(struct bpftuner *tuner, unsigned int tunable,
+				   unsigned long cookie)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	struct bpftuner_netns *netns;
+
+	if (!t || tunable >= BPFTUNE_MAX_TUNABLES)
+		return;
+	netns = bpftuner_tunable_netns(tuner, cookie);
+	if (!netns) {
+		bpftuner_netns_init(tuner, cookie);
+		netns = bpftuner_tunable_netns(tuner, cookie);
+		if (!netns)
+			return;
+	}
+	bpftune_log(LOG_DEBUG, "setting state of '%s' in netns (cookie %ld) to manual for '%s'\n",
+		    t->desc.name, cookie, tuner->name);
+	netns->tunable_state[tunable] = BPFTUNE_MANUAL;
+	netns->tunable_manual_time[tunable] = bpftune_now_secs();
+}
+
+/* is tunable manually overridden in netns?  If a resume period is set and
+ * no manual changes have been made for that period, resume auto-tuning.
+ */
+static bool bpftuner_tunable_netns_is_manual(struct bpftuner *tuner,
+					     unsigned int tunable,
+					     unsigned long cookie)
+{
+	struct bpftuner_netns *netns = bpftuner_tunable_netns(tuner, cookie);
+	unsigned long quiet;
+
+	if (!netns || tunable >= BPFTUNE_MAX_TUNABLES ||
+	    netns->tunable_state[tunable] != BPFTUNE_MANUAL)
+		return false;
+	if (!bpftune_manual_resume)
+		return true;
+	quiet = bpftune_now_secs() - netns->tunable_manual_time[tunable];
+	if (quiet < bpftune_manual_resume)
+		return true;
+	bpftune_log(BPFTUNE_LOG_LEVEL,
+		    "no manual changes to '%s' for %lu seconds; resuming tuning in netns (cookie %ld)\n",
+		    tuner->tunables[tunable].desc.name, quiet, cookie);
+	netns->tunable_state[tunable] = BPFTUNE_ACTIVE;
+	return false;
+}
+
+/* Automatic rollback of regressing changes.  When enabled (see
+ * bpftune_set_rollback()), health metrics for the netns are read before
+ * each tunable change and again once the verification window has passed.
+ * Retransmits, drops and TCP memory pressure transitions per segment sent
+ * after the change are compared with the same ratios from the previous
+ * snapshot of the netns (or boot) up to the change; srtt is the mean for
+ * established TCP sockets at each snapshot.  If the change made any of
+ * these measurably worse, it is reverted and the rejected values are not
+ * tried again for BPFTUNE_ROLLBACK_HOLDOFF seconds.  Further changes to a
+ * tunable during verification extend the window, and a rollback reverts
+ * them all.
+ */
+#define BPFTUNE_ROLLBACK_HOLDOFF	600	/* seconds */
+#define BPFTUNE_ROLLBACK_MIN_SEGS	1000	/* fewer is inconclusive */
+#define BPFTUNE_ROLLBACK_MIN_PPM	1000	/* 0.1% */
+#define BPFTUNE_ROLLBACK_MIN_SRTT_US	1000
+
+static unsigned long bpftune_rollback_window;
+
+void bpftune_set_rollback(unsigned long secs)
+{
+	bpftune_rollback_window = secs;
+}
+
+struct bpftune_health {
+	unsigned long out_segs;
+	unsigned long retrans_segs;
+	unsigned long drops;
+	unsigned long mem_pressures;
+	unsigned long srtt_us;
+};
+
+enum bpftune_rollback_state {
+	BPFTUNE_ROLLBACK_VERIFY,	/* change awaiting verification */
+	BPFTUNE_ROLLBACK_REJECTED,	/* change rolled back */
+};
+
+struct bpftune_rollback {
+	struct bpftune_rollback *next;
+	enum bpftune_rollback_state state;
+	struct bpftuner *tuner;
+	unsigned int tunable;
+	unsigned long netns_cookie;
+	__u8 num_values;
+	long old_values[BPFTUNE_MAX_VALUES];
+	long new_values[BPFTUNE_MAX_VALUES];
+	unsigned long time;		/* end of verification/holdoff */
+	struct bpftune_health prev;	/* previous snapshot of netns */
+	struct bpftune_health before;	/* snapshot prior to change */
+};
+
+/* last health snapshot per netns */
+struct bpftune_health_snapshot {
+	struct bpftune_health_snapshot *next;
+	unsigned long netns_cookie;
+	struct bpftune_health health;
+};
+
+static struct bpftune_rollback *bpftune_rollbacks;
+/* changes being verified, outside of bpftune_rollback_lock */
+static struct bpftune_rollback *bpftune_rollbacks_due;
+static struct bpftune_health_snapshot *bpftune_health_snapshots;
+static pthread_mutex_t bpftune_rollback_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* add up fields in /proc/net/{snmp,netstat} format file, where a line of
+ * field names is followed by a line of their values.
+ */
+static int bpftune_net_stats_read(const char *file, const char *prefix,
+				  const char **names, unsigned int num_names,
+				  unsigned long *value)
+{
+	char names_line[4096], values_line[4096];
+	char *nsave = NULL, *vsave = NULL, *n, *v;
+	int found = 0;
+	unsigned int i;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return -errno;
+	while (fgets(names_line, sizeof(names_line), fp) &&
+	       fgets(values_line, sizeof(values_line), fp)) {
+		if (strncmp(names_line, prefix, strlen(prefix)))
+			continue;
+		for (n = strtok_r(names_line, " \n", &nsave),
+		     v = strtok_r(values_line, " \n", &vsave);
+		     n && v;
+		     n = strtok_r(NULL, " \n", &nsave),
+		     v = strtok_r(NULL, " \n", &vsave)) {
+			for (i = 0; i < num_names; i++) {
+				if (strcmp(n, names[i]) == 0) {
+					*value += strtoul(v, NULL, 10);
+					found++;
+				}
+			}
+		}
+		break;
+	}
+	fclose(fp);
+	return found;
+}
+
+/* mean srtt in usecs of established TCP sockets, via sock_diag */
+static unsigned long bpftune_tcp_srtt_us(void)
+{
+	int families[] = { AF_INET, AF_INET6 };
+	unsigned long total = 0, count = 0;
+	long buf[8192 / sizeof(long)];
+	unsigned int f;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	if (fd < 0)
+		return 0;
+	for (f = 0; f < ARRAY_SIZE(families); f++) {
+		struct {
+			struct nlmsghdr nlh;
+			struct inet_diag_req_v2 req;
+		} req = {
+			.nlh = {
+				.nlmsg_len = sizeof(req),
+				.nlmsg_type = SOCK_DIAG_BY_FAMILY,
+				.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+			},
+			.req = {
+				.sdiag_family = families[f],
+				.sdiag_protocol = IPPROTO_TCP,
+				.idiag_ext = 1 << (INET_DIAG_INFO - 1),
+				.idiag_states = 1 << TCP_ESTABLISHED,
+			},
+		};
+		bool done = false;
+
+		if (send(fd, &req, sizeof(req), 0) < 0)
+			break;
+		while (!done) {
+			struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+			int len = recv(fd, buf, sizeof(buf), 0);
+
+			if (len <= 0)
+				break;
+			for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+				struct inet_diag_msg *msg = NLMSG_DATA(nlh);
+				struct rtattr *attr;
+				int attrlen;
+
+				if (nlh->nlmsg_type == NLMSG_DONE ||
+				    nlh->nlmsg_type == NLMSG_ERROR) {
+					done = true;
+					break;
+				}
+				attrlen = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg));
+				for (attr = (struct rtattr *)(msg + 1);
+				     RTA_OK(attr, attrlen);
+				     attr = RTA_NEXT(attr, attrlen)) {
+					struct tcp_info *info = RTA_DATA(attr);
+
+					if (attr->rta_type != INET_DIAG_INFO ||
+					    RTA_PAYLOAD(attr) < sizeof(*info))
+						continue;
+					total += info->tcpi_rtt;
+					count++;
+				}
+			}
+		}
+	}
+	close(fd);
+	return count ? total / count : 0;
+}
+
+static int bpftune_health_read(int netns_fd, struct bpftune_health *health)
+{
+	static const char *sent[] = { "OutSegs" };
+	static const char *retrans[] = { "RetransSegs" };
+	static const char *drops[] = { "ListenDrops", "TCPBacklogDrop",
+				       "TCPRcvQDrop", "TCPZeroWindowDrop" };
+	static const char *pressures[] = { "TCPMemoryPressures" };
+	const char *snmp = "/proc/thread-self/net/snmp";
+	const char *netstat = "/proc/thread-self/net/netstat";
+	int err, orig_netns_fd = 0;
+
+	memset(health, 0, sizeof(*health));
+	err = bpftune_netns_set(netns_fd, &orig_netns_fd);
+	if (err < 0)
+		return err;
+	err = bpftune_net_stats_read(snmp, "Tcp:", sent, ARRAY_SIZE(sent),
+				     &health->out_segs);
+	if (err >= 0)
+		err = bpftune_net_stats_read(snmp, "Tcp:", retrans,
+					     ARRAY_SIZE(retrans),
+					     &health->retrans_segs);
+	if (err >= 0)
+		err = bpftune_net_stats_read(netstat, "TcpExt:", drops,
+					     ARRAY_SIZE(drops), &health->drops);
+	if (err >= 0)
+		err = bpftune_net_stats_read(netstat, "TcpExt:", pressures,
+					     ARRAY_SIZE(pressures),
+					     &health->mem_pressures);
+	if (err >= 0)
+		health->srtt_us = bpftune_tcp_srtt_us();
+	bpftune_netns_set(orig_netns_fd, NULL);
+	if (orig_netns_fd > 0)
+		close(orig_netns_fd);
+	return err < 0 ? err : 0;
+}
+
+/* called with bpftune_rollback_lock held; returns previous snapshot */
+static struct bpftune_health bpftune_health_snapshot_set(unsigned long cookie,
+							 struct bpftune_health *health)
+{
+	struct bpftune_health_snapshot *s;
+	struct bpftune_health prev = {};
+
+	for (s = bpftune_health_snapshots; s; s = s->next) {
+		if (s->netns_cookie == cookie)
+			break;
+	}
+	if (!s) {
+		s = calloc(1, sizeof(*s));
+		if (!s)
+			return prev;
+		s->netns_cookie = cookie;
+		s->next = bpftune_health_snapshots;
+		bpftune_health_snapshots = s;
+	}
+	prev = s->health;
+	s->health = *health;
+	return prev;
+}
+
+/* is n_after per segs_after measurably worse than n_before per segs_before? */
+static bool bpftune_health_ratio_worse(unsigned long n_before,
+				       unsigned long segs_before,
+				       unsigned long n_after,
+				       unsigned long segs_after)
+{
+	unsigned long before = segs_before ? n_before * 1000000 / segs_before : 0;
+	unsigned long after = segs_after ? n_after * 1000000 / segs_after : 0;
+
+	return after > before + before / 2 + BPFTUNE_ROLLBACK_MIN_PPM;
+}
+
+/* returns the health metric made worse by the change, or NULL */
+static const char *bpftune_health_worse(struct bpftune_rollback *r,
+					struct bpftune_health *after)
+{
+	struct bpftune_health *prev = &r->prev, *before = &r->before;
+	unsigned long segs_before = before->out_segs - prev->out_segs;
+	unsigned long segs_after = after->out_segs - before->out_segs;
+
+	if (segs_after < BPFTUNE_ROLLBACK_MIN_SEGS)
+		return NULL;
+	if (bpftune_health_ratio_worse(before->retrans_segs - prev->retrans_segs,
+				       segs_before,
+				       after->retrans_segs - before->retrans_segs,
+				       segs_after))
+		return "retransmits";
+	if (bpftune_health_ratio_worse(before->drops - prev->drops, segs_before,
+				       after->drops - before->drops, segs_after))
+		return "drops";
+	if (bpftune_health_ratio_worse(before->mem_pressures - prev->mem_pressures,
+				       segs_before,
+				       after->mem_pressures - before->mem_pressures,
+				       segs_after))
+		return "TCP memory pressure";
+	if (before->srtt_us &&
+	    after->srtt_us > before->srtt_us + max(before->srtt_us / 2,
+						   BPFTUNE_ROLLBACK_MIN_SRTT_US))
+		return "srtt";
+	return NULL;
+}
+
+/* called with bpftune_rollback_lock held */
+static struct bpftune_rollback *bpftune_rollback_find(struct bpftuner *tuner,
+						      unsigned int tunable,
+						      unsigned long cookie,
+						      enum bpftune_rollback_state state)
+{
+	struct bpftune_rollback *r;
+
+	for (r = bpftune_rollbacks; r; r = r->next) {
+		if (r->tuner == tuner && r->tunable == tunable &&
+		    r->netns_cookie == cookie && r->state == state)
+			return r;
+	}
+	return NULL;
+}
+
+/* is a change to values a retry of a rejected change in netns; i.e. does
+ * it go as far or further in the same direction?
+ */
+static bool bpftuner_rollback_rejected(struct bpftuner *tuner,
+				       unsigned int tunable,
+				       unsigned long netns_cookie,
+				       __u8 num_values, long *values)
+{
+	struct bpftune_rollback *r;
+	bool rejected = false;
+	__u8 i;
+
+	pthread_mutex_lock(&bpftune_rollback_lock);
+	r = bpftune_rollback_find(tuner, tunable, netns_cookie,
+				  BPFTUNE_ROLLBACK_REJECTED);
+	if (r && bpftune_now_secs() < r->time) {
+		for (i = 0; i < num_values && i < r->num_values; i++) {
+			if ((r->new_values[i] > r->old_values[i] &&
+			     values[i] >= r->new_values[i]) ||
+			    (r->new_values[i] < r->old_values[i] &&
+			     values[i] <= r->new_values[i]))
+				rejected = true;
+		}
+	}
+	pthread_mutex_unlock(&bpftune_rollback_lock);
+	return rejected;
+}
+
+/* prior to change; record current values and health of netns */
+static int bpftuner_rollback_prepare(struct bpftuner *tuner,
+				     unsigned int tunable, int netns_fd,
+				     unsigned long netns_cookie,
+				     struct bpftune_rollback *r)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	int num_values, err;
+
+	num_values = bpftune_sysctl_read(netns_fd, t->desc.name,
+					 r->old_values);
+	if (num_values < 0)
+		return num_values;
+	err = bpftune_health_read(netns_fd, &r->before);
+	if (err)
+		return err;
+	r->tuner = tuner;
+	r->tunable = tunable;
+	r->netns_cookie = netns_cookie;
+	pthread_mutex_lock(&bpftune_rollback_lock);
+	r->prev = bpftune_health_snapshot_set(netns_cookie, &r->before);
+	pthread_mutex_unlock(&bpftune_rollback_lock);
+	return 0;
+}
+
+/* after change; verify it once the verification window has passed */
+static void bpftuner_rollback_verify(struct bpftune_rollback *prepared,
+				     __u8 num_values, long *values)
+{
+	struct bpftune_rollback *r;
+
+	pthread_mutex_lock(&bpftune_rollback_lock);
+	r = bpftune_rollback_find(prepared->tuner, prepared->tunable,
+				  prepared->netns_cookie,
+				  BPFTUNE_ROLLBACK_VERIFY);
+	if (!r) {
+		r = malloc(sizeof(*r));
+		if (!r)
+			goto out;
+		*r = *prepared;
+		r->state = BPFTUNE_ROLLBACK_VERIFY;
+		r->next = bpftune_rollbacks;
+		bpftune_rollbacks = r;
+	}
+	r->num_values = num_values;
+	memcpy(r->new_values, values, num_values * sizeof(*values));
+	r->time = bpftune_now_secs() + bpftune_rollback_window;
+out:
+	pthread_mutex_unlock(&bpftune_rollback_lock);
+}
+
+/* called for a change on bpftune_rollbacks_due, without
+ * bpftune_rollback_lock held.
+ */
+static void bpftune_rollback_revert(struct bpftuner *tuner,
+				    struct bpftune_rollback *r,
+				    const char *worse)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, r->tunable);
+	char vals[PATH_MAX] = {}, s[32];
+	int fd = 0, err;
+	__u8 i;
+
+	if (t->desc.namespaced) {
+		fd = bpftuner_netns_fd_from_cookie(tuner, r->netns_cookie);
+		if (fd < 0)
+			return;
+	}
+	for (i = 0; i < r->num_values; i++) {
+		snprintf(s, sizeof(s), "%ld ", r->old_values[i]);
+		strcat(vals, s);
+	}
+	err = bpftune_sysctl_write(fd, t->desc.name, r->num_values,
+				   r->old_values);
+	if (err) {
+		bpftune_log(LOG_ERR, "could not roll back '%s' to (%s): %s\n",
+			    t->desc.name, vals, strerror(-err));
+	} else {
+		bpftune_log(BPFTUNE_LOG_LEVEL, "rolled back '%s' to (%s) in netns (cookie %ld); %s got worse after change\n",
+			    t->desc.name, vals, r->netns_cookie, worse);
+		t->rollbacks++;
+		bpftuner_tunable_step_update(tuner, r->tunable,
+					     r->netns_cookie, r->num_values,
+					     r->old_values);
+		for (i = 0; i < r->num_values; i++)
+			t->current_values[i] = r->old_values[i];
+	}
+	if (fd > 0)
+		close(fd);
+}
+
+/* verify changes whose verification window has passed; called from the
+ * event loop.  Reading netns health means switching netns and sock_diag
+ * dumps, so due changes are moved to bpftune_rollbacks_due and verified
+ * without holding bpftune_rollback_lock.
+ */
+static void bpftune_rollback_check(void)
+{
+	struct bpftune_rollback *r, **prevp;
+	unsigned long now = bpftune_now_secs();
+
+	if (!bpftune_rollbacks)
+		return;
+	pthread_mutex_lock(&bpftune_rollback_lock);
+	for (prevp = &bpftune_rollbacks; (r = *prevp) != NULL; ) {
+		if (now < r->time) {
+			prevp = &r->next;
+			continue;
+		}
+		*prevp = r->next;
+		r->next = bpftune_rollbacks_due;
+		bpftune_rollbacks_due = r;
+	}
+	pthread_mutex_unlock(&bpftune_rollback_lock);
+
+	for (;;) {
+		struct bpftune_health after;
+		struct bpftuner *tuner;
+		const char *worse = NULL;
+		bool verify;
+		int fd = 0;
+
+		pthread_mutex_lock(&bpftune_rollback_lock);
+		r = bpftune_rollbacks_due;
+		tuner = r ? r->tuner : NULL;
+		verify = r && r->state == BPFTUNE_ROLLBACK_VERIFY && tuner &&
+			 tuner->state == BPFTUNE_ACTIVE;
+		pthread_mutex_unlock(&bpftune_rollback_lock);
+		if (!r)
+			break;
+		if (verify) {
+			struct bpftunable *t = bpftuner_tunable(tuner,
+								r->tunable);
+
+			if (t && t->desc.namespaced)
+				fd = bpftuner_netns_fd_from_cookie(tuner,
+								   r->netns_cookie);
+			if (fd >= 0 && !bpftune_health_read(fd, &after))
+				worse = bpftune_health_worse(r, &after);
+			else
+				verify = false;
+			if (fd > 0)
+				close(fd);
+		}
+		if (worse)
+			bpftune_rollback_revert(tuner, r, worse);
+
+		/* only this thread removes due changes, so r is still first */
+		pthread_mutex_lock(&bpftune_rollback_lock);
+		bpftune_rollbacks_due = r->next;
+		if (verify)
+			bpftune_health_snapshot_set(r->netns_cookie, &after);
+		if (worse && r->tuner) {
+			r->state = BPFTUNE_ROLLBACK_REJECTED;
+			r->time = now + BPFTUNE_ROLLBACK_HOLDOFF;
+			r->next = bpftune_rollbacks;
+			bpftune_rollbacks = r;
+		} else {
+			free(r);
+		}
+		pthread_mutex_unlock(&bpftune_rollback_lock);
+	}
+}
+
+static void bpftuner_rollback_fini(struct bpftuner *tuner)
+{
+	struct bpftune_rollback *r, **prevp;
+
+	pthread_mutex_lock(&bpftune_rollback_lock);
+	for (prevp = &bpftune_rollbacks; (r = *prevp) != NULL; ) {
+		if (r->tuner != tuner) {
+			prevp = &r->next;
+			continue;
+		}
+		*prevp = r->next;
+		free(r);
+	}
+	/* changes being verified are freed by bpftune_rollback_check() */
+	for (r = bpftune_rollbacks_due; r; r = r->next) {
+		if (r->tuner == tuner)
+			r->tuner = NULL;
+	}
+	pthread_mutex_unlock(&bpftune_rollback_lock);
+}
+
+int bpftuner_tunable_sysctl_write(struct bpftuner *tuner, unsigned int tunable,
+				  unsigned int scenario, unsigned long netns_cookie,
+				  __u8 num_values, long *values,
+				  const char *fmt, ...)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	long limited_values[BPFTUNE_MAX_VALUES];
+	long old_values[BPFTUNE_MAX_VALUES];
+	long *cur_values = t ? t->current_values : NULL;
+	struct bpftune_rollback prepared = {};
+	struct bpftuner_netns *netns;
+	int ret = 0, fd = 0;
+	bool rollback = false;
+	__u64 start;
+
+	if (!t) {
+		bpftune_log(LOG_ERR, "no tunable %d for tuner '%s'\n",
+			    tunable, tuner->name);
+		return -EINVAL;
+	}
+	netns = bpftuner_tunable_netns(tuner, netns_cookie);
+	if (netns) {
+		bpftune_log(LOG_DEBUG, "found netns (cookie %ld); state %d\n",
+			    netns_cookie, netns->state);
+		if (netns->state >= BPFTUNE_MANUAL) {
+			bpftune_log(LOG_DEBUG,
+				    "Skipping update of '%s' ; tuner '%s' is disabled in netns (cookie %ld)\n",
+				    t->desc.name, tuner->name, netns_cookie);
+			return 0;
+		}
+	}
+	if (bpftuner_tunable_netns_is_manual(tuner, tunable, netns_cookie)) {
+		bpftune_log(LOG_DEBUG,
+			    "Skipping update of '%s' ; manually set in netns (cookie %ld)\n",
+			    t->desc.name, netns_cookie);
+		return 0;
+	}
+
+	if (t->desc.namespaced) {
+		fd = bpftuner_netns_fd_from_cookie(tuner, netns_cookie);
+		if (fd < 0) {
+			bpftune_log(LOG_DEBUG, "could not get netns fd for cookie %ld\n",
+				    netns_cookie);
+			return 0;
+		}
+	}
+
+	if (num_values > BPFTUNE_MAX_VALUES)
+		num_values = BPFTUNE_MAX_VALUES;
+	memcpy(limited_values, values, num_values * sizeof(*values));
+	/* clamp only values being changed, as BPF programs do */
+	if (bpftune_sysctl_read(fd, t->desc.name, old_values) >= num_values)
+		cur_values = old_values;
+	ret = bpftuner_tunable_limit(tuner, tunable, netns_cookie, num_values,
+				     cur_values, limited_values);
+	if (ret < 0) {
+		bpftune_log(LOG_DEBUG,
+			    "Skipping update of '%s' ; denied by policy in netns (cookie %ld)\n",
+			    t->desc.name, netns_cookie);
+		if (fd > 0)
+			close(fd);
+		return 0;
+	}
+	if (ret > 0) {
+		bpftune_log(LOG_DEBUG, "limited update of '%s' per netns (cookie %ld) limits\n",
+			    t->desc.name, netns_cookie);
+		if (!memcmp(limited_values, cur_values,
+			    num_values * sizeof(*values))) {
+			if (fd > 0)
+				close(fd);
+			return 0;
+		}
+		values = limited_values;
+	}
+	ret = 0;
+
+	if (bpftune_rollback_window && !bpftuner_dry_run(tuner)) {
+		if (bpftuner_rollback_rejected(tuner, tunable, netns_cookie,
+					       num_values, values)) {
+			bpftune_log(LOG_DEBUG, "Skipping update of '%s' ; change was rolled back in netns (cookie %ld)\n",
+				    t->desc.name, netns_cookie);
+			if (fd > 0)
+				close(fd);
+			return 0;
+		}
+		rollback = bpftuner_rollback_prepare(tuner, tunable, fd,
+						     netns_cookie,
+						     &prepared) == 0;
+	}
+
+	if (bpftuner_dry_run(tuner)) {
+		ret = bpftuner_tunable_shadow(tuner, tunable, netns_cookie,
+					      num_values, values);
+	} else {
+		start = bpftune_now_nsecs();
+		ret = bpftune_sysctl_write(fd, t->desc.name, num_values,
+					   values);
+		t->write_time_ns += bpftune_now_nsecs() - start;
+		t->writes++;
+		if (ret)
+			t->write_errors++;
+	}
+	if (!ret) {
+		va_list args;
+		__u8 i;
+
+		va_start(args, fmt);
+		bpftuner_scenario_log(tuner, tunable, scenario, fd,
+				      false, fmt, args);
+		va_end(args);
+
+		bpftuner_tunable_step_update(tuner, tunable, netns_cookie,
+					     num_values, values);
+		if (rollback)
+			bpftuner_rollback_verify(&prepared, num_values, values);
+
+		for (i = 0; i < t->desc.num_values; i++)
+			t->current_values[i] = values[i];
+	}
+
+	if (fd > 0)
+		close(fd);
+
+	return ret;
+}
+
+/* record change to tunable in dry-run mode; the values are stored in the
+ * tuner's shadow_map so BPF programs see them via bpftune_shadow_value().
+ */
+int bpftuner_tunable_shadow(struct bpftuner *tuner, unsigned int tunable,
+			    unsigned long netns_cookie, __u8 num_values,
+			    long *values)
 {
 	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
-	struct bpftuner_netns *netns;
-	int ret = 0, fd = 0;
+	struct bpftune_tunable_key key = { .tunable = tunable };
+	struct bpftune_shadow shadow = {};
+	char vals[PATH_MAX] = {}, s[32];
+	struct bpf_map *map;
+	int fd, ret = 0;
+	__u8 i;
+
+	if (!t) {
+		bpftune_log(LOG_ERR, "no tunable %d for tuner '%s'\n",
+			    tunable, tuner->name);
+		return -EINVAL;
+	}
+	if (num_values > BPFTUNE_MAX_VALUES)
+		num_values = BPFTUNE_MAX_VALUES;
+	for (i = 0; i < num_values; i++) {
+		shadow.values[i] = values[i];
+		snprintf(s, sizeof(s), "%ld ", values[i]);
+		strcat(vals, s);
+	}
+	if (t->desc.namespaced)
+		key.netns_cookie = netns_cookie ? netns_cookie :
+						  global_netns_cookie;
+	t->dry_run_writes++;
+	bpftune_log(BPFTUNE_LOG_LEVEL, "dry run: '%s' would be set to (%s) in netns (cookie %ld); not changing\n",
+		    t->desc.name, vals, netns_cookie);
+
+	map = tuner->obj ? bpf_object__find_map_by_name(tuner->obj,
+						       "shadow_map") : NULL;
+	fd = map ? bpf_map__fd(map) : -1;
+	if (fd < 0)
+		return 0;
+	ret = bpftune_cap_add();
+	if (ret)
+		return ret;
+	if (bpf_map_update_elem(fd, &key, &shadow, BPF_ANY)) {
+		ret = -errno;
+		bpftune_log(LOG_DEBUG, "could not update shadow value of '%s': %s\n",
+			    t->desc.name, strerror(-ret));
+	}
+	bpftune_cap_drop();
+	return ret;
+}
+
+static int bpftuner_step_map_fd(struct bpftuner *tuner)
+{
+	struct bpf_map *map;
+
+	map = tuner->obj ? bpf_object__find_map_by_name(tuner->obj,
+						       "step_map") : NULL;
+	return map ? bpf_map__fd(map) : -1;
+}
+
+/* update adaptive step state for tunable in netns after a change to values
+ * (see BPFTUNE_STEP_WINDOW); state is kept in the tuner's step_map so
+ * BPF programs can use it via bpftune_tunable_step().
+ */
+void bpftuner_tunable_step_update(struct bpftuner *tuner, unsigned int tunable,
+				  unsigned long netns_cookie, __u8 num_values,
+				  long *values)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	struct bpftune_tunable_key key = { .tunable = tunable };
+	struct bpftune_step step = {};
+	long *old_values;
+	int fd, dir = 0;
+	__u8 i;
+
+	fd = bpftuner_step_map_fd(tuner);
+	if (!t || fd < 0)
+		return;
+	if (num_values > BPFTUNE_MAX_VALUES)
+		num_values = BPFTUNE_MAX_VALUES;
+	if (t->desc.namespaced)
+		key.netns_cookie = netns_cookie ? netns_cookie :
+						  global_netns_cookie;
+	if (bpftune_cap_add())
+		return;
+	/* no state yet; compare with last values set */
+	if (bpf_map_lookup_elem(fd, &key, &step))
+		old_values = t->current_values;
+	else
+		old_values = step.values;
+	for (i = 0; i < num_values; i++) {
+		if (values[i] != old_values[i]) {
+			dir = values[i] > old_values[i] ? 1 : -1;
+			break;
+		}
+	}
+	if (!dir)
+		goto out;
+	bpftune_step_change(&step, dir, bpftune_now_nsecs());
+	bpftune_log(LOG_DEBUG, "'%s' %s in netns (cookie %ld); step adjustment %d\n",
+		    t->desc.name, dir > 0 ? "grew" : "shrank",
+		    netns_cookie, step.step);
+	memcpy(step.values, values, num_values * sizeof(*values));
+	if (bpf_map_update_elem(fd, &key, &step, BPF_ANY))
+		bpftune_log(LOG_DEBUG, "could not update step for '%s': %s\n",
+			    t->desc.name, strerror(errno));
+out:
+	bpftune_cap_drop();
+}
+
+int bpftuner_tunable_update(struct bpftuner *tuner, unsigned int tunable,
+			    unsigned int scenario, int netns_fd,
+			    const char *fmt, ...)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	va_list args;
+
+	if (!t) {
+		bpftune_log(LOG_ERR, "no tunable %d for tuner '%s'\n",
+			    tunable, tuner->name);
+		return -EINVAL;
+	}
+	va_start(args, fmt);
+	bpftuner_scenario_log(tuner, tunable, scenario, netns_fd, false,
+			      fmt, args);
+	va_end(args);
+
+	return 0;
+}
+
+unsigned int bpftuner_num_tunables(struct bpftuner *tuner)
+{
+	return tuner->num_tunables;
+}
+
+void bpftuner_tunables_fini(struct bpftuner *tuner)
+{
+	tuner->num_tunables = 0;
+	free(tuner->tunables);
+}
+
+static int bpftune_netns_fd(int netns_pid)
+{
+	char netns_path[256];
+	int netns_fd;
+	int err;
+
+	if (netns_pid == 0)
+		return 0;
+	snprintf(netns_path, sizeof(netns_path), "/proc/%d/ns/net", netns_pid);
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+	netns_fd = open(netns_path, O_RDONLY);
+	if (netns_fd < 0)
+		netns_fd = -errno;
+	bpftune_cap_drop();
+	return netns_fd;
+}
+
+/* sets original netns fd if orig_fd is non-NULL */
+int bpftune_netns_set(int new_fd, int *orig_fd)
+{
+	int fd = 0, err = 0;
+
+	if (!new_fd)
+		return 0;
+
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+
+	if (orig_fd) {
+		fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			err = -errno;
+			bpftune_log(LOG_ERR,
+				    "could not get current netns fd(%d): %s\n",
+				    fd, strerror(-err));
+			goto out;
+		}
+	}
+	err = setns(new_fd, CLONE_NEWNET);
+	if (err < 0) {
+		err = -errno;
+		bpftune_log(LOG_ERR, "could not %s ns(%d): %s\n",
+			    orig_fd ? "set" : "restore",
+			    new_fd, strerror(-err));
+	}
+
+	if (!err && orig_fd) {
+		*orig_fd = fd;
+	} else {
+		if (fd)
+			close(fd);
+	}
+out:
+	bpftune_cap_drop();
+	return err;
+}
+
+/* get fd, cookie (if non-NULL) from pid, or if pid is 0, use passed in
+ * *fd to get cookie.
+ */
+int bpftune_netns_info(int pid, int *fd, unsigned long *cookie)
+{
+	unsigned long netns_cookie = 0;
+	int netns_fd, orig_netns_fd = 0;
+	bool fdnew = true;
+	int ret, err;
+
+	if (pid == 0 && fd && *fd > 0) {
+		fdnew = false;
+		netns_fd = *fd;
+	} else {
+		netns_fd = bpftune_netns_fd(pid);
+		if (netns_fd <= 0)
+			return netns_fd;
+	}
+
+	err = bpftune_netns_set(netns_fd, &orig_netns_fd);
+	if (!err) {
+		int s = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (s < 0) {
+			ret = -errno;
+			bpftune_log(LOG_ERR, "could not open socket in netns: %s\n",
+				    strerror(errno)); 
+		} else {
+			socklen_t cookie_sz = sizeof(netns_cookie);
+
+			ret = getsockopt(s, SOL_SOCKET, SO_NETNS_COOKIE, &netns_cookie,
+					 &cookie_sz);
+			if (ret < 0) {
+				ret = -errno;
+				bpftune_log(LOG_DEBUG,
+					    "could not get SO_NETNS_COOKIE: %s\n",
+					   strerror(-ret));
+				/* system may not support SO_NETNS_COOKIE */
+			}
+			
+			close(s);
+		}
+		bpftune_netns_set(orig_netns_fd, NULL);
+
+		if (ret == 0) {
+			if (fdnew && fd)
+				*fd = netns_fd;
+			if (cookie)
+				*cookie = netns_cookie;
+		}
+	} else {
+		bpftune_log(LOG_DEBUG, "setns failed for for fd %d\n",
+			    netns_fd);
+		ret = -errno;
+	}
+	if (fdnew && !fd)
+		close(netns_fd);
+	if (orig_netns_fd > 0)
+		close(orig_netns_fd);
+	return ret;
+}
+
+/* use the BPF task iterator provided by the netns tuner (if loaded) to
+ * populate netns_map with cookie -> pid for each network namespace in one
+ * pass, then initialize per-netns state for tuners from netns_map.  This
+ * avoids having to setns() into each /proc/<pid> namespace to get its
+ * cookie.  Called with caps set.
+ */
+static int bpftune_netns_iter_all(void)
+{
+	struct bpf_program *prog = NULL;
+	__u64 key, next_key, *prev = NULL;
+	struct bpf_link *link;
+	int iter_fd, ret = 0;
+	struct bpftuner *t;
+	char buf[64];
+
+	if (netns_map_fd <= 0)
+		return -ENOENT;
+
+	bpftune_for_each_tuner(t) {
+		if (t->state != BPFTUNE_ACTIVE || !t->obj)
+			continue;
+		prog = bpf_object__find_program_by_name(t->obj,
+							"bpftune_netns_iter");
+		if (prog && bpf_program__fd(prog) >= 0)
+			break;
+		prog = NULL;
+	}
+	if (!prog)
+		return -ENOENT;
+
+	link = bpf_program__attach_iter(prog, NULL);
+	ret = libbpf_get_error(link);
+	if (ret) {
+		bpftune_log_bpf_err(ret, "could not attach netns iter: %s\n");
+		return ret;
+	}
+	iter_fd = bpf_iter_create(bpf_link__fd(link));
+	if (iter_fd < 0) {
+		ret = -errno;
+		bpftune_log(LOG_ERR, "could not create netns iter: %s\n",
+			    strerror(-ret));
+		goto out;
+	}
+	/* running the iterator populates netns_map; there is no output. */
+	while ((ret = read(iter_fd, buf, sizeof(buf))) > 0) {}
+	if (ret < 0) {
+		ret = -errno;
+		bpftune_log(LOG_ERR, "could not read netns iter: %s\n",
+			    strerror(-ret));
+	}
+	close(iter_fd);
+	if (ret)
+		goto out;
+
+	while (!bpf_map_get_next_key(netns_map_fd, prev, &next_key)) {
+		bpftune_log(LOG_DEBUG, "found netns (cookie %ld) via iter\n",
+			    next_key);
+		bpftune_for_each_tuner(t)
+			bpftuner_netns_init(t, next_key);
+		key = next_key;
+		prev = &key;
+	}
+out:
+	bpf_link__destroy(link);
+	return ret;
+}
+
+/* netns_map holds pid of a task in each netns we know about; use it to
+ * get the netns fd without scanning.  Called with caps set.
+ */
+static int bpftune_netns_find_from_map(unsigned long cookie)
+{
+	unsigned long netns_cookie = 0;
+	__u64 key = cookie, pid = 0;
+	int netns_fd = 0;
+
+	if (netns_map_fd <= 0 ||
+	    bpf_map_lookup_elem(netns_map_fd, &key, &pid) || pid == 0)
+		return -ENOENT;
+	if (bpftune_netns_info(pid, &netns_fd, &netns_cookie))
+		return -ENOENT;
+	if (netns_cookie != cookie) {
+		close(netns_fd);
+		return -ENOENT;
+	}
+	bpftune_log(LOG_DEBUG, "found netns fd %d for cookie %ld via pid %d\n",
+		    netns_fd, cookie, pid);
+	return netns_fd;
+}
 
-	if (!t) {
-		bpftune_log(LOG_ERR, "no tunable %d for tuner '%s'\n",
-			    tunable, tuner->name);
-		return -EINVAL;
+/* scan nsfs mounts and /proc for the netns fd matching cookie, or if
+ * cookie is 0 initialize per-netns state for tuners for every netns
+ * found.  Called with caps set.
+ */
+static int bpftune_netns_scan(unsigned long cookie)
+{
+	unsigned long netns_cookie;
+	struct bpftuner *t;
+	struct mntent *ent;
+        FILE *mounts;
+	struct dirent *dirent;
+	int ret = -ENOENT;
+	DIR *dir;
+
+	mounts = setmntent("/proc/mounts", "r");
+	if (mounts == NULL) {
+		ret = -errno;
+		bpftune_log(LOG_ERR, "cannot setmntent() for /proc/mounts\n",
+			    strerror(-ret));
+		goto out;
 	}
-	netns = bpftuner_netns_from_cookie(tuner->id, netns_cookie);
-	if (netns) {
-		bpftune_log(LOG_DEBUG, "found netns (cookie %ld); state %d\n",
-			    netns_cookie, netns->state);
-		if (netns->state >= BPFTUNE_MANUAL) {
-			bpftune_log(BPFTUNE_LOG_LEVEL,
-				    "Skipping update of '%s' ; tuner '%s' is disabled in netns (cookie %ld)\n",
-				    t->desc.name, tuner->name, netns_cookie);
-			return 0;
+	while ((ent = getmntent(mounts)) != NULL) {
+		int mntfd;
+
+		if (strcmp(ent->mnt_type, "nsfs") != 0)
+			continue;
+		bpftune_log(LOG_DEBUG, "checking nsfs mnt %s\n",
+			    ent->mnt_dir);
+		mntfd = open(ent->mnt_dir, O_RDONLY);
+		if (mntfd < 0)
+			continue;
+		if (bpftune_netns_info(0, &mntfd, &netns_cookie)) {
+			close(mntfd);
+			continue;
+		}
+		bpftune_log(LOG_DEBUG, "found netns fd %d for cookie %ld via mnt %s\n",
+			    mntfd, netns_cookie, ent->mnt_dir);
+		if (cookie == 0) {
+			close(mntfd);
+			bpftune_for_each_tuner(t)
+				bpftuner_netns_init(t, netns_cookie);
+			ret = 0;
+			continue;
 		}
+		ret = mntfd;
+		endmntent(mounts);
+		goto out;
 	}
+	endmntent(mounts);
 
-	if (t->desc.namespaced) {
-		fd = bpftuner_netns_fd_from_cookie(tuner, netns_cookie);
-		if (fd < 0) {
-			bpftune_log(LOG_DEBUG, "could not get netns fd for cookie %ld\n",
-				    netns_cookie);
-			return 0;
+	/* move on to /proc-derived namespace fds... */
+	dir = opendir("/proc");
+	if (!dir) { 
+		ret = -errno;   
+		bpftune_log(LOG_ERR, "could not open /proc: %s\n", strerror(-ret));
+		goto out;
+	}
+	while ((dirent = readdir(dir)) != NULL) {
+		char *endptr;
+		int netns_fd;
+		long pid;
+
+		pid = strtol(dirent->d_name, &endptr, 10);
+		if (!endptr || *endptr != '\0')
+			continue;
+		if (bpftune_netns_info(pid, &netns_fd, &netns_cookie))
+			continue;
+
+		if (cookie == 0) {
+			close(netns_fd);
+			bpftune_for_each_tuner(t)
+				bpftuner_netns_init(t, netns_cookie);
+			ret = 0;
+			continue;
+		}
+		if (netns_cookie == cookie) {
+			bpftune_log(LOG_DEBUG, "found netns fd %d for cookie %ld via pid %d\n",
+				    netns_fd, netns_cookie, pid);
+			ret = netns_fd;
+			break;
+		} else {
+			close(netns_fd);
 		}
 	}
+	closedir(dir);
 
-	ret = bpftune_sysctl_write(fd, t->desc.name, num_values, values);
-	if (!ret) {
-		va_list args;
-		__u8 i;
+out:
+	return ret;
+}
 
-		va_start(args, fmt);
-		bpftuner_scenario_log(tuner, tunable, scenario, fd,
-				      false, fmt, args);
-		va_end(args);
+static int bpftune_netns_find(unsigned long cookie)
+{
+	int ret;
+
+	if (!netns_cookie_supported || cookie == 0 || (global_netns_cookie && cookie == global_netns_cookie))
+		return 0;
+
+	ret = bpftune_cap_add();
+	if (ret)
+		return ret;
+	ret = bpftune_netns_find_from_map(cookie);
+	if (ret < 0)
+		ret = bpftune_netns_scan(cookie);
+	bpftune_cap_drop();
+	return ret;
+}
+
+/* find all network namespaces at startup, via the netns iterator if
+ * available, falling back to scanning.
+ */
+static int bpftune_netns_enumerate(void)
+{
+	int ret;
+
+	ret = bpftune_cap_add();
+	if (ret)
+		return ret;
+	ret = bpftune_netns_iter_all();
+	if (ret < 0)
+		ret = bpftune_netns_scan(0);
+	bpftune_cap_drop();
+	return ret;
+}
+
+int bpftuner_netns_fd_from_cookie(struct bpftuner *tuner, unsigned long cookie)
+{
+	struct bpftuner_netns *netns = bpftuner_netns_from_cookie(tuner->id,
+								  cookie);
+
+	if (netns && netns->state >= BPFTUNE_MANUAL) {
+		bpftune_log(LOG_DEBUG, "netns (cookie %ld} manually disabled\n",
+			    cookie);
+		return -ENOENT;
+	}
+	return bpftune_netns_find(cookie);
+}
+
+int bpftune_netns_init_all(void)
+{
+	unsigned long cookie = 0;
+	int ret;
+
+	netns_cookie_supported = bpftune_netns_cookie_supported();
+	if (!netns_cookie_supported)
+		return 0;
+
+	if (!bpftune_netns_info(getpid(), NULL, &cookie)) {
+		global_netns_cookie = cookie;
+		bpftune_log(LOG_DEBUG, "global netns cookie is %ld\n",
+			    global_netns_cookie);
+	}
+	ret = bpftune_netns_enumerate();
+	bpftune_profiles_update();
+	return ret;
+}
+
+void bpftuner_netns_init(struct bpftuner *tuner, unsigned long cookie)
+{
+	struct bpftuner_netns *netns, *new = NULL;
+
+	if (bpftuner_netns_from_cookie(tuner->id, cookie))
+		return;
+
+	for (netns = &tuner->netns; netns->next != NULL; netns = netns->next) {}
+
+	new = calloc(1, sizeof(struct bpftuner_netns));
+	if (!new) {
+		bpftune_log(LOG_ERR, "unable to allocate netns for bpftuner: %s\n",
+			    strerror(errno));
+	} else {
+		bpftune_log(LOG_DEBUG, "Added netns (cookie %ld) for tuner '%s'\n",
+				       cookie, tuner->name);
+
+		new->netns_cookie = cookie;
+		netns->next = new;
+	}
+}
+
+/* remove state associated with a netns that has gone away from the tuner's
+ * BPF maps; last event times, correlations and hash maps keyed by netns
+ * cookie (which by convention are named netns_*).
+ */
+static void bpftuner_netns_maps_fini(struct bpftuner *tuner,
+				     unsigned long cookie)
+{
+	struct bpf_map *map;
+
+	if (tuner->state != BPFTUNE_ACTIVE || !tuner->obj || bpftune_cap_add())
+		return;
+
+	bpf_object__for_each_map(map, tuner->obj) {
+		const char *name = bpf_map__name(map);
+		int fd = bpf_map__fd(map);
+
+		if (fd < 0)
+			continue;
+		if (strcmp(name, "last_event_map") == 0) {
+			unsigned int i;
+
+			for (i = 0; i < BPFTUNE_MAX_TUNABLES; i++) {
+				__u64 key = last_event_key(cookie, tuner->id, i);
+
+				bpf_map_delete_elem(fd, &key);
+			}
+		} else if (strcmp(name, "corr_map") == 0) {
+			struct corr_key key, next_key;
+			struct corr_key *prev = NULL;
+
+			while (!bpf_map_get_next_key(fd, prev, &next_key)) {
+				if (prev && key.netns_cookie == cookie)
+					bpf_map_delete_elem(fd, &key);
+				key = next_key;
+				prev = &key;
+			}
+			if (prev && key.netns_cookie == cookie)
+				bpf_map_delete_elem(fd, &key);
+		} else if (strncmp(name, "netns_", strlen("netns_")) == 0 &&
+			   bpf_map__key_size(map) == sizeof(__u64)) {
+			__u64 key = cookie;
+
+			bpf_map_delete_elem(fd, &key);
+		}
+	}
+	bpftune_cap_drop();
+}
+
+void bpftuner_netns_fini(struct bpftuner *tuner, unsigned long cookie, enum bpftune_state state)
+{
+	struct bpftuner_netns *netns, *prev = NULL;
+
+	if (cookie == 0 || cookie == global_netns_cookie) {
+		bpftuner_fini(tuner, state);
+		return;
+	}
+	if (!netns_cookie_supported) {
+		bpftune_log(LOG_DEBUG, "no netns support and not global netns; ignoring...\n");
+		return;
+	}
+
+	if (state == BPFTUNE_GONE)
+		bpftuner_netns_maps_fini(tuner, cookie);
+
+	for (netns = &tuner->netns; netns != NULL; netns = netns->next) {
+		if (netns->netns_cookie == cookie) {
+			if (state == BPFTUNE_MANUAL) {
+				bpftune_log(LOG_DEBUG, "setting state of netns (cookie %ld) to manual for '%s'\n",
+					    cookie, tuner->name);
+				netns->state = BPFTUNE_MANUAL;
+				return;
+			}
+			if (prev)
+				prev->next = netns->next;
+			else
+				tuner->netns.next = netns->next;
+			free(netns);
+			return;
+		}
+		prev = netns;
+	}
+	bpftune_log(LOG_DEBUG, "netns_fini: could not find netns for cookie %ld\n",
+		    cookie);
+}
+
+struct bpftuner_netns *bpftuner_netns_from_cookie(unsigned long tuner_id,
+						  unsigned long cookie)
+{
+	struct bpftuner *tuner;
+	struct bpftuner_netns *netns;
+	
+	if (!netns_cookie_supported)
+		return NULL;
+
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->id != tuner_id)
+			continue;
+		if (cookie == 0)
+			return &tuner->netns;
+		bpftuner_for_each_netns(tuner, netns) {
+			if (cookie == netns->netns_cookie)
+				return netns;
+		}
+	}
+	bpftune_log(LOG_DEBUG, "no tuner netns found for tuner %d, cookie %ld\n",
+		    tuner_id, cookie);
+	return NULL;
+}
 
-		for (i = 0; i < t->desc.num_values; i++)
-			t->current_values[i] = values[i];
-	}
+/* per-netns profiles; a learning rate and/or min/max limits for tunables,
+ * specified for a network namespace (via nsfs path, e.g.
+ * /run/netns/foo) or for the namespace of the tasks in a cgroup.
+ * Learning rates are stored in netns_profile_map so BPF programs can use
+ * them.  Profiles without a path hold policy for all namespaces from the
+ * config file (see bpftune_config_load()); per-netns limits and policy
+ * override these.  Limits and allow/deny policy are applied when tunables
+ * are written, and stored in limit_map so BPF programs do not propose
+ * changes that would be rejected.
+ */
+enum bpftune_policy {
+	BPFTUNE_POLICY_NONE,
+	BPFTUNE_POLICY_ALLOW,		/* allowlist tuner/tunable */
+	BPFTUNE_POLICY_DENY,		/* denylist tuner/tunable */
+};
 
-	if (fd > 0)
-		close(fd);
+struct bpftune_profile {
+	struct bpftune_profile *next;
+	char path[PATH_MAX];		/* empty for all namespaces */
+	bool cgroup;
+	bool config;			/* from config file; replaced on reload */
+	unsigned long netns_cookie;	/* resolved from path */
+	int learning_rate;		/* -1 if not set */
+	char tunable[BPFTUNE_MAX_NAME];	/* set for min/max limit, policy */
+	long min;
+	long max;
+	enum bpftune_policy policy;	/* tunable is a tuner/tunable name */
+};
 
-	return ret;
-}
+static struct bpftune_profile *bpftune_profiles;
+static pthread_mutex_t bpftune_profiles_lock = PTHREAD_MUTEX_INITIALIZER;
 
-int bpftuner_tunable_update(struct bpftuner *tuner, unsigned int tunable,
-			    unsigned int scenario, int netns_fd,
-			    const char *fmt, ...)
+/* format is one profile per line:
+ *
+ * {netns|cgroup} <path> learning_rate <rate>
+ * {netns|cgroup} <path> <tunable> <min> <max>
+ * {netns|cgroup} <path> {allow|deny} <tuner|tunable>
+ * {tuner|tunable} <name> learning_rate <rate>
+ * limit <tunable> <min> <max>
+ * {allow|deny} <tuner|tunable>
+ *
+ * tuner and tunable learning rates, limits and allow/deny policy without
+ * a path apply in all namespaces, but netns profiles take precedence.
+ */
+static int bpftune_profiles_parse(const char *file, bool config)
 {
-	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
-	va_list args;
+	char line[PATH_MAX + 256];
+	int ret = 0, lineno = 0;
+	FILE *fp;
 
-	if (!t) {
-		bpftune_log(LOG_ERR, "no tunable %d for tuner '%s'\n",
-			    tunable, tuner->name);
-		return -EINVAL;
+	fp = fopen(file, "r");
+	if (!fp) {
+		ret = -errno;
+		bpftune_log(LOG_ERR, "could not open profiles '%s': %s\n",
+			    file, strerror(-ret));
+		return ret;
 	}
-	va_start(args, fmt);
-	bpftuner_scenario_log(tuner, tunable, scenario, netns_fd, false,
-			      fmt, args);
-	va_end(args);
-
-	return 0;
-}
-
-unsigned int bpftuner_num_tunables(struct bpftuner *tuner)
-{
-	return tuner->num_tunables;
+	while (fgets(line, sizeof(line), fp)) {
+		char type[16], path[PATH_MAX], name[BPFTUNE_MAX_NAME];
+		char policy[16];
+		struct bpftune_profile p = { .learning_rate = -1 };
+		struct bpftune_profile *profile;
+		long min = 0, max = 0;
+		int n;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		n = sscanf(line, "%15s %4095s %127s %ld %ld", type, path, name,
+			   &min, &max);
+		if (n == 4 && (!strcmp(type, "tuner") ||
+			       !strcmp(type, "tunable")) &&
+		    !strcmp(name, "learning_rate") &&
+		    min >= BPFTUNE_DELTA_MIN && min <= BPFTUNE_DELTA_MAX) {
+			if (__bpftune_set_named_learning_rate(path, min,
+							      config)) {
+				bpftune_log(LOG_ERR, "invalid profile at %s:%d\n",
+					    file, lineno);
+				ret = -EINVAL;
+			}
+			continue;
+		}
+		if (!strcmp(type, "limit") &&
+		    sscanf(line, "%15s %127s %ld %ld", type, name, &min,
+			   &max) == 4) {
+			if (min > max) {
+				bpftune_log(LOG_ERR, "invalid limits at %s:%d\n",
+					    file, lineno);
+				ret = -EINVAL;
+				continue;
+			}
+			strcpy(p.tunable, name);
+			p.min = min;
+			p.max = max;
+		} else if ((!strcmp(type, "allow") || !strcmp(type, "deny")) &&
+			   n == 2) {
+			strncpy(p.tunable, path, sizeof(p.tunable) - 1);
+			p.policy = !strcmp(type, "allow") ?
+				   BPFTUNE_POLICY_ALLOW : BPFTUNE_POLICY_DENY;
+		} else if ((!strcmp(type, "netns") || !strcmp(type, "cgroup")) &&
+			   (!strcmp(name, "allow") || !strcmp(name, "deny")) &&
+			   sscanf(line, "%15s %4095s %15s %127s", type, path,
+				  policy, name) == 4) {
+			strcpy(p.path, path);
+			p.cgroup = strcmp(type, "cgroup") == 0;
+			strcpy(p.tunable, name);
+			p.policy = !strcmp(policy, "allow") ?
+				   BPFTUNE_POLICY_ALLOW : BPFTUNE_POLICY_DENY;
+		} else if (n < 4 ||
+			   (strcmp(type, "netns") && strcmp(type, "cgroup")) ||
+			   (strcmp(name, "learning_rate") && n != 5) ||
+			   (!strcmp(name, "learning_rate") &&
+			    (min < BPFTUNE_DELTA_MIN || min > BPFTUNE_DELTA_MAX))) {
+			bpftune_log(LOG_ERR, "invalid profile at %s:%d\n",
+				    file, lineno);
+			ret = -EINVAL;
+			continue;
+		} else {
+			strcpy(p.path, path);
+			p.cgroup = strcmp(type, "cgroup") == 0;
+			if (!strcmp(name, "learning_rate")) {
+				p.learning_rate = min;
+			} else if (min > max) {
+				bpftune_log(LOG_ERR, "invalid limits at %s:%d\n",
+					    file, lineno);
+				ret = -EINVAL;
+				continue;
+			} else {
+				strcpy(p.tunable, name);
+				p.min = min;
+				p.max = max;
+			}
+		}
+		profile = malloc(sizeof(*profile));
+		if (!profile) {
+			ret = -ENOMEM;
+			break;
+		}
+		*profile = p;
+		profile->config = config;
+		pthread_mutex_lock(&bpftune_profiles_lock);
+		profile->next = bpftune_profiles;
+		bpftune_profiles = profile;
+		pthread_mutex_unlock(&bpftune_profiles_lock);
+	}
+	fclose(fp);
+	return ret;
 }
 
-void bpftuner_tunables_fini(struct bpftuner *tuner)
+int bpftune_profiles_load(const char *file)
 {
-	tuner->num_tunables = 0;
-	free(tuner->tunables);
+	return bpftune_profiles_parse(file, false);
 }
 
-static int bpftune_netns_fd(int netns_pid)
+/* called with caps set */
+static int bpftune_profile_cookie(struct bpftune_profile *profile,
+				  unsigned long *cookie)
 {
-	char netns_path[256];
-	int netns_fd;
-	int err;
+	char procs[PATH_MAX + 16];
+	int ret, pid = 0, fd;
+	FILE *fp;
 
-	if (netns_pid == 0)
-		return 0;
-	snprintf(netns_path, sizeof(netns_path), "/proc/%d/ns/net", netns_pid);
-	err = bpftune_cap_add();
-	if (err)
-		return err;
-	netns_fd = open(netns_path, O_RDONLY);
-	if (netns_fd < 0)
-		netns_fd = -errno;
-	bpftune_cap_drop();
-	return netns_fd;
+	if (!profile->cgroup) {
+		fd = open(profile->path, O_RDONLY);
+		if (fd < 0)
+			return -errno;
+		ret = bpftune_netns_info(0, &fd, cookie);
+		close(fd);
+		return ret;
+	}
+	/* use the netns of the first task in the cgroup */
+	snprintf(procs, sizeof(procs), "%s/cgroup.procs", profile->path);
+	fp = fopen(procs, "r");
+	if (!fp)
+		return -errno;
+	ret = fscanf(fp, "%d", &pid);
+	fclose(fp);
+	if (ret != 1 || pid <= 0)
+		return -ENOENT;
+	return bpftune_netns_info(pid, NULL, cookie);
 }
 
-/* sets original netns fd if orig_fd is non-NULL */
-int bpftune_netns_set(int new_fd, int *orig_fd)
+/* resolve profiles to netns cookies and update netns_profile_map; called
+ * at startup and when namespaces are created, since the namespace for a
+ * path can change.
+ */
+void bpftune_profiles_update(void)
 {
-	int fd = 0, err = 0;
+	struct bpftune_profile *profile;
+	struct bpftuner *tuner;
 
-	if (!new_fd)
-		return 0;
+	if (!netns_cookie_supported || bpftune_cap_add())
+		return;
 
-	err = bpftune_cap_add();
-	if (err)
-		return err;
+	pthread_mutex_lock(&bpftune_profiles_lock);
+	for (profile = bpftune_profiles; profile; profile = profile->next) {
+		struct bpftune_netns_profile p = {};
+		unsigned long cookie = 0;
+		__u64 key;
 
-	if (orig_fd) {
-		fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
-		if (fd < 0) {
-			err = -errno;
-			bpftune_log(LOG_ERR,
-				    "could not get current netns fd(%d): %s\n",
-				    fd, strerror(-err));
-			goto out;
+		/* config file limits and policy for all namespaces */
+		if (!profile->path[0])
+			continue;
+		if (bpftune_profile_cookie(profile, &cookie))
+			cookie = 0;
+		if (profile->learning_rate >= 0 && netns_profile_map_fd > 0 &&
+		    profile->netns_cookie && profile->netns_cookie != cookie) {
+			key = profile->netns_cookie;
+			bpf_map_delete_elem(netns_profile_map_fd, &key);
 		}
+		if (cookie && cookie != profile->netns_cookie)
+			bpftune_log(LOG_DEBUG, "profile for %s '%s' applies to netns (cookie %ld)\n",
+				    profile->cgroup ? "cgroup" : "netns",
+				    profile->path, cookie);
+		profile->netns_cookie = cookie;
+		if (!cookie || profile->learning_rate < 0 ||
+		    netns_profile_map_fd <= 0)
+			continue;
+		key = cookie;
+		p.learning_rate = profile->learning_rate;
+		if (bpf_map_update_elem(netns_profile_map_fd, &key, &p, BPF_ANY))
+			bpftune_log(LOG_ERR, "could not set profile for '%s': %s\n",
+				    profile->path, strerror(errno));
 	}
-	err = setns(new_fd, CLONE_NEWNET);
-	if (err < 0) {
-		err = -errno;
-		bpftune_log(LOG_ERR, "could not %s ns(%d): %s\n",
-			    orig_fd ? "set" : "restore",
-			    new_fd, strerror(-err));
-	}
-
-	if (!err && orig_fd) {
-		*orig_fd = fd;
-	} else {
-		if (fd)
-			close(fd);
-	}
-out:
+	pthread_mutex_unlock(&bpftune_profiles_lock);
 	bpftune_cap_drop();
-	return err;
+
+	bpftune_for_each_tuner(tuner)
+		bpftuner_limits_update(tuner);
 }
 
-/* get fd, cookie (if non-NULL) from pid, or if pid is 0, use passed in
- * *fd to get cookie.
+/* config file holds safety limits and allow/deny policy in profile format,
+ * along with any learning rates; it is re-read on SIGHUP, replacing
+ * profiles from the previous load.
  */
-int bpftune_netns_info(int pid, int *fd, unsigned long *cookie)
+static char bpftune_config_file[PATH_MAX];
+static volatile sig_atomic_t bpftune_config_reload_pending;
+
+int bpftune_config_load(const char *file)
 {
-	unsigned long netns_cookie = 0;
-	int netns_fd, orig_netns_fd = 0;
-	bool fdnew = true;
-	int ret, err;
+	strncpy(bpftune_config_file, file, sizeof(bpftune_config_file) - 1);
+	return bpftune_profiles_parse(file, true);
+}
 
-	if (pid == 0 && fd && *fd > 0) {
-		fdnew = false;
-		netns_fd = *fd;
-	} else {
-		netns_fd = bpftune_netns_fd(pid);
-		if (netns_fd <= 0)
-			return netns_fd;
-	}
+/* async-signal-safe; reload happens in the ring buffer poll loop */
+void bpftune_config_reload_request(void)
+{
+	bpftune_config_reload_pending = 1;
+}
 
-	err = bpftune_netns_set(netns_fd, &orig_netns_fd);
-	if (!err) {
-		int s = socket(AF_INET, SOCK_STREAM, 0);
+static void bpftune_config_reload(void)
+{
+	struct bpftune_profile *profile, **prevp;
+	struct bpftuner *tuner;
+	int ret;
 
-		if (s < 0) {
-			ret = -errno;
-			bpftune_log(LOG_ERR, "could not open socket in netns: %s\n",
-				    strerror(errno)); 
-		} else {
-			socklen_t cookie_sz = sizeof(netns_cookie);
+	if (!bpftune_config_reload_pending)
+		return;
+	bpftune_config_reload_pending = 0;
+	if (!bpftune_config_file[0]) {
+		bpftune_log(LOG_INFO, "no config file to reload\n");
+		return;
+	}
+	bpftune_log(LOG_INFO, "reloading config file '%s'\n",
+		    bpftune_config_file);
 
-			ret = getsockopt(s, SOL_SOCKET, SO_NETNS_COOKIE, &netns_cookie,
-					 &cookie_sz);
-			if (ret < 0) {
-				ret = -errno;
-				bpftune_log(LOG_DEBUG,
-					    "could not get SO_NETNS_COOKIE: %s\n",
-					   strerror(-ret));
-				/* system may not support SO_NETNS_COOKIE */
-			}
-			
-			close(s);
+	pthread_mutex_lock(&bpftune_profiles_lock);
+	for (prevp = &bpftune_profiles; (profile = *prevp) != NULL; ) {
+		if (!profile->config) {
+			prevp = &profile->next;
+			continue;
 		}
-		bpftune_netns_set(orig_netns_fd, NULL);
+		if (profile->learning_rate >= 0 && profile->netns_cookie &&
+		    netns_profile_map_fd > 0) {
+			__u64 key = profile->netns_cookie;
 
-		if (ret == 0) {
-			if (fdnew && fd)
-				*fd = netns_fd;
-			if (cookie)
-				*cookie = netns_cookie;
+			bpf_map_delete_elem(netns_profile_map_fd, &key);
 		}
-	} else {
-		bpftune_log(LOG_DEBUG, "setns failed for for fd %d\n",
-			    netns_fd);
-		ret = -errno;
+		*prevp = profile->next;
+		free(profile);
 	}
-	if (fdnew && !fd)
-		close(netns_fd);
-	if (orig_netns_fd > 0)
-		close(orig_netns_fd);
-	return ret;
-}
+	pthread_mutex_unlock(&bpftune_profiles_lock);
+	bpftune_named_learning_rates_reset();
 
-static int bpftune_netns_find(unsigned long cookie)
-{
-	unsigned long netns_cookie;
-	struct bpftuner *t;
-	struct mntent *ent;
-        FILE *mounts;
-	struct dirent *dirent;
-	int ret = -ENOENT;
-	DIR *dir;
-
-	if (!netns_cookie_supported || cookie == 0 || (global_netns_cookie && cookie == global_netns_cookie))
-		return 0;
-
-	ret = bpftune_cap_add();
+	ret = bpftune_profiles_parse(bpftune_config_file, true);
 	if (ret)
-		return ret;
-
-	mounts = setmntent("/proc/mounts", "r");
-	if (mounts == NULL) {
-		ret = -errno;
-		bpftune_log(LOG_ERR, "cannot setmntent() for /proc/mounts\n",
-			    strerror(-ret));
-		goto out;
+		bpftune_log(LOG_ERR, "errors reloading config file '%s': %s\n",
+			    bpftune_config_file, strerror(-ret));
+	bpftune_profiles_update();
+	bpftune_for_each_tuner(tuner) {
+		if (!tuner->obj)
+			continue;
+		bpftuner_learning_rates_update(tuner);
+		bpftuner_limits_update(tuner);
 	}
-	while ((ent = getmntent(mounts)) != NULL) {
-		int mntfd;
+}
 
-		if (strcmp(ent->mnt_type, "nsfs") != 0)
-			continue;
-		bpftune_log(LOG_DEBUG, "checking nsfs mnt %s\n",
-			    ent->mnt_dir);
-		mntfd = open(ent->mnt_dir, O_RDONLY);
-		if (mntfd < 0)
-			continue;
-		if (bpftune_netns_info(0, &mntfd, &netns_cookie)) {
-			close(mntfd);
-			continue;
-		}
-		bpftune_log(LOG_DEBUG, "found netns fd %d for cookie %ld via mnt %s\n",
-			    mntfd, netns_cookie, ent->mnt_dir);
-		if (cookie == 0) {
-			close(mntfd);
-			bpftune_for_each_tuner(t)
-				bpftuner_netns_init(t, netns_cookie);
-			ret = 0;
-			continue;
+/* returns -1 if no profile learning rate is set for netns */
+static int bpftune_profile_learning_rate(unsigned long cookie)
+{
+	struct bpftune_profile *profile;
+	int rate = -1;
+
+	if (cookie == 0)
+		cookie = global_netns_cookie;
+	pthread_mutex_lock(&bpftune_profiles_lock);
+	for (profile = bpftune_profiles; profile; profile = profile->next) {
+		if (profile->netns_cookie == cookie &&
+		    profile->learning_rate >= 0) {
+			rate = profile->learning_rate;
+			break;
 		}
-		ret = mntfd;
-		endmntent(mounts);
-		goto out;
 	}
-	endmntent(mounts);
+	pthread_mutex_unlock(&bpftune_profiles_lock);
+	return rate;
+}
 
-	/* move on to /proc-derived namespace fds... */
-	dir = opendir("/proc");
-	if (!dir) { 
-		ret = -errno;   
-		bpftune_log(LOG_ERR, "could not open /proc: %s\n", strerror(-ret));
-		goto out;
-	}
-	while ((dirent = readdir(dir)) != NULL) {
-		char *endptr;
-		int netns_fd;
-		long pid;
+unsigned short bpftune_netns_learning_rate_get(unsigned long cookie)
+{
+	int rate = bpftune_profile_learning_rate(cookie);
 
-		pid = strtol(dirent->d_name, &endptr, 10);
-		if (!endptr || *endptr != '\0')
-			continue;
-		if (bpftune_netns_info(pid, &netns_fd, &netns_cookie))
-			continue;
+	return rate >= 0 ? rate : bpftune_learning_rate;
+}
 
-		if (cookie == 0) {
-			close(netns_fd);
-			bpftune_for_each_tuner(t)
-				bpftuner_netns_init(t, netns_cookie);
+/* userspace equivalent of bpftune_tunable_learning_rate() in BPF; the
+ * netns profile rate if set, otherwise the tunable's rate, otherwise
+ * the tuner's rate.
+ */
+unsigned short bpftuner_tunable_learning_rate(struct bpftuner *tuner,
+					      unsigned int index,
+					      unsigned long netns_cookie)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, index);
+	int rate = bpftune_profile_learning_rate(netns_cookie);
+
+	if (rate >= 0)
+		return rate;
+	if (t) {
+		rate = bpftune_named_learning_rate(t->desc.name);
+		if (rate >= 0)
+			return rate;
+	}
+	return bpftuner_learning_rate(tuner);
+}
+
+/* min/max limits for tunable; netns-specific limits take precedence over
+ * limits for all namespaces.  A cookie of 0 only matches limits for all
+ * namespaces.  Called with bpftune_profiles_lock held.
+ */
+static bool bpftune_profile_limits(const char *tunable, unsigned long cookie,
+				   long *min, long *max)
+{
+	struct bpftune_profile *profile, *found = NULL;
+
+	for (profile = bpftune_profiles; profile; profile = profile->next) {
+		if (profile->policy != BPFTUNE_POLICY_NONE ||
+		    strcmp(profile->tunable, tunable) != 0)
+			continue;
+		if (!profile->path[0]) {
+			if (!found)
+				found = profile;
 			continue;
 		}
-		if (netns_cookie == cookie) {
-			bpftune_log(LOG_DEBUG, "found netns fd %d for cookie %ld via pid %d\n",
-				    netns_fd, netns_cookie, pid);
-			ret = netns_fd;
+		if (cookie && profile->netns_cookie == cookie) {
+			found = profile;
 			break;
-		} else {
-			close(netns_fd);
 		}
 	}
-	closedir(dir);
-
-out:
-	bpftune_cap_drop();
-	return ret;
+	if (!found)
+		return false;
+	*min = found->min;
+	*max = found->max;
+	return true;
 }
 
-int bpftuner_netns_fd_from_cookie(struct bpftuner *tuner, unsigned long cookie)
+/* clamp values to min/max limits from config file and profiles for tunable
+ * in netns; returns true if any values were changed.  As in BPF, values the
+ * same as in old_values (if non-NULL) are left alone.
+ */
+static bool bpftune_profile_limit(const char *tunable, unsigned long cookie,
+				  __u8 num_values, long *old_values,
+				  long *values)
 {
-	struct bpftuner_netns *netns = bpftuner_netns_from_cookie(tuner->id,
-								  cookie);
-
-	if (netns && netns->state >= BPFTUNE_MANUAL) {
-		bpftune_log(LOG_DEBUG, "netns (cookie %ld} manually disabled\n",
-			    cookie);
-		return -ENOENT;
+	bool limited = false;
+	long min, max;
+	__u8 i;
+
+	if (cookie == 0)
+		cookie = global_netns_cookie;
+	pthread_mutex_lock(&bpftune_profiles_lock);
+	if (bpftune_profile_limits(tunable, cookie, &min, &max)) {
+		for (i = 0; i < num_values; i++) {
+			if (old_values && values[i] == old_values[i])
+				continue;
+			if (values[i] < min) {
+				values[i] = min;
+				limited = true;
+			} else if (values[i] > max) {
+				values[i] = max;
+				limited = true;
+			}
+		}
 	}
-	return bpftune_netns_find(cookie);
+	pthread_mutex_unlock(&bpftune_profiles_lock);
+	return limited;
 }
 
-int bpftune_netns_init_all(void)
+/* evaluate allow/deny policy for netns (netns is true) or for all
+ * namespaces; returns -ENOENT if there is no applicable policy, 0 if the
+ * tunable may not be changed and 1 if it may.  A deny entry for the tuner
+ * or tunable wins; otherwise if there are allow entries one must match.
+ * Called with bpftune_profiles_lock held.
+ */
+static int bpftune_policy_eval(const char *tuner, const char *tunable,
+			       unsigned long cookie, bool netns)
 {
-	unsigned long cookie = 0;
+	struct bpftune_profile *profile;
+	bool found = false, allowlist = false, allowed = false;
 
-	netns_cookie_supported = bpftune_netns_cookie_supported();
-	if (!netns_cookie_supported)
-		return 0;
+	for (profile = bpftune_profiles; profile; profile = profile->next) {
+		bool match;
 
-	if (!bpftune_netns_info(getpid(), NULL, &cookie)) {
-		global_netns_cookie = cookie;
-		bpftune_log(LOG_DEBUG, "global netns cookie is %ld\n",
-			    global_netns_cookie);
+		if (profile->policy == BPFTUNE_POLICY_NONE)
+			continue;
+		if (netns ? (!profile->path[0] ||
+			     profile->netns_cookie != cookie) :
+			    profile->path[0] != '\0')
+			continue;
+		found = true;
+		match = !strcmp(profile->tunable, tuner) ||
+			!strcmp(profile->tunable, tunable);
+		if (profile->policy == BPFTUNE_POLICY_DENY) {
+			if (match)
+				return 0;
+			continue;
+		}
+		allowlist = true;
+		if (match)
+			allowed = true;
 	}
-	return bpftune_netns_find(0);
+	if (!found)
+		return -ENOENT;
+	return !allowlist || allowed;
 }
 
-void bpftuner_netns_init(struct bpftuner *tuner, unsigned long cookie)
+/* netns-specific allow/deny policy replaces policy for all namespaces.
+ * Called with bpftune_profiles_lock held.
+ */
+static bool __bpftune_policy_allowed(const char *tuner, const char *tunable,
+				     unsigned long cookie)
 {
-	struct bpftuner_netns *netns, *new = NULL;
-
-	if (bpftuner_netns_from_cookie(tuner->id, cookie))
-		return;
+	int ret = -ENOENT;
 
-	for (netns = &tuner->netns; netns->next != NULL; netns = netns->next) {}
+	if (cookie)
+		ret = bpftune_policy_eval(tuner, tunable, cookie, true);
+	if (ret < 0)
+		ret = bpftune_policy_eval(tuner, tunable, cookie, false);
+	return ret != 0;
+}
 
-	new = calloc(1, sizeof(struct bpftuner_netns));
-	if (!new) {
-		bpftune_log(LOG_ERR, "unable to allocate netns for bpftuner: %s\n",
-			    strerror(errno));
-	} else {
-		bpftune_log(LOG_DEBUG, "Added netns (cookie %ld) for tuner '%s'\n",
-				       cookie, tuner->name);
+static bool bpftune_policy_allowed(const char *tuner, const char *tunable,
+				   unsigned long cookie)
+{
+	bool allowed;
 
-		new->netns_cookie = cookie;
-		netns->next = new;
-	}
+	pthread_mutex_lock(&bpftune_profiles_lock);
+	allowed = __bpftune_policy_allowed(tuner, tunable, cookie);
+	pthread_mutex_unlock(&bpftune_profiles_lock);
+	return allowed;
 }
 
-void bpftuner_netns_fini(struct bpftuner *tuner, unsigned long cookie, enum bpftune_state state)
+/* apply manual overrides, safety limits and policy for tunable in netns to
+ * values; returns -EPERM if the tunable may not be changed, 1 if values
+ * were clamped to limits and 0 otherwise.
+ */
+int bpftuner_tunable_limit(struct bpftuner *tuner, unsigned int tunable,
+			   unsigned long netns_cookie, __u8 num_values,
+			   long *old_values, long *values)
 {
-	struct bpftuner_netns *netns, *prev = NULL;
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
 
-	if (cookie == 0 || cookie == global_netns_cookie) {
-		bpftuner_fini(tuner, state);
-		return;
-	}
-	if (!netns_cookie_supported) {
-		bpftune_log(LOG_DEBUG, "no netns support and not global netns; ignoring...\n");
-		return;
-	}
+	if (!t)
+		return -EINVAL;
+	/* tuners that write tunables other than via
+	 * bpftuner_tunable_sysctl_write() rely on this check
+	 */
+	if (bpftuner_tunable_netns_is_manual(tuner, tunable, netns_cookie))
+		return -EPERM;
+	if (netns_cookie == 0)
+		netns_cookie = global_netns_cookie;
+	if (!bpftune_policy_allowed(tuner->name, t->desc.name, netns_cookie))
+		return -EPERM;
+	return bpftune_profile_limit(t->desc.name, netns_cookie, num_values,
+				     old_values, values);
+}
 
-	for (netns = &tuner->netns; netns != NULL; netns = netns->next) {
-		if (netns->netns_cookie == cookie) {
-			if (state == BPFTUNE_MANUAL) {
-				bpftune_log(LOG_DEBUG, "setting state of netns (cookie %ld) to manual for '%s'\n",
-					    cookie, tuner->name);
-				netns->state = BPFTUNE_MANUAL;
-				return;
-			}
-			if (prev)
-				prev->next = netns->next;
-			else
-				tuner->netns.next = netns->next;
-			free(netns);
-			return;
-		}
-		prev = netns;
+/* limit_map entry for tunable in netns; cookie 0 for all namespaces.
+ * Returns false if there are no limits or policy for tunable.  Called
+ * with bpftune_profiles_lock held.
+ */
+static bool bpftuner_limit_get(struct bpftuner *tuner, struct bpftunable *t,
+			       unsigned long cookie, struct bpftune_limit *limit)
+{
+	bool found;
+
+	limit->deny = !__bpftune_policy_allowed(tuner->name, t->desc.name,
+						cookie);
+	found = bpftune_profile_limits(t->desc.name, cookie, &limit->min,
+				       &limit->max);
+	if (!found) {
+		limit->min = LONG_MIN;
+		limit->max = LONG_MAX;
 	}
-	bpftune_log(LOG_DEBUG, "netns_fini: could not find netns for cookie %ld\n",
-		    cookie);
+	return found || limit->deny;
 }
 
-struct bpftuner_netns *bpftuner_netns_from_cookie(unsigned long tuner_id,
-						  unsigned long cookie)
+/* update tuner's limit_map from config file and profiles, so that BPF
+ * programs do not send events for changes that would be rejected; called
+ * when tunables are initialized, when profiles are resolved to namespaces
+ * and on config reload.
+ */
+void bpftuner_limits_update(struct bpftuner *tuner)
 {
-	struct bpftuner *tuner;
-	struct bpftuner_netns *netns;
-	
-	if (!netns_cookie_supported)
-		return NULL;
+	struct bpftune_tunable_key key = {}, next;
+	struct bpftune_profile *profile;
+	struct bpftune_limit limit;
+	struct bpf_map *map;
+	unsigned int i;
+	int fd;
 
-	bpftune_for_each_tuner(tuner) {
-		if (tuner->id != tuner_id)
+	map = tuner->obj ? bpf_object__find_map_by_name(tuner->obj,
+						       "limit_map") : NULL;
+	fd = map ? bpf_map__fd(map) : -1;
+	if (fd < 0)
+		return;
+	while (!bpf_map_get_next_key(fd, NULL, &next)) {
+		key = next;
+		if (bpf_map_delete_elem(fd, &key))
+			break;
+	}
+	pthread_mutex_lock(&bpftune_profiles_lock);
+	for (i = 0; i < tuner->num_tunables; i++) {
+		struct bpftunable *t = bpftuner_tunable(tuner, i);
+
+		if (!t)
 			continue;
-		if (cookie == 0)
-			return &tuner->netns;
-		bpftuner_for_each_netns(tuner, netns) {
-			if (cookie == netns->netns_cookie)
-				return netns;
+		key.tunable = i;
+		/* limits for non-namespaced tunables are those that apply
+		 * in the global namespace.
+		 */
+		key.netns_cookie = 0;
+		if (bpftuner_limit_get(tuner, t,
+				       t->desc.namespaced ? 0 : global_netns_cookie,
+				       &limit))
+			bpf_map_update_elem(fd, &key, &limit, BPF_ANY);
+		if (!t->desc.namespaced)
+			continue;
+		for (profile = bpftune_profiles; profile; profile = profile->next) {
+			if (!profile->path[0] || !profile->netns_cookie)
+				continue;
+			key.netns_cookie = profile->netns_cookie;
+			if (bpftuner_limit_get(tuner, t, key.netns_cookie,
+					       &limit))
+				bpf_map_update_elem(fd, &key, &limit, BPF_ANY);
 		}
 	}
-	bpftune_log(LOG_DEBUG, "no tuner netns found for tuner %d, cookie %ld\n",
-		    tuner_id, cookie);
-	return NULL;
+	pthread_mutex_unlock(&bpftune_profiles_lock);
 }
 
 static int bpftune_module_path(const char *name, char *modpath, size_t pathsz)
@@ -1498,3 +5942,324 @@ int bpftune_module_unload(const char *name)
 	bpftune_cap_drop();
 	return ret;
 }
+
+/* Control socket.  Clients connect to BPFTUNE_CONTROL_SOCKET and send a
+ * single request line; the response is a status line ("ok" or
+ * "error <reason>") followed by any output, and the connection is closed.
+ * Requests are handled from the event loop (see bpftune_ring_buffer_poll())
+ * so they are serialized with event handling.  Requests:
+ *
+ * list				tuners, tunables and per-netns state
+ * stats			per-tunable scenario counts (bpftunable_stats)
+ * enable|disable tuner [netns]	(re)enable or disable tuner in netns; netns
+ *				is "global" (default), a cookie or nsfs path
+ * rate [name] learning_rate	set global learning rate, or the rate for
+ *				the named tuner or tunable
+ */
+#define BPFTUNE_CONTROL_MAX_ARGS	4
+
+static int bpftune_control_fd = -1;
+static char bpftune_control_path[PATH_MAX];
+
+int bpftune_control_init(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	err = bpftune_cap_add();
+	if (err)
+		return err;
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		err = -errno;
+		goto out;
+	}
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    chmod(path, 0600) || listen(fd, 8)) {
+		err = -errno;
+		close(fd);
+		goto out;
+	}
+	bpftune_control_fd = fd;
+	snprintf(bpftune_control_path, sizeof(bpftune_control_path), "%s",
+		 path);
+	bpftune_log(LOG_DEBUG, "listening for requests on '%s'\n", path);
+out:
+	if (err)
+		bpftune_log(LOG_ERR, "could not create control socket '%s': %s\n",
+			    path, strerror(-err));
+	bpftune_cap_drop();
+	return err;
+}
+
+void bpftune_control_fini(void)
+{
+	if (bpftune_control_fd < 0)
+		return;
+	close(bpftune_control_fd);
+	bpftune_control_fd = -1;
+	if (!bpftune_cap_add()) {
+		unlink(bpftune_control_path);
+		bpftune_cap_drop();
+	}
+}
+
+static struct bpftuner *bpftune_tuner_from_name(const char *name)
+{
+	struct bpftuner *tuner;
+
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state == BPFTUNE_ACTIVE && tuner->name &&
+		    strcmp(tuner->name, name) == 0)
+			return tuner;
+	}
+	return NULL;
+}
+
+static const char *bpftune_state_name(enum bpftune_state state)
+{
+	switch (state) {
+	case BPFTUNE_ACTIVE:
+		return "active";
+	case BPFTUNE_MANUAL:
+		return "manual";
+	case BPFTUNE_GONE:
+		return "gone";
+	default:
+		return "inactive";
+	}
+}
+
+static void bpftune_control_list(FILE *fp)
+{
+	struct bpftuner_netns *netns;
+	struct bpftuner *tuner;
+	unsigned int i, j;
+
+	fprintf(fp, "ok\n");
+	bpftune_for_each_tuner(tuner) {
+		if (!tuner->name)
+			continue;
+		fprintf(fp, "tuner %s %s rate %d%s%s\n", tuner->name,
+			bpftune_state_name(tuner->state),
+			bpftuner_learning_rate(tuner),
+			tuner->bpf_legacy ? " legacy" : "",
+			bpftuner_dry_run(tuner) ? " dry_run" : "");
+		/* tunable and netns state may be gone for inactive tuners */
+		if (tuner->state != BPFTUNE_ACTIVE)
+			continue;
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			fprintf(fp, " tunable %s %s rate %d", t->desc.name,
+				bpftune_state_name(t->state),
+				bpftuner_tunable_learning_rate(tuner, i, 0));
+			for (j = 0; j < t->desc.num_values &&
+				    j < BPFTUNE_MAX_VALUES; j++)
+				fprintf(fp, " %ld", t->current_values[j]);
+			fprintf(fp, "\n");
+		}
+		bpftuner_for_each_netns(tuner, netns) {
+			if (netns == &tuner->netns)
+				fprintf(fp, " netns global");
+			else
+				fprintf(fp, " netns %lu", netns->netns_cookie);
+			fprintf(fp, " %s\n", netns->state >= BPFTUNE_MANUAL ?
+				"disabled" : "enabled");
+		}
+	}
+}
+
+static void bpftune_control_stats(FILE *fp)
+{
+	struct bpftuner *tuner;
+	unsigned int i, j;
+
+	fprintf(fp, "ok\n");
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state != BPFTUNE_ACTIVE)
+			continue;
+		for (i = 0; i < tuner->num_tunables; i++) {
+			struct bpftunable *t = &tuner->tunables[i];
+
+			for (j = 0; j < tuner->num_scenarios &&
+				    j < BPFTUNE_MAX_SCENARIOS; j++) {
+				if (!t->stats.global_ns[j] &&
+				    !t->stats.nonglobal_ns[j])
+					continue;
+				fprintf(fp, "%s %s %s global %lu nonglobal %lu\n",
+					tuner->name, t->desc.name,
+					tuner->scenarios[j].name,
+					t->stats.global_ns[j],
+					t->stats.nonglobal_ns[j]);
+			}
+		}
+	}
+}
+
+/* netns may be "global", a netns cookie or a nsfs path. */
+static int bpftune_control_netns(const char *netns, unsigned long *cookie)
+{
+	char *end;
+	int fd, ret;
+
+	if (!netns || strcmp(netns, "global") == 0) {
+		*cookie = 0;
+		return 0;
+	}
+	*cookie = strtoul(netns, &end, 10);
+	if (*end == '\0')
+		return 0;
+	if (!netns_cookie_supported)
+		return -ENOTSUP;
+	ret = bpftune_cap_add();
+	if (ret)
+		return ret;
+	fd = open(netns, O_RDONLY);
+	if (fd < 0)
+		ret = -errno;
+	else
+		ret = bpftune_netns_info(0, &fd, cookie);
+	if (fd >= 0)
+		close(fd);
+	bpftune_cap_drop();
+	return ret;
+}
+
+static int bpftune_control_enable(struct bpftuner *tuner, const char *netns,
+				  bool enable)
+{
+	struct bpftuner_netns *n;
+	unsigned long cookie;
+	int ret;
+
+	ret = bpftune_control_netns(netns, &cookie);
+	if (ret)
+		return ret;
+	n = bpftuner_tunable_netns(tuner, cookie);
+	if (!n && enable)
+		return 0;
+	if (!n) {
+		bpftuner_netns_init(tuner, cookie);
+		n = bpftuner_tunable_netns(tuner, cookie);
+		if (!n)
+			return -ENOENT;
+	}
+	n->state = enable ? BPFTUNE_ACTIVE : BPFTUNE_MANUAL;
+	bpftune_log(BPFTUNE_LOG_LEVEL, "%s tuner '%s' in netns %s via control socket\n",
+		    enable ? "enabled" : "disabled", tuner->name,
+		    netns ? netns : "global");
+	return 0;
+}
+
+/* name is a tuner or tunable name, or NULL to set the global rate */
+static int bpftune_control_rate(const char *name, const char *arg)
+{
+	struct bpftuner *tuner;
+	char *end;
+	long rate;
+	int err;
+
+	rate = strtol(arg, &end, 10);
+	if (*end != '\0' || rate < BPFTUNE_DELTA_MIN || rate > BPFTUNE_DELTA_MAX)
+		return -ERANGE;
+	if (name) {
+		err = bpftune_set_named_learning_rate(name, rate);
+		if (err)
+			return err;
+	} else {
+		bpftune_set_learning_rate(rate);
+	}
+	bpftune_for_each_tuner(tuner) {
+		if (tuner->state == BPFTUNE_ACTIVE)
+			bpftuner_learning_rates_update(tuner);
+	}
+	bpftune_log(BPFTUNE_LOG_LEVEL, "learning rate%s%s set to %ld via control socket\n",
+		    name ? " for " : "", name ? name : "", rate);
+	return 0;
+}
+
+static void bpftune_control_request(FILE *fp, char *req)
+{
+	char *argv[BPFTUNE_CONTROL_MAX_ARGS] = {}, *saveptr = NULL, *arg;
+	struct bpftuner *tuner;
+	int argc = 0, ret = 0;
+
+	for (arg = strtok_r(req, " \t\r\n", &saveptr);
+	     arg && argc < BPFTUNE_CONTROL_MAX_ARGS;
+	     arg = strtok_r(NULL, " \t\r\n", &saveptr))
+		argv[argc++] = arg;
+	if (argc == 0) {
+		ret = -EINVAL;
+	} else if (strcmp(argv[0], "list") == 0) {
+		bpftune_control_list(fp);
+		return;
+	} else if (strcmp(argv[0], "stats") == 0) {
+		bpftune_control_stats(fp);
+		return;
+	} else if (strcmp(argv[0], "enable") == 0 ||
+		   strcmp(argv[0], "disable") == 0) {
+		tuner = argc > 1 ? bpftune_tuner_from_name(argv[1]) : NULL;
+		if (!tuner)
+			ret = -ENOENT;
+		else
+			ret = bpftune_control_enable(tuner, argv[2],
+						     argv[0][0] == 'e');
+	} else if (strcmp(argv[0], "rate") == 0 && argc > 1) {
+		ret = argc > 2 ? bpftune_control_rate(argv[1], argv[2]) :
+				 bpftune_control_rate(NULL, argv[1]);
+	} else {
+		ret = -EINVAL;
+	}
+	if (ret)
+		fprintf(fp, "error %s\n", strerror(-ret));
+	else
+		fprintf(fp, "ok\n");
+}
+
+/* called from the event loop; handle any pending control requests. */
+static void bpftune_control_poll(void)
+{
+	struct timeval timeout = { .tv_sec = 1 };
+	char req[BPFTUNE_MAX_NAME * 4];
+	struct ucred cred;
+	socklen_t len;
+	ssize_t n;
+	FILE *fp;
+	int fd;
+
+	if (bpftune_control_fd < 0)
+		return;
+	while ((fd = accept4(bpftune_control_fd, NULL, NULL,
+			     SOCK_CLOEXEC)) >= 0) {
+		len = sizeof(cred);
+		if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+		    (cred.uid != 0 && cred.uid != geteuid())) {
+			close(fd);
+			continue;
+		}
+		/* do not let a slow client stall event handling */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+			   sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+			   sizeof(timeout));
+		n = recv(fd, req, sizeof(req) - 1, 0);
+		fp = fdopen(fd, "w");
+		if (!fp) {
+			close(fd);
+			continue;
+		}
+		if (n <= 0) {
+			fprintf(fp, "error %s\n", strerror(n ? errno : EINVAL));
+		} else {
+			req[n] = '\0';
+			bpftune_log(LOG_DEBUG, "control request '%s'\n", req);
+			bpftune_control_request(fp, req);
+		}
+		fclose(fp);
+	}
+}
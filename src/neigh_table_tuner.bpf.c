@@ -55,7 +55,11 @@ int BPF_PROG(bpftune_neigh_create, struct neigh_table *tbl,
 	}
 	tbl_stats->entries = BPF_CORE_READ(tbl, entries.counter);
 	tbl_stats->gc_entries = BPF_CORE_READ(tbl, gc_entries.counter);
-	tbl_stats->max = BPF_CORE_READ(tbl, gc_thresh3);
+	tbl_stats->max = bpftune_shadow_value(NULL,
+					      tbl_stats->family == AF_INET ?
+					      NEIGH_TABLE_IPV4_GC_THRESH3 :
+					      NEIGH_TABLE_IPV6_GC_THRESH3,
+					      0, BPF_CORE_READ(tbl, gc_thresh3));
 
 	/* exempt from gc entries are not subject to space constraints, but
  	 * do take up table entries.
@@ -74,7 +78,7 @@ int BPF_PROG(bpftune_neigh_create, struct neigh_table *tbl,
 		STATIC_ASSERT(sizeof(event.raw_data) >= sizeof(*tbl_stats),
 			      "event.raw_data too small");
 		__builtin_memcpy(&event.raw_data, tbl_stats, sizeof(*tbl_stats));
-		bpf_ringbuf_output(&ring_buffer_map, &event, sizeof(event), 0);
+		bpftune_ringbuf_output(&event, sizeof(event));
 	}
 	return 0;
 }
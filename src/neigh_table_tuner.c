@@ -68,7 +68,26 @@ void fini(struct bpftuner *tuner)
 	bpftuner_bpf_fini(tuner);
 }
 
-static int set_gc_thresh3(struct bpftuner *tuner, struct tbl_stats *stats)
+/* grown gc_thresh3 value, clamped to limits; 0 if the tunable may not be
+ * changed or the limited value is unchanged.
+ */
+static long gc_thresh3_limited(struct bpftuner *tuner, struct tbl_stats *stats,
+			       unsigned int tunable, unsigned long netns_cookie)
+{
+	long val = BPFTUNE_GROW_BY_RATE(stats->max,
+				bpftuner_tunable_learning_rate(tuner, tunable,
+							       netns_cookie));
+	long old = stats->max;
+
+	if (bpftuner_tunable_limit(tuner, tunable, netns_cookie, 1, &old,
+				   &val) < 0 ||
+	    val == old)
+		return 0;
+	return val;
+}
+
+static int set_gc_thresh3(struct bpftuner *tuner, struct tbl_stats *stats,
+			  unsigned long netns_cookie)
 {
 	char *tbl_name = stats->family == AF_INET ? "arp_cache" : "ndisc_cache";
 	/* Open raw socket for the NETLINK_ROUTE protocol */
@@ -80,9 +99,14 @@ static int set_gc_thresh3(struct bpftuner *tuner, struct tbl_stats *stats)
                 .ndtm_family = stats->family,
         };
 	struct nl_msg *m = NULL, *parms = NULL;
-	int new_gc_thresh3 = 0;
+	int new_gc_thresh3 = gc_thresh3_limited(tuner, stats, tunable, netns_cookie);
 	int ret;
 
+	if (!new_gc_thresh3) {
+		if (sk)
+			nl_socket_free(sk);
+		return 0;
+	}
 	if (!sk) {
 		bpftune_log(LOG_ERR, "failed to alloc netlink socket\n");
 		return -ENOMEM;
@@ -110,7 +134,6 @@ static int set_gc_thresh3(struct bpftuner *tuner, struct tbl_stats *stats)
 
 	NLA_PUT_STRING(m, NDTA_NAME, tbl_name);
 
-	new_gc_thresh3 = BPFTUNE_GROW_BY_DELTA(stats->max);
 	NLA_PUT_U32(m, NDTA_THRESH3, new_gc_thresh3);
 
 	parms = nlmsg_alloc();
@@ -150,6 +173,31 @@ out:
 	return ret;
 }		
 
+/* dry-run mode; record the gc_thresh3 value we would have set. */
+static int shadow_gc_thresh3(struct bpftuner *tuner, struct tbl_stats *stats,
+			     unsigned long netns_cookie)
+{
+	char *tbl_name = stats->family == AF_INET ? "arp_cache" : "ndisc_cache";
+	unsigned int tunable = stats->family == AF_INET ?
+				NEIGH_TABLE_IPV4_GC_THRESH3 :
+				NEIGH_TABLE_IPV6_GC_THRESH3;
+	long new_gc_thresh3;
+	int ret;
+
+	new_gc_thresh3 = gc_thresh3_limited(tuner, stats, tunable,
+					    netns_cookie);
+	if (!new_gc_thresh3)
+		return 0;
+	ret = bpftuner_tunable_shadow(tuner, tunable, netns_cookie, 1,
+				      &new_gc_thresh3);
+	if (!ret)
+		bpftuner_tunable_update(tuner, tunable, NEIGH_TABLE_FULL, 0,
+"dry run: would update gc_thresh3 for %s table, dev '%s' (ifindex %d) from %d to %ld\n",
+					tbl_name, stats->dev, stats->ifindex,
+					stats->max, new_gc_thresh3);
+	return ret;
+}
+
 void event_handler(struct bpftuner *tuner,
 		   struct bpftune_event *event,
 		   __attribute__((unused))void *ctx)
@@ -158,9 +206,13 @@ void event_handler(struct bpftuner *tuner,
 
 	switch (event->scenario_id) {
 	case NEIGH_TABLE_FULL:
+		if (bpftuner_dry_run(tuner)) {
+			shadow_gc_thresh3(tuner, stats, event->netns_cookie);
+			break;
+		}
 		if (bpftune_cap_add())
 			return;
-		set_gc_thresh3(tuner, stats);
+		set_gc_thresh3(tuner, stats, event->netns_cookie);
 		bpftune_cap_drop();
 		break;
 	default:
@@ -57,6 +57,8 @@ int BPF_PROG(bpftune_enqueue_to_backlog, struct sk_buff *skb, int cpu,
 	if (bpf_probe_read_kernel(&max_backlog, sizeof(max_backlog),
 				  max_backlogp))
 		return 0;
+	max_backlog = bpftune_shadow_value(NULL, NETDEV_MAX_BACKLOG, 0,
+					   max_backlog);
 
 	/* if we drop more than 1/16 of the backlog queue size/min,
 	 * increase backlog queue size.  This means as the queue size
@@ -71,7 +73,9 @@ int BPF_PROG(bpftune_enqueue_to_backlog, struct sk_buff *skb, int cpu,
 		return 0;
 
 	old[0] = max_backlog;
-	new[0] = BPFTUNE_GROW_BY_DELTA(max_backlog);
+	new[0] = BPFTUNE_GROW_BY_STEP(max_backlog,
+			bpftune_tunable_learning_rate(NULL, NETDEV_MAX_BACKLOG),
+			bpftune_tunable_step(NULL, NETDEV_MAX_BACKLOG));
 	send_net_sysctl_event(NULL, NETDEV_MAX_BACKLOG_INCREASE,
 			      NETDEV_MAX_BACKLOG, old, new, &event);
 
@@ -18,8 +18,22 @@
  */
 
 #include <bpftune/bpftune.bpf.h>
+#include <bpftune/tcp_hook.bpf.h>
 #include "netns_tuner.h"
 
+BPF_MAP_DEF(netns_conn_map, BPF_MAP_TYPE_HASH, __u64, struct netns_conn_stats,
+	    65536);
+
+/* track live namespaces in netns_map (cookie -> creating pid) */
+static __always_inline void netns_created(struct bpftune_event *event)
+{
+	__u64 cookie = event->netns_cookie;
+	__u64 pid = event->pid;
+
+	bpf_map_update_elem(&netns_map, &cookie, &pid, BPF_ANY);
+	bpftune_ringbuf_output(event, sizeof(*event));
+}
+
 #ifdef BPFTUNE_LEGACY
 
 struct setup_net {
@@ -41,12 +55,10 @@ int BPF_KRETPROBE(bpftune_setup_net_return, int ret)
 	struct bpftune_event event = {};
 	__u64 current, *netnsp;
 	struct net *netns;
-	
-	if (ret != 0)
-		return 0;
 
 	get_entry_data(setup_net_map, setup_net, net, netns);
-	if (!netns)
+	del_entry_struct(setup_net_map);
+	if (ret != 0 || !netns)
 		return 0;
 
 	event.tuner_id = tuner_id;
@@ -54,7 +66,7 @@ int BPF_KRETPROBE(bpftune_setup_net_return, int ret)
 	event.scenario_id = NETNS_SCENARIO_CREATE;
 	event.netns_cookie = get_netns_cookie(netns);
 	if (event.netns_cookie >= 0)
-		bpf_ringbuf_output(&ring_buffer_map, &event, sizeof(event), 0);
+		netns_created(&event);
 
 	return 0;
 }
@@ -74,24 +86,159 @@ int BPF_PROG(bpftune_setup_net, struct net *net, struct user_namespace *user_ns,
 	event.scenario_id = NETNS_SCENARIO_CREATE;
 	event.netns_cookie = get_netns_cookie(net);
 	if (event.netns_cookie >= 0)
-		bpf_ringbuf_output(&ring_buffer_map, &event, sizeof(event), 0);
+		netns_created(&event);
 
 	return 0;
 }
 #endif
 
-/*BPF_FENTRY(net_free, struct net *net)
+#ifndef BPFTUNE_LEGACY
+/* iterate over tasks to find network namespaces in a single pass; each
+ * namespace is recorded in netns_map along with the pid of a task in it,
+ * which userspace can use to get an fd for the namespace.
+ */
+SEC("iter/task")
+int bpftune_netns_iter(struct bpf_iter__task *ctx)
+{
+	struct task_struct *task = ctx->task;
+	struct net *net;
+	long cookie;
+	__u64 pid;
+
+	if (!task)
+		return 0;
+	net = BPF_CORE_READ(task, nsproxy, net_ns);
+	if (!net)
+		return 0;
+	cookie = get_netns_cookie(net);
+	if (cookie < 0)
+		return 0;
+	pid = BPF_CORE_READ(task, tgid);
+	bpf_map_update_elem(&netns_map, &cookie, &pid, BPF_NOEXIST);
+	return 0;
+}
+#endif
+
+/* net_free() is static and may be inlined, so use __put_net(); it is
+ * called when the last reference to the namespace is dropped and queues
+ * it for cleanup.
+ */
+BPF_FENTRY(__put_net, struct net *net)
 {
 	struct bpftune_event event = {};
+	long cookie;
 
 	if (!net)
 		return 0;
 
+	cookie = get_netns_cookie(net);
+	if (cookie <= 0)
+		return 0;
 	event.tuner_id = tuner_id;
 	event.scenario_id = NETNS_SCENARIO_DESTROY;
-	event.netns_cookie = get_netns_cookie(net);
-	if (event.netns_cookie >= 0)
-		bpf_ringbuf_output(&ring_buffer_map, &event, sizeof(event), 0);
+	event.netns_cookie = cookie;
+	bpf_map_delete_elem(&netns_map, &event.netns_cookie);
+	bpftune_ringbuf_output(&event, sizeof(event));
+
+	return 0;
+}
 
+static __always_inline struct netns_conn_stats *get_conn_stats(struct sock *sk)
+{
+	struct netns_conn_stats *stats, new_stats = {};
+	struct net *net = BPF_CORE_READ(sk, sk_net.net);
+	long cookie;
+
+	/* we only size hash tables for non-global namespaces. */
+	if (!net || net == &init_net || net == (void *)bpftune_init_net)
+		return NULL;
+	cookie = get_netns_cookie(net);
+	if (cookie <= 0)
+		return NULL;
+	stats = bpf_map_lookup_elem(&netns_conn_map, &cookie);
+	if (stats)
+		return stats;
+	bpf_map_update_elem(&netns_conn_map, &cookie, &new_stats, BPF_NOEXIST);
+	return bpf_map_lookup_elem(&netns_conn_map, &cookie);
+}
+
+/* count TCP sockets per namespace to size the per-netns ehash
+ * (net.ipv4.tcp_child_ehash_entries) for future namespaces.  Sockets are
+ * counted at creation and destruction rather than on state changes to
+ * keep this off the hot path; tcp_init_sock() is already hooked for
+ * tcp_buffer, and tcp_v4_destroy_sock() is used for IPv6 sockets also.
+ */
+BPF_TCP_HOOK(tcp_init_sock, struct sock *sk)
+{
+	struct netns_conn_stats *stats;
+
+	if (!sk)
+		return 0;
+	stats = get_conn_stats(sk);
+	if (!stats)
+		return 0;
+	__sync_fetch_and_add(&stats->tcp, 1);
+	if (stats->tcp > stats->tcp_max)
+		stats->tcp_max = stats->tcp;
 	return 0;
-} */
+}
+
+BPF_FENTRY(tcp_v4_destroy_sock, struct sock *sk)
+{
+	struct netns_conn_stats *stats;
+
+	if (!sk)
+		return 0;
+	stats = get_conn_stats(sk);
+	if (stats && stats->tcp > 0)
+		__sync_fetch_and_add(&stats->tcp, -1);
+	return 0;
+}
+
+static __always_inline int udp_sock_created(struct sock *sk)
+{
+	struct netns_conn_stats *stats;
+
+	if (!sk)
+		return 0;
+	stats = get_conn_stats(sk);
+	if (!stats)
+		return 0;
+	__sync_fetch_and_add(&stats->udp, 1);
+	if (stats->udp > stats->udp_max)
+		stats->udp_max = stats->udp;
+	return 0;
+}
+
+static __always_inline int udp_sock_destroyed(struct sock *sk)
+{
+	struct netns_conn_stats *stats;
+
+	if (!sk)
+		return 0;
+	stats = get_conn_stats(sk);
+	if (stats && stats->udp > 0)
+		__sync_fetch_and_add(&stats->udp, -1);
+	return 0;
+}
+
+/* IPv6 UDP sockets have their own init/destroy functions. */
+BPF_FENTRY(udp_init_sock, struct sock *sk)
+{
+	return udp_sock_created(sk);
+}
+
+BPF_FENTRY(udpv6_init_sock, struct sock *sk)
+{
+	return udp_sock_created(sk);
+}
+
+BPF_FENTRY(udp_destroy_sock, struct sock *sk)
+{
+	return udp_sock_destroyed(sk);
+}
+
+BPF_FENTRY(udpv6_destroy_sock, struct sock *sk)
+{
+	return udp_sock_destroyed(sk);
+}
@@ -24,30 +24,60 @@
 
 struct netns_tuner_bpf *skel;
 
-#define NETNS	0
-
 static struct bpftunable_desc descs[] = {
 {
  NETNS, BPFTUNABLE_OTHER, "Network namespace", true, 0 },
+{ NETNS_TCP_CHILD_EHASH_ENTRIES, BPFTUNABLE_SYSCTL,
+  "net.ipv4.tcp_child_ehash_entries", false, 1 },
+{ NETNS_UDP_CHILD_HASH_ENTRIES, BPFTUNABLE_SYSCTL,
+  "net.ipv4.udp_child_hash_entries", false, 1 },
 };
 
 static struct bpftunable_scenario scenarios[] = {
 { NETNS_SCENARIO_CREATE, "netns created", "network namespace creation" },
 { NETNS_SCENARIO_DESTROY, "netns destroyed", "network namespace destruction" },
+{ NETNS_SCENARIO_CHILD_HASH, "netns child hash sized",
+  "size per-namespace socket hash tables for new namespaces based on observed namespace socket counts" },
 };
 
+/* learned per-namespace peak socket counts */
+static long tcp_conns, udp_conns;
+
+static const char *persistent_maps[] = { "netns_conn_map", NULL };
+
 int init(struct bpftuner *tuner)
 {
-	const char *optionals[] = { "entry__net_free", NULL };
+	const char *optionals[] = { "entry____put_net",
+				    "hook__tcp_init_sock",
+				    "entry__tcp_v4_destroy_sock",
+				    "entry__udp_init_sock",
+				    "entry__udpv6_init_sock",
+				    "entry__udp_destroy_sock",
+				    "entry__udpv6_destroy_sock",
+				    NULL };
+	unsigned int num_descs = 1;
+	long val;
 
 	if (!bpftune_netns_cookie_supported())
 		return -ENOTSUP;
 
+	tuner->persistent_maps = persistent_maps;
 	bpftuner_bpf_open(netns, tuner);
 	bpftuner_bpf_load(netns, tuner);
 	bpftuner_bpf_attach(netns, tuner, optionals);
 
-	return bpftuner_tunables_init(tuner, ARRAY_SIZE(descs), descs,
+	/* per-netns child hash sysctls are only present in newer kernels
+	 * (tcp_child_ehash_entries in 6.1, udp_child_hash_entries in 6.2).
+	 */
+	if (bpftune_sysctl_read(0, descs[NETNS_TCP_CHILD_EHASH_ENTRIES].name,
+				&val) == 1) {
+		num_descs++;
+		if (bpftune_sysctl_read(0,
+					descs[NETNS_UDP_CHILD_HASH_ENTRIES].name,
+					&val) == 1)
+			num_descs++;
+	}
+	return bpftuner_tunables_init(tuner, num_descs, descs,
 				      ARRAY_SIZE(scenarios), scenarios);
 }
 
@@ -57,6 +87,112 @@ void fini(struct bpftuner *tuner)
 	bpftuner_bpf_fini(tuner);
 }
 
+/* learn from the peak socket counts of a namespace; use max, decaying
+ * towards smaller observed peaks.
+ */
+static long netns_learn(long learned, long observed)
+{
+	if (observed >= learned)
+		return observed;
+	return (3 * learned + observed) / 4;
+}
+
+static int netns_conn_map_fd(struct bpftuner *tuner)
+{
+	struct bpf_map *map;
+
+	map = bpf_object__find_map_by_name(tuner->obj, "netns_conn_map");
+	if (!map)
+		return -ENOENT;
+	return bpf_map__fd(map);
+}
+
+/* namespace is going away; learn from its socket counts. */
+static void netns_conn_learn(struct bpftuner *tuner, unsigned long cookie)
+{
+	struct netns_conn_stats stats = {};
+	int map_fd = netns_conn_map_fd(tuner);
+	__u64 key = cookie;
+
+	if (map_fd < 0 || bpf_map_lookup_elem(map_fd, &key, &stats))
+		return;
+	tcp_conns = netns_learn(tcp_conns, stats.tcp_max);
+	udp_conns = netns_learn(udp_conns, stats.udp_max);
+	bpftune_log(LOG_DEBUG, "netns (cookie %ld) max tcp %lld, udp %lld; learned tcp %ld, udp %ld\n",
+		    cookie, stats.tcp_max, stats.udp_max, tcp_conns, udp_conns);
+}
+
+/* round up to power of 2 within [min, max]; 0 if count is below min as
+ * such namespaces are fine sharing the global hash table.
+ */
+static long netns_child_hash_entries(long count, long min, long max)
+{
+	long entries = min;
+
+	if (count < min)
+		return 0;
+	while (entries < count && entries < max)
+		entries <<= 1;
+	return entries;
+}
+
+static void netns_child_hash_update(struct bpftuner *tuner,
+				    unsigned int tunable,
+				    long count, long min, long max,
+				    const char *proto)
+{
+	struct bpftunable *t = bpftuner_tunable(tuner, tunable);
+	long entries;
+
+	if (!t)
+		return;
+	/* entries may also shrink as learned peaks decay, down to 0 where
+	 * new namespaces share the global table again.
+	 */
+	entries = netns_child_hash_entries(count, min, max);
+	if (entries == t->current_values[0])
+		return;
+	bpftuner_tunable_sysctl_write(tuner, tunable, NETNS_SCENARIO_CHILD_HASH,
+				      0, 1, &entries,
+"Due to up to %ld %s sockets per namespace, change %s from %ld -> %ld for new namespaces\n",
+				      count, proto, t->desc.name,
+				      t->current_values[0], entries);
+}
+
+/* per-namespace hash tables are sized from the sysctl values of the
+ * namespace of the task creating the namespace, so a new namespace is a
+ * cue to size for the next one.  We only set the values in the global
+ * namespace, so this covers namespaces created from there (as container
+ * runtimes usually do); namespaces created from within other namespaces
+ * use the values of those namespaces.  Use learned peaks from namespaces
+ * that have gone away along with peaks from those still running.
+ */
+static void netns_child_hash_size(struct bpftuner *tuner)
+{
+	__u64 key, next_key, *prev = NULL;
+	struct netns_conn_stats stats;
+	long tcp = tcp_conns, udp = udp_conns;
+	int map_fd = netns_conn_map_fd(tuner);
+
+	if (bpftuner_num_tunables(tuner) <= NETNS_TCP_CHILD_EHASH_ENTRIES)
+		return;
+	while (map_fd >= 0 &&
+	       !bpf_map_get_next_key(map_fd, prev, &next_key)) {
+		if (!bpf_map_lookup_elem(map_fd, &next_key, &stats)) {
+			tcp = stats.tcp_max > tcp ? stats.tcp_max : tcp;
+			udp = stats.udp_max > udp ? stats.udp_max : udp;
+		}
+		key = next_key;
+		prev = &key;
+	}
+	netns_child_hash_update(tuner, NETNS_TCP_CHILD_EHASH_ENTRIES, tcp,
+				NETNS_TCP_CHILD_EHASH_MIN,
+				NETNS_TCP_CHILD_EHASH_MAX, "TCP");
+	netns_child_hash_update(tuner, NETNS_UDP_CHILD_HASH_ENTRIES, udp,
+				NETNS_UDP_CHILD_HASH_MIN,
+				NETNS_UDP_CHILD_HASH_MAX, "UDP");
+}
+
 void event_handler(__attribute__((unused))struct bpftuner *tuner,
 		   struct bpftune_event *event,
 		   __attribute__((unused))void *ctx)
@@ -84,8 +220,13 @@ void event_handler(__attribute__((unused))struct bpftuner *tuner,
 		bpftune_for_each_tuner(t)
 			bpftuner_netns_init(t, event->netns_cookie);
 		close(netns_fd);
+		/* profiles may refer to the new namespace */
+		bpftune_profiles_update();
+		netns_child_hash_size(tuner);
 		break;
 	case NETNS_SCENARIO_DESTROY:
+		/* learn before per-netns map state is reclaimed. */
+		netns_conn_learn(tuner, event->netns_cookie);
 		bpftune_for_each_tuner(t)
 			bpftuner_netns_fini(t, event->netns_cookie, BPFTUNE_GONE);
 		break;
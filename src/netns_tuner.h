@@ -19,7 +19,33 @@
 
 #include <bpftune/bpftune.h>
 
+enum netns_tunables {
+	NETNS,
+	NETNS_TCP_CHILD_EHASH_ENTRIES,
+	NETNS_UDP_CHILD_HASH_ENTRIES,
+	NETNS_NUM_TUNABLES,
+};
+
 enum {
 	NETNS_SCENARIO_CREATE,
-	NETNS_SCENARIO_DESTROY
+	NETNS_SCENARIO_DESTROY,
+	NETNS_SCENARIO_CHILD_HASH,
 };
+
+/* per-netns socket counts, used to size per-netns hash tables for
+ * future namespaces.
+ */
+struct netns_conn_stats {
+	__s64 tcp;		/* current TCP sockets */
+	__s64 tcp_max;		/* max TCP sockets */
+	__s64 udp;		/* current UDP sockets (IPv4 and IPv6) */
+	__s64 udp_max;		/* max UDP sockets */
+};
+
+/* per-netns hash table limits from the kernel; tcp_child_ehash_entries
+ * is rounded up to a power of 2, minimum 128.
+ */
+#define NETNS_TCP_CHILD_EHASH_MIN	128
+#define NETNS_TCP_CHILD_EHASH_MAX	(16 * 1024 * 1024)
+#define NETNS_UDP_CHILD_HASH_MIN	256
+#define NETNS_UDP_CHILD_HASH_MAX	65536
@@ -41,6 +41,15 @@ int BPF_PROG(bpftune_neigh_create, struct neigh_table *tbl,
 	return 0;
 }
 
+#ifndef BPFTUNE_LEGACY
+/* probe iterator support */
+SEC("iter/task")
+int bpftune_probe_iter(struct bpf_iter__task *ctx)
+{
+	return 0;
+}
+#endif
+
 SEC("cgroup/sysctl")
 int sysctl_write(struct bpf_sysctl *ctx)
 {
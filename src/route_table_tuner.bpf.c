@@ -23,10 +23,17 @@
 struct dst_net {
 	struct net *net;
 	int entries;
+	__u64 start;
 };
 
 BPF_MAP_DEF(dst_net_map, BPF_MAP_TYPE_HASH, __u64, struct dst_net, 65536);
 
+BPF_MAP_DEF(netns_gc_stats_map, BPF_MAP_TYPE_HASH, __u64,
+	    struct route_gc_stats, 1024);
+
+/* needed to convert gc_min_interval from jiffies to msec */
+extern int CONFIG_HZ __kconfig __weak;
+
 SEC("kprobe/fib6_run_gc")
 int BPF_KPROBE(bpftune_fib6_run_gc_entry, unsigned long expires,
 					  struct net *net, bool force)
@@ -38,15 +45,103 @@ int BPF_KPROBE(bpftune_fib6_run_gc_entry, unsigned long expires,
 	if (dst_netp)
 		return 0;
 	save_entry_data(dst_net_map, dst_net, net, net);
+	get_entry_struct(dst_net_map, dst_netp);
+	if (dst_netp)
+		dst_netp->start = bpf_ktime_get_ns();
 	return 0;
 }
 
-/* catch dst alloc approaching limit and increase route table max size */
+static __always_inline struct route_gc_stats *gc_stats_update(__u64 nscookie,
+							      __u64 now,
+							      __u64 duration)
+{
+	struct route_gc_stats *stats;
+
+	stats = bpf_map_lookup_elem(&netns_gc_stats_map, &nscookie);
+	if (!stats) {
+		struct route_gc_stats new_stats = {};
+
+		bpf_map_update_elem(&netns_gc_stats_map, &nscookie, &new_stats,
+				    BPF_ANY);
+		stats = bpf_map_lookup_elem(&netns_gc_stats_map, &nscookie);
+		if (!stats)
+			return NULL;
+	}
+	if ((now - stats->interval_start) > ROUTE_GC_INTERVAL) {
+		stats->interval_start = now;
+		stats->interval_runs = 0;
+		stats->interval_time_ns = 0;
+	}
+	stats->interval_runs++;
+	stats->interval_time_ns += duration;
+	stats->runs++;
+	stats->time_ns += duration;
+	return stats;
+}
+
+/* gc is running often but the table is not close to max_size; we can
+ * afford to let it fill further before collecting (gc_thresh), collect
+ * less often (gc_min_interval) and expire entries less aggressively
+ * (gc_elasticity).  gc_thresh is bounded by max_size so the table stays
+ * bounded.
+ */
+static __always_inline void gc_excessive(struct net *net, int max_size)
+{
+	struct bpftune_event event = {};
+	long old[3] = {};
+	long new[3] = {};
+	unsigned short rate;
+	int hz = CONFIG_HZ;
+	int step;
+
+	old[0] = bpftune_shadow_value(net, ROUTE_TABLE_IPV6_GC_THRESH, 0,
+				      BPF_CORE_READ(net, ipv6.ip6_dst_ops.gc_thresh));
+	rate = bpftune_tunable_learning_rate(net, ROUTE_TABLE_IPV6_GC_THRESH);
+	step = bpftune_tunable_step(net, ROUTE_TABLE_IPV6_GC_THRESH);
+	new[0] = min(BPFTUNE_GROW_BY_STEP(old[0], rate, step), max_size);
+	if (new[0] > old[0])
+		(void) send_net_sysctl_event(net, ROUTE_TABLE_GC_EXCESSIVE,
+					     ROUTE_TABLE_IPV6_GC_THRESH,
+					     old, new, &event);
+
+	old[0] = bpftune_shadow_value(net, ROUTE_TABLE_IPV6_GC_ELASTICITY, 0,
+				      BPF_CORE_READ(net, ipv6.sysctl.ip6_rt_gc_elasticity));
+	new[0] = old[0] + 1;
+	if (new[0] <= ROUTE_GC_ELASTICITY_MAX)
+		(void) send_net_sysctl_event(net, ROUTE_TABLE_GC_EXCESSIVE,
+					     ROUTE_TABLE_IPV6_GC_ELASTICITY,
+					     old, new, &event);
+
+	if (hz <= 0)
+		return;
+	old[0] = BPF_CORE_READ(net, ipv6.sysctl.ip6_rt_gc_min_interval);
+	old[0] = (old[0] * 1000) / hz;
+	old[0] = bpftune_shadow_value(net, ROUTE_TABLE_IPV6_GC_MIN_INTERVAL_MS,
+				      0, old[0]);
+	rate = bpftune_tunable_learning_rate(net,
+					     ROUTE_TABLE_IPV6_GC_MIN_INTERVAL_MS);
+	step = bpftune_tunable_step(net, ROUTE_TABLE_IPV6_GC_MIN_INTERVAL_MS);
+	new[0] = min(BPFTUNE_GROW_BY_STEP(old[0], rate, step),
+		     ROUTE_GC_MIN_INTERVAL_MS_MAX);
+	if (new[0] > old[0])
+		(void) send_net_sysctl_event(net, ROUTE_TABLE_GC_EXCESSIVE,
+					     ROUTE_TABLE_IPV6_GC_MIN_INTERVAL_MS,
+					     old, new, &event);
+}
+
+/* catch dst alloc approaching limit and increase route table max size;
+ * if gc runs excessively without the table approaching its limit, make
+ * gc less frequent.
+ */
 SEC("kretprobe/fib6_run_gc")
 int BPF_KRETPROBE(bpftune_fib6_run_gc)
 {
+	struct route_gc_stats *stats = NULL;
 	struct dst_net *dst_net;
+	__u64 now, duration;
+	unsigned short rate;
 	struct net *net;
+	long nscookie;
 	int max_size;
 
 	get_entry_struct(dst_net_map, dst_net);
@@ -54,9 +149,17 @@ int BPF_KRETPROBE(bpftune_fib6_run_gc)
 		return 0;
 
 	net = dst_net->net;
+	now = bpf_ktime_get_ns();
+	duration = now - dst_net->start;
+
+	nscookie = get_netns_cookie(net);
+	if (nscookie >= 0)
+		stats = gc_stats_update(nscookie, now, duration);
 
-	max_size = BPF_CORE_READ(net, ipv6.sysctl.ip6_rt_max_size);
-	if (NEARLY_FULL(dst_net->entries, max_size)) {
+	max_size = bpftune_shadow_value(net, ROUTE_TABLE_IPV6_MAX_SIZE, 0,
+					BPF_CORE_READ(net, ipv6.sysctl.ip6_rt_max_size));
+	rate = bpftune_tunable_learning_rate(net, ROUTE_TABLE_IPV6_MAX_SIZE);
+	if (NEARLY_FULL_RATE(dst_net->entries, max_size, rate)) {
 		struct bpftune_event event = {};
 		long old[3] = {};
 		long new[3] = {};
@@ -65,10 +168,18 @@ int BPF_KRETPROBE(bpftune_fib6_run_gc)
 		event.scenario_id = ROUTE_TABLE_FULL;
 
 		old[0] = max_size;
-		new[0] = BPFTUNE_GROW_BY_DELTA(max_size);
+		new[0] = BPFTUNE_GROW_BY_STEP(max_size, rate,
+				bpftune_tunable_step(net, ROUTE_TABLE_IPV6_MAX_SIZE));
 		(void) send_net_sysctl_event(net, ROUTE_TABLE_FULL,
 					     ROUTE_TABLE_IPV6_MAX_SIZE,
 					     old, new, &event);
+	} else if (stats && (stats->interval_runs > ROUTE_GC_MAX_RUNS ||
+			     stats->interval_time_ns > ROUTE_GC_MAX_TIME)) {
+		gc_excessive(net, max_size);
+		/* start a new interval so we give changes time to work */
+		stats->interval_start = now;
+		stats->interval_runs = 0;
+		stats->interval_time_ns = 0;
 	}
 	del_entry_struct(dst_net_map);
 	return 0;
@@ -28,15 +28,26 @@ struct route_table_tuner_bpf *skel;
 static struct bpftunable_desc descs[] = {
 { ROUTE_TABLE_IPV6_MAX_SIZE,		BPFTUNABLE_SYSCTL,
 		"net.ipv6.route.max_size",		true, 1 },
+{ ROUTE_TABLE_IPV6_GC_THRESH,		BPFTUNABLE_SYSCTL,
+		"net.ipv6.route.gc_thresh",		true, 1 },
+{ ROUTE_TABLE_IPV6_GC_ELASTICITY,	BPFTUNABLE_SYSCTL,
+		"net.ipv6.route.gc_elasticity",		true, 1 },
+{ ROUTE_TABLE_IPV6_GC_MIN_INTERVAL_MS,	BPFTUNABLE_SYSCTL,
+		"net.ipv6.route.gc_min_interval_ms",	true, 1 },
 };
 
 static struct bpftunable_scenario scenarios[] = {
 { ROUTE_TABLE_FULL,	"destination table nearly full",
 		"destination table is nearly full, preventing new entries from being added." },
+{ ROUTE_TABLE_GC_EXCESSIVE, "destination table gc excessive",
+		"destination table garbage collection is running frequently while the table is not close to full; reduce gc frequency." },
 };
 
+static const char *persistent_maps[] = { "netns_gc_stats_map", NULL };
+
 int init(struct bpftuner *tuner)
 {
+	tuner->persistent_maps = persistent_maps;
 	bpftuner_bpf_open(route_table, tuner);
 	bpftuner_bpf_load(route_table, tuner);
 	bpftuner_bpf_attach(route_table, tuner, NULL);
@@ -50,10 +61,24 @@ void fini(struct bpftuner *tuner)
 	bpftuner_bpf_fini(tuner);
 }
 
+/* retrieve gc statistics for netns to report with gc tunable changes */
+static void gc_stats_get(struct bpftuner *tuner, unsigned long netns_cookie,
+			 struct route_gc_stats *stats)
+{
+	struct bpf_map *map;
+	__u64 key = netns_cookie;
+
+	map = bpf_object__find_map_by_name(tuner->obj, "netns_gc_stats_map");
+	if (!map || bpf_map_lookup_elem(bpf_map__fd(map), &key, stats))
+		memset(stats, 0, sizeof(*stats));
+}
+
 void event_handler(struct bpftuner *tuner,
 		   struct bpftune_event *event,
 		   __attribute__((unused))void *ctx)
 {
+	struct route_gc_stats stats;
+	const char *tunable;
 	int id;
 
 	switch (event->scenario_id) {
@@ -67,6 +92,23 @@ void event_handler(struct bpftuner *tuner,
 					      event->update[0].old[0],
 					      event->update[0].new[0]);
 		break;
+	case ROUTE_TABLE_GC_EXCESSIVE:
+		id = event->update[0].id;
+		tunable = bpftuner_tunable_name(tuner, id);
+		if (!tunable) {
+			bpftune_log(LOG_DEBUG, "unknown tunable [%d] for route_table_tuner\n", id);
+			return;
+		}
+		gc_stats_get(tuner, event->netns_cookie, &stats);
+		bpftuner_tunable_sysctl_write(tuner, id, ROUTE_TABLE_GC_EXCESSIVE,
+					      event->netns_cookie, 1,
+					      event->update[0].new,
+"Due to excessive dst table gc (%llu runs, %llu usec total), change %s from %d -> %d\n",
+					      stats.runs, stats.time_ns / 1000,
+					      tunable,
+					      event->update[0].old[0],
+					      event->update[0].new[0]);
+		break;
 	default:
 		return;
 	}
@@ -25,11 +25,36 @@
 
 enum route_table_tunables {
 	ROUTE_TABLE_IPV6_MAX_SIZE,
+	ROUTE_TABLE_IPV6_GC_THRESH,
+	ROUTE_TABLE_IPV6_GC_ELASTICITY,
+	ROUTE_TABLE_IPV6_GC_MIN_INTERVAL_MS,
 	ROUTE_TABLE_NUM_TUNABLES
 };
 
 enum route_table_scenarios {
 	ROUTE_TABLE_FULL,
+	ROUTE_TABLE_GC_EXCESSIVE,
+};
+
+/* fib6_run_gc() is considered excessive if it runs more than
+ * ROUTE_GC_MAX_RUNS times in ROUTE_GC_INTERVAL, or if it consumes
+ * more than ROUTE_GC_MAX_TIME in that interval (1% of a CPU).
+ */
+#define ROUTE_GC_INTERVAL		SECOND
+#define ROUTE_GC_MAX_RUNS		50
+#define ROUTE_GC_MAX_TIME		(10 * MSEC)
+
+/* upper limits for gc tunables; gc_thresh is limited by max_size. */
+#define ROUTE_GC_ELASTICITY_MAX		16
+#define ROUTE_GC_MIN_INTERVAL_MS_MAX	5000
+
+/* per-netns gc statistics, keyed by netns cookie */
+struct route_gc_stats {
+	__u64 interval_start;
+	__u64 interval_runs;
+	__u64 interval_time_ns;
+	__u64 runs;
+	__u64 time_ns;
 };
 
 struct tbl_stats {
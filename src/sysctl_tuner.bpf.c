@@ -18,6 +18,10 @@
  */
 
 #include <bpftune/bpftune.bpf.h>
+#include "sysctl_tuner.h"
+
+BPF_MAP_DEF(sysctl_watch_map, BPF_MAP_TYPE_HASH, struct sysctl_watch_key,
+	    __u8, 1024);
 
 /* use kprobe here as it is not in fastpath and the function has a large
  * number of args not well handled by fentry.  We trace the sysctl set
@@ -33,6 +37,7 @@ int BPF_KPROBE(bpftune_sysctl, struct ctl_table_header *head,
  	 */
 	struct ctl_table_set *dummy_ctl_table_set = NULL;
 	struct net *dummy_net = NULL;
+	struct sysctl_watch_key key = {};
 	struct bpftune_event event = {};
 	struct ctl_dir *root, *parent, *gparent, *ggparent;
 	struct ctl_dir *gggparent;
@@ -50,6 +55,16 @@ int BPF_KPROBE(bpftune_sysctl, struct ctl_table_header *head,
 	current_pid = bpf_get_current_pid_tgid() >> 32;
 	if (current_pid == bpftune_pid)
 		return 0;
+	/* only send events for sysctls tuners use; container runtimes
+	 * write many sysctls at startup we do not care about.
+	 */
+	procname = BPF_CORE_READ(table, procname);
+	if (!procname)
+		return 0;
+	if (bpf_probe_read_str(key.name, sizeof(key.name), procname) < 0)
+		return 0;
+	if (!bpf_map_lookup_elem(&sysctl_watch_map, &key))
+		return 0;
 	parent = BPF_CORE_READ(head, parent);
 	if (!parent)
 		return 0;
@@ -93,12 +108,9 @@ int BPF_KPROBE(bpftune_sysctl, struct ctl_table_header *head,
 		}
 	}
 
-	procname = BPF_CORE_READ(table, procname);
-	if (!procname)
-		return 0;
-	if (bpf_probe_read(str, len, procname) < 0)
+	if (bpf_probe_read(str, len, key.name) < 0)
 		return 0;
-	bpf_ringbuf_output(&ring_buffer_map, &event, sizeof(event), 0);	
+	bpftune_ringbuf_output(&event, sizeof(event));	
 	return 0;
 }
 
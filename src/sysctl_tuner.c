@@ -27,7 +27,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <linux/limits.h>
 
 extern unsigned short learning_rate;
 
@@ -52,7 +51,8 @@ void fini(struct bpftuner *tuner)
 void event_handler(struct bpftuner *tuner, struct bpftune_event *event,
 		   __attribute__((unused))void *ctx)
 {
-	struct bpftuner *t = NULL;
+	struct bpftune_sysctl_match matches[BPFTUNE_MAX_TUNERS];
+	int i, num_matches;
 
 	bpftune_log(LOG_DEBUG, "sysctl write for '%s' (scenario %d) for tuner %s\n",
 		    event->str, event->scenario_id, tuner->name);
@@ -60,30 +60,23 @@ void event_handler(struct bpftuner *tuner, struct bpftune_event *event,
 	if (event->netns_cookie == (unsigned long)-1)
 		return;
 
-	bpftune_for_each_tuner(t) {
-		struct bpftunable *tunable;
+	/* exact match on sysctl path, so gc_thresh in routing table tuner
+	 * does not match gc_thresh3 in neigh table tuner for example.
+	 */
+	num_matches = bpftune_sysctl_tunables_find(event->str, matches,
+						   BPFTUNE_MAX_TUNERS);
+	for (i = 0; i < num_matches; i++) {
+		struct bpftuner *t = matches[i].tuner;
+		struct bpftunable *tunable = matches[i].tunable;
 
-		bpftune_log(LOG_DEBUG, "checking tuner %s\n", tuner->name);
-		bpftuner_for_each_tunable(t, tunable) {
-			char path[PATH_MAX];
-
-			bpftune_sysctl_name_to_path(tunable->desc.name, path,
-						    sizeof(path));
-
-			bpftune_log(LOG_DEBUG, "checking path %s against %s\n",
-				    path, event->str);
-			/* does name match last characters in path? want to
-			 * avoid gc_thresh in routing table tuner matching
-			 * gc_thresh3 in neigh table tuner for example.
-			 */
-			if (strstr(path, event->str)) {
-				bpftune_log(BPFTUNE_LOG_LEVEL,
-					    "user modified sysctl '%s' that tuner '%s' uses; disabling '%s' for namespace cookie %ld\n",
-					    event->str, t->name, t->name,
-					    event->netns_cookie);
-				bpftuner_netns_fini(t, event->netns_cookie, BPFTUNE_MANUAL);
-				break;
-			}
-		}
+		/* only the modified tunable is disabled; the tuner carries
+		 * on tuning its other tunables.
+		 */
+		bpftune_log(BPFTUNE_LOG_LEVEL,
+			    "user modified sysctl '%s' that tuner '%s' uses; disabling tuning of '%s' for namespace cookie %ld\n",
+			    event->str, t->name, tunable->desc.name,
+			    event->netns_cookie);
+		bpftuner_tunable_netns_manual(t, tunable->desc.id,
+					      event->netns_cookie);
 	}
 }
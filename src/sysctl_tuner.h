@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Copyright (c) 2023, Oracle and/or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#ifndef __SYSCTL_TUNER_H
+#define __SYSCTL_TUNER_H
+
+#include <bpftune/bpftune.h>
+
+/* sysctl_watch_map is keyed by the last component of the sysctl name
+ * (e.g. "tcp_rmem" for net.ipv4.tcp_rmem); it is populated from the
+ * tunables of all tuners so we only send events for sysctls of interest.
+ */
+struct sysctl_watch_key {
+	char name[BPFTUNE_MAX_NAME];
+};
+
+#endif /* __SYSCTL_TUNER_H */
@@ -18,6 +18,7 @@
  */
 
 #include <bpftune/bpftune.bpf.h>
+#include <bpftune/tcp_hook.bpf.h>
 #include "tcp_buffer_tuner.h"
 #include <bpftune/corr.h>
 
@@ -39,6 +40,11 @@ int sk_mem_quantum;
 int sk_mem_quantum_shift;
 unsigned long nr_free_buffer_pages;
 
+/* tcp_[rw]mem value, or the value set in dry-run mode */
+#define tcp_sysctl_mem(__net, __id, __field, __i)			\
+	bpftune_shadow_value(__net, __id, __i,				\
+			     (long)BPF_CORE_READ(__net, ipv4.__field[__i]))
+
 #define tcp_tunable_corr(__id, __cookie, __newval, __tp, __field_type, __field)\
 	{								\
 		__field_type __field;					\
@@ -59,7 +65,8 @@ static __always_inline bool tcp_nearly_out_of_memory(struct sock *sk,
 	atomic_long_t *memory_allocated = BPF_CORE_READ(prot, memory_allocated);
 	long *sysctl_mem = BPF_CORE_READ(prot, sysctl_mem);
 	__u8 shift_left = 0, shift_right = 0;
-	int i;
+	unsigned short rate, mem_rate;
+	int i, step, mem_step;
 
 	if (!sk || !prot || !memory_allocated)
 		return false;
@@ -68,6 +75,11 @@ static __always_inline bool tcp_nearly_out_of_memory(struct sock *sk,
 		return false;
 	if (bpf_probe_read_kernel(mem, sizeof(mem), sysctl_mem))
 		return false;
+	mem[0] = bpftune_shadow_value(NULL, TCP_BUFFER_TCP_MEM, 0, mem[0]);
+	mem[1] = bpftune_shadow_value(NULL, TCP_BUFFER_TCP_MEM, 1, mem[1]);
+	mem[2] = bpftune_shadow_value(NULL, TCP_BUFFER_TCP_MEM, 2, mem[2]);
+	mem_rate = bpftune_tunable_learning_rate(NULL, TCP_BUFFER_TCP_MEM);
+	mem_step = bpftune_tunable_step(NULL, TCP_BUFFER_TCP_MEM);
 
 	if (!mem[0] || !mem[1] || !mem[2])
 		return false;
@@ -101,7 +113,7 @@ static __always_inline bool tcp_nearly_out_of_memory(struct sock *sk,
 		mem_new[0] = mem[0];
 		mem_new[1] = mem[1];
 		mem_new[2] = min(nr_free_buffer_pages >> 2,
-				 BPFTUNE_GROW_BY_DELTA(mem[2]));
+				 BPFTUNE_GROW_BY_STEP(mem[2], mem_rate, mem_step));
 		/* if we still have room to grow mem exhaustion limit, do that,
 		 * otherwise shrink wmem/rmem.
 		 */
@@ -113,23 +125,30 @@ static __always_inline bool tcp_nearly_out_of_memory(struct sock *sk,
 		}
 		if (!net)
 			return true;
-		mem[0] = (long)BPF_CORE_READ(net, ipv4.sysctl_tcp_wmem[0]);
-		mem[1] = (long)BPF_CORE_READ(net, ipv4.sysctl_tcp_wmem[1]);
-		mem[2] = (long)BPF_CORE_READ(net, ipv4.sysctl_tcp_wmem[2]);
+		/* tcp_mem is global, but wmem/rmem are per-netns so use
+		 * the netns learning rate for them.
+		 */
+		rate = bpftune_tunable_learning_rate(net, TCP_BUFFER_TCP_WMEM);
+		step = bpftune_tunable_step(net, TCP_BUFFER_TCP_WMEM);
+		mem[0] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_WMEM, sysctl_tcp_wmem, 0);
+		mem[1] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_WMEM, sysctl_tcp_wmem, 1);
+		mem[2] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_WMEM, sysctl_tcp_wmem, 2);
 		mem_new[0] = mem[0];
 		mem_new[1] = mem[1];
-		mem_new[2] = BPFTUNE_SHRINK_BY_DELTA(mem[2]);
+		mem_new[2] = BPFTUNE_SHRINK_BY_STEP(mem[2], rate, step);
 		send_sk_sysctl_event(sk, TCP_BUFFER_DECREASE,
 				     TCP_BUFFER_TCP_WMEM,
 				     mem, mem_new, event);
 		if (!net)
 			return true;
-		mem[0] = (long)BPF_CORE_READ(net, ipv4.sysctl_tcp_rmem[0]);
-		mem[1] = (long)BPF_CORE_READ(net, ipv4.sysctl_tcp_rmem[1]);
-		mem[2] = (long)BPF_CORE_READ(net, ipv4.sysctl_tcp_rmem[2]);
+		rate = bpftune_tunable_learning_rate(net, TCP_BUFFER_TCP_RMEM);
+		step = bpftune_tunable_step(net, TCP_BUFFER_TCP_RMEM);
+		mem[0] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_RMEM, sysctl_tcp_rmem, 0);
+		mem[1] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_RMEM, sysctl_tcp_rmem, 1);
+		mem[2] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_RMEM, sysctl_tcp_rmem, 2);
 		mem_new[0] = mem[0];
 		mem_new[1] = mem[1];
-		mem_new[2] = BPFTUNE_SHRINK_BY_DELTA(mem[2]);
+		mem_new[2] = BPFTUNE_SHRINK_BY_STEP(mem[2], rate, step);
 		send_sk_sysctl_event(sk, TCP_BUFFER_DECREASE,
 				     TCP_BUFFER_TCP_RMEM,
 				     mem, mem_new, event);
@@ -147,11 +166,11 @@ static __always_inline bool tcp_nearly_out_of_memory(struct sock *sk,
 		mem_new[0] = mem[0];
 		mem_new[1] = mem[1];
 		if (mem[0] < nr_free_buffer_pages >> 4)
-			mem_new[0] = BPFTUNE_GROW_BY_DELTA(mem[0]);
+			mem_new[0] = BPFTUNE_GROW_BY_STEP(mem[0], mem_rate, mem_step);
 		if (mem[1] < nr_free_buffer_pages >> 3)
-			mem_new[1] = BPFTUNE_GROW_BY_DELTA(mem[1]);
+			mem_new[1] = BPFTUNE_GROW_BY_STEP(mem[1], mem_rate, mem_step);
 		mem_new[2] = min(nr_free_buffer_pages >> 2,
-				 BPFTUNE_GROW_BY_DELTA(mem[2]));
+				 BPFTUNE_GROW_BY_STEP(mem[2], mem_rate, mem_step));
 		send_sk_sysctl_event(sk, TCP_MEM_PRESSURE,
 				     TCP_BUFFER_TCP_MEM, mem, mem_new,
 				     event);
@@ -189,27 +208,34 @@ BPF_FENTRY(tcp_leave_memory_pressure, struct sock *sk)
  * However, all that said, we may soon run out of sndbuf space, so
  * if it is nearly exhausted (>75% full), expand by 25%.
  */
-BPF_FENTRY(tcp_sndbuf_expand, struct sock *sk)
+BPF_TCP_HOOK(tcp_sndbuf_expand, struct sock *sk)
 {
 	struct bpftune_event event = { 0 };
-	struct net *net = BPF_CORE_READ(sk, sk_net.net);
+	struct net *net = hook->net;
 	struct tcp_sock *tp = (struct tcp_sock *)sk;
 	long wmem[3], wmem_new[3];
+	unsigned short rate;
 	long sndbuf;
+	int step;
 
-	if (!sk || !net || tcp_nearly_out_of_memory(sk, &event))
+	if (!sk || !net || bpftune_sample_skip() ||
+	    tcp_nearly_out_of_memory(sk, &event))
 		return 0;
 
-	sndbuf = BPF_CORE_READ(sk, sk_sndbuf);
-	wmem[2] = BPF_CORE_READ(net, ipv4.sysctl_tcp_wmem[2]);
+	sndbuf = hook->sndbuf;
+	wmem[2] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_WMEM, sysctl_tcp_wmem, 2);
+	rate = bpftune_tunable_learning_rate(net, TCP_BUFFER_TCP_WMEM);
+	step = bpftune_tunable_step(net, TCP_BUFFER_TCP_WMEM);
 
-	if (NEARLY_FULL(sndbuf, wmem[2])) {
+	if (NEARLY_FULL_RATE(sndbuf, wmem[2], rate)) {
 
 		if (!net)
 			return 0;
-		wmem[0] = wmem_new[0] = BPF_CORE_READ(net, ipv4.sysctl_tcp_wmem[0]);
-		wmem[1] = wmem_new[1] = BPF_CORE_READ(net, ipv4.sysctl_tcp_wmem[1]);
-		wmem_new[2] = BPFTUNE_GROW_BY_DELTA(wmem[2]);
+		wmem[0] = wmem_new[0] =
+			tcp_sysctl_mem(net, TCP_BUFFER_TCP_WMEM, sysctl_tcp_wmem, 0);
+		wmem[1] = wmem_new[1] =
+			tcp_sysctl_mem(net, TCP_BUFFER_TCP_WMEM, sysctl_tcp_wmem, 1);
+		wmem_new[2] = BPFTUNE_GROW_BY_STEP(wmem[2], rate, step);
 
 		if (send_sk_sysctl_event(sk, TCP_BUFFER_INCREASE,
 					 TCP_BUFFER_TCP_WMEM,
@@ -229,16 +255,18 @@ BPF_FENTRY(tcp_sndbuf_expand, struct sock *sk)
  * regardless of if we are under memory pressure or not; so use the variable
  * we set when memory pressure is triggered.
  */
-BPF_FENTRY(tcp_rcv_space_adjust, struct sock *sk)
+BPF_TCP_HOOK(tcp_rcv_space_adjust, struct sock *sk)
 {
 	struct bpftune_event event = { 0 };
-	struct net *net = BPF_CORE_READ(sk, sk_net.net);
+	struct net *net = hook->net;
 	struct tcp_sock *tp = (struct tcp_sock *)sk;
 	long rmem[3], rmem_new[3];
 	__u8 sk_userlocks = 0;
+	unsigned short rate;
 	long rcvbuf;
+	int step;
 
-	if (!sk || !net)
+	if (!sk || !net || bpftune_sample_skip())
 		return 0;
 
 #ifndef BPFTUNE_LEGACY
@@ -249,16 +277,20 @@ BPF_FENTRY(tcp_rcv_space_adjust, struct sock *sk)
 	    near_memory_exhaustion)
 		return 0;
 
-	rcvbuf = BPF_CORE_READ(sk, sk_rcvbuf);
-	rmem[2] = BPF_CORE_READ(net, ipv4.sysctl_tcp_rmem[2]);
+	rcvbuf = hook->rcvbuf;
+	rmem[2] = tcp_sysctl_mem(net, TCP_BUFFER_TCP_RMEM, sysctl_tcp_rmem, 2);
+	rate = bpftune_tunable_learning_rate(net, TCP_BUFFER_TCP_RMEM);
+	step = bpftune_tunable_step(net, TCP_BUFFER_TCP_RMEM);
 
-	if (NEARLY_FULL(rcvbuf, rmem[2])) {
+	if (NEARLY_FULL_RATE(rcvbuf, rmem[2], rate)) {
 		if (tcp_nearly_out_of_memory(sk, &event))
 			return 0;
 
-		rmem[0] = rmem_new[0] = BPF_CORE_READ(net, ipv4.sysctl_tcp_rmem[0]);
-		rmem[1] = rmem_new[1] = BPF_CORE_READ(net, ipv4.sysctl_tcp_rmem[1]);
-		rmem_new[2] = BPFTUNE_GROW_BY_DELTA(rmem[2]);
+		rmem[0] = rmem_new[0] =
+			tcp_sysctl_mem(net, TCP_BUFFER_TCP_RMEM, sysctl_tcp_rmem, 0);
+		rmem[1] = rmem_new[1] =
+			tcp_sysctl_mem(net, TCP_BUFFER_TCP_RMEM, sysctl_tcp_rmem, 1);
+		rmem_new[2] = BPFTUNE_GROW_BY_STEP(rmem[2], rate, step);
 		if (send_sk_sysctl_event(sk, TCP_BUFFER_INCREASE, TCP_BUFFER_TCP_RMEM,
 					 rmem, rmem_new, &event) < 0)
 			return 0;
@@ -273,7 +305,7 @@ BPF_FENTRY(tcp_rcv_space_adjust, struct sock *sk)
 	return 0;
 }
 
-BPF_FENTRY(tcp_init_sock, struct sock *sk)
+BPF_TCP_HOOK(tcp_init_sock, struct sock *sk)
 {
 	struct bpftune_event event = { 0 };
 
@@ -285,9 +317,45 @@ BPF_FENTRY(tcp_init_sock, struct sock *sk)
 	return 0;
 }
 
-BPF_FENTRY(tcp_release_cb, struct sock *sk)
+BPF_TCP_HOOK(tcp_release_cb, struct sock *sk)
 {
 	if (tcp_sock_count > 0)
 		tcp_sock_count--;
 	return 0;
 }
+
+#ifndef BPFTUNE_LEGACY
+/* number of sockets seen by the watcher iterator with buffers past
+ * TCP_BUFFER_WATCH_SHIFT of their limits; reset by userspace.
+ */
+__u64 tcp_buffer_headroom_low = 0;
+
+/* Cheap watcher run periodically from userspace; the per-socket programs
+ * above are only attached while some sockets are using a significant
+ * fraction of the rmem/wmem limits.
+ */
+SEC("iter/tcp")
+int tcp_buffer_watch(struct bpf_iter__tcp *ctx)
+{
+	struct sock_common *skc = ctx->sk_common;
+	long rcvbuf, sndbuf, rmem, wmem;
+	struct sock *sk = NULL;
+	struct net *net;
+
+	if (skc)
+		sk = (struct sock *)bpf_skc_to_tcp_sock(skc);
+	if (!sk)
+		return 0;
+	net = BPF_CORE_READ(sk, sk_net.net);
+	if (!net)
+		return 0;
+	rcvbuf = BPF_CORE_READ(sk, sk_rcvbuf);
+	sndbuf = BPF_CORE_READ(sk, sk_sndbuf);
+	rmem = tcp_sysctl_mem(net, TCP_BUFFER_TCP_RMEM, sysctl_tcp_rmem, 2);
+	wmem = tcp_sysctl_mem(net, TCP_BUFFER_TCP_WMEM, sysctl_tcp_wmem, 2);
+	if (rcvbuf >= (rmem >> TCP_BUFFER_WATCH_SHIFT) ||
+	    sndbuf >= (wmem >> TCP_BUFFER_WATCH_SHIFT))
+		tcp_buffer_headroom_low++;
+	return 0;
+}
+#endif
@@ -136,12 +136,150 @@ retry:
 	return nr_pages;
 }
 
+static const char *persistent_maps[] = { "corr_map", NULL };
+
+/* per-packet buffer programs that fire on hot paths; only attached while
+ * buffers or TCP memory are near limits (see tcp_buffer_periodic()).
+ * tcp_init_sock/tcp_release_cb hooks stay attached since they maintain
+ * socket counts and check for memory pressure/exhaustion.
+ */
+static const char *lazy_progs[] = {
+	"hook__tcp_sndbuf_expand",
+	"hook__tcp_rcv_space_adjust",
+	NULL
+};
+
+/* skipping buffer checks only delays growing buffers, so these may be
+ * detached by the overhead governor.
+ */
+static const char *governed_progs[] = {
+	"hook__tcp_sndbuf_expand",
+	"hook__tcp_rcv_space_adjust",
+	NULL
+};
+
+static unsigned long last_busy;
+
+/* TCP memory in use in pages, from /proc/net/sockstat */
+static long tcp_mem_allocated(void)
+{
+	long mem = -1;
+	FILE *fp;
+
+	fp = fopen("/proc/net/sockstat", "r");
+	if (!fp)
+		return -1;
+	if (get_from_file(fp, "TCP: inuse %*d orphan %*d tw %*d alloc %*d mem %ld",
+			  &mem) != 1)
+		mem = -1;
+	fclose(fp);
+	return mem;
+}
+
+/* run watcher iterator over TCP sockets in each netns we know about */
+static bool tcp_buffer_watch_netns(struct bpftuner *tuner)
+{
+	struct tcp_buffer_tuner_bpf *skel = tuner->skel;
+	struct bpftuner_netns *netns;
+	char buf[64];
+
+	skel->bss->tcp_buffer_headroom_low = 0;
+	bpftuner_for_each_netns(tuner, netns) {
+		int fd = 0, orig_fd = 0, iter_fd;
+
+		if (netns != &tuner->netns) {
+			fd = bpftuner_netns_fd_from_cookie(tuner,
+							   netns->netns_cookie);
+			if (fd < 0)
+				continue;
+			if (bpftune_netns_set(fd, &orig_fd)) {
+				close(fd);
+				continue;
+			}
+		}
+		/* the tcp iterator only walks sockets in the current netns */
+		if (!bpftune_cap_add()) {
+			iter_fd = bpf_iter_create(bpf_link__fd(skel->links.tcp_buffer_watch));
+			if (iter_fd >= 0) {
+				while (read(iter_fd, buf, sizeof(buf)) > 0) {}
+				close(iter_fd);
+			}
+			bpftune_cap_drop();
+		}
+		if (fd) {
+			bpftune_netns_set(orig_fd, NULL);
+			close(orig_fd);
+			close(fd);
+		}
+		if (skel->bss->tcp_buffer_headroom_low)
+			break;
+	}
+	return skel->bss->tcp_buffer_headroom_low > 0;
+}
+
+/* Cheap global check first: TCP memory in use (which is not per-netns)
+ * nearly at tcp_mem[0] means headroom is low.  Otherwise only walk
+ * sockets in each netns if enough TCP memory is in use for a socket to
+ * be past the watch fraction of the smaller of the rmem/wmem limits.
+ */
+static bool tcp_buffer_headroom_low(struct bpftuner *tuner)
+{
+	struct tcp_buffer_tuner_bpf *skel = tuner->skel;
+	long tcp_mem[3], rmem[3], wmem[3], mem, limit;
+
+	mem = tcp_mem_allocated();
+	if (mem < 0 || !skel->links.tcp_buffer_watch)
+		return true;
+	if (bpftune_sysctl_read(0, "net.ipv4.tcp_mem", tcp_mem) == 3 &&
+	    NEARLY_FULL(mem, tcp_mem[0]))
+		return true;
+	if (bpftune_sysctl_read(0, "net.ipv4.tcp_rmem", rmem) != 3 ||
+	    bpftune_sysctl_read(0, "net.ipv4.tcp_wmem", wmem) != 3)
+		return true;
+	limit = rmem[2] < wmem[2] ? rmem[2] : wmem[2];
+	limit >>= TCP_BUFFER_WATCH_SHIFT;
+	/* sockstat TCP memory is in pages */
+	if (mem * sysconf(_SC_PAGESIZE) < limit)
+		return false;
+	return tcp_buffer_watch_netns(tuner);
+}
+
+static void tcp_buffer_periodic(struct bpftuner *tuner)
+{
+	bool attached = bpftuner_prog_attached(tuner, lazy_progs[0]);
+	unsigned long now = bpftune_now_secs();
+	int i;
+
+	if (tcp_buffer_headroom_low(tuner)) {
+		last_busy = now;
+		if (attached)
+			return;
+		bpftune_log(LOG_INFO, "%s: buffers/TCP memory near limits, attaching buffer programs\n",
+			    tuner->name);
+		for (i = 0; lazy_progs[i] != NULL; i++)
+			bpftuner_prog_attach(tuner, lazy_progs[i]);
+	} else if (attached && now - last_busy >= TCP_BUFFER_QUIET_PERIOD) {
+		bpftune_log(LOG_INFO, "%s: quiet for %ds, detaching buffer programs\n",
+			    tuner->name, TCP_BUFFER_QUIET_PERIOD);
+		for (i = 0; lazy_progs[i] != NULL; i++)
+			bpftuner_prog_detach(tuner, lazy_progs[i]);
+	}
+}
+
 int init(struct bpftuner *tuner)
 {
 	int pagesize;
 
+	tuner->persistent_maps = persistent_maps;
+	tuner->governed_progs = governed_progs;
 	bpftuner_bpf_open(tcp_buffer, tuner);
 	bpftuner_bpf_load(tcp_buffer, tuner);
+	/* without the watcher iterator (legacy), attach everything */
+	if (!tuner->bpf_legacy) {
+		tuner->lazy_progs = lazy_progs;
+		tuner->periodic = tcp_buffer_periodic;
+		tuner->periodic_interval = TCP_BUFFER_WATCH_INTERVAL;
+	}
 
 	pagesize = sysconf(_SC_PAGESIZE);
 	if (pagesize < 0)
@@ -180,6 +318,9 @@ void event_handler(struct bpftuner *tuner,
 	struct corr_key key;
 	int id;
 
+	/* events keep per-socket programs attached */
+	last_busy = bpftune_now_secs();
+
 	/* netns cookie not supported; ignore */
 	if (event->netns_cookie == (unsigned long)-1)
 		return;
@@ -23,6 +23,15 @@
 #define SK_MEM_QUANTUM          4096
 #endif
 
+/* per-packet buffer programs are attached while some socket buffers are
+ * past 1/(1 << TCP_BUFFER_WATCH_SHIFT) of the rmem/wmem limits or TCP
+ * memory use is nearly at tcp_mem[0]; they are detached after
+ * TCP_BUFFER_QUIET_PERIOD seconds without this or any events.
+ */
+#define TCP_BUFFER_WATCH_SHIFT		1
+#define TCP_BUFFER_WATCH_INTERVAL	5	/* seconds */
+#define TCP_BUFFER_QUIET_PERIOD		60	/* seconds */
+
 enum tcp_buffer_tunables {
 	TCP_BUFFER_TCP_WMEM,
 	TCP_BUFFER_TCP_RMEM,
@@ -106,6 +106,11 @@ static __always_inline void set_cong(void *ctx, struct remote_host *remote_host)
 	char buf[CONG_MAXNAME] = {};
 	int ret;
 
+	/* in dry-run mode, events are sent but congestion control is
+	 * left unchanged.
+	 */
+	if (bpftune_dry_run)
+		return;
 	/* check if cong alg already set */
 	if (bpf_getsockopt(ctx, SOL_TCP, TCP_CONGESTION, &buf, sizeof(buf)) ||
 	    __strncmp(remote_host->cong_alg, buf, sizeof(buf)) == 0)
@@ -175,7 +180,7 @@ int cong_tuner_sockops(struct bpf_sock_ops *ops)
 	if (!prior_retransmit_threshold) {
 		event.tuner_id = tuner_id;
 		event.scenario_id = TCP_CONG_BBR;
-		bpf_ringbuf_output(&ring_buffer_map, &event, sizeof(event), 0);
+		bpftune_ringbuf_output(&event, sizeof(event));
 	}
 
 	return 1;
@@ -218,7 +223,7 @@ int BPF_PROG(cong_retransmit, struct sock *sk, struct sk_buff *skb)
 	event.netns_cookie = get_netns_cookie(net);
 	if (event.netns_cookie < 0)
 		return 0;
-	bpf_ringbuf_output(&ring_buffer_map, &event, sizeof(event), 0);
+	bpftune_ringbuf_output(&event, sizeof(event));
 
 	return 0;
 }
@@ -43,6 +43,11 @@ struct tcp_cong_tuner_bpf *skel;
 
 int tcp_iter_fd;
 
+static const char *persistent_maps[] = { "remote_host_map", NULL };
+
+/* missing retransmits only delays the choice of congestion control */
+static const char *governed_progs[] = { "cong_retransmit", NULL };
+
 int init(struct bpftuner *tuner)
 {
 	int err;
@@ -55,6 +60,8 @@ int init(struct bpftuner *tuner)
 		bpftune_log(LOG_DEBUG, "could not load tcp_bbr module: %s\n",
 			    strerror(-err));
 
+	tuner->persistent_maps = persistent_maps;
+	tuner->governed_progs = governed_progs;
 	bpftuner_bpf_init(tcp_cong, tuner, NULL);
 
 	if (tuner->bpf_legacy) {
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Copyright (c) 2023, Oracle and/or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <bpftune/bpftune.bpf.h>
+#include <bpftune/tcp_hook.bpf.h>
+
+/* Dispatcher for shared TCP hooks; see include/bpftune/tcp_hook.bpf.h.
+ * Programs are attached by libbpftune only while at least one tuner
+ * program is registered for the hook.
+ */
+#ifndef BPFTUNE_LEGACY
+
+/* number of prog array slots in use per hook; set from userspace */
+__u32 tcp_hook_nr[BPFTUNE_TCP_HOOK_MAX];
+/* hook programs record their run time; set from userspace if BPF
+ * run-time stats are enabled.
+ */
+__u32 tcp_hook_timed;
+
+static __always_inline int tcp_hook_dispatch(void *ctx, void *prog_array,
+					     __u32 id, struct sock *sk)
+{
+	struct bpftune_tcp_hook_ctx *hook = bpftune_tcp_hook_ctx(id);
+
+	if (!hook || !sk || id >= BPFTUNE_TCP_HOOK_MAX)
+		return 0;
+	bpftune_tcp_hook_ctx_fill(hook, sk);
+	hook->nr = tcp_hook_nr[id];
+	hook->next = 0;
+	hook->timed = tcp_hook_timed;
+	bpftune_tcp_hook_next(ctx, prog_array, hook);
+	return 0;
+}
+
+BPF_FENTRY(tcp_set_state, struct sock *sk, int state)
+{
+	return tcp_hook_dispatch(ctx, &tcp_hook_tcp_set_state,
+				 bpftune_tcp_hook__tcp_set_state, sk);
+}
+
+BPF_FENTRY(tcp_init_sock, struct sock *sk)
+{
+	return tcp_hook_dispatch(ctx, &tcp_hook_tcp_init_sock,
+				 bpftune_tcp_hook__tcp_init_sock, sk);
+}
+
+BPF_FENTRY(tcp_release_cb, struct sock *sk)
+{
+	return tcp_hook_dispatch(ctx, &tcp_hook_tcp_release_cb,
+				 bpftune_tcp_hook__tcp_release_cb, sk);
+}
+
+BPF_FENTRY(tcp_sndbuf_expand, struct sock *sk)
+{
+	return tcp_hook_dispatch(ctx, &tcp_hook_tcp_sndbuf_expand,
+				 bpftune_tcp_hook__tcp_sndbuf_expand, sk);
+}
+
+BPF_FENTRY(tcp_rcv_space_adjust, struct sock *sk)
+{
+	return tcp_hook_dispatch(ctx, &tcp_hook_tcp_rcv_space_adjust,
+				 bpftune_tcp_hook__tcp_rcv_space_adjust, sk);
+}
+#endif /* BPFTUNE_LEGACY */
@@ -0,0 +1,58 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# verify attach types are probed and every tuner initializes without
+# falling back to legacy mode where full support is available.
+
+. ./test_lib.sh
+
+SLEEPTIME=1
+
+test_start "$0|attach test: do all tuners load with supported attach types?"
+
+test_setup true
+
+$BPFTUNE_PROG -S 2>&1 | grep "supports attach types:"
+
+test_run_cmd_local "$BPFTUNE -ds &" true
+sleep $SETUPTIME
+
+num_tuners=$(ls /usr/lib64/bpftune/*_tuner.so | wc -l)
+num_init=$(grep -c "initialized tuner" $TESTLOG_LAST)
+echo "initialized $num_init of $num_tuners tuners"
+# netns tuner needs netns cookie support
+if [[ $BPFTUNE_NETNS -eq 0 ]]; then
+	num_tuners=$((num_tuners - 1))
+fi
+[[ $num_init -ge $num_tuners ]]
+
+if [[ ${BPFTUNE_LEGACY} -eq 0 ]]; then
+	if grep "retrying in legacy mode" $TESTLOG_LAST ; then
+		echo "tuner fell back to legacy mode with full support"
+		false
+	fi
+	grep "loaded tcp hook dispatcher" $TESTLOG_LAST
+fi
+
+test_pass
+
+test_cleanup
+
+test_exit
@@ -0,0 +1,65 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# verify control socket requests: list tuners, disable/enable a tuner
+# and change the learning rate of a running bpftune.
+
+BPFTUNE_FLAGS="-s"
+
+. ./test_lib.sh
+
+BPFTUNECTL=${BPFTUNECTL:-"/usr/sbin/bpftunectl"}
+
+test_start "$0|control test: does bpftunectl control a running bpftune?"
+
+test_setup "true"
+
+test_run_cmd_local "$BPFTUNE &" true
+
+sleep $SETUPTIME
+
+$BPFTUNECTL list
+tuners=$($BPFTUNECTL list | awk '/^tuner .* active/ { print $2 }')
+echo "active tuners: $tuners"
+if [[ -z "$tuners" ]]; then
+	test_cleanup
+fi
+$BPFTUNECTL disable sysctl
+disabled=$($BPFTUNECTL list | \
+	   awk '/^tuner/ { t = $2 } t == "sysctl" && /netns global disabled/')
+echo "disabled: $disabled"
+if [[ -z "$disabled" ]]; then
+	test_cleanup
+fi
+$BPFTUNECTL enable sysctl global
+$BPFTUNECTL rate 1
+$BPFTUNECTL stats
+set +e
+$BPFTUNECTL rate 10
+if [[ $? -eq 0 ]]; then
+	test_cleanup
+fi
+set -e
+
+test_pass
+
+test_cleanup
+
+test_exit
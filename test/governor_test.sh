@@ -0,0 +1,64 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# run bpftune with a tiny CPU budget under iperf3 load; ensure the
+# overhead governor raises sampling and then detaches programs, including
+# those run via the shared TCP hook dispatcher.  Also ensure invalid
+# budgets are rejected.
+
+PORT=5201
+
+BPFTUNE_FLAGS="-d"
+
+. ./test_lib.sh
+
+SLEEPTIME=1
+TIMEOUT=30
+# 6 sampling steps then a detach, every 5 seconds
+LOADTIME=45
+
+test_start "$0|governor test: are programs detached when over budget?"
+
+for budget in foo -1 0 1x ; do
+	if $BPFTUNE_PROG -B $budget -S 2>/dev/null ; then
+		echo "budget '$budget' was not rejected"
+		false
+	fi
+done
+
+test_setup true
+
+LOGSZ=$(wc -l $LOGFILE | awk '{print $1}')
+LOGSZ=$(expr $LOGSZ + 1)
+test_run_cmd_local "$BPFTUNE -B 0.0001 &"
+sleep $SETUPTIME
+test_run_cmd_local "ip netns exec $NETNS $IPERF3 -s -p $PORT -1 &"
+sleep $SLEEPTIME
+$IPERF3 -fm -p $PORT -c $VETH1_IPV4 -t $LOADTIME
+sleep $SLEEPTIME
+
+tail -n +${LOGSZ} $LOGFILE | grep "sampling 1 in"
+tail -n +${LOGSZ} $LOGFILE | grep "over CPU budget; detached"
+
+test_pass
+
+test_cleanup
+
+test_exit
@@ -0,0 +1,66 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# verify tcp_buffer's per-packet buffer programs are attached when socket
+# buffers near their limits under iperf3 load, and detached again once
+# things are quiet.
+
+PORT=5201
+
+. ./test_lib.sh
+
+SLEEPTIME=1
+TIMEOUT=30
+# TCP_BUFFER_QUIET_PERIOD plus TCP_BUFFER_WATCH_INTERVAL
+QUIETTIME=70
+
+test_start "$0|lazy test: are buffer programs attached/detached as needed?"
+
+wmem_orig=($(sysctl -n net.ipv4.tcp_wmem))
+
+test_setup true
+
+if [[ ${BPFTUNE_LEGACY} -ne 0 ]]; then
+	echo "programs are always attached in legacy mode, skipping..."
+	test_pass
+	test_cleanup
+	test_exit
+fi
+
+sysctl -w net.ipv4.tcp_wmem="${wmem_orig[0]} ${wmem_orig[1]} ${wmem_orig[1]}"
+
+test_run_cmd_local "$BPFTUNE -ds &" true
+sleep $SETUPTIME
+test_run_cmd_local "ip netns exec $NETNS $IPERF3 -s -p $PORT -1 &"
+sleep $SLEEPTIME
+$IPERF3 -fm -p $PORT -c $VETH1_IPV4 -t 10
+sleep $SLEEPTIME
+
+sysctl -w net.ipv4.tcp_wmem="${wmem_orig[0]} ${wmem_orig[1]} ${wmem_orig[2]}"
+grep "attaching buffer programs" $TESTLOG_LAST
+
+sleep $QUIETTIME
+grep "detaching buffer programs" $TESTLOG_LAST
+
+test_pass
+
+test_cleanup
+
+test_exit
@@ -0,0 +1,74 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# verify per-tuner and per-tunable learning rates specified on the
+# command line and in a profiles file are used, and that a tunable's
+# rate takes precedence over its tuner's.
+
+BPFTUNE_FLAGS="-s"
+
+. ./test_lib.sh
+
+BPFTUNECTL=${BPFTUNECTL:-"/usr/sbin/bpftunectl"}
+
+test_start "$0|learning rate test: are per-tuner/tunable rates used?"
+
+for rate in abc net.ipv4.tcp_wmem=abc net.ipv4.tcp_wmem= 2x ; do
+	if $BPFTUNE_PROG -r $rate -S 2>/dev/null ; then
+		echo "learning rate '$rate' was not rejected"
+		false
+	fi
+done
+
+test_setup "true"
+
+PROFILES=$(mktemp /tmp/bpftune-profiles.XXXXXX)
+cat > $PROFILES << PROFILES_EOF
+tuner route_table learning_rate 3
+tunable net.ipv4.tcp_rmem learning_rate 1
+PROFILES_EOF
+
+test_run_cmd_local "$BPFTUNE -r 4 -r tcp_buffer=2 -p $PROFILES &" true
+
+sleep $SETUPTIME
+
+rm -f $PROFILES
+$BPFTUNECTL list
+tcp_buffer_rate=$($BPFTUNECTL list | awk '$1 == "tuner" && $2 == "tcp_buffer" { print $5 }')
+route_table_rate=$($BPFTUNECTL list | awk '$1 == "tuner" && $2 == "route_table" { print $5 }')
+rmem_rate=$($BPFTUNECTL list | awk '$2 == "net.ipv4.tcp_rmem" { print $5 }')
+wmem_rate=$($BPFTUNECTL list | awk '$2 == "net.ipv4.tcp_wmem" { print $5 }')
+echo "tcp_buffer $tcp_buffer_rate route_table $route_table_rate rmem $rmem_rate wmem $wmem_rate"
+if [[ "$tcp_buffer_rate" != "2" ]] || [[ "$route_table_rate" != "3" ]] || \
+   [[ "$rmem_rate" != "1" ]] || [[ "$wmem_rate" != "2" ]]; then
+	test_cleanup
+fi
+$BPFTUNECTL rate net.ipv4.tcp_wmem 0
+wmem_rate=$($BPFTUNECTL list | awk '$2 == "net.ipv4.tcp_wmem" { print $5 }')
+echo "wmem $wmem_rate"
+if [[ "$wmem_rate" != "0" ]]; then
+	test_cleanup
+fi
+
+test_pass
+
+test_cleanup
+
+test_exit
@@ -0,0 +1,90 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# check manual overrides are per-tunable and expire: after gc_thresh3 for
+# IPv4 is set by hand, bpftune must not grow the arp_cache table, but
+# must still grow ndisc_cache; once the resume period passes without
+# further changes, arp_cache is grown again.
+
+. ./test_lib.sh
+
+LOGFILE=$TESTLOG_LAST
+
+SLEEPTIME=1
+RESUME=15
+
+# fill neighbour table tbl via dev; thresh3 is first set low so it fills
+fill_tbl()
+{
+	tbl=$1
+	dev=$2
+
+	ip ntable change name $tbl dev $dev thresh3 128
+	for ((i=3; i < 255; i++ ))
+	do
+		ih=$(printf '%x' $i)
+		if [[ $tbl == "arp_cache" ]]; then
+			ip neigh replace 192.168.168.${i} lladdr de:ad:be:ef:de:${ih} dev $dev
+		else
+			ip neigh replace fd::${ih} lladdr de:ad:be:ef:de:${ih} dev $dev
+		fi
+	done
+	sleep $SLEEPTIME
+}
+
+test_start "$0|manual test: are manual overrides per-tunable and do they expire?"
+
+for resume in foo -1 5x ; do
+	if $BPFTUNE_PROG -R $resume -S 2>/dev/null ; then
+		echo "resume period '$resume' was not rejected"
+		false
+	fi
+done
+
+test_setup "true"
+
+test_run_cmd_local "$BPFTUNE -s -R $RESUME &" true
+
+sleep $SETUPTIME
+
+val="$(sysctl -qn net.ipv4.neigh.default.gc_thresh3)"
+sysctl -qw net.ipv4.neigh.default.gc_thresh3="${val}"
+sleep $SLEEPTIME
+grep "disabling tuning of 'net.ipv4.neigh.default.gc_thresh3'" $LOGFILE
+
+fill_tbl arp_cache $VETH2
+if grep "updated gc_thresh3 for arp_cache table" $LOGFILE ; then
+	echo "arp_cache grown despite manual override"
+	false
+fi
+fill_tbl ndisc_cache $VETH2
+grep "updated gc_thresh3 for ndisc_cache table" $LOGFILE
+
+sleep $RESUME
+ip neigh flush dev $VETH2 nud all
+fill_tbl arp_cache $VETH2
+grep "resuming tuning" $LOGFILE
+grep "updated gc_thresh3 for arp_cache table" $LOGFILE
+
+test_pass
+
+test_cleanup
+
+test_exit
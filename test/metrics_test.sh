@@ -0,0 +1,52 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# verify bpftune writes metrics in Prometheus text format.
+
+BPFTUNE_FLAGS="-s"
+
+. ./test_lib.sh
+
+METRICS=$(mktemp /tmp/bpftune-metrics.XXXXXX)
+
+test_start "$0|metrics test: does bpftune write Prometheus metrics?"
+
+test_setup "true"
+
+test_run_cmd_local "$BPFTUNE -m $METRICS &" true
+
+sleep $SETUPTIME
+
+cat $METRICS
+for metric in bpftune_events_total bpftune_tunable_value \
+	      bpftune_tunable_initial_value bpftune_handler_seconds_total ; do
+	if [[ -z "$(grep "^${metric}{" $METRICS)" ]]; then
+		echo "no $metric metrics"
+		rm -f $METRICS
+		test_cleanup
+	fi
+done
+rm -f $METRICS
+
+test_pass
+
+test_cleanup
+
+test_exit
@@ -58,6 +58,9 @@ for CONTAINER_CMD in "ip netns add testns.$$" "$PODMAN_CMD sleep 5" ; do
  fi
  sleep $SLEEPTIME
  grep "netns created" $TESTLOG_LAST
+ if [[ ${CONTAINER_CMD} =~ "ip netns" ]]; then
+	grep "netns destroyed" $TESTLOG_LAST
+ fi
  test_pass
 done
 test_cleanup
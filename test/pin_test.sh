@@ -0,0 +1,84 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# run bpftune with pinning; on exit, ensure tuner links and the TCP hook
+# dispatcher stay pinned, then restart and ensure they are adopted.  Finally
+# run without pinning and ensure pinned objects are removed.
+
+BPFTUNE_FLAGS="-d"
+
+. ./test_lib.sh
+
+SLEEPTIME=1
+TIMEOUT=30
+
+PINDIR=/sys/fs/bpf/bpftune
+
+test_start "$0|pin test: are pinned programs kept across restart?"
+
+test_setup true
+
+if [[ ${BPFTUNE_LEGACY} -ne 0 ]]; then
+	echo "links are not pinned in legacy mode, skipping..."
+	test_pass
+	test_cleanup
+	test_exit
+fi
+
+LOGSZ=$(wc -l $LOGFILE | awk '{print $1}')
+LOGSZ=$(expr $LOGSZ + 1)
+test_run_cmd_local "$BPFTUNE -P &"
+sleep $SETUPTIME
+
+pkill -TERM -x bpftune
+sleep $SETUPTIME
+ls -R $PINDIR
+ls $PINDIR/*/link_* > /dev/null
+ls $PINDIR/tcp_hook/tcp_hook_* > /dev/null
+if [[ $BPFTUNE_NETNS -ne 0 ]]; then
+	# netns tuner registers a tcp_init_sock hook
+	ls $PINDIR/tcp_hook/link_entry__tcp_init_sock
+fi
+
+LOGSZ=$(wc -l $LOGFILE | awk '{print $1}')
+LOGSZ=$(expr $LOGSZ + 1)
+test_run_cmd_local "$BPFTUNE -P &"
+sleep $SETUPTIME
+
+tail -n +${LOGSZ} $LOGFILE | grep "adopting pinned link"
+if [[ $BPFTUNE_NETNS -ne 0 ]]; then
+	tail -n +${LOGSZ} $LOGFILE | grep "adopting pinned tcp hook dispatcher"
+	tail -n +${LOGSZ} $LOGFILE | grep "took over tcp hook 'tcp_init_sock'"
+fi
+
+pkill -TERM -x bpftune
+sleep $SETUPTIME
+test_run_cmd_local "$BPFTUNE &"
+sleep $SETUPTIME
+if [[ -d $PINDIR ]]; then
+	echo "$PINDIR not removed without pinning"
+	false
+fi
+
+test_pass
+
+test_cleanup
+
+test_exit
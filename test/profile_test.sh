@@ -0,0 +1,69 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# run iperf3 test with low rmem max in netns, with a profile limiting
+# netns rmem; ensure tuner increases rmem but not beyond profile limit.
+
+PORT=5201
+
+. ./test_lib.sh
+
+SLEEPTIME=1
+TIMEOUT=30
+
+test_start "$0|profile test: are per-netns profile limits respected?"
+
+test_setup true
+
+if [[ ${BPFTUNE_NETNS} -eq 0 ]]; then
+	echo "bpftune does not support per-netns policy, skipping..."
+	test_pass
+	test_cleanup
+	test_exit
+fi
+
+rmem_orig_netns=($(ip netns exec $NETNS sysctl -n net.ipv4.tcp_rmem))
+rmem_limit=$(expr ${rmem_orig_netns[1]} + ${rmem_orig_netns[1]} / 8)
+ip netns exec $NETNS sysctl -w net.ipv4.tcp_rmem="${rmem_orig_netns[0]} ${rmem_orig_netns[1]} ${rmem_orig_netns[1]}"
+
+PROFILES=$(mktemp /tmp/bpftune-profiles.XXXXXX)
+cat > $PROFILES << PROFILES_EOF
+netns /var/run/netns/$NETNS learning_rate 1
+netns /var/run/netns/$NETNS net.ipv4.tcp_rmem 0 $rmem_limit
+PROFILES_EOF
+
+test_run_cmd_local "ip netns exec $NETNS $IPERF3 -s -p $PORT -1 &"
+test_run_cmd_local "$BPFTUNE -p $PROFILES &"
+sleep $SETUPTIME
+test_run_cmd_local "$IPERF3 -fm -R -c $PORT -c $VETH1_IPV4" true
+sleep $SLEEPTIME
+
+rm -f $PROFILES
+rmem_post_netns=($(ip netns exec $NETNS sysctl -n net.ipv4.tcp_rmem))
+echo "netns rmem before ${rmem_orig_netns[1]} ; after ${rmem_post_netns[2]} ; limit $rmem_limit"
+if [[ ${rmem_post_netns[2]} -gt $rmem_limit ]]; then
+	test_cleanup
+fi
+
+test_pass
+
+test_cleanup
+
+test_exit
@@ -0,0 +1,79 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# run iperf3 test with low wmem max and a rollback verification window;
+# once the tuner has increased wmem, introduce packet loss so that
+# retransmits increase during verification, and ensure the change is
+# rolled back.
+
+PORT=5201
+
+WINDOW=10
+BPFTUNE_FLAGS="-b $WINDOW"
+
+. ./test_lib.sh
+
+SLEEPTIME=1
+TIMEOUT=30
+
+test_start "$0|rollback test: are changes followed by regressions rolled back?"
+
+for window in foo -1 10x ; do
+	if $BPFTUNE_PROG -b $window -S 2>/dev/null ; then
+		echo "rollback window '$window' was not rejected"
+		false
+	fi
+done
+
+wmem_orig=($(sysctl -n net.ipv4.tcp_wmem))
+
+test_setup true
+
+sysctl -w net.ipv4.tcp_wmem="${wmem_orig[0]} ${wmem_orig[1]} ${wmem_orig[1]}"
+
+LOGSZ=$(wc -l $LOGFILE | awk '{print $1}')
+LOGSZ=$(expr $LOGSZ + 1)
+test_run_cmd_local "ip netns exec $NETNS $IPERF3 -s -p $PORT &"
+test_run_cmd_local "$BPFTUNE &"
+sleep $SETUPTIME
+test_run_cmd_local "$IPERF3 -fm -t 2 -p $PORT -c $VETH1_IPV4" true
+wmem_post=($(sysctl -n net.ipv4.tcp_wmem))
+echo "wmem before ${wmem_orig[1]} ; after ${wmem_post[2]}"
+if [[ ${wmem_post[2]} -le ${wmem_orig[1]} ]]; then
+	sysctl -w net.ipv4.tcp_wmem="${wmem_orig[0]} ${wmem_orig[1]} ${wmem_orig[2]}"
+	test_cleanup
+fi
+tc qdisc replace dev $VETH2 root netem loss 10%
+test_run_cmd_local "$IPERF3 -fm -t 5 -p $PORT -c $VETH1_IPV4" true
+sleep $(expr $WINDOW + 5)
+
+wmem_rollback=($(sysctl -n net.ipv4.tcp_wmem))
+sysctl -w net.ipv4.tcp_wmem="${wmem_orig[0]} ${wmem_orig[1]} ${wmem_orig[2]}"
+echo "wmem after rollback ${wmem_rollback[2]}"
+tail -n +${LOGSZ} $LOGFILE | grep "rolled back 'net.ipv4.tcp_wmem'"
+if [[ ${wmem_rollback[2]} -ne ${wmem_orig[1]} ]]; then
+	test_cleanup
+fi
+
+test_pass
+
+test_cleanup
+
+test_exit
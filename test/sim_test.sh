@@ -0,0 +1,62 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# run the tcp_buffer tuner in the simulator on a synthetic scenario
+# growing rmem max; verify the target is reached, that a lower learning
+# rate takes longer to reach it and that results are reproducible.
+
+. ./test_lib.sh
+
+BPFTUNESIM=${BPFTUNESIM:-"/usr/sbin/bpftunesim"}
+TUNER=${TUNER:-"/usr/lib64/bpftune/tcp_buffer_tuner.so"}
+SCENARIO="${TESTDIR}/sim.scenario.$$"
+
+test_start "$0|sim test: does bpftunesim converge on rmem target?"
+
+test_setup "true"
+
+cat > $SCENARIO <<EOS
+tuner $TUNER
+sysctl net.ipv4.tcp_rmem 4096 131072 6291456
+sysctl net.ipv4.tcp_wmem 4096 16384 4194304
+sysctl net.ipv4.tcp_mem 190000 253000 380000
+grow 0 1000 200 0 0 net.ipv4.tcp_rmem 2 16777216
+EOS
+
+$BPFTUNESIM $SCENARIO
+fast=$($BPFTUNESIM $SCENARIO | awk '/^converged net.ipv4.tcp_rmem/ { print $5 }')
+slow=$($BPFTUNESIM -r 1 $SCENARIO | awk '/^converged net.ipv4.tcp_rmem/ { print $5 }')
+echo "converged at rate 4: $fast msecs ; at rate 1: $slow msecs"
+if [[ -z "$fast" || "$fast" == "never" || "$slow" == "never" ]]; then
+	test_cleanup
+fi
+if [[ $slow -le $fast ]]; then
+	test_cleanup
+fi
+if ! diff <($BPFTUNESIM $SCENARIO) <($BPFTUNESIM $SCENARIO) ; then
+	test_cleanup
+fi
+rm -f $SCENARIO
+
+test_pass
+
+test_cleanup
+
+test_exit
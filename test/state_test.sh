@@ -0,0 +1,69 @@
+#!/usr/bin/bash
+#
+# SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+#
+# Copyright (c) 2023, Oracle and/or its affiliates.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public
+# License v2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public
+# License along with this program; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 021110-1307, USA.
+
+# run iperf3 test so that tuners learn state (tcp_buffer correlations,
+# tcp_cong per-host state); stop bpftune and ensure state is saved, then
+# restart it and ensure saved map entries are restored.
+
+PORT=5201
+
+BPFTUNE_FLAGS="-d"
+
+. ./test_lib.sh
+
+SLEEPTIME=1
+TIMEOUT=30
+
+STATEFILE=/var/run/bpftune/state
+
+test_start "$0|state test: is learned state saved and restored?"
+
+test_setup true
+
+rm -f $STATEFILE
+
+LOGSZ=$(wc -l $LOGFILE | awk '{print $1}')
+LOGSZ=$(expr $LOGSZ + 1)
+test_run_cmd_local "ip netns exec $NETNS $IPERF3 -s -p $PORT -1 &"
+test_run_cmd_local "$BPFTUNE &"
+sleep $SETUPTIME
+test_run_cmd_local "$IPERF3 -fm -p $PORT -c $VETH1_IPV4" true
+sleep $SLEEPTIME
+
+# state is saved on exit
+pkill -TERM -x bpftune
+sleep $SETUPTIME
+if [[ ! -s $STATEFILE ]]; then
+	echo "no state saved to $STATEFILE"
+	test_cleanup
+fi
+grep -aq -E "corr_map|remote_host_map" $STATEFILE
+
+test_run_cmd_local "$BPFTUNE &"
+sleep $SETUPTIME
+
+tail -n +${LOGSZ} $LOGFILE | \
+	grep -E "restored [1-9][0-9]* entries for '(tcp_buffer|tcp_cong)' map"
+
+test_pass
+
+test_cleanup
+
+test_exit